@@ -0,0 +1,61 @@
+/** daelib/alloc.c: Pluggable allocators.
+ */
+
+
+/* An allocator is a vtable and the context it
+ * is called with. Containers keep a pointer to
+ * theirs, so one allocator serves many, and
+ * route every block through it but mapped
+ * images and huge vectors. The default ignores
+ * sizes and calls libc.
+ */
+
+
+/* Prototypes. */
+#include "alloc.h"
+
+
+/* Call malloc(). */
+static void *_dalloc_libc_alloc(void *ctx, size_t size) {
+
+	return malloc(size);
+}
+
+/* Call posix_memalign(). */
+static void *_dalloc_libc_aligned(void *ctx, size_t align, size_t size) {
+
+	void *mem = NULL;
+
+	if (align < sizeof(void*))
+		align = sizeof(void*);
+
+	if (posix_memalign(&mem, align, size) != 0)
+		return NULL;
+
+	return mem;
+}
+
+/* Call realloc(). */
+static void *_dalloc_libc_realloc(void *ctx, void *ptr,
+                                  size_t old_size, size_t new_size) {
+
+	return realloc(ptr, new_size);
+}
+
+/* Call free(). */
+static void _dalloc_libc_free(void *ctx, void *ptr, size_t size) {
+
+	free(ptr);
+}
+
+
+/* The default allocator. */
+struct dalloc dalloc_libc = {
+
+	.alloc = &_dalloc_libc_alloc,
+	.aligned = &_dalloc_libc_aligned,
+	.realloc = &_dalloc_libc_realloc,
+	.free = &_dalloc_libc_free,
+
+	.ctx = NULL
+};
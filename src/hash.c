@@ -0,0 +1,290 @@
+/** daelib/hash.c: Fast 64 bit hash functions.
+ */
+
+
+/* Prototypes. */
+#include "hash.h"
+
+/* memcpy(), memmove(). */
+#include <string.h>
+
+
+/* Mixing constants, from wyhash. */
+#define S0 0xa0761d6478bd642full
+#define S1 0xe7037ed1a0b428dbull
+#define S2 0x8ebc6af09c88c6e3ull
+#define S3 0x589965cc75374cc3ull
+
+
+/* Multiply to 128 bits, fold the
+ * halves together with xor.
+ */
+static inline uint64_t _dhash_mix(uint64_t a, uint64_t b) {
+
+#ifdef __SIZEOF_INT128__
+	__uint128_t r = (__uint128_t) a * b;
+
+	return (uint64_t) r ^ (uint64_t) (r >> 64);
+#else
+	/* Schoolbook multiply
+	 * on 32 bit halves.
+	 */
+	uint64_t ha = a >> 32, la = (uint32_t) a;
+	uint64_t hb = b >> 32, lb = (uint32_t) b;
+
+	uint64_t hh = ha * hb, hl = ha * lb;
+	uint64_t lh = la * hb, ll = la * lb;
+
+	uint64_t t = ll + (hl << 32);
+	uint64_t lo = t + (lh << 32);
+
+	uint64_t c = (t < ll) + (lo < t);
+	uint64_t hi = hh + (hl >> 32) + (lh >> 32) + c;
+
+	return lo ^ hi;
+#endif /* __SIZEOF_INT128__ */
+}
+
+/* Unaligned reads. */
+static inline uint64_t _dhash_r8(const unsigned char *p) {
+
+	uint64_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint64_t _dhash_r4(const unsigned char *p) {
+
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+/* Read 1 to 3 bytes. */
+static inline uint64_t _dhash_r3(const unsigned char *p, size_t size) {
+
+	return ((uint64_t) p[0] << 16) |
+	       ((uint64_t) p[size >> 1] << 8) |
+	       p[size - 1];
+}
+
+/* Fold the last two words
+ * and the size into a hash.
+ */
+static inline uint64_t _dhash_final(uint64_t a, uint64_t b,
+                                    size_t size, uint64_t seed) {
+
+	return _dhash_mix(_dhash_mix(a ^ S1, b ^ seed) ^ S0 ^ size, S1 ^ b);
+}
+
+/* Read a short input, up to
+ * 16 bytes, as two words.
+ */
+static inline void _dhash_short(const unsigned char *p, size_t size,
+                                uint64_t *a, uint64_t *b) {
+
+	if (size >= 4) {
+		size_t off = (size >> 3) << 2;
+
+		*a = (_dhash_r4(p) << 32) | _dhash_r4(p + off);
+		*b = (_dhash_r4(p + size - 4) << 32) |
+		     _dhash_r4(p + size - 4 - off);
+
+	} else if (size > 0) {
+		*a = _dhash_r3(p, size);
+		*b = 0;
+
+	} else {
+		*a = *b = 0;
+	}
+}
+
+/* Consume a 48 byte block
+ * over three lanes.
+ */
+static inline void _dhash_block(const unsigned char *p, uint64_t *seed,
+                                uint64_t *see1, uint64_t *see2) {
+
+	*seed = _dhash_mix(_dhash_r8(p) ^ S1, _dhash_r8(p + 8) ^ *seed);
+	*see1 = _dhash_mix(_dhash_r8(p + 16) ^ S2, _dhash_r8(p + 24) ^ *see1);
+	*see2 = _dhash_mix(_dhash_r8(p + 32) ^ S3, _dhash_r8(p + 40) ^ *see2);
+}
+
+/* Consume the last 1 to 48 bytes
+ * of a long input, 16 at a time,
+ * and finish on its last 16 bytes.
+ * Reads up to 16 bytes before p.
+ */
+static inline uint64_t _dhash_tail(const unsigned char *p, size_t i,
+                                   size_t size, uint64_t seed) {
+
+	while (i > 16) {
+		seed = _dhash_mix(_dhash_r8(p) ^ S1, _dhash_r8(p + 8) ^ seed);
+		p += 16;
+		i -= 16;
+	}
+
+	return _dhash_final(_dhash_r8(p + i - 16), _dhash_r8(p + i - 8),
+	                    size, seed);
+}
+
+/* Hash a block of memory.
+ * Every byte affects the hash.
+ */
+uint64_t dhash_bytes(const void *data, size_t size, uint64_t seed) {
+
+	/* Mix the seed, read short inputs
+	 * as two overlapping words, else
+	 * consume 48 then 16 bytes at a time,
+	 * finish on the last 16 bytes.
+	 */
+	const unsigned char *p = (const unsigned char*) data;
+
+	seed ^= _dhash_mix(seed ^ S0, S1);
+
+	if (size <= 16) {
+		uint64_t a, b;
+
+		_dhash_short(p, size, &a, &b);
+
+		return _dhash_final(a, b, size, seed);
+	}
+
+	size_t i = size;
+
+	if (i > 48) {
+		uint64_t see1 = seed, see2 = seed;
+
+		do {
+			_dhash_block(p, &seed, &see1, &see2);
+			p += 48;
+			i -= 48;
+		} while (i > 48);
+
+		seed ^= see1 ^ see2;
+	}
+
+	return _dhash_tail(p, i, size, seed);
+}
+
+/* Start a streamed hash. */
+void dhash_init(struct dhash_state *state, uint64_t seed) {
+
+	state->seed = seed ^ _dhash_mix(seed ^ S0, S1);
+	state->see1 = state->seed;
+	state->see2 = state->seed;
+	state->size = 0;
+	state->fill = 0;
+}
+
+/* Add bytes to a streamed hash.
+ * Whole blocks are consumed once more
+ * bytes are known to follow them, as
+ * dhash_bytes would.
+ */
+void dhash_update(struct dhash_state *state, const void *data, size_t size) {
+
+	/* Buffer the bytes, consuming
+	 * a block whenever the buffer
+	 * holds more than one, keeping
+	 * the last 16 bytes consumed
+	 * in front of the buffer.
+	 */
+	const unsigned char *p = (const unsigned char*) data;
+
+	state->size += size;
+
+	while (size > 0) {
+		size_t room = DHASH_BLOCK * 2 - state->fill;
+		size_t take = (size < room) ? size : room;
+
+		memcpy(state->buff + DHASH_TAIL + state->fill, p, take);
+		state->fill += take;
+		p += take;
+		size -= take;
+
+		while (state->fill > DHASH_BLOCK) {
+			unsigned char *block = state->buff + DHASH_TAIL;
+
+			_dhash_block(block, &state->seed, &state->see1, &state->see2);
+
+			state->fill -= DHASH_BLOCK;
+			memmove(state->buff, block + DHASH_BLOCK - DHASH_TAIL,
+			        DHASH_TAIL + state->fill);
+		}
+	}
+}
+
+/* Finish a streamed hash. Equal
+ * to dhash_bytes of every byte
+ * given, in order.
+ */
+uint64_t dhash_final(struct dhash_state *state) {
+
+	/* Hash short inputs whole,
+	 * fold the lanes if blocks ran,
+	 * finish on the buffer.
+	 */
+	unsigned char *p = state->buff + DHASH_TAIL;
+	uint64_t seed = state->seed;
+
+	if (state->size <= 16) {
+		uint64_t a, b;
+
+		_dhash_short(p, state->size, &a, &b);
+
+		return _dhash_final(a, b, state->size, seed);
+	}
+
+	if (state->size > DHASH_BLOCK)
+		seed ^= state->see1 ^ state->see2;
+
+	return _dhash_tail(p, state->fill, state->size, seed);
+}
+
+/* Mix a 32 bit integer. */
+uint64_t dhash_u32(uint32_t num) {
+
+	return _dhash_mix((uint64_t) num ^ S0, S1);
+}
+
+/* Mix a 64 bit integer. */
+uint64_t dhash_u64(uint64_t num) {
+
+	return _dhash_mix(num ^ S0, _dhash_mix(num ^ S2, S1) ^ S3);
+}
+
+/* Hash any key, using the
+ * mixer for its size if
+ * there is one.
+ */
+uint64_t dhash_key(size_t key_size, void *key) {
+
+	switch (key_size) {
+	case 4:  return dhash_key4 (key_size, key);
+	case 8:  return dhash_key8 (key_size, key);
+	case 16: return dhash_key16(key_size, key);
+	}
+
+	return dhash_bytes(key, key_size, 0);
+}
+
+/* Hash a 4 byte key. */
+uint64_t dhash_key4(size_t key_size, void *key) {
+
+	return dhash_u32((uint32_t) _dhash_r4((const unsigned char*) key));
+}
+
+/* Hash an 8 byte key. */
+uint64_t dhash_key8(size_t key_size, void *key) {
+
+	return dhash_u64(_dhash_r8((const unsigned char*) key));
+}
+
+/* Hash a 16 byte key. */
+uint64_t dhash_key16(size_t key_size, void *key) {
+
+	const unsigned char *p = (const unsigned char*) key;
+
+	return _dhash_final(_dhash_r8(p), _dhash_r8(p + 8), 16, S2);
+}
@@ -13,12 +13,36 @@
 /* Assertions. */
 #include "assert.h"
 
-/* malloc(), realloc(), free(). */
-#include <stdlib.h>
+/* dhash_key(), dhash_index_mix(). */
+#include "hash.h"
+
+/* Vectors, to stage parallel joins. */
+#include "vector.h"
+
+/* dalloc_libc, dalloc_*(). */
+#include "alloc.h"
 
 /* memcpy(), memset(). */
 #include <string.h>
 
+/* FILE, fopen(), fwrite(), rename(), remove(). */
+#include <stdio.h>
+
+/* open(). */
+#include <fcntl.h>
+
+/* close(), fsync(). */
+#include <unistd.h>
+
+/* fstat(), fchmod(). */
+#include <sys/stat.h>
+
+/* mmap(), munmap(). */
+#include <sys/mman.h>
+
+/* pthread_create(), pthread_join(). */
+#include <pthread.h>
+
 
 /* Base definition of a hashtable. */
 struct daelib_hashtable {
@@ -27,6 +51,34 @@ struct daelib_hashtable {
 	struct dhtable_backend_context kv_data;
 	size_t bucket_count;
 	void **buckets;
+
+	/* Non-empty buckets, one bit each.
+	 * Shares the buckets' allocation.
+	 */
+	uint64_t *occupied;
+
+	/* Hash to bucket mapping. */
+	enum dhtable_index index;
+
+	/* Automatic resizing. */
+	size_t count;
+	size_t min_buckets;
+	double min_load;
+	double max_load;
+
+	/* Buckets still being migrated. */
+	size_t old_count;
+	size_t migrated;
+	void **old_buckets;
+
+	/* The image of a mapped table,
+	 * which is read only.
+	 */
+	void *map;
+	size_t map_size;
+
+	/* Threads for copy and join. */
+	size_t threads;
 };
 
 
@@ -48,6 +100,29 @@ struct daelib_hashtable {
 #endif /* IBACKEND */
 
 
+/* Bucket count of a dynamically sized table. */
+#define DEFAULT_BUCKETS 8
+
+/* Default loads of a dynamically sized table. */
+#define DEFAULT_MIN_LOAD 0.25
+#define DEFAULT_MAX_LOAD 2.0
+
+/* Old buckets migrated per operation. */
+#define MIGRATE_STEP 4
+
+/* Entries below which copy and join
+ * stay on one thread. Starting threads
+ * costs more than it saves.
+ */
+#define PARALLEL_MIN 4096
+
+/* Keys in flight per batch stage.
+ * Enough to hide a miss, few
+ * enough to stay in L1.
+ */
+#define BATCH_STEP 16
+
+
 /* Determine if a hashtable is valid.
  * If valid return nonzero. Else return zero.
  */
@@ -71,7 +146,7 @@ static int _dhtable_valid(dhtable table) {
 	if (table->kv_data.key_cmp == NULL)
 		return 0;
 
-	if (table->kv_data.key_hsh == NULL)
+	if (table->kv_data.key_hsh == NULL && table->kv_data.key_hsh64 == NULL)
 		return 0;
 
 	return 1;
@@ -83,15 +158,11 @@ static int _dhtable_valid(dhtable table) {
 static int _dhtable_joinable(dhtable dst, dhtable src) {
 
 	/* Validate each dhtable, check for
-	 * the same kv_data, backend,
-	 * bucket_count.
+	 * the same kv_data and backend.
 	 */
 	if (!_dhtable_valid(dst) || !_dhtable_valid(src))
 		return 1;
 
-	if (dst->bucket_count != src->bucket_count)
-		return 0;
-
 	if (dst->backend != src->backend)
 		return 0;
 
@@ -107,9 +178,190 @@ static int _dhtable_joinable(dhtable dst, dhtable src) {
 	if (dst->kv_data.key_hsh != src->kv_data.key_hsh)
 		return 0;
 
+	if (dst->kv_data.key_hsh64 != src->kv_data.key_hsh64)
+		return 0;
+
+	return 1;
+}
+
+/* Checks if two joinable tables put
+ * each key in the same bucket, so
+ * buckets can be joined pairwise.
+ * Returns nonzero if so, else zero.
+ */
+static int _dhtable_same_layout(dhtable dst, dhtable src) {
+
+	if (dst->bucket_count != src->bucket_count)
+		return 0;
+
+	if (dst->index != src->index)
+		return 0;
+
 	return 1;
 }
 
+/* Words in the bitmap of a bucket array. */
+static inline size_t _dhtable_words(size_t buckets) {
+
+	return (buckets + 63) / 64;
+}
+
+/* Bytes of a bucket array and its bitmap.
+ * The pointers round up to whole words.
+ */
+static inline size_t _dhtable_buckets_size(size_t buckets) {
+
+	size_t head = (sizeof(void*) * buckets + 7) & ~(size_t) 7;
+
+	return head + sizeof(uint64_t) * _dhtable_words(buckets);
+}
+
+/* Allocate a clean bucket array,
+ * followed by its bitmap.
+ * Returns NULL on failure.
+ */
+static void **_dhtable_buckets_alloc(struct dalloc *alloc, size_t buckets) {
+
+	/* Allocate both,
+	 * clean, return.
+	 */
+	size_t size = _dhtable_buckets_size(buckets);
+
+	void **new_buckets = (void**) dalloc_alloc(alloc, size);
+
+	if (new_buckets != NULL)
+		memset(new_buckets, 0, size);
+
+	return new_buckets;
+}
+
+/* Free a bucket array of
+ * count, and its bitmap.
+ */
+static void _dhtable_buckets_free(struct dalloc *alloc, void **buckets,
+                                  size_t count) {
+
+	dalloc_free(alloc, buckets, _dhtable_buckets_size(count));
+}
+
+/* Find the bitmap of a bucket array. */
+static inline uint64_t *_dhtable_buckets_bits(void **buckets, size_t count) {
+
+	size_t head = (sizeof(void*) * count + 7) & ~(size_t) 7;
+
+	return (uint64_t*) ((char*) buckets + head);
+}
+
+/* Set or clear the bit of a bucket,
+ * if its slot is in the current array.
+ */
+static inline void _dhtable_mark(dhtable table, void **slot, int full) {
+
+	uintptr_t off = (uintptr_t) slot - (uintptr_t) table->buckets;
+
+	if (off >= sizeof(void*) * table->bucket_count)
+		return;
+
+	size_t i = off / sizeof(void*);
+
+	if (full)
+		table->occupied[i / 64] |= (uint64_t) 1 << (i % 64);
+	else
+		table->occupied[i / 64] &= ~((uint64_t) 1 << (i % 64));
+}
+
+/* Count trailing and leading zeros,
+ * of a nonzero word.
+ */
+static inline unsigned _dhtable_ctz(uint64_t word) {
+
+#ifdef __GNUC__
+	return (unsigned) __builtin_ctzll(word);
+#else
+	unsigned n = 0;
+	while (!(word & 1)) {
+		word >>= 1;
+		n++;
+	}
+	return n;
+#endif /* __GNUC__ */
+}
+
+static inline unsigned _dhtable_clz(uint64_t word) {
+
+#ifdef __GNUC__
+	return (unsigned) __builtin_clzll(word);
+#else
+	unsigned n = 0;
+	while (!(word >> 63)) {
+		word <<= 1;
+		n++;
+	}
+	return n;
+#endif /* __GNUC__ */
+}
+
+/* Find the first non-empty bucket
+ * at or after from. Returns the
+ * bucket count if there is none.
+ */
+static size_t _dhtable_scan(dhtable table, size_t from) {
+
+	/* Mask off the bits before from,
+	 * skip empty words, take the
+	 * lowest set bit.
+	 */
+	size_t count = table->bucket_count;
+
+	if (from >= count)
+		return count;
+
+	size_t words = _dhtable_words(count);
+	size_t w = from / 64;
+
+	uint64_t word = table->occupied[w] & (~(uint64_t) 0 << (from % 64));
+
+	while (word == 0) {
+
+		if (++w == words)
+			return count;
+
+		word = table->occupied[w];
+	}
+
+	return w * 64 + _dhtable_ctz(word);
+}
+
+/* Find the last non-empty bucket
+ * at or before from. Returns the
+ * bucket count if there is none.
+ */
+static size_t _dhtable_rscan(dhtable table, size_t from) {
+
+	/* Mask off the bits after from,
+	 * skip empty words, take the
+	 * highest set bit.
+	 */
+	size_t count = table->bucket_count;
+
+	if (from >= count)
+		from = count - 1;
+
+	size_t w = from / 64;
+
+	uint64_t word = table->occupied[w] & (~(uint64_t) 0 >> (63 - from % 64));
+
+	while (word == 0) {
+
+		if (w-- == 0)
+			return count;
+
+		word = table->occupied[w];
+	}
+
+	return w * 64 + 63 - _dhtable_clz(word);
+}
+
 /* Basic memory compare function. */
 int _dhtable_key_cmp(size_t key_size, void *keyl, void *keyr) {
 
@@ -128,26 +380,204 @@ int _dhtable_key_cmp(size_t key_size, void *keyl, void *keyr) {
 	return memcmp(keyl, keyr, key_size);
 }
 
-/* Treat the key as an int, return that. */
-int _dhtable_key_hsh(size_t key_size, void *key) {
+/* Map a hash onto count buckets.
+ * Mask and fastrange mix the hash
+ * first, so weak hashes still spread.
+ */
+static inline size_t _dhtable_index(dhtable table, uint64_t hash,
+                                    size_t count) {
+
+	switch (table->index) {
+	case DHTABLE_MASK:
+		return (size_t) dhash_index_mix(hash) & (count - 1);
+
+	case DHTABLE_FASTRANGE:
+		hash = dhash_index_mix(hash);
+
+#ifdef __SIZEOF_INT128__
+		return (size_t) (((__uint128_t) hash * count) >> 64);
+#else
+		return (size_t) (((hash >> 32) * (uint32_t) count) >> 32);
+#endif /* __SIZEOF_INT128__ */
+
+	default:
+		return (size_t) (hash % count);
+	}
+}
+
+/* Move old buckets into the new bucket array.
+ * Migrates at most steps buckets, freeing
+ * the old array when done. Returns nonzero
+ * on error, leaving the failed bucket in place.
+ * ASSUMES VALID TABLE.
+ */
+static int _dhtable_migrate(dhtable table, size_t steps) {
 
-	/* Validate the key,
-	 * return the first part of the
-	 * key as an int.
+	/* For each old bucket, walk its entries,
+	 * put each into its new bucket, kill
+	 * the old bucket. Once all are moved,
+	 * free the old array.
 	 */
-	DASSERT(key != NULL, ICALLER, "Given invalid key.",
-		return 0;
+	struct dhtable_backend *backend = table->backend;
+	dhtable_ctx *ctx = &table->kv_data;
+
+	while (steps-- > 0 && table->migrated < table->old_count) {
+
+		void *old = table->old_buckets[table->migrated];
+
+		void *it = (old == NULL) ? NULL : backend->begin(ctx, old);
+
+		/* Step first, a move
+		 * unlinks the entry.
+		 */
+		void *next;
+		for (; it != NULL; it = next) {
+
+			next = backend->next(ctx, old, it);
+
+			char *entry = (char*) backend->iget(ctx, old, it);
+
+			DASSERT(entry != NULL, IBACKEND, "Failed to get an entry.",
+				return 1;
+				);
+
+			uint64_t hash = (backend->ihsh != NULL) ?
+				backend->ihsh(ctx, old, it) :
+				dhtable_ctx_hash(ctx, entry);
+			size_t index = _dhtable_index(table, hash,
+			                              table->bucket_count);
+
+			void *bucket = table->buckets[index];
+
+			if (bucket == NULL) {
+				bucket = backend->init(ctx);
+
+				DASSERT(bucket != NULL, IBACKEND,
+					"Failed to create a bucket.",
+					return 1;
+					);
+
+				table->buckets[index] = bucket;
+			}
+
+			int t = (backend->move != NULL) ?
+				backend->move(ctx, bucket, old, it, hash) :
+				backend->put(ctx, bucket, hash, entry,
+				             entry + ctx->key_size);
+
+			DASSERT(t == 0, IBACKEND, "Failed to migrate an entry.",
+				return 1;
+				);
+
+			table->occupied[index / 64] |= (uint64_t) 1 << (index % 64);
+		}
+
+		if (old != NULL) {
+			int t = backend->kill(ctx, old);
+
+			DASSERT(t == 0, IBACKEND, "Failed to kill bucket. Continuing.",
+				);
+		}
+
+		table->old_buckets[table->migrated++] = NULL;
+	}
+
+	if (table->old_buckets != NULL && table->migrated == table->old_count) {
+		_dhtable_buckets_free(table->kv_data.alloc, table->old_buckets,
+		                      table->old_count);
+
+		table->old_buckets = NULL;
+		table->old_count = 0;
+		table->migrated = 0;
+	}
+
+	return 0;
+}
+
+/* Start migrating to a new bucket count.
+ * Returns nonzero on error.
+ * ASSUMES VALID TABLE, NO MIGRATION.
+ */
+static int _dhtable_resize(dhtable table, size_t buckets) {
+
+	/* Allocate new, clean buckets,
+	 * make the current ones old,
+	 * return.
+	 */
+	void **new_buckets = _dhtable_buckets_alloc(table->kv_data.alloc, buckets);
+	DASSERT(new_buckets != NULL, IALLOC, "Failed to allocate new buckets.",
+		return 1;
 		);
 
-	return *((int*)key);
+	table->old_buckets = table->buckets;
+	table->old_count = table->bucket_count;
+	table->migrated = 0;
+
+	table->buckets = new_buckets;
+	table->bucket_count = buckets;
+	table->occupied = _dhtable_buckets_bits(new_buckets, buckets);
+
+	return 0;
+}
+
+/* Check the load, and start resizing
+ * the table if it is out of bounds.
+ * ASSUMES VALID TABLE.
+ */
+static void _dhtable_check_load(dhtable table) {
+
+	/* Ignore fixed or migrating tables,
+	 * double or halve the bucket count
+	 * if the load is out of bounds.
+	 */
+	if (table->max_load == 0 || table->old_buckets != NULL)
+		return;
+
+	double load = (double) table->count / table->bucket_count;
+
+	if (load > table->max_load)
+		_dhtable_resize(table, table->bucket_count * 2);
+
+	else if (load < table->min_load &&
+	         table->bucket_count / 2 >= table->min_buckets)
+		_dhtable_resize(table, table->bucket_count / 2);
+}
+
+/* Find the bucket holding a hash.
+ * Returns a pointer to the bucket's slot,
+ * in the old array if it is yet to be migrated.
+ * ASSUMES VALID TABLE.
+ */
+static void **_dhtable_locate(dhtable table, uint64_t hash) {
+
+	/* Check the old array,
+	 * else index the new one,
+	 * return.
+	 */
+	if (table->old_buckets != NULL) {
+		size_t index = _dhtable_index(table, hash, table->old_count);
+
+		if (index >= table->migrated)
+			return &table->old_buckets[index];
+	}
+
+	size_t index = _dhtable_index(table, hash, table->bucket_count);
+
+	return &table->buckets[index];
 }
 
 /* Allocate and initialize a hashtable.
- * TODO: If size == 0, dynamically allocate.
+ * Takes either hash functor, preferring
+ * key_hsh64. With neither, use dhash_key.
+ * If buckets is 0, the table starts small
+ * and resizes itself with the default loads.
+ * A NULL alloc is libc's.
  */
-dhtable dhtable_init(size_t buckets, size_t key_size, size_t val_size,
-                     dhtable_key_cmp key_cmp, dhtable_key_hsh key_hsh,
-                     struct dhtable_backend *backend) {
+static dhtable _dhtable_init(size_t buckets, size_t key_size, size_t val_size,
+                             dhtable_key_cmp key_cmp, dhtable_key_hsh key_hsh,
+                             dhtable_key_hsh64 key_hsh64,
+                             struct dhtable_backend *backend,
+                             struct dalloc *alloc) {
 
 	/* Validate arguments, allocate memory, allocate
 	 * buckets, clean buckets, deal with defaults,
@@ -157,41 +587,112 @@ dhtable dhtable_init(size_t buckets, size_t key_size, size_t val_size,
 		return NULL;
 		);
 
-	DASSERT(buckets != 0, ICALLER, "Given bad bucket count.",
-		return NULL;
-		);
+	double min_load = 0;
+	double max_load = 0;
+
+	if (buckets == 0) {
+		buckets = DEFAULT_BUCKETS;
+		min_load = DEFAULT_MIN_LOAD;
+		max_load = DEFAULT_MAX_LOAD;
+	}
+
+	if (alloc == NULL)
+		alloc = &dalloc_libc;
 
-	dhtable new_table = (dhtable) malloc(sizeof(struct daelib_hashtable));
+	dhtable new_table = (dhtable) dalloc_alloc(alloc,
+	                                           sizeof(struct daelib_hashtable));
 	DASSERT(new_table != NULL, IALLOC, "Failed to allocate new table.",
 		return NULL;
 		);
 
-	void **new_buckets = (void**) malloc(sizeof(void*) * buckets);
+	void **new_buckets = _dhtable_buckets_alloc(alloc, buckets);
 	DASSERT(new_buckets != NULL, IALLOC, "Failed to allocate new buckets.",
-		free(new_table);
+		dalloc_free(alloc, new_table, sizeof(struct daelib_hashtable));
 		return NULL;
 		);
 
-	memset(new_buckets, 0, sizeof(void*) * buckets);
-
 	if (key_cmp == NULL)
 		key_cmp = &_dhtable_key_cmp;
-	if (key_hsh == NULL)
-		key_hsh = &_dhtable_key_hsh;
+	if (key_hsh == NULL && key_hsh64 == NULL)
+		key_hsh64 = &dhash_key;
 	if (backend == NULL)
 		backend = &dhtable_vector;
 
 	new_table->backend = backend;
 	new_table->buckets = new_buckets;
 	new_table->bucket_count = buckets;
+	new_table->occupied = _dhtable_buckets_bits(new_buckets, buckets);
+	new_table->index = DHTABLE_MODULO;
 	new_table->kv_data.key_size = key_size;
 	new_table->kv_data.val_size = val_size;
 	new_table->kv_data.key_hsh = key_hsh;
 	new_table->kv_data.key_cmp = key_cmp;
+	new_table->kv_data.key_hsh64 = key_hsh64;
+	new_table->kv_data.state = NULL;
+	new_table->kv_data.alloc = alloc;
+
+	new_table->count = 0;
+	new_table->min_buckets = buckets;
+	new_table->min_load = min_load;
+	new_table->max_load = max_load;
+
+	new_table->old_count = 0;
+	new_table->migrated = 0;
+	new_table->old_buckets = NULL;
+
+	new_table->map = NULL;
+	new_table->map_size = 0;
+
+	new_table->threads = 1;
+
+	if (backend->setup != NULL) {
+		int t = backend->setup(&new_table->kv_data);
+
+		DASSERT(t == 0, IBACKEND, "Failed to set up backend.",
+			_dhtable_buckets_free(alloc, new_buckets, buckets);
+			dalloc_free(alloc, new_table, sizeof(struct daelib_hashtable));
+			return NULL;
+			);
+	}
 
 	return new_table;
 }
 
+/* Allocate and initialize a hashtable
+ * with an int hash functor.
+ */
+dhtable dhtable_init(size_t buckets, size_t key_size, size_t val_size,
+                     dhtable_key_cmp key_cmp, dhtable_key_hsh key_hsh,
+                     struct dhtable_backend *backend) {
+
+	return _dhtable_init(buckets, key_size, val_size,
+	                     key_cmp, key_hsh, NULL, backend, NULL);
+}
+
+/* Allocate and initialize a hashtable
+ * with a 64 bit hash functor.
+ */
+dhtable dhtable_init64(size_t buckets, size_t key_size, size_t val_size,
+                       dhtable_key_cmp key_cmp, dhtable_key_hsh64 key_hsh,
+                       struct dhtable_backend *backend) {
+
+	return _dhtable_init(buckets, key_size, val_size,
+	                     key_cmp, NULL, key_hsh, backend, NULL);
+}
+
+/* Allocate and initialize a hashtable
+ * with a 64 bit hash functor, taking
+ * its memory from alloc.
+ */
+dhtable dhtable_init_ex(size_t buckets, size_t key_size, size_t val_size,
+                        dhtable_key_cmp key_cmp, dhtable_key_hsh64 key_hsh,
+                        struct dhtable_backend *backend,
+                        struct dalloc *alloc) {
+
+	return _dhtable_init(buckets, key_size, val_size,
+	                     key_cmp, NULL, key_hsh, backend, alloc);
+}
+
 /* For each valid bucket, call backend->kill,
  * free the buckets, invalidate the struct,
  * free the struct.
@@ -227,97 +728,453 @@ int dhtable_kill(dhtable table) {
 		}
 	}
 
-	free(table->buckets);
+	size_t j;
+	for (j = table->migrated; j < table->old_count; j++) {
+
+		if (table->old_buckets[j] != NULL) {
+
+			int t = table->backend->
+			        kill(&table->kv_data, table->old_buckets[j]);
+
+			DASSERT(t == 0, IBACKEND, "Failed to kill bucket.",
+				return 1;
+				);
+		}
+	}
+
+	if (table->backend->teardown != NULL)
+		table->backend->teardown(&table->kv_data);
+
+	struct dalloc *alloc = table->kv_data.alloc;
 
+	_dhtable_buckets_free(alloc, table->old_buckets, table->old_count);
+	_dhtable_buckets_free(alloc, table->buckets, table->bucket_count);
+
+	if (table->map != NULL)
+		munmap(table->map, table->map_size);
+
+	table->old_buckets = NULL;
 	table->buckets = NULL;
 
-	free(table);
+	dalloc_free(alloc, table, sizeof(struct daelib_hashtable));
 
 	return 0;
 }
 
-/* Free all buckets before index,
- * free buckets, free table.
- * ASSUMES VALID TABLE, INDEX.
+/* A share of a parallel copy or join,
+ * buckets [start, end) of one table.
+ * Shares cover whole bitmap words, so
+ * no two set bits in the same word.
  */
-static void _dhtable_kill_copy(dhtable table, void **buckets, int index) {
+struct _dhtable_part {
 
-	/* For each entry,
-	 * if valid, kill, free buckets,
-	 * invalidate table, free table.
+	dhtable dst;
+	dhtable src;
+
+	size_t start;
+	size_t end;
+
+	/* Entries added to dst. */
+	size_t added;
+	int error;
+
+	/* Rehash joins only. Entries bound
+	 * for each destination share, and
+	 * every share, to read them back.
 	 */
-	int i;
-	for (i = index; i >= 0; i--) {
+	dvec *staged;
+	struct _dhtable_part *parts;
+	size_t count;
+	size_t index;
+};
 
-		if (buckets[i] != NULL) {
-			int t = table->backend->kill(&table->kv_data, buckets[i]);
+/* An entry staged for a destination share. */
+struct _dhtable_staged {
 
-			DASSERT(t == 0, IBACKEND, "Failed to kill bucket. Continuing.",
-				continue;
-				);
-		}
-	}
+	uint64_t hash;
+	size_t index;
+	char *entry;
+};
+
+/* Threads worth using over a number of
+ * entries. Backends with per-table state
+ * share it between buckets, so they
+ * stay on one thread.
+ */
+static size_t _dhtable_threads(dhtable table, size_t entries) {
+
+	if (table->backend->setup != NULL || entries < PARALLEL_MIN)
+		return 1;
 
-	free(buckets);
-	free(table);
+	return table->threads;
 }
 
-/* Copy a hashtable.
- * Returns NULL on error.
+/* Split buckets into at most
+ * threads shares of whole words.
+ * Returns the share count.
  */
-dhtable dhtable_copy(dhtable table) {
+static size_t _dhtable_split(size_t buckets, size_t threads,
+                             struct _dhtable_part *parts) {
 
-	/* Validate the hashtable,
-	 * allocate the new table, buckets,
-	 * for each bucket, call backend->copy,
-	 * if fail, kill all previous buckets,
-	 * copy metadata, return.
+	/* Clamp to the word count, give
+	 * each share an even run of
+	 * words, return.
 	 */
-	DASSERT(table != NULL, ICALLER, "Given NULL table.",
-		return NULL;
+	size_t words = _dhtable_words(buckets);
+
+	if (threads > words)
+		threads = words;
+
+	size_t i;
+	for (i = 0; i < threads; i++) {
+
+		size_t start = i * words / threads * 64;
+		size_t end = (i + 1) * words / threads * 64;
+
+		parts[i].start = start;
+		parts[i].end = end < buckets ? end : buckets;
+		parts[i].added = 0;
+		parts[i].error = 0;
+	}
+
+	return threads;
+}
+
+/* Run work on every share, the first
+ * on the calling thread. A share whose
+ * thread fails to start runs here too.
+ */
+static void _dhtable_parallel(struct _dhtable_part *parts, size_t count,
+                              void *(*work)(void*)) {
+
+	/* Start a thread per share past
+	 * the first, run the first, join
+	 * the others, return.
+	 */
+	pthread_t threads[count];
+	int started[count];
+
+	size_t i;
+	for (i = 1; i < count; i++) {
+
+		started[i] = pthread_create(&threads[i], NULL, work, &parts[i]) == 0;
+
+		if (!started[i])
+			work(&parts[i]);
+	}
+
+	work(&parts[0]);
+
+	for (i = 1; i < count; i++)
+		if (started[i])
+			pthread_join(threads[i], NULL);
+}
+
+/* Copy a share of buckets from
+ * src into the buckets of dst.
+ */
+static void *_dhtable_copy_part(void *arg) {
+
+	struct _dhtable_part *part = arg;
+	dhtable dst = part->dst;
+	dhtable src = part->src;
+
+	size_t i;
+	for (i = part->start; i < part->end; i++) {
+
+		void *bucket = src->buckets[i];
+
+		if (bucket == NULL)
+			continue;
+
+		dst->buckets[i] = src->backend->copy(&dst->kv_data, bucket);
+
+		if (dst->buckets[i] == NULL) {
+			part->error = 1;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+/* Join a share of src buckets
+ * into the same buckets of dst.
+ */
+static void *_dhtable_join_part(void *arg) {
+
+	struct _dhtable_part *part = arg;
+	dhtable dst = part->dst;
+	dhtable src = part->src;
+
+	dhtable_ctx *ctx = &dst->kv_data;
+
+	size_t i;
+	for (i = part->start; i < part->end; i++) {
+
+		void *sbucket = src->buckets[i];
+
+		if (sbucket == NULL)
+			continue;
+
+		void *dbucket = dst->buckets[i];
+
+		if (dbucket == NULL) {
+			dbucket = dst->backend->init(ctx);
+			dst->buckets[i] = dbucket;
+		}
+
+		if (dbucket == NULL) {
+			part->error = 1;
+			break;
+		}
+
+		size_t before = dst->backend->size(ctx, dbucket);
+
+		int t = dst->backend->join(ctx, dbucket, sbucket);
+
+		part->added += dst->backend->size(ctx, dbucket) - before;
+
+		if (t != 0) {
+			part->error = 1;
+			break;
+		}
+
+		if (dst->backend->size(ctx, dbucket) != 0)
+			dst->occupied[i / 64] |= (uint64_t) 1 << (i % 64);
+	}
+
+	return NULL;
+}
+
+/* Stage a share of src entries
+ * by their destination share.
+ */
+static void *_dhtable_stage_part(void *arg) {
+
+	/* Walk the share's buckets, hash
+	 * each entry, find its bucket and
+	 * share in dst, push it, return.
+	 */
+	struct _dhtable_part *part = arg;
+	dhtable dst = part->dst;
+	dhtable src = part->src;
+
+	struct dhtable_backend *backend = src->backend;
+	dhtable_ctx *ctx = &src->kv_data;
+
+	size_t words = _dhtable_words(dst->bucket_count);
+
+	size_t i;
+	for (i = part->start; i < part->end; i++) {
+
+		void *bucket = src->buckets[i];
+
+		if (bucket == NULL)
+			continue;
+
+		void *it;
+		for (it = backend->begin(ctx, bucket); it != NULL;
+		     it = backend->next(ctx, bucket, it)) {
+
+			struct _dhtable_staged staged;
+
+			staged.entry = (char*) backend->iget(ctx, bucket, it);
+			staged.hash = backend->ihsh != NULL ?
+				backend->ihsh(ctx, bucket, it) :
+				dhtable_ctx_hash(ctx, staged.entry);
+			staged.index = _dhtable_index(dst, staged.hash,
+			                              dst->bucket_count);
+
+			/* Last share starting at
+			 * or before the word.
+			 */
+			size_t word = staged.index / 64;
+			size_t share = ((word + 1) * part->count - 1) / words;
+
+			if (dvec_push(part->staged[share], &staged) != 0) {
+				part->error = 1;
+				return NULL;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Put every entry staged for a
+ * share of dst buckets.
+ */
+static void *_dhtable_unstage_part(void *arg) {
+
+	/* For each staging share, put
+	 * each entry into its bucket,
+	 * count it, mark it, return.
+	 */
+	struct _dhtable_part *part = arg;
+	dhtable dst = part->dst;
+
+	dhtable_ctx *ctx = &dst->kv_data;
+
+	size_t i;
+	for (i = 0; i < part->count; i++) {
+
+		dvec staged = part->parts[i].staged[part->index];
+
+		size_t n = dvec_size(staged);
+		struct _dhtable_staged *entries = n == 0 ? NULL :
+			(struct _dhtable_staged*) dvec_get(staged, 0);
+
+		size_t j;
+		for (j = 0; j < n; j++) {
+
+			size_t index = entries[j].index;
+			char *entry = entries[j].entry;
+
+			void *bucket = dst->buckets[index];
+
+			if (bucket == NULL) {
+				bucket = dst->backend->init(ctx);
+				dst->buckets[index] = bucket;
+			}
+
+			if (bucket == NULL) {
+				part->error = 1;
+				return NULL;
+			}
+
+			size_t before = dst->backend->size(ctx, bucket);
+
+			int t = dst->backend->put(ctx, bucket, entries[j].hash,
+			                          entry, entry + ctx->key_size);
+
+			part->added += dst->backend->size(ctx, bucket) - before;
+
+			if (t != 0) {
+				part->error = 1;
+				return NULL;
+			}
+
+			dst->occupied[index / 64] |= (uint64_t) 1 << (index % 64);
+		}
+	}
+
+	return NULL;
+}
+
+/* Free all buckets before index,
+ * free buckets, free table.
+ * ASSUMES VALID TABLE, INDEX.
+ */
+static void _dhtable_kill_copy(dhtable table, void **buckets, int index) {
+
+	/* For each entry,
+	 * if valid, kill, free buckets,
+	 * invalidate table, free table.
+	 */
+	int i;
+	for (i = index; i >= 0; i--) {
+
+		if (buckets[i] != NULL) {
+			int t = table->backend->kill(&table->kv_data, buckets[i]);
+
+			DASSERT(t == 0, IBACKEND, "Failed to kill bucket. Continuing.",
+				continue;
+				);
+		}
+	}
+
+	if (table->backend->teardown != NULL)
+		table->backend->teardown(&table->kv_data);
+
+	_dhtable_buckets_free(table->kv_data.alloc, buckets, table->bucket_count);
+	dalloc_free(table->kv_data.alloc, table, sizeof(struct daelib_hashtable));
+}
+
+/* Copy a hashtable.
+ * Returns NULL on error.
+ */
+dhtable dhtable_copy(dhtable table) {
+
+	/* Validate the hashtable, finish
+	 * any migration, allocate the new
+	 * table, buckets, copy metadata, set
+	 * up the backend, split the buckets
+	 * over threads, each calling
+	 * backend->copy, if any fail, kill
+	 * all copied buckets, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return NULL;
 		);
 
 	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
 		return NULL;
 		);
 
-	dhtable new_table = (dhtable) malloc(sizeof(struct daelib_hashtable));
-	DASSERT(new_table != NULL, IALLOC, "Failed to allocate new table.",
+	DASSERT(table->map == NULL, ICALLER, "Given read-only table.",
 		return NULL;
 		);
 
-	void **new_buckets = malloc(sizeof(void*) * table->bucket_count);
-	DASSERT(new_buckets != NULL, IALLOC, "Failed to allocate new buckets.",
-		free(new_buckets);
+	int t = _dhtable_migrate(table, table->old_count);
+	DASSERT(t == 0, IBACKEND, "Failed to finish migration.",
 		return NULL;
 		);
 
-	int count = table->bucket_count;
+	struct dalloc *alloc = table->kv_data.alloc;
 
-	int i;
-	for (i = 0; i < count; i++) {
+	dhtable new_table = (dhtable) dalloc_alloc(alloc,
+	                                           sizeof(struct daelib_hashtable));
+	DASSERT(new_table != NULL, IALLOC, "Failed to allocate new table.",
+		return NULL;
+		);
+
+	void **new_buckets = _dhtable_buckets_alloc(alloc, table->bucket_count);
+	DASSERT(new_buckets != NULL, IALLOC, "Failed to allocate new buckets.",
+		dalloc_free(alloc, new_table, sizeof(struct daelib_hashtable));
+		return NULL;
+		);
 
-		void *current_bucket = table->buckets[i];
-		void *new_bucket = NULL;
+	memcpy(new_table, table, sizeof(struct daelib_hashtable));
+	new_table->buckets = new_buckets;
+	new_table->occupied = _dhtable_buckets_bits(new_buckets,
+	                                            table->bucket_count);
+	new_table->kv_data.state = NULL;
 
-		if (current_bucket == NULL) {
-			new_buckets[i] = new_bucket;
-			continue;
-		}
+	memcpy(new_table->occupied, table->occupied,
+	       sizeof(uint64_t) * _dhtable_words(table->bucket_count));
 
-		new_bucket = table->backend->copy(&table->kv_data,
-		                               current_bucket);
+	if (table->backend->setup != NULL) {
+		t = table->backend->setup(&new_table->kv_data);
 
-		DASSERT(new_bucket != NULL, IBACKEND, "Failed to copy a bucket.",
-			_dhtable_kill_copy(table, new_buckets, i - 1);
+		DASSERT(t == 0, IBACKEND, "Failed to set up backend.",
+			_dhtable_buckets_free(alloc, new_buckets, table->bucket_count);
+			dalloc_free(alloc, new_table, sizeof(struct daelib_hashtable));
 			return NULL;
 			);
+	}
+
+	size_t threads = _dhtable_threads(table, table->count);
+
+	struct _dhtable_part parts[threads];
+	size_t count = _dhtable_split(table->bucket_count, threads, parts);
 
-		new_buckets[i] = new_bucket;
+	size_t i;
+	for (i = 0; i < count; i++) {
+		parts[i].dst = new_table;
+		parts[i].src = table;
 	}
 
-	memcpy(new_table, table, sizeof(struct daelib_hashtable));
-	new_table->buckets = new_buckets;
+	_dhtable_parallel(parts, count, _dhtable_copy_part);
+
+	for (i = 0; i < count; i++) {
+
+		DASSERT(parts[i].error == 0, IBACKEND, "Failed to copy a bucket.",
+			_dhtable_kill_copy(new_table, new_buckets,
+			                   table->bucket_count - 1);
+			return NULL;
+			);
+	}
 
 	return new_table;
 }
@@ -328,9 +1185,9 @@ dhtable dhtable_copy(dhtable table) {
  */
 void *dhtable_get(dhtable table, void *key) {
 
-	/* Validate the table,
-	 * get the hash, get the bucket,
-	 * check the bucket, call the
+	/* Validate the table, step any
+	 * migration, hash the key, get the
+	 * bucket, check the bucket, call the
 	 * backend, return.
 	 */
 	DASSERT(table != NULL, ICALLER, "Given NULL table.",
@@ -345,46 +1202,62 @@ void *dhtable_get(dhtable table, void *key) {
 		return NULL;
 		);
 
-	int hash = table->kv_data.key_hsh(table->kv_data.key_size, key);
+	if (table->old_buckets != NULL)
+		_dhtable_migrate(table, MIGRATE_STEP);
 
-	int index = ((unsigned) hash) % table->bucket_count;
+	uint64_t hash = dhtable_ctx_hash(&table->kv_data, key);
 
-	void *bucket = table->buckets[index];
+	void *bucket = *_dhtable_locate(table, hash);
 
 	if (bucket == NULL)
 		return NULL;
 
-	return table->backend->get(&table->kv_data, bucket, key);
+	return table->backend->get(&table->kv_data, bucket, hash, key);
 }
 
-/* Hash the key, index
- * into the table, call the
- * backend, return the status.
+/* Get, without stepping any
+ * migration. Never writes, so
+ * any number of threads may
+ * peek at once.
  */
-int dhtable_put(dhtable table, void *key, void *value) {
+void *dhtable_peek(dhtable table, void *key) {
 
-	/* Validate the table, key,
-	 * hash the key, mod the count,
-	 * get the bucket, call backend->put,
-	 * return.
+	/* Validate the table, hash
+	 * the key, get the bucket, check
+	 * the bucket, call the backend, return.
 	 */
 	DASSERT(table != NULL, ICALLER, "Given NULL table.",
-		return 1;
+		return NULL;
 		);
 
 	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
-		return 1;
+		return NULL;
 		);
 
 	DASSERT(key != NULL, ICALLER, "Given invalid key.",
-		return 1;
+		return NULL;
 		);
 
-	int hash = table->kv_data.key_hsh(table->kv_data.key_size, key);
+	uint64_t hash = dhtable_ctx_hash(&table->kv_data, key);
+
+	void *bucket = *_dhtable_locate(table, hash);
+
+	if (bucket == NULL)
+		return NULL;
+
+	return table->backend->get(&table->kv_data, bucket, hash, key);
+}
 
-	int index = ((unsigned) hash) % table->bucket_count;
+/* Put a pair whose hash is known. */
+static int _dhtable_put_hashed(dhtable table, uint64_t hash,
+                               void *key, void *value) {
 
-	void *bucket = table->buckets[index];
+	/* Get the bucket, call backend->put,
+	 * count any new element, return.
+	 * Callers check the load.
+	 */
+	void **slot = _dhtable_locate(table, hash);
+	void *bucket = *slot;
 
 	if (bucket == NULL) {
 		bucket = table->backend->init(&table->kv_data);
@@ -393,23 +1266,32 @@ int dhtable_put(dhtable table, void *key, void *value) {
 			return 1;
 			);
 
-		table->buckets[index] = bucket;
+		*slot = bucket;
 	}
 
-	return table->backend->put(&table->kv_data, bucket, key, value);
+	size_t before = table->backend->size(&table->kv_data, bucket);
+
+	int t = table->backend->put(&table->kv_data, bucket, hash, key, value);
+
+	if (t != 0)
+		return t;
+
+	table->count += table->backend->size(&table->kv_data, bucket) - before;
+
+	_dhtable_mark(table, slot, 1);
+
+	return 0;
 }
 
 /* Hash the key, index
  * into the table, call the
  * backend, return the status.
  */
-int dhtable_rm (dhtable table, void *key) {
+int dhtable_put(dhtable table, void *key, void *value) {
 
-	/* Validate the table, key
-	 * hash the key, mod the bucket_count,
-	 * index into the table, verify
-	 * the bucket, call the backend,
-	 * return.
+	/* Validate the table, key, step
+	 * any migration, hash the key,
+	 * put, check the load, return.
 	 */
 	DASSERT(table != NULL, ICALLER, "Given NULL table.",
 		return 1;
@@ -419,98 +1301,939 @@ int dhtable_rm (dhtable table, void *key) {
 		return 1;
 		);
 
+	DASSERT(table->map == NULL, ICALLER, "Given read-only table.",
+		return 1;
+		);
+
 	DASSERT(key != NULL, ICALLER, "Given invalid key.",
 		return 1;
 		);
 
-	int hash = table->kv_data.key_hsh(table->kv_data.key_size, key);
+	if (table->old_buckets != NULL)
+		_dhtable_migrate(table, MIGRATE_STEP);
 
-	int index = ((unsigned) hash) % table->bucket_count;
+	uint64_t hash = dhtable_ctx_hash(&table->kv_data, key);
 
-	void *bucket = table->buckets[index];
+	int t = _dhtable_put_hashed(table, hash, key, value);
 
-	if (bucket == NULL)
-		return 0;
+	if (t == 0)
+		_dhtable_check_load(table);
 
-	return table->backend->rm(&table->kv_data, bucket, key);
+	return t;
 }
 
-/* Returns the element count. */
-size_t dhtable_size(dhtable table) {
+/* Find a key's value, inserting it
+ * with a zeroed value if missing, in
+ * one probe when the backend can.
+ * The value lives until the next write.
+ */
+void *dhtable_emplace(dhtable table, void *key, int *inserted) {
 
-	/* Validate the table, for each bucket,
-	 * get the number of elements,
-	 * return sum.
+	/* Validate the table, key, step
+	 * any migration, hash the key, get
+	 * the bucket, call backend->emplace
+	 * or fall back to get and put, count
+	 * any new element, check the load, return.
 	 */
 	DASSERT(table != NULL, ICALLER, "Given NULL table.",
-		return 0;
+		return NULL;
 		);
 
 	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
-		return 0;
+		return NULL;
 		);
 
-	size_t n = 0;
+	DASSERT(table->map == NULL, ICALLER, "Given read-only table.",
+		return NULL;
+		);
 
-	size_t count = table->bucket_count;
+	DASSERT(key != NULL, ICALLER, "Given invalid key.",
+		return NULL;
+		);
 
-	size_t i;
-	for (i = 0; i < count; i++) {
+	if (table->old_buckets != NULL)
+		_dhtable_migrate(table, MIGRATE_STEP);
 
-		void *bucket = table->buckets[i];
+	uint64_t hash = dhtable_ctx_hash(&table->kv_data, key);
+
+	void **slot = _dhtable_locate(table, hash);
+	void *bucket = *slot;
+
+	if (bucket == NULL) {
+		bucket = table->backend->init(&table->kv_data);
+
+		DASSERT(bucket != NULL, IBACKEND, "Failed to create a bucket.",
+			return NULL;
+			);
 
-		if (bucket != NULL)
-			n += table->backend->size(&table->kv_data, bucket);
+		*slot = bucket;
 	}
 
-	return n;
-}
+	int added = 0;
+	void *value = NULL;
 
-/* Returns the key size. */
-size_t dhtable_key_size(dhtable table) {
+	if (table->backend->emplace != NULL) {
+		value = table->backend->emplace(&table->kv_data, bucket,
+		                                hash, key, &added);
+	}
+	else {
+		value = table->backend->get(&table->kv_data, bucket, hash, key);
 
-	/* Validate the table,
-	 * return the key size.
-	 */
-	DASSERT(table != NULL, ICALLER, "Given NULL table.",
-		return 0;
-		);
+		if (value == NULL) {
+			char zero[table->kv_data.val_size + 1];
+			memset(zero, 0, sizeof(zero));
 
-	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
-		return 0;
+			added = table->backend->put(&table->kv_data, bucket,
+			                            hash, key, zero) == 0;
+
+			if (added)
+				value = table->backend->get(&table->kv_data, bucket,
+				                            hash, key);
+		}
+	}
+
+	DASSERT(value != NULL, IBACKEND, "Failed to emplace key.",
+		return NULL;
 		);
 
-	return table->kv_data.key_size;
-}
+	if (added) {
+		table->count++;
 
-/* Returns the value size */
-size_t dhtable_val_size(dhtable table) {
+		_dhtable_mark(table, slot, 1);
 
-	/* Validate the table,
-	 * return the value size.
-	 */
-	DASSERT(table != NULL, ICALLER, "Given NULL table.",
-		return 0;
-		);
+		_dhtable_check_load(table);
+	}
 
-	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
-		return 0;
-		);
+	if (inserted != NULL)
+		*inserted = added;
 
-	return table->kv_data.val_size;
+	return value;
 }
 
-/* For each corresponding
- * bucket pair in two hashtables,
- * join one into the other.
+/* Emplace a key and let a functor
+ * edit its value in place. Returns
+ * the status.
  */
-int dhtable_join(dhtable dst, dhtable src) {
+int dhtable_update(dhtable table, void *key, dhtable_updater fn, void *arg) {
 
-	/* Validate that buckets are
-	 * joinable, for each bucket,
-	 * attempt backend->join, return.
+	/* Validate the functor,
+	 * emplace, call, return.
 	 */
-	DASSERT(dst != NULL, ICALLER, "Given NULL destination table.",
+	DASSERT(fn != NULL, ICALLER, "Given NULL functor.",
+		return 1;
+		);
+
+	int inserted;
+	void *value = dhtable_emplace(table, key, &inserted);
+
+	if (value == NULL)
+		return 1;
+
+	fn(key, value, inserted, arg);
+
+	return 0;
+}
+
+/* Hash the key, index
+ * into the table, call the
+ * backend, return the status.
+ */
+int dhtable_rm (dhtable table, void *key) {
+
+	/* Validate the table, key, step
+	 * any migration, hash the key, get
+	 * the bucket, verify the bucket, call the backend,
+	 * uncount any removed element, check
+	 * the load, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(table->map == NULL, ICALLER, "Given read-only table.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, ICALLER, "Given invalid key.",
+		return 1;
+		);
+
+	if (table->old_buckets != NULL)
+		_dhtable_migrate(table, MIGRATE_STEP);
+
+	uint64_t hash = dhtable_ctx_hash(&table->kv_data, key);
+
+	void **slot = _dhtable_locate(table, hash);
+	void *bucket = *slot;
+
+	if (bucket == NULL)
+		return 0;
+
+	size_t before = table->backend->size(&table->kv_data, bucket);
+
+	int t = table->backend->rm(&table->kv_data, bucket, hash, key);
+
+	if (t != 0)
+		return t;
+
+	size_t after = table->backend->size(&table->kv_data, bucket);
+
+	table->count -= before - after;
+
+	_dhtable_mark(table, slot, after != 0);
+
+	_dhtable_check_load(table);
+
+	return 0;
+}
+
+/* Hash a run of keys, then locate
+ * and prefetch their buckets in stages,
+ * so the misses overlap. Resolves nothing.
+ */
+static void _dhtable_batch_locate(dhtable table, size_t n, char *keys,
+                                  uint64_t *hashes, void ***slots) {
+
+	/* Hash every key and prefetch its
+	 * slot, then prefetch every bucket,
+	 * then let the backend prefetch
+	 * what the lookups will read.
+	 */
+	dhtable_ctx *ctx = &table->kv_data;
+
+	size_t i;
+	for (i = 0; i < n; i++) {
+
+		hashes[i] = dhtable_ctx_hash(ctx, keys + i * ctx->key_size);
+		slots[i] = _dhtable_locate(table, hashes[i]);
+
+		DHTABLE_PREFETCH(slots[i]);
+	}
+
+	for (i = 0; i < n; i++) {
+
+		if (*slots[i] != NULL)
+			DHTABLE_PREFETCH(*slots[i]);
+	}
+
+	if (table->backend->prefetch == NULL)
+		return;
+
+	for (i = 0; i < n; i++) {
+
+		if (*slots[i] != NULL)
+			table->backend->prefetch(ctx, *slots[i], hashes[i]);
+	}
+}
+
+/* Get many keys at once.
+ * keys holds n keys back to back,
+ * vals receives n value pointers,
+ * NULL where a key is missing.
+ */
+int dhtable_get_batch(dhtable table, size_t n, void *keys, void **vals) {
+
+	/* Validate once, then per run, step
+	 * any migration, locate the buckets,
+	 * call the backend for each key, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(n == 0 || (keys != NULL && vals != NULL), ICALLER,
+		"Given invalid keys or values.",
+		return 1;
+		);
+
+	dhtable_ctx *ctx = &table->kv_data;
+	char *key = (char*) keys;
+
+	uint64_t hashes[BATCH_STEP];
+	void **slots[BATCH_STEP];
+
+	size_t done;
+	for (done = 0; done < n; done += BATCH_STEP) {
+
+		size_t run = n - done < BATCH_STEP ? n - done : BATCH_STEP;
+		char *run_keys = key + done * ctx->key_size;
+
+		if (table->old_buckets != NULL)
+			_dhtable_migrate(table, MIGRATE_STEP);
+
+		_dhtable_batch_locate(table, run, run_keys, hashes, slots);
+
+		size_t i;
+		for (i = 0; i < run; i++) {
+
+			void *bucket = *slots[i];
+
+			vals[done + i] = bucket == NULL ? NULL :
+				table->backend->get(ctx, bucket, hashes[i],
+				                    run_keys + i * ctx->key_size);
+		}
+	}
+
+	return 0;
+}
+
+/* Put many pairs at once.
+ * keys holds n keys back to back,
+ * vals holds n values back to back.
+ */
+int dhtable_put_batch(dhtable table, size_t n, void *keys, void *vals) {
+
+	/* Validate once, then per run, step
+	 * any migration, locate the buckets,
+	 * put each pair, count new elements,
+	 * check the load, return. The load is
+	 * only checked between runs, since a
+	 * resize would move the located slots.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(table->map == NULL, ICALLER, "Given read-only table.",
+		return 1;
+		);
+
+	DASSERT(n == 0 || keys != NULL, ICALLER, "Given invalid keys.",
+		return 1;
+		);
+
+	DASSERT(n == 0 || vals != NULL || table->kv_data.val_size == 0, ICALLER,
+		"Given invalid values.",
+		return 1;
+		);
+
+	dhtable_ctx *ctx = &table->kv_data;
+	char *key = (char*) keys;
+	char *val = (char*) vals;
+
+	uint64_t hashes[BATCH_STEP];
+	void **slots[BATCH_STEP];
+
+	size_t done;
+	for (done = 0; done < n; done += BATCH_STEP) {
+
+		size_t run = n - done < BATCH_STEP ? n - done : BATCH_STEP;
+		char *run_keys = key + done * ctx->key_size;
+
+		if (table->old_buckets != NULL)
+			_dhtable_migrate(table, MIGRATE_STEP);
+
+		_dhtable_batch_locate(table, run, run_keys, hashes, slots);
+
+		size_t i;
+		for (i = 0; i < run; i++) {
+
+			void *bucket = *slots[i];
+
+			if (bucket == NULL) {
+				bucket = table->backend->init(ctx);
+
+				DASSERT(bucket != NULL, IBACKEND,
+					"Failed to create a bucket.",
+					return 1;
+					);
+
+				*slots[i] = bucket;
+			}
+
+			size_t before = table->backend->size(ctx, bucket);
+
+			int t = table->backend->put(ctx, bucket, hashes[i],
+				run_keys + i * ctx->key_size,
+				val == NULL ? NULL : val + (done + i) * ctx->val_size);
+
+			if (t != 0)
+				return t;
+
+			table->count += table->backend->size(ctx, bucket) - before;
+
+			_dhtable_mark(table, slots[i], 1);
+		}
+
+		_dhtable_check_load(table);
+	}
+
+	return 0;
+}
+
+/* Remove many keys at once.
+ * keys holds n keys back to back.
+ */
+int dhtable_rm_batch(dhtable table, size_t n, void *keys) {
+
+	/* Validate once, then per run, step
+	 * any migration, locate the buckets,
+	 * remove each key, uncount removed
+	 * elements, check the load, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(table->map == NULL, ICALLER, "Given read-only table.",
+		return 1;
+		);
+
+	DASSERT(n == 0 || keys != NULL, ICALLER, "Given invalid keys.",
+		return 1;
+		);
+
+	dhtable_ctx *ctx = &table->kv_data;
+	char *key = (char*) keys;
+
+	uint64_t hashes[BATCH_STEP];
+	void **slots[BATCH_STEP];
+
+	size_t done;
+	for (done = 0; done < n; done += BATCH_STEP) {
+
+		size_t run = n - done < BATCH_STEP ? n - done : BATCH_STEP;
+		char *run_keys = key + done * ctx->key_size;
+
+		if (table->old_buckets != NULL)
+			_dhtable_migrate(table, MIGRATE_STEP);
+
+		_dhtable_batch_locate(table, run, run_keys, hashes, slots);
+
+		size_t i;
+		for (i = 0; i < run; i++) {
+
+			void *bucket = *slots[i];
+
+			if (bucket == NULL)
+				continue;
+
+			size_t before = table->backend->size(ctx, bucket);
+
+			int t = table->backend->rm(ctx, bucket, hashes[i],
+				run_keys + i * ctx->key_size);
+
+			if (t != 0)
+				return t;
+
+			size_t after = table->backend->size(ctx, bucket);
+
+			table->count -= before - after;
+
+			_dhtable_mark(table, slots[i], after != 0);
+		}
+
+		_dhtable_check_load(table);
+	}
+
+	return 0;
+}
+
+/* Returns the element count. */
+size_t dhtable_size(dhtable table) {
+
+	/* Validate the table,
+	 * return the count.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 0;
+		);
+
+	return table->count;
+}
+
+/* Key compares made by the
+ * lookups of dhtable_stats.
+ */
+static _Thread_local dhtable_key_cmp _dhtable_probe_cmp;
+static _Thread_local size_t _dhtable_probes;
+
+/* Count a compare, then compare. */
+static int _dhtable_probe(size_t key_size, void *keyl, void *keyr) {
+
+	_dhtable_probes++;
+
+	return _dhtable_probe_cmp(key_size, keyl, keyr);
+}
+
+/* Gather the statistics of a table.
+ * Lookups are sampled. A hit looks up
+ * an entry in its own bucket, a miss
+ * looks it up in another bucket.
+ */
+int dhtable_stats(dhtable table, struct dhtable_stats *stats) {
+
+	/* Validate, finish any migration,
+	 * size every bucket, sample lookups
+	 * over a counting ctx, add up the
+	 * bytes, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(stats != NULL, ICALLER, "Given NULL stats.",
+		return 1;
+		);
+
+	int t = _dhtable_migrate(table, table->old_count);
+	DASSERT(t == 0, IBACKEND, "Failed to finish migration.",
+		return 1;
+		);
+
+	struct dhtable_backend *backend = table->backend;
+	dhtable_ctx *ctx = &table->kv_data;
+
+	size_t count = table->bucket_count;
+
+	memset(stats, 0, sizeof(struct dhtable_stats));
+
+	stats->count = table->count;
+	stats->buckets = count;
+	stats->load = (double) table->count / count;
+
+	stats->bytes = sizeof(struct daelib_hashtable) +
+		_dhtable_buckets_size(count);
+
+	size_t i;
+	for (i = 0; i < count; i++) {
+
+		void *bucket = table->buckets[i];
+		size_t n = bucket == NULL ? 0 : backend->size(ctx, bucket);
+
+		stats->chains[n < DHTABLE_STATS_CHAINS ? n :
+		              DHTABLE_STATS_CHAINS - 1]++;
+
+		if (n > stats->max_chain)
+			stats->max_chain = n;
+
+		if (n == 0)
+			continue;
+
+		stats->occupied++;
+
+		stats->bytes += backend->bytes != NULL ?
+			backend->bytes(ctx, bucket) :
+			n * (ctx->key_size + ctx->val_size);
+	}
+
+	stats->bytes_per_bucket = (double) stats->bytes / count;
+
+	if (stats->occupied == 0)
+		return 0;
+
+	/* Sample evenly spread buckets, and
+	 * within each, a rotating entry.
+	 */
+	dhtable_ctx probe_ctx = *ctx;
+	probe_ctx.key_cmp = &_dhtable_probe;
+	_dhtable_probe_cmp = ctx->key_cmp;
+
+	size_t samples = table->count < DHTABLE_STATS_SAMPLES ?
+		table->count : DHTABLE_STATS_SAMPLES;
+
+	size_t hits = 0, misses = 0;
+	size_t hit_probes = 0, miss_probes = 0;
+
+	for (i = 0; i < samples; i++) {
+
+		size_t index = _dhtable_scan(table, i * count / samples);
+
+		if (index >= count)
+			index = _dhtable_scan(table, 0);
+
+		void *bucket = table->buckets[index];
+
+		size_t n = backend->size(ctx, bucket);
+		void *it = backend->begin(ctx, bucket);
+
+		size_t j;
+		for (j = 0; j < i % n; j++)
+			it = backend->next(ctx, bucket, it);
+
+		char *key = (char*) backend->iget(ctx, bucket, it);
+		uint64_t hash = backend->ihsh != NULL ?
+			backend->ihsh(ctx, bucket, it) : dhtable_ctx_hash(ctx, key);
+
+		_dhtable_probes = 0;
+		backend->get(&probe_ctx, bucket, hash, key);
+		hit_probes += _dhtable_probes;
+		hits++;
+
+		size_t other = _dhtable_scan(table, index + 1);
+
+		if (other >= count)
+			other = _dhtable_scan(table, 0);
+
+		if (other == index)
+			continue;
+
+		_dhtable_probes = 0;
+		backend->get(&probe_ctx, table->buckets[other], hash, key);
+		miss_probes += _dhtable_probes;
+		misses++;
+	}
+
+	stats->hit_probes = (double) hit_probes / hits;
+	stats->miss_probes = misses == 0 ? 0 : (double) miss_probes / misses;
+
+	return 0;
+}
+/* Set the loads at which the table
+ * resizes itself. A max_load of 0
+ * fixes the bucket count. Returns
+ * nonzero on error.
+ */
+int dhtable_set_load(dhtable table, double min_load, double max_load) {
+
+	/* Validate the table, the loads,
+	 * set them, check the load,
+	 * return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(table->map == NULL, ICALLER, "Given read-only table.",
+		return 1;
+		);
+
+	DASSERT(max_load == 0 || (min_load >= 0 && max_load > 2 * min_load),
+		ICALLER, "Given bad loads.",
+		return 1;
+		);
+
+	table->min_load = min_load;
+	table->max_load = max_load;
+
+	_dhtable_check_load(table);
+
+	return 0;
+}
+
+/* Set how hashes map to buckets.
+ * Masking rounds the bucket count
+ * up to a power of two. The table
+ * must be empty. Returns nonzero
+ * on error.
+ */
+int dhtable_set_index(dhtable table, enum dhtable_index index) {
+
+	/* Validate the table, check it is
+	 * empty, if masking, round up the
+	 * bucket count, replacing the bucket
+	 * array, set the mode, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(table->map == NULL, ICALLER, "Given read-only table.",
+		return 1;
+		);
+
+	DASSERT(table->count == 0 && table->old_buckets == NULL, ICALLER,
+		"Given non-empty table.",
+		return 1;
+		);
+
+	size_t buckets = table->bucket_count;
+
+	if (index == DHTABLE_MASK)
+		while (buckets & (buckets - 1))
+			buckets += buckets & -buckets;
+
+	if (buckets != table->bucket_count) {
+
+		void **new_buckets = _dhtable_buckets_alloc(table->kv_data.alloc,
+		                                            buckets);
+		DASSERT(new_buckets != NULL, IALLOC, "Failed to allocate new buckets.",
+			return 1;
+			);
+
+		size_t i;
+		for (i = 0; i < table->bucket_count; i++)
+			if (table->buckets[i] != NULL)
+				table->backend->kill(&table->kv_data, table->buckets[i]);
+
+		_dhtable_buckets_free(table->kv_data.alloc, table->buckets,
+		                      table->bucket_count);
+
+		table->buckets = new_buckets;
+		table->bucket_count = buckets;
+		table->occupied = _dhtable_buckets_bits(new_buckets, buckets);
+
+		if (table->min_buckets < buckets)
+			table->min_buckets = buckets;
+	}
+
+	table->index = index;
+
+	return 0;
+}
+
+/* Set the threads copy and join
+ * may use. 1, the default, keeps
+ * them on the calling thread.
+ * Returns nonzero on error.
+ */
+int dhtable_set_threads(dhtable table, size_t threads) {
+
+	/* Validate the table, the count,
+	 * set it, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(threads != 0, ICALLER, "Given no threads.",
+		return 1;
+		);
+
+	table->threads = threads;
+
+	return 0;
+}
+
+/* Returns the key size. */
+size_t dhtable_key_size(dhtable table) {
+
+	/* Validate the table,
+	 * return the key size.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 0;
+		);
+
+	return table->kv_data.key_size;
+}
+
+/* Returns the value size */
+size_t dhtable_val_size(dhtable table) {
+
+	/* Validate the table,
+	 * return the value size.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 0;
+		);
+
+	return table->kv_data.val_size;
+}
+
+/* Grow a growing dst to hold both
+ * tables before a rehashing join,
+ * so nothing resizes mid join.
+ * Returns nonzero on error.
+ */
+static int _dhtable_join_grow(dhtable dst, dhtable src) {
+
+	/* Double the bucket count past
+	 * the max load, resize, finish
+	 * the migration, return.
+	 */
+	if (dst->max_load == 0)
+		return 0;
+
+	size_t buckets = dst->bucket_count;
+
+	while ((double) (dst->count + src->count) / buckets > dst->max_load)
+		buckets *= 2;
+
+	if (buckets == dst->bucket_count)
+		return 0;
+
+	int t = _dhtable_resize(dst, buckets);
+	DASSERT(t == 0, IALLOC, "Failed to grow destination.",
+		return 1;
+		);
+
+	t = _dhtable_migrate(dst, dst->old_count);
+	DASSERT(t == 0, IBACKEND, "Failed to finish migration.",
+		return 1;
+		);
+
+	return 0;
+}
+
+/* Join tables whose layouts differ,
+ * putting each source entry into
+ * the destination one by one.
+ */
+static int _dhtable_join_rehash(dhtable dst, dhtable src) {
+
+	/* For each source bucket, walk
+	 * its entries, reuse any stored
+	 * hash, put into dst, check the
+	 * load once, return.
+	 */
+	struct dhtable_backend *backend = src->backend;
+	dhtable_ctx *ctx = &src->kv_data;
+
+	size_t i;
+	for (i = 0; i < src->bucket_count; i++) {
+
+		void *bucket = src->buckets[i];
+
+		if (bucket == NULL)
+			continue;
+
+		void *it;
+		for (it = backend->begin(ctx, bucket); it != NULL;
+		     it = backend->next(ctx, bucket, it)) {
+
+			char *key = (char*) backend->iget(ctx, bucket, it);
+
+			uint64_t hash = backend->ihsh != NULL ?
+				backend->ihsh(ctx, bucket, it) :
+				dhtable_ctx_hash(ctx, key);
+
+			int t = _dhtable_put_hashed(dst, hash, key,
+			                            key + ctx->key_size);
+
+			DASSERT(t == 0, IBACKEND, "Failed to put an entry.",
+				return 1;
+				);
+		}
+	}
+
+	_dhtable_check_load(dst);
+
+	return 0;
+}
+
+/* Rehash src into dst over threads.
+ * Each thread stages a share of src by
+ * destination share, then each thread
+ * puts one destination share, so no
+ * bucket is touched by two threads.
+ */
+static int _dhtable_join_rehash_parallel(dhtable dst, dhtable src,
+                                         size_t threads) {
+
+	/* Split both tables, make the
+	 * staging, stage, unstage, count,
+	 * free the staging, return.
+	 */
+	struct _dhtable_part sparts[threads];
+	struct _dhtable_part dparts[threads];
+
+	size_t dcount = _dhtable_split(dst->bucket_count, threads, dparts);
+	size_t scount = _dhtable_split(src->bucket_count, threads, sparts);
+
+	dvec staging[scount * dcount];
+
+	size_t i;
+	for (i = 0; i < scount * dcount; i++)
+		staging[i] = dvec_init(sizeof(struct _dhtable_staged));
+
+	int error = 0;
+
+	for (i = 0; i < scount * dcount; i++)
+		error |= staging[i] == NULL;
+
+	for (i = 0; i < scount; i++) {
+		sparts[i].dst = dst;
+		sparts[i].src = src;
+		sparts[i].staged = staging + i * dcount;
+		sparts[i].count = dcount;
+	}
+
+	for (i = 0; i < dcount; i++) {
+		dparts[i].dst = dst;
+		dparts[i].src = src;
+		dparts[i].parts = sparts;
+		dparts[i].count = scount;
+		dparts[i].index = i;
+	}
+
+	if (error == 0)
+		_dhtable_parallel(sparts, scount, _dhtable_stage_part);
+
+	for (i = 0; i < scount; i++)
+		error |= sparts[i].error;
+
+	if (error == 0)
+		_dhtable_parallel(dparts, dcount, _dhtable_unstage_part);
+
+	for (i = 0; i < dcount; i++) {
+		dst->count += dparts[i].added;
+		error |= dparts[i].error;
+	}
+
+	for (i = 0; i < scount * dcount; i++)
+		if (staging[i] != NULL)
+			dvec_kill(staging[i]);
+
+	DASSERT(error == 0, IBACKEND, "Failed to rehash an entry.",
+		return 1;
+		);
+
+	_dhtable_check_load(dst);
+
+	return 0;
+}
+
+/* For each corresponding
+ * bucket pair in two hashtables,
+ * join one into the other. Tables
+ * with different layouts are
+ * joined entry by entry.
+ */
+int dhtable_join(dhtable dst, dhtable src) {
+
+	/* Finish any migrations, validate
+	 * that buckets are joinable, grow dst
+	 * and rehash if the layouts differ,
+	 * else split the buckets over threads,
+	 * each attempting backend->join,
+	 * recount, return.
+	 */
+	DASSERT(dst != NULL, ICALLER, "Given NULL destination table.",
 		return 1;
 		);
 
@@ -518,48 +2241,863 @@ int dhtable_join(dhtable dst, dhtable src) {
 		return 1;
 		);
 
-	DASSERT(_dhtable_joinable(dst, src), ICALLER, "Given unjoinable tables.",
+	DASSERT(dst->map == NULL, ICALLER, "Given read-only destination.",
+		return 1;
+		);
+
+	int t = _dhtable_migrate(dst, dst->old_count);
+	DASSERT(t == 0, IBACKEND, "Failed to finish destination migration.",
+		return 1;
+		);
+
+	t = _dhtable_migrate(src, src->old_count);
+	DASSERT(t == 0, IBACKEND, "Failed to finish source migration.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_joinable(dst, src), ICALLER, "Given unjoinable tables.",
+		return 1;
+		);
+
+	size_t threads = _dhtable_threads(dst, src->count);
+
+	if (!_dhtable_same_layout(dst, src)) {
+
+		t = _dhtable_join_grow(dst, src);
+		DASSERT(t == 0, IALLOC, "Failed to grow destination.",
+			return 1;
+			);
+
+		return threads > 1 ?
+			_dhtable_join_rehash_parallel(dst, src, threads) :
+			_dhtable_join_rehash(dst, src);
+	}
+
+	struct _dhtable_part parts[threads];
+	size_t count = _dhtable_split(dst->bucket_count, threads, parts);
+
+	size_t i;
+	for (i = 0; i < count; i++) {
+		parts[i].dst = dst;
+		parts[i].src = src;
+	}
+
+	_dhtable_parallel(parts, count, _dhtable_join_part);
+
+	int error = 0;
+
+	for (i = 0; i < count; i++) {
+		dst->count += parts[i].added;
+		error |= parts[i].error;
+	}
+
+	DASSERT(error == 0, IBACKEND, "Failed to join two buckets.",
+		return 1;
+		);
+
+	_dhtable_check_load(dst);
+
+	return 0;
+}
+
+/* Find the first entry at or after
+ * a bucket, or the last entry at or
+ * before it if going backwards.
+ * ASSUMES VALID TABLE, NO MIGRATION.
+ */
+static dhtable_it _dhtable_seek(dhtable table, size_t from, int forward) {
+
+	/* Scan the bitmap for a non-empty
+	 * bucket, take its first or last
+	 * entry, keep scanning if it had
+	 * none, return.
+	 */
+	dhtable_it it = { .bucket = table->bucket_count, .it = NULL };
+
+	size_t i = forward ? _dhtable_scan(table, from) :
+	                     _dhtable_rscan(table, from);
+
+	while (i < table->bucket_count) {
+
+		void *bucket = table->buckets[i];
+
+		it.it = forward ? table->backend->begin(&table->kv_data, bucket) :
+		                  table->backend->end(&table->kv_data, bucket);
+
+		if (it.it != NULL) {
+			it.bucket = i;
+			return it;
+		}
+
+		if (!forward && i == 0)
+			break;
+
+		i = forward ? _dhtable_scan(table, i + 1) :
+		              _dhtable_rscan(table, i - 1);
+	}
+
+	it.bucket = table->bucket_count;
+
+	return it;
+}
+
+/* Get an iterator to the first entry.
+ * Finishes any migration.
+ */
+dhtable_it dhtable_begin(dhtable table) {
+
+	/* Validate the table, finish
+	 * any migration, seek forward
+	 * from the first bucket, return.
+	 */
+	dhtable_it none = { .bucket = 0, .it = NULL };
+
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return none;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return none;
+		);
+
+	int t = _dhtable_migrate(table, table->old_count);
+	DASSERT(t == 0, IBACKEND, "Failed to finish migration.",
+		return none;
+		);
+
+	return _dhtable_seek(table, 0, 1);
+}
+
+/* Get an iterator to the last entry.
+ * Finishes any migration.
+ */
+dhtable_it dhtable_end(dhtable table) {
+
+	/* Validate the table, finish
+	 * any migration, seek backward
+	 * from the last bucket, return.
+	 */
+	dhtable_it none = { .bucket = 0, .it = NULL };
+
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return none;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return none;
+		);
+
+	int t = _dhtable_migrate(table, table->old_count);
+	DASSERT(t == 0, IBACKEND, "Failed to finish migration.",
+		return none;
+		);
+
+	return _dhtable_seek(table, table->bucket_count - 1, 0);
+}
+
+/* Step an iterator back. */
+dhtable_it dhtable_prev(dhtable table, dhtable_it it) {
+
+	/* Validate the table and iterator,
+	 * step within the bucket, else
+	 * seek back from the previous bucket,
+	 * return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return it;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return it;
+		);
+
+	if (it.it == NULL)
+		return it;
+
+	DASSERT(it.bucket < table->bucket_count, ICALLER,
+		"Given invalid iterator.",
+		it.it = NULL;
+		return it;
+		);
+
+	void *bucket = table->buckets[it.bucket];
+	void *prev = table->backend->prev(&table->kv_data, bucket, it.it);
+
+	if (prev != NULL) {
+		it.it = prev;
+		return it;
+	}
+
+	if (it.bucket == 0) {
+		it.bucket = table->bucket_count;
+		it.it = NULL;
+		return it;
+	}
+
+	return _dhtable_seek(table, it.bucket - 1, 0);
+}
+
+/* Step an iterator forward. */
+dhtable_it dhtable_next(dhtable table, dhtable_it it) {
+
+	/* Validate the table and iterator,
+	 * step within the bucket, else
+	 * seek on from the next bucket,
+	 * return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return it;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return it;
+		);
+
+	if (it.it == NULL)
+		return it;
+
+	DASSERT(it.bucket < table->bucket_count, ICALLER,
+		"Given invalid iterator.",
+		it.it = NULL;
+		return it;
+		);
+
+	void *bucket = table->buckets[it.bucket];
+	void *next = table->backend->next(&table->kv_data, bucket, it.it);
+
+	if (next != NULL) {
+		it.it = next;
+		return it;
+	}
+
+	return _dhtable_seek(table, it.bucket + 1, 1);
+}
+
+/* Get the key under an iterator.
+ * The value directly follows it.
+ */
+void *dhtable_iget(dhtable table, dhtable_it it) {
+
+	/* Validate the table and
+	 * iterator, call backend->iget,
+	 * return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return NULL;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return NULL;
+		);
+
+	DASSERT(it.it != NULL && it.bucket < table->bucket_count, ICALLER,
+		"Given invalid iterator.",
+		return NULL;
+		);
+
+	return table->backend->iget(&table->kv_data,
+	                            table->buckets[it.bucket], it.it);
+}
+
+/* Call a functor on every entry,
+ * stopping when it returns nonzero.
+ * Returns what stopped it, else zero.
+ */
+int dhtable_foreach(dhtable table, dhtable_visit visit, void *arg) {
+
+	/* Validate the table and functor,
+	 * finish any migration, for each
+	 * set bit, walk the bucket, visit
+	 * each entry, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(visit != NULL, ICALLER, "Given NULL functor.",
+		return 1;
+		);
+
+	int t = _dhtable_migrate(table, table->old_count);
+	DASSERT(t == 0, IBACKEND, "Failed to finish migration.",
 		return 1;
 		);
 
-	void **dbuckets = dst->buckets;
-	void **sbuckets = src->buckets;
+	struct dhtable_backend *backend = table->backend;
+	dhtable_ctx *ctx = &table->kv_data;
 
-	int count = dst->bucket_count;
+	size_t words = _dhtable_words(table->bucket_count);
 
-	int i;
+	size_t w;
+	for (w = 0; w < words; w++) {
+
+		uint64_t word = table->occupied[w];
+
+		while (word != 0) {
+
+			void *bucket = table->buckets[w * 64 + _dhtable_ctz(word)];
+
+			word &= word - 1;
+
+			void *it;
+			for (it = backend->begin(ctx, bucket); it != NULL;
+			     it = backend->next(ctx, bucket, it)) {
+
+				char *key = (char*) backend->iget(ctx, bucket, it);
+
+				t = visit(key, key + ctx->key_size, arg);
+
+				if (t != 0)
+					return t;
+			}
+		}
+	}
+
+	return 0;
+}
+
+
+/* Snapshot images. All fields are
+ * native 64 bit words, and offsets
+ * count from the start of the file,
+ * so an image maps anywhere.
+ *
+ *   header
+ *   uint64_t offsets[bucket_count], 0 if empty
+ *   per bucket, 8 byte aligned:
+ *     uint64_t count
+ *     uint64_t hashes[count]
+ *     key|value entries[count], padded to 8
+ */
+
+/* "DHTABLE" and a NUL, as read in
+ * native byte order. Also catches
+ * images of the other endianness.
+ */
+#define IMAGE_MAGIC 0x00454C4241544844ull
+
+/* Bump on any change to the layout. */
+#define IMAGE_VERSION 1
+
+/* Images are written to path with this
+ * suffix, mkstemp() filling the X's, then
+ * renamed over it. New images get this
+ * mode, replacements keep the old one.
+ */
+#define SAVE_SUFFIX ".XXXXXX"
+#define SAVE_MODE 0644
+
+/* Image header. */
+struct _dhtable_image {
+
+	uint64_t magic;
+	uint32_t version;
+	uint32_t hash64; /* Saved with a 64 bit hash. */
+
+	uint64_t key_size;
+	uint64_t val_size;
+
+	uint64_t bucket_count;
+	uint64_t index;
+	uint64_t count;
+
+	uint64_t size; /* Of the whole file. */
+};
+
+/* Image bucket. Entries follow the hashes. */
+struct _dhtable_image_bucket {
+
+	uint64_t count;
+	uint64_t hashes[];
+};
+
+
+/* The backend of a mapped table. Buckets
+ * point into the image, and iterators at
+ * their hashes. Writes fail, though the
+ * table functions refuse them first.
+ */
+static char *_dhtable_mapped_entries(struct _dhtable_image_bucket *bucket) {
+
+	return (char*) (bucket->hashes + bucket->count);
+}
+
+static void *_dhtable_mapped_init(dhtable_ctx *ctx) {
+
+	return NULL;
+}
+
+static int _dhtable_mapped_kill(dhtable_ctx *ctx, void *bucket) {
+
+	return 0;
+}
+
+static void *_dhtable_mapped_copy(dhtable_ctx *ctx, void *bucket) {
+
+	return NULL;
+}
+
+static size_t _dhtable_mapped_size(dhtable_ctx *ctx, void *bucket) {
+
+	return ((struct _dhtable_image_bucket*) bucket)->count;
+}
+
+static void *_dhtable_mapped_get(dhtable_ctx *ctx, void *bucket,
+                                 uint64_t hash, void *key) {
+
+	/* Scan the hashes, compare
+	 * keys on a match, return.
+	 */
+	struct _dhtable_image_bucket *image = bucket;
+
+	size_t elem_size = ctx->key_size + ctx->val_size;
+	char *entries = _dhtable_mapped_entries(image);
+
+	size_t i;
+	for (i = 0; i < image->count; i++) {
+
+		if (image->hashes[i] != hash)
+			continue;
+
+		char *entry = entries + i * elem_size;
+
+		if (ctx->key_cmp(ctx->key_size, entry, key) == 0)
+			return entry + ctx->key_size;
+	}
+
+	return NULL;
+}
+
+static int _dhtable_mapped_put(dhtable_ctx *ctx, void *bucket,
+                               uint64_t hash, void *key, void *value) {
+
+	return 1;
+}
+
+static int _dhtable_mapped_rm(dhtable_ctx *ctx, void *bucket,
+                              uint64_t hash, void *key) {
+
+	return 1;
+}
+
+static int _dhtable_mapped_join(dhtable_ctx *ctx, void *dst, void *src) {
+
+	return 1;
+}
+
+static void *_dhtable_mapped_begin(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_image_bucket *image = bucket;
+
+	return image->count == 0 ? NULL : (void*) image->hashes;
+}
+
+static void *_dhtable_mapped_end(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_image_bucket *image = bucket;
+
+	return image->count == 0 ? NULL : (void*)
+		(image->hashes + image->count - 1);
+}
+
+static void *_dhtable_mapped_prev(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	struct _dhtable_image_bucket *image = bucket;
+	uint64_t *hash = it;
+
+	return hash == image->hashes ? NULL : (void*) (hash - 1);
+}
+
+static void *_dhtable_mapped_next(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	struct _dhtable_image_bucket *image = bucket;
+	uint64_t *hash = it;
+
+	return hash + 1 == image->hashes + image->count ? NULL : (void*)
+		(hash + 1);
+}
+
+static void *_dhtable_mapped_iget(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	struct _dhtable_image_bucket *image = bucket;
+
+	if (it == NULL)
+		return NULL;
+
+	size_t i = (uint64_t*) it - image->hashes;
+
+	return _dhtable_mapped_entries(image) +
+		i * (ctx->key_size + ctx->val_size);
+}
+
+static uint64_t _dhtable_mapped_ihsh(dhtable_ctx *ctx, void *bucket,
+                                     void *it) {
+
+	return *(uint64_t*) it;
+}
+
+static void _dhtable_mapped_prefetch(dhtable_ctx *ctx, void *bucket,
+                                     uint64_t hash) {
+
+	DHTABLE_PREFETCH(bucket);
+}
+
+static size_t _dhtable_mapped_bytes(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_image_bucket *image = bucket;
+
+	size_t entries = image->count * (ctx->key_size + ctx->val_size);
+
+	return sizeof(uint64_t) * (1 + image->count) +
+		((entries + 7) & ~(size_t) 7);
+}
+
+static struct dhtable_backend _dhtable_mapped = {
+	.init = _dhtable_mapped_init,
+	.kill = _dhtable_mapped_kill,
+	.copy = _dhtable_mapped_copy,
+
+	.size = _dhtable_mapped_size,
+
+	.get = _dhtable_mapped_get,
+	.put = _dhtable_mapped_put,
+	.rm = _dhtable_mapped_rm,
+
+	.join = _dhtable_mapped_join,
+
+	.begin = _dhtable_mapped_begin,
+	.end = _dhtable_mapped_end,
+
+	.prev = _dhtable_mapped_prev,
+	.next = _dhtable_mapped_next,
+
+	.iget = _dhtable_mapped_iget,
+
+	.ihsh = _dhtable_mapped_ihsh,
+
+	.prefetch = _dhtable_mapped_prefetch,
+
+	.bytes = _dhtable_mapped_bytes
+};
+
+/* Bytes a bucket of n entries
+ * takes in an image.
+ */
+static inline size_t _dhtable_image_bucket_size(dhtable table, size_t n) {
+
+	size_t entries = n * (table->kv_data.key_size + table->kv_data.val_size);
+
+	return sizeof(uint64_t) * (1 + n) + ((entries + 7) & ~(size_t) 7);
+}
+
+/* Write to a file. Returns nonzero on error. */
+static inline int _dhtable_write(FILE *file, const void *data, size_t size) {
+
+	return size != 0 && fwrite(data, size, 1, file) != 1;
+}
+
+/* Write a table out as an image
+ * that dhtable_open_mmap can map.
+ * Returns nonzero on error, leaving
+ * no file behind.
+ */
+int dhtable_save(dhtable table, const char *path) {
+
+	/* Validate, finish any migration,
+	 * size the image, open a temporary
+	 * file beside path, write the header,
+	 * the offsets, then each bucket's
+	 * hashes and entries, sync, close,
+	 * rename over path, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(path != NULL, ICALLER, "Given NULL path.",
+		return 1;
+		);
+
+	int t = _dhtable_migrate(table, table->old_count);
+	DASSERT(t == 0, IBACKEND, "Failed to finish migration.",
+		return 1;
+		);
+
+	struct dhtable_backend *backend = table->backend;
+	dhtable_ctx *ctx = &table->kv_data;
+
+	size_t count = table->bucket_count;
+	size_t head = sizeof(struct _dhtable_image) + sizeof(uint64_t) * count;
+
+	struct _dhtable_image image = {
+		.magic = IMAGE_MAGIC,
+		.version = IMAGE_VERSION,
+		.hash64 = ctx->key_hsh64 != NULL,
+		.key_size = ctx->key_size,
+		.val_size = ctx->val_size,
+		.bucket_count = count,
+		.index = table->index,
+		.count = 0,
+		.size = head
+	};
+
+	size_t i;
 	for (i = 0; i < count; i++) {
 
-		void *sbucket = sbuckets[i];
+		void *bucket = table->buckets[i];
+		size_t n = bucket == NULL ? 0 : backend->size(ctx, bucket);
 
-		if (sbucket == NULL)
+		if (n != 0)
+			image.size += _dhtable_image_bucket_size(table, n);
+
+		image.count += n;
+	}
+
+	/* Tables mapped from path keep the old
+	 * image, as it is replaced, not truncated.
+	 */
+	size_t path_len = strlen(path);
+	char *temp = dalloc_alloc(ctx->alloc, path_len + sizeof(SAVE_SUFFIX));
+
+	DASSERT(temp != NULL, IALLOC, "Failed to allocate temporary path.",
+		return 1;
+		);
+
+	memcpy(temp, path, path_len);
+	memcpy(temp + path_len, SAVE_SUFFIX, sizeof(SAVE_SUFFIX));
+
+	int fd = mkstemp(temp);
+	DASSERT(fd >= 0, ICALLER, "Failed to create temporary file.",
+		dalloc_free(ctx->alloc, temp, path_len + sizeof(SAVE_SUFFIX));
+		return 1;
+		);
+
+	struct stat old;
+	mode_t mode = stat(path, &old) == 0 ? old.st_mode & 07777 : SAVE_MODE;
+
+	t = fchmod(fd, mode);
+	DASSERT(t == 0, ICALLER, "Failed to set the image mode.",
+		close(fd);
+		remove(temp);
+		dalloc_free(ctx->alloc, temp, path_len + sizeof(SAVE_SUFFIX));
+		return 1;
+		);
+
+	FILE *file = fdopen(fd, "wb");
+	DASSERT(file != NULL, ICALLER, "Failed to open file.",
+		close(fd);
+		remove(temp);
+		dalloc_free(ctx->alloc, temp, path_len + sizeof(SAVE_SUFFIX));
+		return 1;
+		);
+
+	t = _dhtable_write(file, &image, sizeof(image));
+
+	uint64_t offset = head;
+
+	for (i = 0; t == 0 && i < count; i++) {
+
+		void *bucket = table->buckets[i];
+		size_t n = bucket == NULL ? 0 : backend->size(ctx, bucket);
+
+		uint64_t at = n == 0 ? 0 : offset;
+
+		t = _dhtable_write(file, &at, sizeof(at));
+
+		if (n != 0)
+			offset += _dhtable_image_bucket_size(table, n);
+	}
+
+	size_t elem_size = ctx->key_size + ctx->val_size;
+	uint64_t pad = 0;
+
+	for (i = 0; t == 0 && i < count; i++) {
+
+		void *bucket = table->buckets[i];
+		uint64_t n = bucket == NULL ? 0 : backend->size(ctx, bucket);
+
+		if (n == 0)
 			continue;
 
-		void *dbucket = dbuckets[i];
+		t = _dhtable_write(file, &n, sizeof(n));
 
-		if (dbucket == NULL) {
-			dbucket = dst->backend->init(&dst->kv_data);
-			dbuckets[i] = dbucket;
+		void *it;
+		for (it = backend->begin(ctx, bucket); t == 0 && it != NULL;
+		     it = backend->next(ctx, bucket, it)) {
+
+			uint64_t hash = (backend->ihsh != NULL) ?
+				backend->ihsh(ctx, bucket, it) :
+				dhtable_ctx_hash(ctx, backend->iget(ctx, bucket, it));
+
+			t = _dhtable_write(file, &hash, sizeof(hash));
 		}
 
-		DASSERT(dbucket != NULL, IBACKEND, "Failed to create a bucket.",
-			return 1;
-			);
+		for (it = backend->begin(ctx, bucket); t == 0 && it != NULL;
+		     it = backend->next(ctx, bucket, it))
+			t = _dhtable_write(file, backend->iget(ctx, bucket, it),
+			                   elem_size);
+
+		if (t == 0)
+			t = _dhtable_write(file, &pad, (8 - n * elem_size % 8) % 8);
+	}
 
-		int t = dst->backend->join(&dst->kv_data, dbucket, sbucket);
+	if (t == 0 && (fflush(file) != 0 || fsync(fileno(file)) != 0))
+		t = 1;
 
-		DASSERT(t == 0, IBACKEND, "Failed to join two buckets.",
-			return 1;
+	if (fclose(file) != 0)
+		t = 1;
+
+	if (t == 0 && rename(temp, path) != 0)
+		t = 1;
+
+	DASSERT(t == 0, ICALLER, "Failed to write image.",
+		remove(temp);
+		dalloc_free(ctx->alloc, temp, path_len + sizeof(SAVE_SUFFIX));
+		return 1;
+		);
+
+	dalloc_free(ctx->alloc, temp, path_len + sizeof(SAVE_SUFFIX));
+
+	return 0;
+}
+
+/* Map an image read only,
+ * pointing buckets into it.
+ */
+static dhtable _dhtable_open_mmap(const char *path, size_t key_size,
+                                  size_t val_size, dhtable_key_cmp key_cmp,
+                                  dhtable_key_hsh key_hsh,
+                                  dhtable_key_hsh64 key_hsh64) {
+
+	/* Validate the path, map the file,
+	 * check the header against the
+	 * arguments, init a table on the
+	 * mapped backend, point each bucket
+	 * at its offset, return.
+	 */
+	DASSERT(path != NULL, ICALLER, "Given NULL path.",
+		return NULL;
+		);
+
+	int fd = open(path, O_RDONLY);
+	DASSERT(fd >= 0, ICALLER, "Failed to open file.",
+		return NULL;
+		);
+
+	struct stat st;
+	int t = fstat(fd, &st);
+
+	DASSERT(t == 0 && (size_t) st.st_size >= sizeof(struct _dhtable_image),
+		ICALLER, "Given truncated image.",
+		close(fd);
+		return NULL;
+		);
+
+	size_t size = st.st_size;
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+	close(fd);
+
+	DASSERT(map != MAP_FAILED, IALLOC, "Failed to map image.",
+		return NULL;
+		);
+
+	struct _dhtable_image *image = map;
+
+	DASSERT(image->magic == IMAGE_MAGIC && image->version == IMAGE_VERSION,
+		ICALLER, "Given image of another version.",
+		munmap(map, size);
+		return NULL;
+		);
+
+	DASSERT(image->key_size == key_size && image->val_size == val_size,
+		ICALLER, "Given image of other sizes.",
+		munmap(map, size);
+		return NULL;
+		);
+
+	DASSERT(image->size == size && image->bucket_count != 0 &&
+		image->bucket_count <= (size - sizeof(*image)) / sizeof(uint64_t) &&
+		image->index <= DHTABLE_FASTRANGE,
+		ICALLER, "Given corrupt image.",
+		munmap(map, size);
+		return NULL;
+		);
+
+	size_t count = image->bucket_count;
+
+	dhtable table = _dhtable_init(count, key_size, val_size, key_cmp,
+	                              key_hsh, key_hsh64, &_dhtable_mapped, NULL);
+	DASSERT(table != NULL, ICALLER, "Failed to init table.",
+		munmap(map, size);
+		return NULL;
+		);
+
+	DASSERT((table->kv_data.key_hsh64 != NULL) == (image->hash64 != 0),
+		ICALLER, "Given image of another hash width.",
+		dhtable_kill(table);
+		munmap(map, size);
+		return NULL;
+		);
+
+	uint64_t *offsets = (uint64_t*) (image + 1);
+	size_t head = sizeof(*image) + sizeof(uint64_t) * count;
+
+	size_t i;
+	for (i = 0; i < count; i++) {
+
+		uint64_t at = offsets[i];
+
+		if (at == 0)
+			continue;
+
+		DASSERT(at >= head && at % 8 == 0 &&
+			at <= size - sizeof(struct _dhtable_image_bucket),
+			ICALLER, "Given corrupt image.",
+			dhtable_kill(table);
+			munmap(map, size);
+			return NULL;
 			);
+
+		table->buckets[i] = (char*) map + at;
+		table->occupied[i / 64] |= (uint64_t) 1 << (i % 64);
 	}
 
-	return 0;
+	table->index = image->index;
+	table->count = image->count;
+
+	table->map = map;
+	table->map_size = size;
+
+	return table;
 }
 
-dhtable_it dhtable_begin(dhtable table);
-dhtable_it dhtable_end  (dhtable table);
+/* Map an image saved with
+ * an int hash functor.
+ */
+dhtable dhtable_open_mmap(const char *path, size_t key_size,
+                          size_t val_size, dhtable_key_cmp key_cmp,
+                          dhtable_key_hsh key_hsh) {
+
+	return _dhtable_open_mmap(path, key_size, val_size,
+	                          key_cmp, key_hsh, NULL);
+}
 
-dhtable_it dhtable_prev(dhtable table, dhtable_it it);
-dhtable_it dhtable_next(dhtable table, dhtable_it it);
+/* Map an image saved with
+ * a 64 bit hash functor.
+ */
+dhtable dhtable_open_mmap64(const char *path, size_t key_size,
+                            size_t val_size, dhtable_key_cmp key_cmp,
+                            dhtable_key_hsh64 key_hsh) {
 
-void      *dhtable_iget(dhtable table, dhtable_it it);
+	return _dhtable_open_mmap(path, key_size, val_size,
+	                          key_cmp, NULL, key_hsh);
+}
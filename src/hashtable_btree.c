@@ -0,0 +1,990 @@
+/** daelib/hashtable_btree.c: B-tree backend for hashtable.
+ */
+
+
+/* Each bucket is a B+ tree ordered by key_cmp,
+ * so key_cmp must order keys, as memcmp does,
+ * not just test them for equality. Entries live
+ * in the leaves, which are chained for iteration,
+ * and inner nodes hold separator keys. Lookups
+ * are O(log n) however long a bucket grows.
+ *
+ * Nodes are a power of two of cache lines, and
+ * aligned to their own size, so the leaf holding
+ * an entry is found by masking the entry's
+ * address. An iterator is a plain entry pointer.
+ *
+ * Removal frees leaves once they empty, without
+ * merging half full ones. The tree never grows
+ * taller on removal, so the worst case lookup
+ * stays bounded by the largest size it reached.
+ */
+
+
+/* Prototypes. */
+#include "hashtable_backend.h"
+
+/* Assertions. */
+#include "assert.h"
+
+/* dalloc_*(). */
+#include "alloc.h"
+
+/* memcpy(), memmove(), memset(). */
+#include <string.h>
+
+
+/* Backend functions. */
+void *dhtable_btree_init(dhtable_ctx *ctx);
+int   dhtable_btree_kill(dhtable_ctx *ctx, void *bucket);
+void *dhtable_btree_copy(dhtable_ctx *ctx, void *bucket);
+
+size_t dhtable_btree_size(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_btree_get(dhtable_ctx *ctx, void *bucket,
+                        uint64_t hash, void *key);
+int   dhtable_btree_put(dhtable_ctx *ctx, void *bucket,
+                        uint64_t hash, void *key, void *value);
+int   dhtable_btree_rm (dhtable_ctx *ctx, void *bucket,
+                        uint64_t hash, void *key);
+
+int dhtable_btree_join(dhtable_ctx *ctx, void *dst, void *src);
+
+void *dhtable_btree_begin(dhtable_ctx *ctx, void *bucket);
+void *dhtable_btree_end  (dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_btree_prev(dhtable_ctx *ctx, void *bucket, void *it);
+void *dhtable_btree_next(dhtable_ctx *ctx, void *bucket, void *it);
+
+void *dhtable_btree_iget(dhtable_ctx *ctx, void *bucket, void *it);
+
+void dhtable_btree_prefetch(dhtable_ctx *ctx, void *bucket, uint64_t hash);
+
+size_t dhtable_btree_bytes(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_btree_emplace(dhtable_ctx *ctx, void *bucket,
+                            uint64_t hash, void *key, int *inserted);
+
+
+/* Hashtable backend struct. */
+struct dhtable_backend dhtable_btree = {
+	.init = dhtable_btree_init,
+	.kill = dhtable_btree_kill,
+	.copy = dhtable_btree_copy,
+
+	.size = dhtable_btree_size,
+
+	.get = dhtable_btree_get,
+	.put = dhtable_btree_put,
+	.rm = dhtable_btree_rm,
+
+	.join = dhtable_btree_join,
+
+	.begin = dhtable_btree_begin,
+	.end = dhtable_btree_end,
+
+	.prev = dhtable_btree_prev,
+	.next = dhtable_btree_next,
+
+	.iget = dhtable_btree_iget,
+
+	.prefetch = dhtable_btree_prefetch,
+
+	.bytes = dhtable_btree_bytes,
+
+	.emplace = dhtable_btree_emplace
+};
+
+
+/* Default error behaviour. */
+#ifndef IHASHTABLE /* When fed bad data. */
+#define IHASHTABLE DLOG
+#endif /* IHASHTABLE */
+
+#ifndef IALLOC /* When malloc() fails. */
+#define IALLOC DLOG
+#endif /* IALLOC */
+
+
+/* Smallest node, in bytes. */
+#define MIN_NODE 256
+
+/* Fewest entries or keys a node holds. */
+#define MIN_FANOUT 4
+
+/* Deepest tree walked. Fanout is at
+ * least 2 after a split, so this is
+ * never reached.
+ */
+#define MAX_DEPTH 64
+
+
+/* A node. Leaves follow the header with
+ * entries, inner nodes with count + 1
+ * children, then count separator keys.
+ * Child i + 1 holds keys >= key i.
+ */
+struct _dhtable_btree_node {
+
+	unsigned count;
+	unsigned leaf;
+
+	/* Leaf chain. */
+	struct _dhtable_btree_node *prev;
+	struct _dhtable_btree_node *next;
+};
+
+/* Node data starts here. */
+#define HEADER ((sizeof(struct _dhtable_btree_node) + 15) & ~(size_t) 15)
+
+/* A bucket. */
+struct _dhtable_btree {
+
+	struct _dhtable_btree_node *root;
+	struct _dhtable_btree_node *first;
+	struct _dhtable_btree_node *last;
+
+	size_t count;
+
+	/* Node geometry. */
+	size_t node_size;
+	unsigned leaf_cap;
+	unsigned inner_cap;
+};
+
+/* A step of a walk from the root. */
+struct _dhtable_btree_step {
+
+	struct _dhtable_btree_node *node;
+	unsigned index;
+};
+
+
+/* Validate a context. */
+static int _dhtable_ctx_valid(dhtable_ctx *ctx) {
+
+	/* Validate painter,
+	 * all fields but val_size
+	 * (you can have empty
+	 * value), return.
+	 */
+	if (ctx == NULL)
+		return 0;
+	if (ctx->key_size == 0)
+		return 0;
+	if (ctx->key_cmp == NULL)
+		return 0;
+	if (ctx->key_hsh == NULL && ctx->key_hsh64 == NULL)
+		return 0;
+
+	return 1;
+}
+
+/* Node accessors. */
+static inline char *_dhtable_btree_entry(dhtable_ctx *ctx,
+                                         struct _dhtable_btree_node *node,
+                                         unsigned i) {
+
+	return (char*) node + HEADER + i * (ctx->key_size + ctx->val_size);
+}
+
+static inline struct _dhtable_btree_node **_dhtable_btree_children(
+	struct _dhtable_btree_node *node) {
+
+	return (struct _dhtable_btree_node**) ((char*) node + HEADER);
+}
+
+static inline char *_dhtable_btree_key(dhtable_ctx *ctx,
+                                       struct _dhtable_btree *tree,
+                                       struct _dhtable_btree_node *node,
+                                       unsigned i) {
+
+	return (char*) node + HEADER +
+	       sizeof(void*) * (tree->inner_cap + 1) + i * ctx->key_size;
+}
+
+/* Allocate a node, aligned to its size. */
+static struct _dhtable_btree_node *_dhtable_btree_node(
+	dhtable_ctx *ctx, struct _dhtable_btree *tree, unsigned leaf) {
+
+	struct _dhtable_btree_node *node = (struct _dhtable_btree_node*)
+		dalloc_aligned(ctx->alloc, tree->node_size, tree->node_size);
+
+	if (node == NULL)
+		return NULL;
+
+	node->count = 0;
+	node->leaf = leaf;
+	node->prev = NULL;
+	node->next = NULL;
+
+	return node;
+}
+
+/* Free a subtree. */
+static void _dhtable_btree_free(dhtable_ctx *ctx, struct _dhtable_btree *tree,
+                                struct _dhtable_btree_node *node) {
+
+	if (!node->leaf) {
+
+		struct _dhtable_btree_node **children =
+			_dhtable_btree_children(node);
+
+		unsigned i;
+		for (i = 0; i <= node->count; i++)
+			_dhtable_btree_free(ctx, tree, children[i]);
+	}
+
+	dalloc_free(ctx->alloc, node, tree->node_size);
+}
+
+/* Count the nodes under a node. */
+static size_t _dhtable_btree_nodes(struct _dhtable_btree_node *node) {
+
+	if (node == NULL)
+		return 0;
+
+	size_t n = 1;
+
+	if (!node->leaf) {
+
+		struct _dhtable_btree_node **children =
+			_dhtable_btree_children(node);
+
+		unsigned i;
+		for (i = 0; i <= node->count; i++)
+			n += _dhtable_btree_nodes(children[i]);
+	}
+
+	return n;
+}
+
+/* Find the first entry not below
+ * a key in a leaf. Sets *found if
+ * it is equal.
+ */
+static unsigned _dhtable_btree_lower(dhtable_ctx *ctx,
+                                     struct _dhtable_btree_node *leaf,
+                                     void *key, int *found) {
+
+	unsigned lo = 0, hi = leaf->count;
+
+	while (lo < hi) {
+
+		unsigned mid = (lo + hi) / 2;
+
+		int c = ctx->key_cmp(ctx->key_size,
+		                     _dhtable_btree_entry(ctx, leaf, mid), key);
+
+		if (c < 0) {
+			lo = mid + 1;
+
+		} else if (c > 0) {
+			hi = mid;
+
+		} else {
+			*found = 1;
+			return mid;
+		}
+	}
+
+	*found = 0;
+	return lo;
+}
+
+/* Find the child of an inner
+ * node that may hold a key.
+ */
+static unsigned _dhtable_btree_child(dhtable_ctx *ctx,
+                                     struct _dhtable_btree *tree,
+                                     struct _dhtable_btree_node *node,
+                                     void *key) {
+
+	unsigned lo = 0, hi = node->count;
+
+	while (lo < hi) {
+
+		unsigned mid = (lo + hi) / 2;
+
+		if (ctx->key_cmp(ctx->key_size,
+		                 _dhtable_btree_key(ctx, tree, node, mid), key) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* Walk from the root to the leaf
+ * that may hold a key, recording
+ * the path. Returns its depth.
+ */
+static unsigned _dhtable_btree_walk(dhtable_ctx *ctx,
+                                    struct _dhtable_btree *tree, void *key,
+                                    struct _dhtable_btree_step *path) {
+
+	struct _dhtable_btree_node *node = tree->root;
+
+	unsigned depth = 0;
+
+	while (!node->leaf && depth < MAX_DEPTH) {
+
+		unsigned i = _dhtable_btree_child(ctx, tree, node, key);
+
+		path[depth].node = node;
+		path[depth].index = i;
+		depth++;
+
+		node = _dhtable_btree_children(node)[i];
+	}
+
+	path[depth].node = node;
+
+	return depth;
+}
+
+/* Insert a separator and right child
+ * above a split, splitting upwards
+ * as needed.
+ */
+static int _dhtable_btree_lift(dhtable_ctx *ctx, struct _dhtable_btree *tree,
+                               struct _dhtable_btree_step *path,
+                               unsigned depth, char *sep,
+                               struct _dhtable_btree_node *right) {
+
+	/* If the split was at the root, grow a
+	 * new root. Else insert into the parent,
+	 * splitting it through a buffer if full,
+	 * and lift its median, return.
+	 */
+	size_t ksize = ctx->key_size;
+
+	char key[ksize];
+	memcpy(key, sep, ksize);
+
+	while (depth > 0) {
+
+		depth--;
+
+		struct _dhtable_btree_node *node = path[depth].node;
+		unsigned pos = path[depth].index;
+
+		struct _dhtable_btree_node **children = _dhtable_btree_children(node);
+		char *keys = _dhtable_btree_key(ctx, tree, node, 0);
+
+		if (node->count < tree->inner_cap) {
+
+			memmove(keys + (pos + 1) * ksize, keys + pos * ksize,
+			        (node->count - pos) * ksize);
+			memmove(children + pos + 2, children + pos + 1,
+			        (node->count - pos) * sizeof(void*));
+
+			memcpy(keys + pos * ksize, key, ksize);
+			children[pos + 1] = right;
+			node->count++;
+
+			return 0;
+		}
+
+		/* Merge into buffers one larger. */
+		unsigned total = node->count + 1;
+
+		char all_keys[total * ksize];
+		struct _dhtable_btree_node *all_children[total + 1];
+
+		memcpy(all_keys, keys, pos * ksize);
+		memcpy(all_keys + pos * ksize, key, ksize);
+		memcpy(all_keys + (pos + 1) * ksize, keys + pos * ksize,
+		       (node->count - pos) * ksize);
+
+		memcpy(all_children, children, (pos + 1) * sizeof(void*));
+		all_children[pos + 1] = right;
+		memcpy(all_children + pos + 2, children + pos + 1,
+		       (node->count - pos) * sizeof(void*));
+
+		struct _dhtable_btree_node *sibling = _dhtable_btree_node(ctx, tree, 0);
+
+		DASSERT(sibling != NULL, IALLOC, "Failed to allocate node.",
+			return 1;
+			);
+
+		/* Left keeps mid keys, the
+		 * median moves up.
+		 */
+		unsigned mid = total / 2;
+
+		memcpy(keys, all_keys, mid * ksize);
+		memcpy(children, all_children, (mid + 1) * sizeof(void*));
+		node->count = mid;
+
+		sibling->count = total - mid - 1;
+		memcpy(_dhtable_btree_key(ctx, tree, sibling, 0),
+		       all_keys + (mid + 1) * ksize, sibling->count * ksize);
+		memcpy(_dhtable_btree_children(sibling), all_children + mid + 1,
+		       (sibling->count + 1) * sizeof(void*));
+
+		memcpy(key, all_keys + mid * ksize, ksize);
+		right = sibling;
+	}
+
+	struct _dhtable_btree_node *root = _dhtable_btree_node(ctx, tree, 0);
+
+	DASSERT(root != NULL, IALLOC, "Failed to allocate node.",
+		return 1;
+		);
+
+	root->count = 1;
+	_dhtable_btree_children(root)[0] = tree->root;
+	_dhtable_btree_children(root)[1] = right;
+	memcpy(_dhtable_btree_key(ctx, tree, root, 0), key, ksize);
+
+	tree->root = root;
+
+	return 0;
+}
+
+/* Initialize a bucket. */
+void *dhtable_btree_init(dhtable_ctx *ctx) {
+
+	/* Validate ctx, size the nodes,
+	 * allocate the bucket and an
+	 * empty leaf root, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	struct _dhtable_btree *tree = (struct _dhtable_btree*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_btree));
+
+	DASSERT(tree != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	size_t entry = ctx->key_size + ctx->val_size;
+	size_t inner = ctx->key_size + sizeof(void*);
+
+	tree->node_size = MIN_NODE;
+
+	while (HEADER + MIN_FANOUT * entry > tree->node_size ||
+	       HEADER + sizeof(void*) + MIN_FANOUT * inner > tree->node_size)
+		tree->node_size *= 2;
+
+	tree->leaf_cap = (tree->node_size - HEADER) / entry;
+	tree->inner_cap = (tree->node_size - HEADER - sizeof(void*)) / inner;
+
+	tree->root = _dhtable_btree_node(ctx, tree, 1);
+
+	DASSERT(tree->root != NULL, IALLOC, "Failed to allocate node.",
+		dalloc_free(ctx->alloc, tree, sizeof(struct _dhtable_btree));
+		return NULL;
+		);
+
+	tree->first = tree->root;
+	tree->last = tree->root;
+	tree->count = 0;
+
+	return (void*) tree;
+}
+
+/* Free a bucket. */
+int dhtable_btree_kill(dhtable_ctx *ctx, void *bucket) {
+
+	/* Free every node,
+	 * free the bucket, return.
+	 */
+	struct _dhtable_btree *tree = (struct _dhtable_btree*) bucket;
+
+	_dhtable_btree_free(ctx, tree, tree->root);
+
+	dalloc_free(ctx->alloc, tree, sizeof(struct _dhtable_btree));
+
+	return 0;
+}
+
+/* Copy a subtree, chaining its
+ * leaves after *last in order.
+ */
+static struct _dhtable_btree_node *_dhtable_btree_clone(
+	dhtable_ctx *ctx, struct _dhtable_btree *tree,
+	struct _dhtable_btree_node *node, struct _dhtable_btree_node **last) {
+
+	/* Copy the node, then its
+	 * children left to right, or
+	 * if a leaf, chain it, return.
+	 */
+	struct _dhtable_btree_node *copy = _dhtable_btree_node(ctx, tree, node->leaf);
+
+	DASSERT(copy != NULL, IALLOC, "Failed to allocate node.",
+		return NULL;
+		);
+
+	memcpy(copy, node, tree->node_size);
+
+	if (node->leaf) {
+
+		copy->prev = *last;
+		copy->next = NULL;
+
+		if (*last != NULL)
+			(*last)->next = copy;
+
+		*last = copy;
+
+		return copy;
+	}
+
+	struct _dhtable_btree_node **children = _dhtable_btree_children(copy);
+
+	unsigned i;
+	for (i = 0; i <= copy->count; i++) {
+
+		struct _dhtable_btree_node *child =
+			_dhtable_btree_clone(ctx, tree, children[i], last);
+
+		if (child == NULL) {
+			copy->count = i == 0 ? 0 : i - 1;
+			if (i == 0)
+				copy->leaf = 1;
+			_dhtable_btree_free(ctx, tree, copy);
+			return NULL;
+		}
+
+		children[i] = child;
+	}
+
+	return copy;
+}
+
+/* Copy a bucket. */
+void *dhtable_btree_copy(dhtable_ctx *ctx, void *bucket) {
+
+	/* Allocate bucket, clone
+	 * the tree, find the first
+	 * leaf, return bucket.
+	 */
+	struct _dhtable_btree *tree = (struct _dhtable_btree*) bucket;
+
+	struct _dhtable_btree *new_tree = (struct _dhtable_btree*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_btree));
+
+	DASSERT(new_tree != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	memcpy(new_tree, tree, sizeof(struct _dhtable_btree));
+
+	struct _dhtable_btree_node *last = NULL;
+
+	new_tree->root = _dhtable_btree_clone(ctx, new_tree, tree->root, &last);
+
+	DASSERT(new_tree->root != NULL, IALLOC, "Failed to copy tree.",
+		dalloc_free(ctx->alloc, new_tree, sizeof(struct _dhtable_btree));
+		return NULL;
+		);
+
+	new_tree->last = last;
+	new_tree->first = last;
+
+	while (new_tree->first->prev != NULL)
+		new_tree->first = new_tree->first->prev;
+
+	return (void*) new_tree;
+}
+
+/* Get the number of elements. */
+size_t dhtable_btree_size(dhtable_ctx *ctx, void *bucket) {
+
+	return ((struct _dhtable_btree*) bucket)->count;
+}
+
+/* Get a value. */
+void *dhtable_btree_get(dhtable_ctx *ctx, void *bucket,
+                        uint64_t hash, void *key) {
+
+	/* Validate ctx, descend to the
+	 * leaf, search it, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	struct _dhtable_btree *tree = (struct _dhtable_btree*) bucket;
+	struct _dhtable_btree_node *node = tree->root;
+
+	while (!node->leaf)
+		node = _dhtable_btree_children(node)
+			[_dhtable_btree_child(ctx, tree, node, key)];
+
+	int found;
+	unsigned i = _dhtable_btree_lower(ctx, node, key, &found);
+
+	if (!found)
+		return NULL;
+
+	return _dhtable_btree_entry(ctx, node, i) + ctx->key_size;
+}
+
+/* Find a key, or insert it with a
+ * value, zeroed if NULL. Sets *inserted
+ * and returns the entry, NULL on error.
+ */
+static char *_dhtable_btree_upsert(dhtable_ctx *ctx,
+                                   struct _dhtable_btree *tree,
+                                   void *key, void *value, int *inserted) {
+
+	/* Walk to the leaf, return if
+	 * found, else insert, splitting the
+	 * leaf and lifting the separator
+	 * if full, return.
+	 */
+	struct _dhtable_btree_step path[MAX_DEPTH + 1];
+
+	unsigned depth = _dhtable_btree_walk(ctx, tree, key, path);
+
+	DASSERT(depth < MAX_DEPTH, IHASHTABLE, "Tree too deep.",
+		return NULL;
+		);
+
+	struct _dhtable_btree_node *leaf = path[depth].node;
+
+	size_t entry = ctx->key_size + ctx->val_size;
+
+	int found;
+	unsigned pos = _dhtable_btree_lower(ctx, leaf, key, &found);
+
+	*inserted = !found;
+
+	if (found)
+		return _dhtable_btree_entry(ctx, leaf, pos);
+
+	if (leaf->count == tree->leaf_cap) {
+
+		/* Move the upper half to a new
+		 * right leaf, chain it, pick
+		 * the half to insert into.
+		 */
+		struct _dhtable_btree_node *right = _dhtable_btree_node(ctx, tree, 1);
+
+		DASSERT(right != NULL, IALLOC, "Failed to allocate node.",
+			return NULL;
+			);
+
+		unsigned mid = leaf->count / 2;
+
+		right->count = leaf->count - mid;
+		memcpy(_dhtable_btree_entry(ctx, right, 0),
+		       _dhtable_btree_entry(ctx, leaf, mid), right->count * entry);
+		leaf->count = mid;
+
+		right->prev = leaf;
+		right->next = leaf->next;
+
+		if (leaf->next != NULL)
+			leaf->next->prev = right;
+		else
+			tree->last = right;
+
+		leaf->next = right;
+
+		if (_dhtable_btree_lift(ctx, tree, path, depth,
+		                        _dhtable_btree_entry(ctx, right, 0),
+		                        right) != 0)
+			return NULL;
+
+		if (pos > mid) {
+			pos -= mid;
+			leaf = right;
+		}
+	}
+
+	char *at = _dhtable_btree_entry(ctx, leaf, pos);
+
+	memmove(at + entry, at, (leaf->count - pos) * entry);
+
+	memcpy(at, key, ctx->key_size);
+
+	if (value != NULL)
+		memcpy(at + ctx->key_size, value, ctx->val_size);
+	else
+		memset(at + ctx->key_size, 0, ctx->val_size);
+
+	leaf->count++;
+	tree->count++;
+
+	return at;
+}
+
+/* Put a key, value pair. */
+int dhtable_btree_put(dhtable_ctx *ctx, void *bucket,
+                      uint64_t hash, void *key, void *value) {
+
+	/* Validate ctx, find or insert,
+	 * replace the value if found,
+	 * return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	int inserted;
+	char *at = _dhtable_btree_upsert(ctx, (struct _dhtable_btree*) bucket,
+	                                 key, value, &inserted);
+
+	if (at == NULL)
+		return 1;
+
+	if (!inserted && ctx->val_size != 0)
+		memcpy(at + ctx->key_size, value, ctx->val_size);
+
+	return 0;
+}
+
+/* Remove a key, value pair. */
+int dhtable_btree_rm(dhtable_ctx *ctx, void *bucket,
+                     uint64_t hash, void *key) {
+
+	/* Validate ctx, walk to the leaf,
+	 * remove the entry. If the leaf
+	 * empties, unchain it and remove it
+	 * from its parents, then shorten
+	 * the root while it has one child,
+	 * return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	struct _dhtable_btree *tree = (struct _dhtable_btree*) bucket;
+	struct _dhtable_btree_step path[MAX_DEPTH + 1];
+
+	unsigned depth = _dhtable_btree_walk(ctx, tree, key, path);
+
+	DASSERT(depth < MAX_DEPTH, IHASHTABLE, "Tree too deep.",
+		return 1;
+		);
+
+	struct _dhtable_btree_node *leaf = path[depth].node;
+
+	size_t entry = ctx->key_size + ctx->val_size;
+
+	int found;
+	unsigned pos = _dhtable_btree_lower(ctx, leaf, key, &found);
+
+	if (!found)
+		return 0;
+
+	char *at = _dhtable_btree_entry(ctx, leaf, pos);
+
+	memmove(at, at + entry, (leaf->count - pos - 1) * entry);
+
+	leaf->count--;
+	tree->count--;
+
+	if (leaf->count != 0 || depth == 0)
+		return 0;
+
+	if (leaf->prev != NULL)
+		leaf->prev->next = leaf->next;
+	else
+		tree->first = leaf->next;
+
+	if (leaf->next != NULL)
+		leaf->next->prev = leaf->prev;
+	else
+		tree->last = leaf->prev;
+
+	dalloc_free(ctx->alloc, leaf, tree->node_size);
+
+	/* Drop the child from each parent,
+	 * stopping at one that keeps a child.
+	 */
+	while (depth > 0) {
+
+		depth--;
+
+		struct _dhtable_btree_node *node = path[depth].node;
+		unsigned child = path[depth].index;
+
+		struct _dhtable_btree_node **children = _dhtable_btree_children(node);
+		char *keys = _dhtable_btree_key(ctx, tree, node, 0);
+
+		if (node->count == 0) {
+
+			if (depth == 0) {
+				/* Cannot happen, the
+				 * root would hold the
+				 * removed entry's leaf.
+				 */
+				break;
+			}
+
+			dalloc_free(ctx->alloc, node, tree->node_size);
+			continue;
+		}
+
+		unsigned kpos = child == 0 ? 0 : child - 1;
+
+		memmove(keys + kpos * ctx->key_size, keys + (kpos + 1) * ctx->key_size,
+		        (node->count - kpos - 1) * ctx->key_size);
+		memmove(children + child, children + child + 1,
+		        (node->count - child) * sizeof(void*));
+
+		node->count--;
+
+		break;
+	}
+
+	while (!tree->root->leaf && tree->root->count == 0) {
+
+		struct _dhtable_btree_node *old = tree->root;
+
+		tree->root = _dhtable_btree_children(old)[0];
+
+		dalloc_free(ctx->alloc, old, tree->node_size);
+	}
+
+	return 0;
+}
+
+/* Join two buckets.
+ * Source values replace
+ * destination values.
+ */
+int dhtable_btree_join(dhtable_ctx *ctx, void *dst, void *src) {
+
+	/* Validate ctx, walk the source
+	 * leaves in order, put each
+	 * entry, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	struct _dhtable_btree *srctree = (struct _dhtable_btree*) src;
+
+	struct _dhtable_btree_node *leaf;
+	for (leaf = srctree->first; leaf != NULL; leaf = leaf->next) {
+
+		unsigned i;
+		for (i = 0; i < leaf->count; i++) {
+
+			char *at = _dhtable_btree_entry(ctx, leaf, i);
+
+			if (dhtable_btree_put(ctx, dst, 0, at, at + ctx->key_size) != 0)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+/* Find the leaf of an entry. */
+static inline struct _dhtable_btree_node *_dhtable_btree_leaf(
+	struct _dhtable_btree *tree, void *it) {
+
+	return (struct _dhtable_btree_node*)
+		((uintptr_t) it & ~(uintptr_t) (tree->node_size - 1));
+}
+
+/* Get the first entry. */
+void *dhtable_btree_begin(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_btree *tree = (struct _dhtable_btree*) bucket;
+
+	if (tree->count == 0)
+		return NULL;
+
+	return _dhtable_btree_entry(ctx, tree->first, 0);
+}
+
+/* Get the last entry. */
+void *dhtable_btree_end(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_btree *tree = (struct _dhtable_btree*) bucket;
+
+	if (tree->count == 0)
+		return NULL;
+
+	return _dhtable_btree_entry(ctx, tree->last, tree->last->count - 1);
+}
+
+/* Step back an entry, crossing
+ * to the previous leaf if needed.
+ */
+void *dhtable_btree_prev(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	struct _dhtable_btree *tree = (struct _dhtable_btree*) bucket;
+	struct _dhtable_btree_node *leaf = _dhtable_btree_leaf(tree, it);
+
+	if ((char*) it != _dhtable_btree_entry(ctx, leaf, 0))
+		return (char*) it - (ctx->key_size + ctx->val_size);
+
+	if (leaf->prev == NULL)
+		return NULL;
+
+	return _dhtable_btree_entry(ctx, leaf->prev, leaf->prev->count - 1);
+}
+
+/* Step on an entry, crossing
+ * to the next leaf if needed.
+ */
+void *dhtable_btree_next(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	struct _dhtable_btree *tree = (struct _dhtable_btree*) bucket;
+	struct _dhtable_btree_node *leaf = _dhtable_btree_leaf(tree, it);
+
+	char *next = (char*) it + (ctx->key_size + ctx->val_size);
+
+	if (next != _dhtable_btree_entry(ctx, leaf, leaf->count))
+		return next;
+
+	if (leaf->next == NULL)
+		return NULL;
+
+	return _dhtable_btree_entry(ctx, leaf->next, 0);
+}
+
+/* Get an iterator's entry. */
+void *dhtable_btree_iget(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	return it;
+}
+
+/* Prefetch the root. */
+void dhtable_btree_prefetch(dhtable_ctx *ctx, void *bucket, uint64_t hash) {
+
+	struct _dhtable_btree *tree = (struct _dhtable_btree*) bucket;
+
+	DHTABLE_PREFETCH(tree->root);
+}
+
+/* Get the bytes a bucket holds. */
+size_t dhtable_btree_bytes(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_btree *tree = (struct _dhtable_btree*) bucket;
+
+	return sizeof(struct _dhtable_btree) +
+		_dhtable_btree_nodes(tree->root) * tree->node_size;
+}
+
+/* Find a key, or insert it with
+ * a zeroed value. Returns the value,
+ * NULL on error.
+ */
+void *dhtable_btree_emplace(dhtable_ctx *ctx, void *bucket,
+                            uint64_t hash, void *key, int *inserted) {
+
+	/* Validate ctx, find or
+	 * insert, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	char *at = _dhtable_btree_upsert(ctx, (struct _dhtable_btree*) bucket,
+	                                 key, NULL, inserted);
+
+	return (at == NULL) ? NULL : at + ctx->key_size;
+}
@@ -0,0 +1,564 @@
+/** daelib/hashtable_btree_vector.c: Sorted vector backend for hashtable.
+ */
+
+
+/* Each bucket is one vector of key|value
+ * entries, kept sorted by key_cmp, so key_cmp
+ * must order keys, as memcmp does. Lookups
+ * binary search, in a branchless form whose
+ * loop runs a fixed log2(n) steps, so long
+ * buckets cost no mispredicts. Joins merge
+ * the two sorted runs in one linear pass.
+ * Inserting shifts the tail, so this suits
+ * read-mostly tables with longer buckets.
+ */
+
+
+/* Prototypes. */
+#include "hashtable_backend.h"
+
+/* Vectors, unchecked accessors. */
+#include "vector_inline.h"
+
+/* Assertions. */
+#include "assert.h"
+
+/* dalloc_*(). */
+#include "alloc.h"
+
+/* memcpy(), memset(). */
+#include <string.h>
+
+
+/* Backend functions. */
+void *dhtable_btree_vector_init(dhtable_ctx *ctx);
+int   dhtable_btree_vector_kill(dhtable_ctx *ctx, void *bucket);
+void *dhtable_btree_vector_copy(dhtable_ctx *ctx, void *bucket);
+
+size_t dhtable_btree_vector_size(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_btree_vector_get(dhtable_ctx *ctx, void *bucket,
+                               uint64_t hash, void *key);
+int   dhtable_btree_vector_put(dhtable_ctx *ctx, void *bucket,
+                               uint64_t hash, void *key, void *value);
+int   dhtable_btree_vector_rm (dhtable_ctx *ctx, void *bucket,
+                               uint64_t hash, void *key);
+
+int dhtable_btree_vector_join(dhtable_ctx *ctx, void *dst, void *src);
+
+void *dhtable_btree_vector_begin(dhtable_ctx *ctx, void *bucket);
+void *dhtable_btree_vector_end  (dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_btree_vector_prev(dhtable_ctx *ctx, void *bucket, void *it);
+void *dhtable_btree_vector_next(dhtable_ctx *ctx, void *bucket, void *it);
+
+void *dhtable_btree_vector_iget(dhtable_ctx *ctx, void *bucket, void *it);
+
+void dhtable_btree_vector_prefetch(dhtable_ctx *ctx, void *bucket,
+                                   uint64_t hash);
+
+size_t dhtable_btree_vector_bytes(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_btree_vector_emplace(dhtable_ctx *ctx, void *bucket,
+                                   uint64_t hash, void *key, int *inserted);
+
+
+/* Hashtable backend struct. */
+struct dhtable_backend dhtable_btree_vector = {
+	.init = dhtable_btree_vector_init,
+	.kill = dhtable_btree_vector_kill,
+	.copy = dhtable_btree_vector_copy,
+
+	.size = dhtable_btree_vector_size,
+
+	.get = dhtable_btree_vector_get,
+	.put = dhtable_btree_vector_put,
+	.rm = dhtable_btree_vector_rm,
+
+	.join = dhtable_btree_vector_join,
+
+	.begin = dhtable_btree_vector_begin,
+	.end = dhtable_btree_vector_end,
+
+	.prev = dhtable_btree_vector_prev,
+	.next = dhtable_btree_vector_next,
+
+	.iget = dhtable_btree_vector_iget,
+
+	.prefetch = dhtable_btree_vector_prefetch,
+
+	.bytes = dhtable_btree_vector_bytes,
+
+	.emplace = dhtable_btree_vector_emplace
+};
+
+
+/* Default error behaviour. */
+#ifndef IHASHTABLE /* When fed bad data. */
+#define IHASHTABLE DLOG
+#endif /* IHASHTABLE */
+
+#ifndef IVECTOR /* When the vector fails. */
+#define IVECTOR DLOG
+#endif /* IVECTOR */
+
+#ifndef IALLOC /* When malloc() fails. */
+#define IALLOC DLOG
+#endif /* IALLOC */
+
+
+/* A bucket. Wrapped, so a join
+ * can swap in the merged vector.
+ */
+struct _dhtable_sorted {
+
+	dvec entries;
+};
+
+
+/* Validate a context. */
+static int _dhtable_ctx_valid(dhtable_ctx *ctx) {
+
+	/* Validate painter,
+	 * all fields but val_size
+	 * (you can have empty
+	 * value), return.
+	 */
+	if (ctx == NULL)
+		return 0;
+	if (ctx->key_size == 0)
+		return 0;
+	if (ctx->key_cmp == NULL)
+		return 0;
+	if (ctx->key_hsh == NULL && ctx->key_hsh64 == NULL)
+		return 0;
+
+	return 1;
+}
+
+/* Find the first entry not below a key.
+ * Sets *found if it is equal.
+ */
+static size_t _dhtable_sorted_lower(dhtable_ctx *ctx,
+                                    struct _dhtable_sorted *sorted,
+                                    void *key, int *found) {
+
+	/* Halve the range without branching
+	 * on the comparison, landing on the
+	 * last entry not above the key, test
+	 * it for equality, step past it
+	 * if it is below, return.
+	 */
+	*found = 0;
+
+	size_t count = dvec_size_fast(sorted->entries);
+
+	if (count == 0)
+		return 0;
+
+	char *first = (char*) dvec_data(sorted->entries);
+
+	size_t elem_size = ctx->key_size + ctx->val_size;
+
+	char *base = first;
+
+	while (count > 1) {
+
+		size_t half = count / 2;
+
+		int below = ctx->key_cmp(ctx->key_size, base + half * elem_size,
+		                         key) <= 0;
+
+		base += below * half * elem_size;
+		count -= half;
+	}
+
+	int c = ctx->key_cmp(ctx->key_size, base, key);
+
+	size_t index = (size_t) (base - first) / elem_size + (c < 0);
+
+	*found = c == 0;
+
+	return index;
+}
+
+/* Insert a pair at an index. A NULL
+ * value is zeroed. Returns the entry,
+ * NULL on error.
+ */
+static char *_dhtable_sorted_insert(dhtable_ctx *ctx,
+                                    struct _dhtable_sorted *sorted,
+                                    void *key, void *value, size_t index) {
+
+	/* Build the entry, insert
+	 * it, get it back, return.
+	 */
+	char buff[ctx->key_size + ctx->val_size];
+
+	memcpy(buff, key, ctx->key_size);
+
+	if (value != NULL)
+		memcpy(buff + ctx->key_size, value, ctx->val_size);
+	else
+		memset(buff + ctx->key_size, 0, ctx->val_size);
+
+	if (dvec_insert(sorted->entries, 1, (void*) buff, index) != 0)
+		return NULL;
+
+	return (char*) dvec_get(sorted->entries, index);
+}
+
+/* Initialize a bucket. */
+void *dhtable_btree_vector_init(dhtable_ctx *ctx) {
+
+	/* Validate ctx, allocate
+	 * bucket, init vector,
+	 * return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	struct _dhtable_sorted *sorted = (struct _dhtable_sorted*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_sorted));
+
+	DASSERT(sorted != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	sorted->entries = dvec_init_ex(ctx->key_size + ctx->val_size, 0,
+	                               ctx->alloc);
+
+	DASSERT(sorted->entries != NULL, IVECTOR, "Failed to init vector.",
+		dalloc_free(ctx->alloc, sorted, sizeof(struct _dhtable_sorted));
+		return NULL;
+		);
+
+	return (void*) sorted;
+}
+
+/* Free a bucket. */
+int dhtable_btree_vector_kill(dhtable_ctx *ctx, void *bucket) {
+
+	/* Call dvec_kill,
+	 * free bucket, return error.
+	 */
+	struct _dhtable_sorted *sorted = (struct _dhtable_sorted*) bucket;
+
+	int t = dvec_kill(sorted->entries);
+
+	dalloc_free(ctx->alloc, sorted, sizeof(struct _dhtable_sorted));
+
+	return t;
+}
+
+/* Copy a bucket. */
+void *dhtable_btree_vector_copy(dhtable_ctx *ctx, void *bucket) {
+
+	/* Allocate bucket,
+	 * call dvec_copy,
+	 * return bucket.
+	 */
+	struct _dhtable_sorted *sorted = (struct _dhtable_sorted*) bucket;
+
+	struct _dhtable_sorted *new_sorted = (struct _dhtable_sorted*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_sorted));
+
+	DASSERT(new_sorted != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	new_sorted->entries = dvec_copy(sorted->entries);
+
+	DASSERT(new_sorted->entries != NULL, IVECTOR, "Failed to copy vector.",
+		dalloc_free(ctx->alloc, new_sorted, sizeof(struct _dhtable_sorted));
+		return NULL;
+		);
+
+	return (void*) new_sorted;
+}
+
+/* Get the element count of a bucket. */
+size_t dhtable_btree_vector_size(dhtable_ctx *ctx, void *bucket) {
+
+	/* Call dvec_size_fast,
+	 * return.
+	 */
+	return dvec_size_fast(((struct _dhtable_sorted*) bucket)->entries);
+}
+
+/* Get an element in a bucket. */
+void *dhtable_btree_vector_get(dhtable_ctx *ctx, void *bucket,
+                               uint64_t hash, void *key) {
+
+	/* Verify the context, verify the key,
+	 * search, get element, return val.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_sorted *sorted = (struct _dhtable_sorted*) bucket;
+
+	int found;
+	size_t index = _dhtable_sorted_lower(ctx, sorted, key, &found);
+
+	if (!found)
+		return NULL;
+
+	char *r = (char*) dvec_get_fast(sorted->entries, index);
+
+	return r + ctx->key_size;
+}
+
+/* Put an element in order. */
+int dhtable_btree_vector_put(dhtable_ctx *ctx, void *bucket,
+                             uint64_t hash, void *key, void *value) {
+
+	/* Verify context, key, value,
+	 * search, if exists, overwrite
+	 * value, else insert in place,
+	 * return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return 1;
+		);
+
+	DASSERT((ctx->val_size == 0) || value != NULL, IHASHTABLE,
+		"Given invalid value.",
+		return 1;
+		);
+
+	struct _dhtable_sorted *sorted = (struct _dhtable_sorted*) bucket;
+
+	int found;
+	size_t index = _dhtable_sorted_lower(ctx, sorted, key, &found);
+
+	if (found) {
+
+		char *elem = (char*) dvec_get(sorted->entries, index);
+
+		DASSERT(elem != NULL, IVECTOR, "Failed to get element.",
+			return 1;
+			);
+
+		if (ctx->val_size != 0)
+			memcpy(elem + ctx->key_size, value, ctx->val_size);
+
+		return 0;
+	}
+
+	return _dhtable_sorted_insert(ctx, sorted, key, value, index) == NULL;
+}
+
+/* Remove an element. */
+int dhtable_btree_vector_rm(dhtable_ctx *ctx, void *bucket,
+                            uint64_t hash, void *key) {
+
+	/* Verify ctx, key, search,
+	 * call dvec_rm, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return 1;
+		);
+
+	struct _dhtable_sorted *sorted = (struct _dhtable_sorted*) bucket;
+
+	int found;
+	size_t index = _dhtable_sorted_lower(ctx, sorted, key, &found);
+
+	if (!found)
+		return 0;
+
+	return dvec_rm(sorted->entries, index);
+}
+
+/* Join two buckets by merging
+ * their sorted runs. Source values
+ * replace destination values.
+ */
+int dhtable_btree_vector_join(dhtable_ctx *ctx, void *dst, void *src) {
+
+	/* Validate ctx, walk both runs,
+	 * pushing the lower entry, or the
+	 * source on a tie, push what
+	 * remains, swap in the result,
+	 * return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	struct _dhtable_sorted *dstsorted = (struct _dhtable_sorted*) dst;
+	struct _dhtable_sorted *srcsorted = (struct _dhtable_sorted*) src;
+
+	size_t dcount = dvec_size(dstsorted->entries);
+	size_t scount = dvec_size(srcsorted->entries);
+
+	if (scount == 0)
+		return 0;
+
+	size_t elem_size = ctx->key_size + ctx->val_size;
+
+	dvec merged = dvec_init_ex(elem_size, 0, ctx->alloc);
+
+	DASSERT(merged != NULL, IVECTOR, "Failed to init vector.",
+		return 1;
+		);
+
+	char *d = dcount == 0 ? NULL : (char*) dvec_get(dstsorted->entries, 0);
+	char *s = (char*) dvec_get(srcsorted->entries, 0);
+
+	size_t i = 0, j = 0;
+	int t = 0;
+
+	while (t == 0 && i < dcount && j < scount) {
+
+		char *dl = d + i * elem_size;
+		char *sl = s + j * elem_size;
+
+		int c = ctx->key_cmp(ctx->key_size, dl, sl);
+
+		if (c < 0) {
+			t = dvec_push(merged, dl);
+			i++;
+
+		} else {
+			t = dvec_push(merged, sl);
+			j++;
+			i += c == 0;
+		}
+	}
+
+	if (t == 0 && i < dcount)
+		t = dvec_insert(merged, dcount - i, d + i * elem_size,
+		                dvec_size(merged));
+
+	if (t == 0 && j < scount)
+		t = dvec_insert(merged, scount - j, s + j * elem_size,
+		                dvec_size(merged));
+
+	DASSERT(t == 0, IVECTOR, "Failed to merge buckets.",
+		dvec_kill(merged);
+		return 1;
+		);
+
+	dvec_kill(dstsorted->entries);
+	dstsorted->entries = merged;
+
+	return 0;
+}
+
+/* Get the first element of a bucket. */
+void *dhtable_btree_vector_begin(dhtable_ctx *ctx, void *bucket) {
+
+	/* Call dvec_begin,
+	 * return.
+	 */
+	return (void*) dvec_begin(((struct _dhtable_sorted*) bucket)->entries);
+}
+
+/* Get the last element of a bucket. */
+void *dhtable_btree_vector_end(dhtable_ctx *ctx, void *bucket) {
+
+	/* Call dvec_end,
+	 * return.
+	 */
+	return (void*) dvec_end(((struct _dhtable_sorted*) bucket)->entries);
+}
+
+/* Get the previous element of a bucket. */
+void *dhtable_btree_vector_prev(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Call dvec_prev,
+	 * return.
+	 */
+	return (void*) dvec_prev(((struct _dhtable_sorted*) bucket)->entries,
+	                         (dvec_it) it);
+}
+
+/* Get the next element of a bucket. */
+void *dhtable_btree_vector_next(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Call dvec_next,
+	 * return.
+	 */
+	return (void*) dvec_next(((struct _dhtable_sorted*) bucket)->entries,
+	                         (dvec_it) it);
+}
+
+/* Get the entry at an iterator. */
+void *dhtable_btree_vector_iget(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Call dvec_iget, the element
+	 * is already key then value,
+	 * return.
+	 */
+	return dvec_iget(((struct _dhtable_sorted*) bucket)->entries,
+	                 (dvec_it) it);
+}
+
+/* Prefetch a bucket's vector. */
+void dhtable_btree_vector_prefetch(dhtable_ctx *ctx, void *bucket,
+                                   uint64_t hash) {
+
+	/* The vector is opaque, so
+	 * fetch its header.
+	 */
+	DHTABLE_PREFETCH(((struct _dhtable_sorted*) bucket)->entries);
+}
+
+/* Get the bytes a bucket holds.
+ * The vector counts its allocated
+ * capacity, spare room included.
+ */
+size_t dhtable_btree_vector_bytes(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_sorted *sorted = (struct _dhtable_sorted*) bucket;
+
+	return sizeof(struct _dhtable_sorted) +
+		dvec_capacity(sorted->entries) * dvec_elem_size(sorted->entries);
+}
+
+/* Find a key, or insert it in order
+ * with a zeroed value. Returns the
+ * value, NULL on error.
+ */
+void *dhtable_btree_vector_emplace(dhtable_ctx *ctx, void *bucket,
+                                   uint64_t hash, void *key, int *inserted) {
+
+	/* Verify context, key, search,
+	 * if missing, insert, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_sorted *sorted = (struct _dhtable_sorted*) bucket;
+
+	int found;
+	size_t index = _dhtable_sorted_lower(ctx, sorted, key, &found);
+
+	*inserted = !found;
+
+	char *entry = found ? (char*) dvec_get(sorted->entries, index) :
+		_dhtable_sorted_insert(ctx, sorted, key, NULL, index);
+
+	return (entry == NULL) ? NULL : entry + ctx->key_size;
+}
@@ -0,0 +1,775 @@
+/** daelib/hashtable_flat.c: Open addressing backend for hashtable.
+ */
+
+
+/* Each bucket is a flat, Robin Hood hashed,
+ * open addressing table. Keys and values are
+ * stored inline in one contiguous slot array,
+ * next to their hash and probe distance, so a
+ * lookup touches the slot array and nothing else.
+ * Deletion uses backward shifting, so there
+ * are no tombstones.
+ *
+ * Buckets grow on their own, so a table using
+ * this backend wants very few buckets. Creating
+ * it with a single bucket gives a plain flat
+ * hashtable.
+ */
+
+
+/* Prototypes. */
+#include "hashtable_backend.h"
+
+/* Assertions. */
+#include "assert.h"
+
+/* dalloc_*(). */
+#include "alloc.h"
+
+/* memcpy(), memset(). */
+#include <string.h>
+
+
+/* Backend functions. */
+void *dhtable_flat_init(dhtable_ctx *ctx);
+int   dhtable_flat_kill(dhtable_ctx *ctx, void *bucket);
+void *dhtable_flat_copy(dhtable_ctx *ctx, void *bucket);
+
+size_t dhtable_flat_size(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_flat_get(dhtable_ctx *ctx, void *bucket,
+                       uint64_t hash, void *key);
+int   dhtable_flat_put(dhtable_ctx *ctx, void *bucket,
+                       uint64_t hash, void *key, void *value);
+int   dhtable_flat_rm (dhtable_ctx *ctx, void *bucket,
+                       uint64_t hash, void *key);
+
+int dhtable_flat_join(dhtable_ctx *ctx, void *dst, void *src);
+
+void *dhtable_flat_begin(dhtable_ctx *ctx, void *bucket);
+void *dhtable_flat_end  (dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_flat_prev(dhtable_ctx *ctx, void *bucket, void *it);
+void *dhtable_flat_next(dhtable_ctx *ctx, void *bucket, void *it);
+
+void *dhtable_flat_iget(dhtable_ctx *ctx, void *bucket, void *it);
+
+void dhtable_flat_prefetch(dhtable_ctx *ctx, void *bucket, uint64_t hash);
+
+size_t dhtable_flat_bytes(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_flat_emplace(dhtable_ctx *ctx, void *bucket,
+                           uint64_t hash, void *key, int *inserted);
+
+
+/* Hashtable backend struct. */
+struct dhtable_backend dhtable_flat = {
+	.init = dhtable_flat_init,
+	.kill = dhtable_flat_kill,
+	.copy = dhtable_flat_copy,
+
+	.size = dhtable_flat_size,
+
+	.get = dhtable_flat_get,
+	.put = dhtable_flat_put,
+	.rm = dhtable_flat_rm,
+
+	.join = dhtable_flat_join,
+
+	.begin = dhtable_flat_begin,
+	.end = dhtable_flat_end,
+
+	.prev = dhtable_flat_prev,
+	.next = dhtable_flat_next,
+
+	.iget = dhtable_flat_iget,
+
+	.prefetch = dhtable_flat_prefetch,
+
+	.bytes = dhtable_flat_bytes,
+
+	.emplace = dhtable_flat_emplace
+};
+
+
+/* Default error behaviour. */
+#ifndef IHASHTABLE /* When fed bad data. */
+#define IHASHTABLE DLOG
+#endif /* IHASHTABLE */
+
+#ifndef IALLOC /* When malloc() fails. */
+#define IALLOC DLOG
+#endif /* IALLOC */
+
+
+/* Slot count of a fresh bucket. */
+#define FLAT_MIN_SLOTS 8
+
+/* Maximum load, as count / slots, in eighths. */
+#define FLAT_MAX_LOAD 7
+
+
+/* Slot header. The key follows
+ * directly, then the value.
+ */
+struct _dhtable_flat_slot {
+
+	unsigned hash;
+	unsigned dist; /* 0 when empty, else probe length + 1. */
+};
+
+/* A bucket. */
+struct _dhtable_flat {
+
+	size_t count;
+	size_t mask;
+	unsigned shift;
+
+	size_t slot_size;
+	char *slots;
+};
+
+
+/* Validate a context. */
+static int _dhtable_ctx_valid(dhtable_ctx *ctx) {
+
+	/* Validate pointer,
+	 * all fields but val_size
+	 * (you can have empty
+	 * value), return.
+	 */
+	if (ctx == NULL)
+		return 0;
+	if (ctx->key_size == 0)
+		return 0;
+	if (ctx->key_cmp == NULL)
+		return 0;
+	if (ctx->key_hsh == NULL && ctx->key_hsh64 == NULL)
+		return 0;
+
+	return 1;
+}
+
+/* Get a slot by index. */
+static inline struct _dhtable_flat_slot *_dhtable_flat_at(
+	struct _dhtable_flat *flat, size_t index) {
+
+	return (struct _dhtable_flat_slot*)
+		(flat->slots + index * flat->slot_size);
+}
+
+/* Get the key of a slot. */
+static inline char *_dhtable_flat_key(struct _dhtable_flat_slot *slot) {
+
+	return (char*) slot + sizeof(struct _dhtable_flat_slot);
+}
+
+/* Fold a hash to 32 bits. */
+static inline unsigned _dhtable_flat_fold(uint64_t hash) {
+
+	return (unsigned) (hash ^ (hash >> 32));
+}
+
+/* Find the home slot of a hash.
+ * Fibonacci hashing takes the high
+ * bits, so buckets, which are picked
+ * with the low bits, still spread
+ * over every slot.
+ */
+static inline size_t _dhtable_flat_home(struct _dhtable_flat *flat,
+                                        unsigned hash) {
+
+	return (size_t) ((hash * 2654435769u) >> flat->shift);
+}
+
+/* Find the slot holding a key.
+ * Returns NULL if not found.
+ */
+static struct _dhtable_flat_slot *_dhtable_flat_search(
+	dhtable_ctx *ctx, struct _dhtable_flat *flat,
+	unsigned hash, void *key) {
+
+	/* Walk from the home slot
+	 * until the key is found, or
+	 * until a slot is closer to
+	 * its own home than the key
+	 * would be.
+	 */
+	if (flat->slots == NULL)
+		return NULL;
+
+	size_t i = _dhtable_flat_home(flat, hash);
+
+	unsigned dist;
+	for (dist = 1;; dist++) {
+
+		struct _dhtable_flat_slot *slot = _dhtable_flat_at(flat, i);
+
+		if (slot->dist < dist)
+			return NULL;
+
+		if (slot->hash == hash &&
+		    ctx->key_cmp(ctx->key_size, key,
+		                 _dhtable_flat_key(slot)) == 0)
+			return slot;
+
+		i = (i + 1) & flat->mask;
+	}
+}
+
+/* Place a prepared slot, returning
+ * where it landed. The carry buffer
+ * is clobbered.
+ * ASSUMES THERE IS A FREE SLOT.
+ */
+static struct _dhtable_flat_slot *_dhtable_flat_place(
+	struct _dhtable_flat *flat, struct _dhtable_flat_slot *carry) {
+
+	/* Walk from the home slot, when a slot is
+	 * closer to home than the carried one,
+	 * swap them, stop at an empty slot. The
+	 * first slot written holds the original.
+	 */
+	size_t words = flat->slot_size / sizeof(size_t);
+	size_t swap[words];
+
+	struct _dhtable_flat_slot *placed = NULL;
+
+	size_t i = _dhtable_flat_home(flat, carry->hash);
+
+	carry->dist = 1;
+
+	for (;; i = (i + 1) & flat->mask, carry->dist++) {
+
+		struct _dhtable_flat_slot *slot = _dhtable_flat_at(flat, i);
+
+		if (slot->dist == 0) {
+			memcpy(slot, carry, flat->slot_size);
+			break;
+		}
+
+		if (slot->dist < carry->dist) {
+			memcpy(swap, slot, flat->slot_size);
+			memcpy(slot, carry, flat->slot_size);
+			memcpy(carry, swap, flat->slot_size);
+
+			if (placed == NULL)
+				placed = slot;
+		}
+	}
+
+	flat->count++;
+
+	return placed != NULL ? placed :
+		_dhtable_flat_at(flat, i);
+}
+
+/* Reallocate the slots.
+ * Returns nonzero on error.
+ */
+static int _dhtable_flat_rehash(dhtable_ctx *ctx, struct _dhtable_flat *flat,
+                                size_t slots) {
+
+	/* Allocate new zeroed slots,
+	 * swap them in, place each
+	 * old slot with its stored
+	 * hash, free the old slots.
+	 */
+	char *new_slots = (char*) dalloc_alloc(ctx->alloc,
+	                                       slots * flat->slot_size);
+	DASSERT(new_slots != NULL, IALLOC, "Failed to allocate slots.",
+		return 1;
+		);
+
+	memset(new_slots, 0, slots * flat->slot_size);
+
+	char *old_slots = flat->slots;
+	size_t old_count = (old_slots == NULL) ? 0 : flat->mask + 1;
+
+	unsigned shift = 32;
+	size_t n;
+	for (n = slots; n > 1; n >>= 1)
+		shift--;
+
+	flat->slots = new_slots;
+	flat->mask = slots - 1;
+	flat->shift = shift;
+	flat->count = 0;
+
+	size_t words = flat->slot_size / sizeof(size_t);
+	size_t carry[words];
+
+	size_t i;
+	for (i = 0; i < old_count; i++) {
+
+		char *slot = old_slots + i * flat->slot_size;
+
+		if (((struct _dhtable_flat_slot*) slot)->dist == 0)
+			continue;
+
+		memcpy(carry, slot, flat->slot_size);
+		_dhtable_flat_place(flat, (struct _dhtable_flat_slot*) carry);
+	}
+
+	dalloc_free(ctx->alloc, old_slots, old_count * flat->slot_size);
+
+	return 0;
+}
+
+/* Insert a new key, value pair
+ * with a known hash. A NULL value
+ * is zeroed. Returns the placed
+ * entry, NULL on error.
+ */
+static char *_dhtable_flat_insert(dhtable_ctx *ctx, struct _dhtable_flat *flat,
+                                  unsigned hash, void *key, void *value) {
+
+	/* Grow if needed, build
+	 * the slot, place it.
+	 */
+	size_t slots = (flat->slots == NULL) ? 0 : flat->mask + 1;
+
+	if ((flat->count + 1) * 8 > slots * FLAT_MAX_LOAD) {
+
+		size_t new_slots = (slots == 0) ? FLAT_MIN_SLOTS : slots * 2;
+
+		if (_dhtable_flat_rehash(ctx, flat, new_slots) != 0)
+			return NULL;
+	}
+
+	size_t words = flat->slot_size / sizeof(size_t);
+	size_t carry[words];
+
+	struct _dhtable_flat_slot *slot = (struct _dhtable_flat_slot*) carry;
+	slot->hash = hash;
+
+	memcpy(_dhtable_flat_key(slot), key, ctx->key_size);
+
+	if (value != NULL)
+		memcpy(_dhtable_flat_key(slot) + ctx->key_size,
+		       value, ctx->val_size);
+	else
+		memset(_dhtable_flat_key(slot) + ctx->key_size, 0, ctx->val_size);
+
+	return _dhtable_flat_key(_dhtable_flat_place(flat, slot));
+}
+
+/* Initialize a bucket. */
+void *dhtable_flat_init(dhtable_ctx *ctx) {
+
+	/* Validate ctx, allocate
+	 * the bucket, find the slot
+	 * size, leave the slots
+	 * for the first put.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	struct _dhtable_flat *flat = (struct _dhtable_flat*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_flat));
+
+	DASSERT(flat != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	size_t slot_size = sizeof(struct _dhtable_flat_slot) +
+		ctx->key_size + ctx->val_size;
+
+	slot_size = (slot_size + sizeof(size_t) - 1) & ~(sizeof(size_t) - 1);
+
+	flat->count = 0;
+	flat->mask = 0;
+	flat->shift = 32;
+	flat->slot_size = slot_size;
+	flat->slots = NULL;
+
+	return (void*) flat;
+}
+
+/* Free a bucket. */
+int dhtable_flat_kill(dhtable_ctx *ctx, void *bucket) {
+
+	/* Free the slots,
+	 * free the bucket.
+	 */
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	DASSERT(flat != NULL, IHASHTABLE, "Given NULL bucket.",
+		return 1;
+		);
+
+	if (flat->slots != NULL)
+		dalloc_free(ctx->alloc, flat->slots,
+		            (flat->mask + 1) * flat->slot_size);
+
+	flat->slots = NULL;
+
+	dalloc_free(ctx->alloc, flat, sizeof(struct _dhtable_flat));
+
+	return 0;
+}
+
+/* Copy a bucket. */
+void *dhtable_flat_copy(dhtable_ctx *ctx, void *bucket) {
+
+	/* Allocate the bucket,
+	 * copy the metadata, copy
+	 * the slots, return.
+	 */
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	DASSERT(flat != NULL, IHASHTABLE, "Given NULL bucket.",
+		return NULL;
+		);
+
+	struct _dhtable_flat *new_flat = (struct _dhtable_flat*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_flat));
+
+	DASSERT(new_flat != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	memcpy(new_flat, flat, sizeof(struct _dhtable_flat));
+
+	if (flat->slots == NULL)
+		return (void*) new_flat;
+
+	size_t bytes = (flat->mask + 1) * flat->slot_size;
+
+	new_flat->slots = (char*) dalloc_alloc(ctx->alloc, bytes);
+
+	DASSERT(new_flat->slots != NULL, IALLOC, "Failed to allocate slots.",
+		dalloc_free(ctx->alloc, new_flat, sizeof(struct _dhtable_flat));
+		return NULL;
+		);
+
+	memcpy(new_flat->slots, flat->slots, bytes);
+
+	return (void*) new_flat;
+}
+
+/* Get the element count of a bucket. */
+size_t dhtable_flat_size(dhtable_ctx *ctx, void *bucket) {
+
+	/* Return the count of
+	 * full slots.
+	 */
+	return ((struct _dhtable_flat*) bucket)->count;
+}
+
+/* Get an element in a bucket. */
+void *dhtable_flat_get(dhtable_ctx *ctx, void *bucket,
+                       uint64_t hash, void *key) {
+
+	/* Verify the context, verify the key,
+	 * search, return the value.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	unsigned fold = _dhtable_flat_fold(hash);
+
+	struct _dhtable_flat_slot *slot =
+		_dhtable_flat_search(ctx, flat, fold, key);
+
+	if (slot == NULL)
+		return NULL;
+
+	return (void*) (_dhtable_flat_key(slot) + ctx->key_size);
+}
+
+/* Put an element into a bucket. */
+int dhtable_flat_put(dhtable_ctx *ctx, void *bucket,
+                     uint64_t hash, void *key, void *value) {
+
+	/* Verify context, key,
+	 * if exists, overwrite
+	 * value or insert new key, value.
+	 * return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return 1;
+		);
+
+	DASSERT((ctx->val_size == 0) || value != NULL, IHASHTABLE,
+		"Given invalid value.",
+		return 1;
+		);
+
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	unsigned fold = _dhtable_flat_fold(hash);
+
+	struct _dhtable_flat_slot *slot =
+		_dhtable_flat_search(ctx, flat, fold, key);
+
+	if (slot == NULL)
+		return _dhtable_flat_insert(ctx, flat, fold, key, value) == NULL;
+
+	if (ctx->val_size != 0)
+		memcpy(_dhtable_flat_key(slot) + ctx->key_size,
+		       value, ctx->val_size);
+
+	return 0;
+}
+
+/* Remove an element from
+ * a bucket.
+ */
+int dhtable_flat_rm(dhtable_ctx *ctx, void *bucket,
+                    uint64_t hash, void *key) {
+
+	/* Verify ctx, key, search,
+	 * shift each following displaced
+	 * slot back by one, clear the
+	 * last one, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return 1;
+		);
+
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	unsigned fold = _dhtable_flat_fold(hash);
+
+	struct _dhtable_flat_slot *slot =
+		_dhtable_flat_search(ctx, flat, fold, key);
+
+	if (slot == NULL)
+		return 0;
+
+	size_t i = ((char*) slot - flat->slots) / flat->slot_size;
+
+	for (;;) {
+
+		size_t j = (i + 1) & flat->mask;
+
+		struct _dhtable_flat_slot *next = _dhtable_flat_at(flat, j);
+
+		if (next->dist <= 1)
+			break;
+
+		memcpy(slot, next, flat->slot_size);
+		slot->dist--;
+
+		slot = next;
+		i = j;
+	}
+
+	slot->dist = 0;
+	flat->count--;
+
+	return 0;
+}
+
+/* Join two buckets. */
+int dhtable_flat_join(dhtable_ctx *ctx, void *dst, void *src) {
+
+	/* Validate ctx, for each
+	 * full slot in src, search dst
+	 * with the stored hash, if there,
+	 * replace, else, insert.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	struct _dhtable_flat *dstflat = (struct _dhtable_flat*) dst;
+	struct _dhtable_flat *srcflat = (struct _dhtable_flat*) src;
+
+	if (srcflat->slots == NULL)
+		return 0;
+
+	size_t count = srcflat->mask + 1;
+
+	size_t i;
+	for (i = 0; i < count; i++) {
+
+		struct _dhtable_flat_slot *slot = _dhtable_flat_at(srcflat, i);
+
+		if (slot->dist == 0)
+			continue;
+
+		void *key = (void*) _dhtable_flat_key(slot);
+		void *value = (void*) (_dhtable_flat_key(slot) + ctx->key_size);
+
+		struct _dhtable_flat_slot *found =
+			_dhtable_flat_search(ctx, dstflat, slot->hash, key);
+
+		if (found == NULL) {
+			if (_dhtable_flat_insert(ctx, dstflat, slot->hash,
+			                         key, value) == NULL)
+				return 1;
+			continue;
+		}
+
+		if (ctx->val_size != 0)
+			memcpy(_dhtable_flat_key(found) + ctx->key_size,
+			       value, ctx->val_size);
+	}
+
+	return 0;
+}
+
+/* Iterators are a slot index plus one,
+ * so that NULL is past either end.
+ */
+
+/* Get the first element of a bucket. */
+void *dhtable_flat_begin(dhtable_ctx *ctx, void *bucket) {
+
+	/* Step forward from
+	 * before the first slot.
+	 */
+	return dhtable_flat_next(ctx, bucket, NULL);
+}
+
+/* Get the last element of a bucket. */
+void *dhtable_flat_end(dhtable_ctx *ctx, void *bucket) {
+
+	/* Step back from
+	 * after the last slot.
+	 */
+	return dhtable_flat_prev(ctx, bucket, NULL);
+}
+
+/* Get the previous element of a bucket.
+ * If at NULL, return the last element.
+ */
+void *dhtable_flat_prev(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Find the slot before it, walk
+	 * back to a full slot, or
+	 * return NULL at the start.
+	 */
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	if (flat->slots == NULL)
+		return NULL;
+
+	size_t i = (it == NULL) ? flat->mask + 1 : (size_t) it - 1;
+
+	while (i-- > 0)
+		if (_dhtable_flat_at(flat, i)->dist != 0)
+			return (void*) (i + 1);
+
+	return NULL;
+}
+
+/* Get the next element of a bucket.
+ * If at NULL, return the first element.
+ */
+void *dhtable_flat_next(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Find the slot after it, walk
+	 * forward to a full slot, or
+	 * return NULL at the end.
+	 */
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	if (flat->slots == NULL)
+		return NULL;
+
+	size_t i = (size_t) it;
+
+	for (; i <= flat->mask; i++)
+		if (_dhtable_flat_at(flat, i)->dist != 0)
+			return (void*) (i + 1);
+
+	return NULL;
+}
+
+/* Get the entry at an iterator. */
+void *dhtable_flat_iget(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Validate the iterator,
+	 * return the key, the
+	 * value follows it.
+	 */
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	size_t i = (size_t) it - 1;
+
+	DASSERT(flat->slots != NULL && i <= flat->mask, IHASHTABLE,
+		"Given invalid iterator.",
+		return NULL;
+		);
+
+	return (void*) _dhtable_flat_key(_dhtable_flat_at(flat, i));
+}
+
+/* Prefetch the home slot of a hash. */
+void dhtable_flat_prefetch(dhtable_ctx *ctx, void *bucket, uint64_t hash) {
+
+	/* Find the home slot,
+	 * fetch it.
+	 */
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	if (flat->slots == NULL)
+		return;
+
+	size_t i = _dhtable_flat_home(flat, _dhtable_flat_fold(hash));
+
+	DHTABLE_PREFETCH(_dhtable_flat_at(flat, i));
+}
+
+/* Get the bytes a bucket holds. */
+size_t dhtable_flat_bytes(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	if (flat->slots == NULL)
+		return sizeof(struct _dhtable_flat);
+
+	return sizeof(struct _dhtable_flat) + (flat->mask + 1) * flat->slot_size;
+}
+
+/* Find a key, or insert it with
+ * a zeroed value. Returns the value,
+ * NULL on error.
+ */
+void *dhtable_flat_emplace(dhtable_ctx *ctx, void *bucket,
+                           uint64_t hash, void *key, int *inserted) {
+
+	/* Verify context, key, search,
+	 * if missing, insert, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_flat *flat = (struct _dhtable_flat*) bucket;
+
+	unsigned fold = _dhtable_flat_fold(hash);
+
+	struct _dhtable_flat_slot *slot =
+		_dhtable_flat_search(ctx, flat, fold, key);
+
+	*inserted = slot == NULL;
+
+	char *entry = (slot != NULL) ? _dhtable_flat_key(slot) :
+		_dhtable_flat_insert(ctx, flat, fold, key, NULL);
+
+	return (entry == NULL) ? NULL : entry + ctx->key_size;
+}
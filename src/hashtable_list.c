@@ -0,0 +1,745 @@
+/** daelib/hashtable_list.c: Linked list backend for hashtable.
+ */
+
+
+/* Each bucket is a doubly linked list of
+ * nodes, each holding its hash, key and value.
+ * Nodes come from a pool shared by the whole
+ * table, carved out of slabs, so a put is
+ * rarely an allocation. A node never moves, not
+ * even when the table resizes, so a pointer
+ * from get stays valid until its key is
+ * removed. Removal unlinks the node in O(1).
+ *
+ * Freed nodes go back to the pool, not to
+ * the system. Slabs are only released when
+ * the table is killed.
+ */
+
+
+/* Prototypes. */
+#include "hashtable_backend.h"
+
+/* Assertions. */
+#include "assert.h"
+
+/* dalloc_*(). */
+#include "alloc.h"
+
+/* memcpy(), memset(). */
+#include <string.h>
+
+
+/* Backend functions. */
+void *dhtable_list_init(dhtable_ctx *ctx);
+int   dhtable_list_kill(dhtable_ctx *ctx, void *bucket);
+void *dhtable_list_copy(dhtable_ctx *ctx, void *bucket);
+
+size_t dhtable_list_size(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_list_get(dhtable_ctx *ctx, void *bucket,
+                       uint64_t hash, void *key);
+int   dhtable_list_put(dhtable_ctx *ctx, void *bucket,
+                       uint64_t hash, void *key, void *value);
+int   dhtable_list_rm (dhtable_ctx *ctx, void *bucket,
+                       uint64_t hash, void *key);
+
+int dhtable_list_join(dhtable_ctx *ctx, void *dst, void *src);
+
+void *dhtable_list_begin(dhtable_ctx *ctx, void *bucket);
+void *dhtable_list_end  (dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_list_prev(dhtable_ctx *ctx, void *bucket, void *it);
+void *dhtable_list_next(dhtable_ctx *ctx, void *bucket, void *it);
+
+void *dhtable_list_iget(dhtable_ctx *ctx, void *bucket, void *it);
+
+uint64_t dhtable_list_ihsh(dhtable_ctx *ctx, void *bucket, void *it);
+
+void dhtable_list_prefetch(dhtable_ctx *ctx, void *bucket, uint64_t hash);
+
+size_t dhtable_list_bytes(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_list_emplace(dhtable_ctx *ctx, void *bucket,
+                           uint64_t hash, void *key, int *inserted);
+
+int  dhtable_list_setup   (dhtable_ctx *ctx);
+void dhtable_list_teardown(dhtable_ctx *ctx);
+
+int dhtable_list_move(dhtable_ctx *ctx, void *dst, void *src,
+                      void *it, uint64_t hash);
+
+
+/* Hashtable backend struct. */
+struct dhtable_backend dhtable_list = {
+	.init = dhtable_list_init,
+	.kill = dhtable_list_kill,
+	.copy = dhtable_list_copy,
+
+	.size = dhtable_list_size,
+
+	.get = dhtable_list_get,
+	.put = dhtable_list_put,
+	.rm = dhtable_list_rm,
+
+	.join = dhtable_list_join,
+
+	.begin = dhtable_list_begin,
+	.end = dhtable_list_end,
+
+	.prev = dhtable_list_prev,
+	.next = dhtable_list_next,
+
+	.iget = dhtable_list_iget,
+
+	.ihsh = dhtable_list_ihsh,
+
+	.prefetch = dhtable_list_prefetch,
+
+	.bytes = dhtable_list_bytes,
+
+	.emplace = dhtable_list_emplace,
+
+	.setup = dhtable_list_setup,
+	.teardown = dhtable_list_teardown,
+
+	.move = dhtable_list_move
+};
+
+
+/* Default error behaviour. */
+#ifndef IHASHTABLE /* When fed bad data. */
+#define IHASHTABLE DLOG
+#endif /* IHASHTABLE */
+
+#ifndef IALLOC /* When malloc() fails. */
+#define IALLOC DLOG
+#endif /* IALLOC */
+
+
+/* Node counts of the first and
+ * largest slabs. Each slab doubles
+ * the last, up to the largest.
+ */
+#define LIST_MIN_SLAB 32
+#define LIST_MAX_SLAB 4096
+
+
+/* Node header. The key follows
+ * directly, then the value.
+ */
+struct _dhtable_list_node {
+
+	struct _dhtable_list_node *next;
+	struct _dhtable_list_node *prev;
+
+	uint64_t hash;
+};
+
+/* A bucket. */
+struct _dhtable_list {
+
+	struct _dhtable_list_node *head;
+	struct _dhtable_list_node *tail;
+
+	size_t count;
+};
+
+/* Slab header. Nodes follow. */
+struct _dhtable_list_slab {
+
+	struct _dhtable_list_slab *next;
+	size_t nodes;
+};
+
+/* The pool, in ctx->state. */
+struct _dhtable_list_pool {
+
+	size_t node_size;
+	size_t slab_nodes;
+
+	struct _dhtable_list_slab *slabs;
+	struct _dhtable_list_node *free;
+};
+
+
+/* Validate a context. */
+static int _dhtable_ctx_valid(dhtable_ctx *ctx) {
+
+	/* Validate painter,
+	 * all fields but val_size
+	 * (you can have empty
+	 * value), and the pool,
+	 * return.
+	 */
+	if (ctx == NULL)
+		return 0;
+	if (ctx->key_size == 0)
+		return 0;
+	if (ctx->key_cmp == NULL)
+		return 0;
+	if (ctx->key_hsh == NULL && ctx->key_hsh64 == NULL)
+		return 0;
+	if (ctx->state == NULL)
+		return 0;
+
+	return 1;
+}
+
+/* Get the key of a node. */
+static inline char *_dhtable_list_key(struct _dhtable_list_node *node) {
+
+	return (char*) node + sizeof(struct _dhtable_list_node);
+}
+
+/* Take a node from the pool,
+ * adding a slab if it is empty.
+ */
+static struct _dhtable_list_node *_dhtable_list_alloc(dhtable_ctx *ctx) {
+
+	/* If the free list is empty,
+	 * allocate a slab, thread its
+	 * nodes onto the free list,
+	 * grow the next slab, pop
+	 * a node, return.
+	 */
+	struct _dhtable_list_pool *pool = (struct _dhtable_list_pool*)
+		ctx->state;
+
+	if (pool->free == NULL) {
+
+		size_t nodes = pool->slab_nodes;
+
+		struct _dhtable_list_slab *slab = (struct _dhtable_list_slab*)
+			dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_list_slab) +
+			             nodes * pool->node_size);
+
+		DASSERT(slab != NULL, IALLOC, "Failed to allocate slab.",
+			return NULL;
+			);
+
+		slab->nodes = nodes;
+		slab->next = pool->slabs;
+		pool->slabs = slab;
+
+		char *first = (char*) slab + sizeof(struct _dhtable_list_slab);
+
+		size_t i;
+		for (i = nodes; i-- > 0;) {
+
+			struct _dhtable_list_node *node = (struct _dhtable_list_node*)
+				(first + i * pool->node_size);
+
+			node->next = pool->free;
+			pool->free = node;
+		}
+
+		if (pool->slab_nodes < LIST_MAX_SLAB)
+			pool->slab_nodes *= 2;
+	}
+
+	struct _dhtable_list_node *node = pool->free;
+	pool->free = node->next;
+
+	return node;
+}
+
+/* Give a node back to the pool. */
+static inline void _dhtable_list_free(dhtable_ctx *ctx,
+                                      struct _dhtable_list_node *node) {
+
+	struct _dhtable_list_pool *pool = (struct _dhtable_list_pool*)
+		ctx->state;
+
+	node->next = pool->free;
+	pool->free = node;
+}
+
+/* Link a node at the tail. */
+static inline void _dhtable_list_link(struct _dhtable_list *list,
+                                      struct _dhtable_list_node *node) {
+
+	node->next = NULL;
+	node->prev = list->tail;
+
+	if (list->tail != NULL)
+		list->tail->next = node;
+	else
+		list->head = node;
+
+	list->tail = node;
+	list->count++;
+}
+
+/* Unlink a node. */
+static inline void _dhtable_list_unlink(struct _dhtable_list *list,
+                                        struct _dhtable_list_node *node) {
+
+	if (node->prev != NULL)
+		node->prev->next = node->next;
+	else
+		list->head = node->next;
+
+	if (node->next != NULL)
+		node->next->prev = node->prev;
+	else
+		list->tail = node->prev;
+
+	list->count--;
+}
+
+/* Find the node holding a key.
+ * Returns NULL if not found.
+ */
+static struct _dhtable_list_node *_dhtable_list_search(
+	dhtable_ctx *ctx, struct _dhtable_list *list,
+	uint64_t hash, void *key) {
+
+	/* Walk the list, comparing
+	 * hashes before keys, return.
+	 */
+	struct _dhtable_list_node *node;
+
+	for (node = list->head; node != NULL; node = node->next) {
+
+		if (node->hash != hash)
+			continue;
+
+		if (ctx->key_cmp(ctx->key_size, _dhtable_list_key(node), key) == 0)
+			return node;
+	}
+
+	return NULL;
+}
+
+/* Add a filled node to a list. */
+static int _dhtable_list_add(dhtable_ctx *ctx, struct _dhtable_list *list,
+                             uint64_t hash, void *entry) {
+
+	/* Take a node, fill it,
+	 * link it, return.
+	 */
+	struct _dhtable_list_node *node = _dhtable_list_alloc(ctx);
+
+	DASSERT(node != NULL, IALLOC, "Failed to allocate node.",
+		return 1;
+		);
+
+	node->hash = hash;
+	memcpy(_dhtable_list_key(node), entry, ctx->key_size + ctx->val_size);
+
+	_dhtable_list_link(list, node);
+
+	return 0;
+}
+
+/* Set up the node pool. */
+int dhtable_list_setup(dhtable_ctx *ctx) {
+
+	/* Allocate the pool, size
+	 * nodes to keep each header
+	 * aligned, return.
+	 */
+	struct _dhtable_list_pool *pool = (struct _dhtable_list_pool*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_list_pool));
+
+	DASSERT(pool != NULL, IALLOC, "Failed to allocate pool.",
+		return 1;
+		);
+
+	size_t align = sizeof(struct _dhtable_list_node *);
+	size_t size = sizeof(struct _dhtable_list_node) +
+		ctx->key_size + ctx->val_size;
+
+	pool->node_size = (size + align - 1) / align * align;
+	pool->slab_nodes = LIST_MIN_SLAB;
+	pool->slabs = NULL;
+	pool->free = NULL;
+
+	ctx->state = (void*) pool;
+
+	return 0;
+}
+
+/* Free every slab and the pool. */
+void dhtable_list_teardown(dhtable_ctx *ctx) {
+
+	/* Free each slab,
+	 * free the pool.
+	 */
+	struct _dhtable_list_pool *pool = (struct _dhtable_list_pool*)
+		ctx->state;
+
+	if (pool == NULL)
+		return;
+
+	while (pool->slabs != NULL) {
+
+		struct _dhtable_list_slab *next = pool->slabs->next;
+
+		dalloc_free(ctx->alloc, pool->slabs,
+		            sizeof(struct _dhtable_list_slab) +
+		            pool->slabs->nodes * pool->node_size);
+		pool->slabs = next;
+	}
+
+	dalloc_free(ctx->alloc, pool, sizeof(struct _dhtable_list_pool));
+	ctx->state = NULL;
+}
+
+/* Initialize a bucket. */
+void *dhtable_list_init(dhtable_ctx *ctx) {
+
+	/* Validate ctx, allocate
+	 * bucket, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	struct _dhtable_list *list = (struct _dhtable_list*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_list));
+
+	DASSERT(list != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	list->head = NULL;
+	list->tail = NULL;
+	list->count = 0;
+
+	return (void*) list;
+}
+
+/* Free a bucket. */
+int dhtable_list_kill(dhtable_ctx *ctx, void *bucket) {
+
+	/* Give each node back to
+	 * the pool, free bucket,
+	 * return.
+	 */
+	struct _dhtable_list *list = (struct _dhtable_list*) bucket;
+
+	struct _dhtable_list_node *node = list->head;
+
+	while (node != NULL) {
+
+		struct _dhtable_list_node *next = node->next;
+
+		_dhtable_list_free(ctx, node);
+		node = next;
+	}
+
+	dalloc_free(ctx->alloc, list, sizeof(struct _dhtable_list));
+
+	return 0;
+}
+
+/* Copy a bucket into the
+ * pool of the given context.
+ */
+void *dhtable_list_copy(dhtable_ctx *ctx, void *bucket) {
+
+	/* Init a bucket, add each
+	 * node in order, return.
+	 */
+	struct _dhtable_list *list = (struct _dhtable_list*) bucket;
+
+	struct _dhtable_list *new_list = (struct _dhtable_list*)
+		dhtable_list_init(ctx);
+
+	DASSERT(new_list != NULL, IHASHTABLE, "Failed to init bucket.",
+		return NULL;
+		);
+
+	struct _dhtable_list_node *node;
+
+	for (node = list->head; node != NULL; node = node->next) {
+
+		int t = _dhtable_list_add(ctx, new_list, node->hash,
+		                          _dhtable_list_key(node));
+
+		DASSERT(t == 0, IHASHTABLE, "Failed to copy a node.",
+			dhtable_list_kill(ctx, new_list);
+			return NULL;
+			);
+	}
+
+	return (void*) new_list;
+}
+
+/* Get the element count of a bucket. */
+size_t dhtable_list_size(dhtable_ctx *ctx, void *bucket) {
+
+	return ((struct _dhtable_list*) bucket)->count;
+}
+
+/* Get an element in a bucket. */
+void *dhtable_list_get(dhtable_ctx *ctx, void *bucket,
+                       uint64_t hash, void *key) {
+
+	/* Verify the context, verify the key,
+	 * search, return val.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_list_node *node = _dhtable_list_search(
+		ctx, (struct _dhtable_list*) bucket, hash, key);
+
+	if (node == NULL)
+		return NULL;
+
+	return _dhtable_list_key(node) + ctx->key_size;
+}
+
+/* Put an element at the tail. */
+int dhtable_list_put(dhtable_ctx *ctx, void *bucket,
+                     uint64_t hash, void *key, void *value) {
+
+	/* Verify context, key, value,
+	 * search, if exists, overwrite
+	 * value in place, else take a
+	 * node and link it, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return 1;
+		);
+
+	DASSERT((ctx->val_size == 0) || value != NULL, IHASHTABLE,
+		"Given invalid value.",
+		return 1;
+		);
+
+	struct _dhtable_list *list = (struct _dhtable_list*) bucket;
+
+	struct _dhtable_list_node *node = _dhtable_list_search(ctx, list,
+	                                                       hash, key);
+
+	if (node == NULL) {
+
+		node = _dhtable_list_alloc(ctx);
+
+		DASSERT(node != NULL, IALLOC, "Failed to allocate node.",
+			return 1;
+			);
+
+		node->hash = hash;
+		memcpy(_dhtable_list_key(node), key, ctx->key_size);
+
+		_dhtable_list_link(list, node);
+	}
+
+	if (ctx->val_size != 0)
+		memcpy(_dhtable_list_key(node) + ctx->key_size, value,
+		       ctx->val_size);
+
+	return 0;
+}
+
+/* Remove an element. */
+int dhtable_list_rm(dhtable_ctx *ctx, void *bucket,
+                    uint64_t hash, void *key) {
+
+	/* Verify ctx, key, search,
+	 * unlink, give the node back,
+	 * return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return 1;
+		);
+
+	struct _dhtable_list *list = (struct _dhtable_list*) bucket;
+
+	struct _dhtable_list_node *node = _dhtable_list_search(ctx, list,
+	                                                       hash, key);
+
+	if (node == NULL)
+		return 0;
+
+	_dhtable_list_unlink(list, node);
+	_dhtable_list_free(ctx, node);
+
+	return 0;
+}
+
+/* Join two buckets. Source
+ * values replace destination
+ * values.
+ */
+int dhtable_list_join(dhtable_ctx *ctx, void *dst, void *src) {
+
+	/* Validate ctx, for each source
+	 * node, put it into the
+	 * destination, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	struct _dhtable_list *srclist = (struct _dhtable_list*) src;
+
+	struct _dhtable_list_node *node;
+
+	for (node = srclist->head; node != NULL; node = node->next) {
+
+		char *key = _dhtable_list_key(node);
+
+		int t = dhtable_list_put(ctx, dst, node->hash, key,
+		                         key + ctx->key_size);
+
+		DASSERT(t == 0, IHASHTABLE, "Failed to join a node.",
+			return 1;
+			);
+	}
+
+	return 0;
+}
+
+/* Move a node between buckets. */
+int dhtable_list_move(dhtable_ctx *ctx, void *dst, void *src,
+                      void *it, uint64_t hash) {
+
+	/* Unlink from source,
+	 * link to destination,
+	 * return.
+	 */
+	struct _dhtable_list_node *node = (struct _dhtable_list_node*) it;
+
+	_dhtable_list_unlink((struct _dhtable_list*) src, node);
+	_dhtable_list_link((struct _dhtable_list*) dst, node);
+
+	return 0;
+}
+
+/* Get the first element of a bucket. */
+void *dhtable_list_begin(dhtable_ctx *ctx, void *bucket) {
+
+	return (void*) ((struct _dhtable_list*) bucket)->head;
+}
+
+/* Get the last element of a bucket. */
+void *dhtable_list_end(dhtable_ctx *ctx, void *bucket) {
+
+	return (void*) ((struct _dhtable_list*) bucket)->tail;
+}
+
+/* Get the previous element of a bucket,
+ * the last if given NULL.
+ */
+void *dhtable_list_prev(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	if (it == NULL)
+		return dhtable_list_end(ctx, bucket);
+
+	return (void*) ((struct _dhtable_list_node*) it)->prev;
+}
+
+/* Get the next element of a bucket,
+ * the first if given NULL.
+ */
+void *dhtable_list_next(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	if (it == NULL)
+		return dhtable_list_begin(ctx, bucket);
+
+	return (void*) ((struct _dhtable_list_node*) it)->next;
+}
+
+/* Get the entry at an iterator. */
+void *dhtable_list_iget(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* The node holds key then
+	 * value after its header,
+	 * return.
+	 */
+	if (it == NULL)
+		return NULL;
+
+	return _dhtable_list_key((struct _dhtable_list_node*) it);
+}
+
+/* Get the stored hash at an iterator. */
+uint64_t dhtable_list_ihsh(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	return ((struct _dhtable_list_node*) it)->hash;
+}
+
+/* Prefetch a bucket's header. */
+void dhtable_list_prefetch(dhtable_ctx *ctx, void *bucket, uint64_t hash) {
+
+	/* Only the bucket header is
+	 * known without a load.
+	 */
+	DHTABLE_PREFETCH(bucket);
+}
+
+/* Get the bytes a bucket holds.
+ * Free nodes in the pool belong
+ * to no bucket.
+ */
+size_t dhtable_list_bytes(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_list_pool *pool = (struct _dhtable_list_pool*)
+		ctx->state;
+
+	return sizeof(struct _dhtable_list) +
+		((struct _dhtable_list*) bucket)->count * pool->node_size;
+}
+
+/* Find a key, or link it at the
+ * tail with a zeroed value. Returns
+ * the value, NULL on error.
+ */
+void *dhtable_list_emplace(dhtable_ctx *ctx, void *bucket,
+                           uint64_t hash, void *key, int *inserted) {
+
+	/* Verify context, key, search,
+	 * if missing, take a node, fill
+	 * it, link it, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_list *list = (struct _dhtable_list*) bucket;
+
+	struct _dhtable_list_node *node = _dhtable_list_search(ctx, list,
+	                                                       hash, key);
+
+	*inserted = node == NULL;
+
+	if (node == NULL) {
+
+		node = _dhtable_list_alloc(ctx);
+
+		DASSERT(node != NULL, IALLOC, "Failed to allocate node.",
+			return NULL;
+			);
+
+		node->hash = hash;
+		memcpy(_dhtable_list_key(node), key, ctx->key_size);
+		memset(_dhtable_list_key(node) + ctx->key_size, 0, ctx->val_size);
+
+		_dhtable_list_link(list, node);
+	}
+
+	return _dhtable_list_key(node) + ctx->key_size;
+}
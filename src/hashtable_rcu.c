@@ -0,0 +1,815 @@
+/** daelib/hashtable_rcu.c: Read-mostly hashtable.
+ */
+
+
+/* The table publishes one array of bucket
+ * pointers, a power of two long. A get loads
+ * the array, then the bucket, then asks the
+ * backend, with no locks and no retries.
+ *
+ * Writers take one mutex. A put or rm copies
+ * the bucket it changes with backend->copy,
+ * changes the copy and swaps it in. Growing
+ * builds a whole new array and swaps that in.
+ * Either way, what was swapped out is retired,
+ * tagged with the global epoch, which is then
+ * bumped.
+ *
+ * Each reader owns a slot, padded to a cache
+ * line. Enter stores the global epoch in it,
+ * leave stores 0. A retired object is freed
+ * once every slot is 0 or newer than its tag:
+ * a reader that entered before the swap has
+ * left, and one entering after sees the copy.
+ * The store on enter and the loads in get and
+ * in the writer's scan are sequentially
+ * consistent, which that argument relies on.
+ */
+
+
+/* Prototypes. */
+#include "hashtable_rcu.h"
+
+/* Backend interface. */
+#include "hashtable_backend.h"
+
+/* Assertions. */
+#include "assert.h"
+
+/* dhash_key(), dhash_index_mix(). */
+#include "hash.h"
+
+/* pthread_mutex_*(). */
+#include <pthread.h>
+
+/* sched_yield(). */
+#include <sched.h>
+
+/* atomic_*(). */
+#include <stdatomic.h>
+
+/* malloc(), free(). */
+#include <stdlib.h>
+
+/* memcmp(). */
+#include <string.h>
+
+
+/* Default error behaviour. */
+#ifndef ICALLER /* When fed bad data. */
+#define ICALLER DLOG
+#endif /* ICALLER */
+
+#ifndef IINTRA /* When table is invalid. */
+#define IINTRA DSTRIP
+#endif /* IINTRA */
+
+#ifndef IALLOC /* When malloc() fails. */
+#define IALLOC DLOG
+#endif /* IALLOC */
+
+#ifndef IBACKEND /* When a backend fails. */
+#define IBACKEND DLOG
+#endif /* IBACKEND */
+
+#ifndef ILOCK /* When a lock fails. */
+#define ILOCK DLOG
+#endif /* ILOCK */
+
+
+/* Bucket count when given 0. */
+#define DEFAULT_BUCKETS 64
+
+/* Growing tables double past this. */
+#define MAX_LOAD 1
+
+/* Reader slots per table. */
+#define MAX_READERS 64
+
+/* Slots are aligned to this, so
+ * readers never share a line.
+ */
+#define CACHE_LINE 64
+
+#ifdef __GNUC__
+#define READER_ALIGN __attribute__((aligned(CACHE_LINE)))
+#else
+#define READER_ALIGN
+#endif /* __GNUC__ */
+
+
+/* A reader's slot. Epoch is
+ * 0 outside enter and leave.
+ */
+struct dhtable_rcu_reader {
+
+	atomic_uint_fast64_t epoch;
+	atomic_int used;
+
+	struct daelib_hashtable_rcu *table;
+} READER_ALIGN;
+
+/* A published bucket array. */
+struct _dhtable_rcu_array {
+
+	unsigned bits;
+	size_t count;
+	_Atomic(void*) buckets[];
+};
+
+/* Something swapped out, waiting
+ * for its readers to leave.
+ */
+struct _dhtable_rcu_retired {
+
+	struct _dhtable_rcu_retired *next;
+	uint64_t tag;
+
+	/* A bucket, or else an array. */
+	void *bucket;
+	struct _dhtable_rcu_array *array;
+};
+
+/* Base definition of a read-mostly hashtable. */
+struct daelib_hashtable_rcu {
+
+	struct dhtable_backend *backend;
+	dhtable_ctx kv_data;
+
+	_Atomic(struct _dhtable_rcu_array*) array;
+	int grows;
+
+	atomic_size_t count;
+	atomic_uint_fast64_t epoch;
+
+	/* Writers only. */
+	pthread_mutex_t lock;
+	struct _dhtable_rcu_retired *retired;
+
+	struct dhtable_rcu_reader readers[MAX_READERS];
+};
+
+
+/* Determine if a table is valid.
+ * If valid return nonzero. Else return zero.
+ */
+static int _dhtable_rcu_valid(dhtable_rcu table) {
+
+	/* Check for valid sizes,
+	 * functors and buckets.
+	 */
+	if (table->kv_data.key_size == 0)
+		return 0;
+
+	if (table->kv_data.key_cmp == NULL || table->kv_data.key_hsh64 == NULL)
+		return 0;
+
+	if (table->backend == NULL || atomic_load(&table->array) == NULL)
+		return 0;
+
+	return 1;
+}
+
+/* Default key compare. */
+static int _dhtable_rcu_cmp(size_t key_size, void *keyl, void *keyr) {
+
+	return memcmp(keyl, keyr, key_size);
+}
+
+/* Find the bucket slot of a hash,
+ * by the top bits of its index mix.
+ */
+static inline _Atomic(void*) *_dhtable_rcu_slot(
+	struct _dhtable_rcu_array *array, uint64_t hash) {
+
+	if (array->bits == 0)
+		return array->buckets;
+
+	hash = dhash_index_mix(hash);
+
+	return array->buckets + (size_t) (hash >> (64 - array->bits));
+}
+
+/* Allocate an empty array
+ * of 1 << bits buckets.
+ */
+static struct _dhtable_rcu_array *_dhtable_rcu_array_alloc(unsigned bits) {
+
+	size_t count = (size_t) 1 << bits;
+
+	struct _dhtable_rcu_array *array = (struct _dhtable_rcu_array*)
+		malloc(sizeof(struct _dhtable_rcu_array) + sizeof(void*) * count);
+
+	DASSERT(array != NULL, IALLOC, "Failed to allocate buckets.",
+		return NULL;
+		);
+
+	array->bits = bits;
+	array->count = count;
+
+	size_t i;
+	for (i = 0; i < count; i++)
+		atomic_init(&array->buckets[i], NULL);
+
+	return array;
+}
+
+/* Kill every bucket of an array. */
+static void _dhtable_rcu_array_kill(dhtable_rcu table,
+                                    struct _dhtable_rcu_array *array) {
+
+	size_t i;
+	for (i = 0; i < array->count; i++) {
+		void *bucket = atomic_load_explicit(&array->buckets[i],
+		                                    memory_order_relaxed);
+		if (bucket != NULL)
+			table->backend->kill(&table->kv_data, bucket);
+	}
+}
+
+/* Free what is retired and no longer
+ * held by a reader. With wait, first
+ * wait for every reader to pass it all.
+ * ASSUMES THE WRITE LOCK IS HELD.
+ */
+static void _dhtable_rcu_reclaim(dhtable_rcu table, int wait) {
+
+	/* Find the oldest reader's epoch,
+	 * waiting on older ones if asked,
+	 * free everything tagged before it.
+	 */
+	uint64_t now = atomic_load(&table->epoch);
+	uint64_t oldest;
+
+	for (;;) {
+		oldest = UINT64_MAX;
+
+		size_t i;
+		for (i = 0; i < MAX_READERS; i++) {
+			uint64_t epoch = atomic_load(&table->readers[i].epoch);
+
+			if (epoch != 0 && epoch < oldest)
+				oldest = epoch;
+		}
+
+		if (!wait || oldest >= now)
+			break;
+
+		sched_yield();
+	}
+
+	struct _dhtable_rcu_retired **link = &table->retired;
+
+	while (*link != NULL) {
+		struct _dhtable_rcu_retired *retired = *link;
+
+		if (retired->tag >= oldest) {
+			link = &retired->next;
+			continue;
+		}
+
+		if (retired->bucket != NULL)
+			table->backend->kill(&table->kv_data, retired->bucket);
+		else
+			free(retired->array);
+
+		*link = retired->next;
+		free(retired);
+	}
+}
+
+/* Retire a bucket or array, so it is
+ * freed once its readers leave.
+ * ASSUMES THE WRITE LOCK IS HELD.
+ */
+static int _dhtable_rcu_retire(dhtable_rcu table, void *bucket,
+                               struct _dhtable_rcu_array *array) {
+
+	/* Tag with the epoch, bump it,
+	 * so later readers are newer.
+	 */
+	struct _dhtable_rcu_retired *retired = (struct _dhtable_rcu_retired*)
+		malloc(sizeof(struct _dhtable_rcu_retired));
+
+	DASSERT(retired != NULL, IALLOC, "Failed to retire.",
+		return 1;
+		);
+
+	retired->bucket = bucket;
+	retired->array = array;
+	retired->tag = atomic_fetch_add(&table->epoch, 1);
+
+	retired->next = table->retired;
+	table->retired = retired;
+
+	return 0;
+}
+
+/* Double the array. Entries are put
+ * into new buckets, and the old array
+ * and its buckets are retired whole.
+ * ASSUMES THE WRITE LOCK IS HELD.
+ */
+static int _dhtable_rcu_grow(dhtable_rcu table) {
+
+	/* Allocate the array, put every
+	 * entry of every old bucket, publish,
+	 * retire the old buckets, then the
+	 * array that points to them.
+	 */
+	struct dhtable_backend *backend = table->backend;
+	dhtable_ctx *ctx = &table->kv_data;
+
+	struct _dhtable_rcu_array *old = atomic_load(&table->array);
+	struct _dhtable_rcu_array *array = _dhtable_rcu_array_alloc(old->bits + 1);
+
+	if (array == NULL)
+		return 1;
+
+	size_t i;
+	for (i = 0; i < old->count; i++) {
+		void *bucket = atomic_load(&old->buckets[i]);
+
+		if (bucket == NULL)
+			continue;
+
+		void *it;
+		for (it = backend->begin(ctx, bucket); it != NULL;
+		     it = backend->next(ctx, bucket, it)) {
+
+			char *entry = (char*) backend->iget(ctx, bucket, it);
+			uint64_t hash = backend->ihsh != NULL ?
+				backend->ihsh(ctx, bucket, it) :
+				dhtable_ctx_hash(ctx, entry);
+
+			_Atomic(void*) *slot = _dhtable_rcu_slot(array, hash);
+			void *dst = atomic_load_explicit(slot, memory_order_relaxed);
+
+			if (dst == NULL) {
+				dst = backend->init(ctx);
+				atomic_store_explicit(slot, dst, memory_order_relaxed);
+			}
+
+			DASSERT(dst != NULL, IBACKEND, "Failed to create a bucket.",
+				_dhtable_rcu_array_kill(table, array);
+				free(array);
+				return 1;
+				);
+
+			int t = backend->put(ctx, dst, hash, entry,
+			                     entry + ctx->key_size);
+
+			DASSERT(t == 0, IBACKEND, "Failed to move an entry.",
+				_dhtable_rcu_array_kill(table, array);
+				free(array);
+				return 1;
+				);
+		}
+	}
+
+	atomic_store(&table->array, array);
+
+	for (i = 0; i < old->count; i++) {
+		void *bucket = atomic_load_explicit(&old->buckets[i],
+		                                    memory_order_relaxed);
+		if (bucket != NULL)
+			_dhtable_rcu_retire(table, bucket, NULL);
+	}
+
+	_dhtable_rcu_retire(table, NULL, old);
+
+	return 0;
+}
+
+/* Copy a bucket, let a write change the
+ * copy, publish it, retire the original.
+ * Returns the status.
+ * ASSUMES THE WRITE LOCK IS HELD.
+ */
+static int _dhtable_rcu_write(dhtable_rcu table, void *key, void *value,
+                              int rm) {
+
+	/* Hash, find the bucket, skip a
+	 * removal from an empty one, copy
+	 * or init, write, count, swap,
+	 * retire, grow if loaded, reclaim.
+	 */
+	struct dhtable_backend *backend = table->backend;
+	dhtable_ctx *ctx = &table->kv_data;
+
+	uint64_t hash = dhtable_ctx_hash(ctx, key);
+
+	struct _dhtable_rcu_array *array = atomic_load(&table->array);
+	_Atomic(void*) *slot = _dhtable_rcu_slot(array, hash);
+	void *bucket = atomic_load(slot);
+
+	if (rm && (bucket == NULL || backend->get(ctx, bucket, hash, key) == NULL))
+		return 0;
+
+	void *copy = (bucket != NULL) ? backend->copy(ctx, bucket) :
+		backend->init(ctx);
+
+	DASSERT(copy != NULL, IBACKEND, "Failed to copy a bucket.",
+		return 1;
+		);
+
+	size_t before = (bucket != NULL) ? backend->size(ctx, bucket) : 0;
+
+	int t = rm ? backend->rm(ctx, copy, hash, key) :
+		backend->put(ctx, copy, hash, key, value);
+
+	DASSERT(t == 0, IBACKEND, "Failed to write a bucket.",
+		backend->kill(ctx, copy);
+		return t;
+		);
+
+	size_t after = backend->size(ctx, copy);
+
+	if (after > before)
+		atomic_fetch_add(&table->count, after - before);
+	else
+		atomic_fetch_sub(&table->count, before - after);
+
+	atomic_store(slot, copy);
+
+	if (bucket != NULL)
+		_dhtable_rcu_retire(table, bucket, NULL);
+
+	if (table->grows &&
+	    atomic_load(&table->count) > array->count * MAX_LOAD)
+		_dhtable_rcu_grow(table);
+
+	_dhtable_rcu_reclaim(table, 0);
+
+	return 0;
+}
+
+/* Initialize a read-mostly table. */
+dhtable_rcu dhtable_rcu_init(size_t buckets, size_t key_size, size_t val_size,
+                             dhtable_key_cmp key_cmp,
+                             dhtable_key_hsh64 key_hsh,
+                             struct dhtable_backend *backend) {
+
+	/* Validate the key size, round the
+	 * bucket count up, allocate the table,
+	 * set defaults, set up the backend,
+	 * allocate the array, init the lock
+	 * and slots, return.
+	 */
+	DASSERT(key_size != 0, ICALLER, "Given invalid key size.",
+		return NULL;
+		);
+
+	int grows = buckets == 0;
+
+	if (buckets == 0)
+		buckets = DEFAULT_BUCKETS;
+
+	unsigned bits = 0;
+
+	while (((size_t) 1 << bits) < buckets)
+		bits++;
+
+	/* Aligned, so each reader
+	 * slot owns its cache line.
+	 */
+	void *mem = NULL;
+	int t = posix_memalign(&mem, CACHE_LINE,
+	                       sizeof(struct daelib_hashtable_rcu));
+
+	DASSERT(t == 0, IALLOC, "Failed to allocate table.",
+		return NULL;
+		);
+
+	dhtable_rcu table = (dhtable_rcu) mem;
+
+	table->backend = backend == NULL ? &dhtable_vector : backend;
+	table->grows = grows;
+
+	table->kv_data.key_size = key_size;
+	table->kv_data.val_size = val_size;
+	table->kv_data.key_hsh = NULL;
+	table->kv_data.key_cmp = key_cmp == NULL ? _dhtable_rcu_cmp : key_cmp;
+	table->kv_data.key_hsh64 = key_hsh == NULL ? dhash_key : key_hsh;
+	table->kv_data.state = NULL;
+	table->kv_data.alloc = &dalloc_libc;
+
+	if (table->backend->setup != NULL) {
+		t = table->backend->setup(&table->kv_data);
+
+		DASSERT(t == 0, IBACKEND, "Failed to set up the backend.",
+			free(table);
+			return NULL;
+			);
+	}
+
+	struct _dhtable_rcu_array *array = _dhtable_rcu_array_alloc(bits);
+
+	DASSERT(array != NULL, IALLOC, "Failed to allocate buckets.",
+		if (table->backend->teardown != NULL)
+			table->backend->teardown(&table->kv_data);
+		free(table);
+		return NULL;
+		);
+
+	t = pthread_mutex_init(&table->lock, NULL);
+
+	DASSERT(t == 0, ILOCK, "Failed to init the write lock.",
+		free(array);
+		if (table->backend->teardown != NULL)
+			table->backend->teardown(&table->kv_data);
+		free(table);
+		return NULL;
+		);
+
+	atomic_init(&table->array, array);
+	atomic_init(&table->count, 0);
+	atomic_init(&table->epoch, 1);
+	table->retired = NULL;
+
+	size_t i;
+	for (i = 0; i < MAX_READERS; i++) {
+		atomic_init(&table->readers[i].epoch, 0);
+		atomic_init(&table->readers[i].used, 0);
+		table->readers[i].table = table;
+	}
+
+	return table;
+}
+
+/* Free a read-mostly table.
+ * No other thread may use it.
+ */
+int dhtable_rcu_kill(dhtable_rcu table) {
+
+	/* Validate the table, free what
+	 * is retired, kill the buckets,
+	 * tear down, free, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_rcu_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	_dhtable_rcu_reclaim(table, 0);
+
+	DASSERT(table->retired == NULL, ICALLER, "Given table still being read.",
+		return 1;
+		);
+
+	struct _dhtable_rcu_array *array = atomic_load(&table->array);
+
+	_dhtable_rcu_array_kill(table, array);
+	free(array);
+
+	if (table->backend->teardown != NULL)
+		table->backend->teardown(&table->kv_data);
+
+	pthread_mutex_destroy(&table->lock);
+	free(table);
+
+	return 0;
+}
+
+/* Claim a free reader slot.
+ * Returns NULL if all are taken.
+ */
+dhtable_rcu_reader dhtable_rcu_register(dhtable_rcu table) {
+
+	/* Validate the table, claim
+	 * the first free slot, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return NULL;
+		);
+
+	DASSERT(_dhtable_rcu_valid(table), IINTRA, "Given invalid table.",
+		return NULL;
+		);
+
+	size_t i;
+	for (i = 0; i < MAX_READERS; i++) {
+		int expect = 0;
+
+		if (atomic_compare_exchange_strong(&table->readers[i].used,
+		                                   &expect, 1))
+			return table->readers + i;
+	}
+
+	DASSERT(0, ICALLER, "Given too many readers.",
+		return NULL;
+		);
+
+	return NULL;
+}
+
+/* Give a reader slot back. */
+int dhtable_rcu_unregister(dhtable_rcu table, dhtable_rcu_reader reader) {
+
+	/* Validate the reader,
+	 * free the slot, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(reader >= table->readers && reader < table->readers + MAX_READERS,
+	        ICALLER, "Given reader of another table.",
+		return 1;
+		);
+
+	DASSERT(atomic_load(&reader->epoch) == 0, ICALLER,
+	        "Given reader still inside.",
+		return 1;
+		);
+
+	atomic_store(&reader->used, 0);
+
+	return 0;
+}
+
+/* Start reading. Stores the epoch, so
+ * writers keep what this reader sees.
+ */
+void dhtable_rcu_enter(dhtable_rcu_reader reader) {
+
+	DASSERT(reader != NULL, ICALLER, "Given NULL reader.",
+		return;
+		);
+
+	atomic_store(&reader->epoch, atomic_load(&reader->table->epoch));
+}
+
+/* Stop reading. Pointers from
+ * get are no longer held.
+ */
+void dhtable_rcu_leave(dhtable_rcu_reader reader) {
+
+	DASSERT(reader != NULL, ICALLER, "Given NULL reader.",
+		return;
+		);
+
+	atomic_store_explicit(&reader->epoch, 0, memory_order_release);
+}
+
+/* Hash the key, load the array and
+ * bucket, ask the backend. Call
+ * between enter and leave.
+ */
+void *dhtable_rcu_get(dhtable_rcu table, void *key) {
+
+	/* Validate the table, key, hash,
+	 * load, check the bucket, get,
+	 * return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return NULL;
+		);
+
+	DASSERT(_dhtable_rcu_valid(table), IINTRA, "Given invalid table.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, ICALLER, "Given invalid key.",
+		return NULL;
+		);
+
+	uint64_t hash = table->kv_data.key_hsh64(table->kv_data.key_size, key);
+
+	struct _dhtable_rcu_array *array = atomic_load(&table->array);
+	void *bucket = atomic_load(_dhtable_rcu_slot(array, hash));
+
+	if (bucket == NULL)
+		return NULL;
+
+	return table->backend->get(&table->kv_data, bucket, hash, key);
+}
+
+/* Lock, copy, write and publish
+ * the bucket, unlock, return.
+ */
+int dhtable_rcu_put(dhtable_rcu table, void *key, void *value) {
+
+	/* Validate the table, key,
+	 * write under the lock, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_rcu_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, ICALLER, "Given invalid key.",
+		return 1;
+		);
+
+	int t = pthread_mutex_lock(&table->lock);
+
+	DASSERT(t == 0, ILOCK, "Failed to take the write lock.",
+		return 1;
+		);
+
+	t = _dhtable_rcu_write(table, key, value, 0);
+
+	pthread_mutex_unlock(&table->lock);
+
+	return t;
+}
+
+/* Lock, copy, remove from and
+ * publish the bucket, unlock, return.
+ */
+int dhtable_rcu_rm(dhtable_rcu table, void *key) {
+
+	/* Validate the table, key,
+	 * write under the lock, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_rcu_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, ICALLER, "Given invalid key.",
+		return 1;
+		);
+
+	int t = pthread_mutex_lock(&table->lock);
+
+	DASSERT(t == 0, ILOCK, "Failed to take the write lock.",
+		return 1;
+		);
+
+	t = _dhtable_rcu_write(table, key, NULL, 1);
+
+	pthread_mutex_unlock(&table->lock);
+
+	return t;
+}
+
+/* Wait for readers inside to
+ * leave, free all that is retired.
+ * Must not be called while inside.
+ */
+int dhtable_rcu_synchronize(dhtable_rcu table) {
+
+	/* Validate the table, reclaim,
+	 * waiting, under the lock, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_rcu_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	int t = pthread_mutex_lock(&table->lock);
+
+	DASSERT(t == 0, ILOCK, "Failed to take the write lock.",
+		return 1;
+		);
+
+	_dhtable_rcu_reclaim(table, 1);
+
+	pthread_mutex_unlock(&table->lock);
+
+	return 0;
+}
+
+/* Return the number of entries. */
+size_t dhtable_rcu_size(dhtable_rcu table) {
+
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	return atomic_load_explicit(&table->count, memory_order_relaxed);
+}
+
+/* Return the key size. */
+size_t dhtable_rcu_key_size(dhtable_rcu table) {
+
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	return table->kv_data.key_size;
+}
+
+/* Return the value size. */
+size_t dhtable_rcu_val_size(dhtable_rcu table) {
+
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	return table->kv_data.val_size;
+}
@@ -0,0 +1,534 @@
+/** daelib/hashtable_shard.c: Concurrent sharded hashtable.
+ */
+
+
+/* Keys are sent to one of a power of two
+ * shards by the top bits of their mixed
+ * hash. Each shard is a plain dhtable behind
+ * its own reader/writer lock, padded to a
+ * cache line, so readers of a shard run
+ * together and writers only block their own
+ * shard. Readers peek, so they never step
+ * a shard's resize; writers do. The element
+ * count is kept in one atomic, so size
+ * never takes a lock.
+ */
+
+
+/* Prototypes. */
+#include "hashtable_shard.h"
+
+/* Assertions. */
+#include "assert.h"
+
+/* dhash_key(), dhash_index_mix(). */
+#include "hash.h"
+
+/* pthread_rwlock_*(). */
+#include <pthread.h>
+
+/* atomic_size_t, atomic_fetch_add(). */
+#include <stdatomic.h>
+
+/* malloc(), free(). */
+#include <stdlib.h>
+
+/* memcpy(). */
+#include <string.h>
+
+
+/* Default error behaviour. */
+#ifndef ICALLER /* When fed bad data. */
+#define ICALLER DLOG
+#endif /* ICALLER */
+
+#ifndef IINTRA /* When table is invalid. */
+#define IINTRA DSTRIP
+#endif /* IINTRA */
+
+#ifndef IALLOC /* When malloc() fails. */
+#define IALLOC DLOG
+#endif /* IALLOC */
+
+#ifndef IHASHTABLE /* When a shard fails. */
+#define IHASHTABLE DLOG
+#endif /* IHASHTABLE */
+
+#ifndef ILOCK /* When a lock fails. */
+#define ILOCK DLOG
+#endif /* ILOCK */
+
+
+/* Shard count when given 0. */
+#define DEFAULT_SHARDS 64
+
+/* Shards are aligned to this, so
+ * locks never share a line.
+ */
+#define CACHE_LINE 64
+
+#ifdef __GNUC__
+#define SHARD_ALIGN __attribute__((aligned(CACHE_LINE)))
+#else
+#define SHARD_ALIGN
+#endif /* __GNUC__ */
+
+
+/* A shard. */
+struct _dhtable_shard {
+
+	pthread_rwlock_t lock;
+	dhtable table;
+} SHARD_ALIGN;
+
+/* Base definition of a sharded hashtable. */
+struct daelib_hashtable_shard {
+
+	size_t key_size;
+	size_t val_size;
+	dhtable_key_hsh64 key_hsh;
+
+	/* Shard selection. */
+	unsigned shard_bits;
+	size_t shard_count;
+	struct _dhtable_shard *shards;
+
+	atomic_size_t count;
+};
+
+
+/* Determine if a sharded table is valid.
+ * If valid return nonzero. Else return zero.
+ */
+static int _dhtable_shard_valid(dhtable_shard table) {
+
+	/* Check for valid sizes,
+	 * functors and shards.
+	 */
+	if (table->key_size == 0)
+		return 0;
+
+	if (table->key_hsh == NULL)
+		return 0;
+
+	if (table->shard_count != (size_t) 1 << table->shard_bits)
+		return 0;
+
+	if (table->shards == NULL)
+		return 0;
+
+	return 1;
+}
+
+/* Find the shard of a key. */
+static inline struct _dhtable_shard *_dhtable_shard_locate(
+	dhtable_shard table, void *key) {
+
+	/* Mix the hash, so the bits
+	 * picking the shard are not
+	 * the ones picking the bucket,
+	 * take the top bits.
+	 */
+	if (table->shard_bits == 0)
+		return table->shards;
+
+	uint64_t hash = table->key_hsh(table->key_size, key);
+
+	hash = dhash_index_mix(hash);
+
+	return table->shards + (size_t) (hash >> (64 - table->shard_bits));
+}
+
+/* Kill the first count shards. */
+static void _dhtable_shard_kill_shards(dhtable_shard table, size_t count) {
+
+	size_t i;
+	for (i = 0; i < count; i++) {
+
+		dhtable_kill(table->shards[i].table);
+		pthread_rwlock_destroy(&table->shards[i].lock);
+	}
+}
+
+/* Initialize a sharded table. */
+dhtable_shard dhtable_shard_init(size_t shards, size_t key_size,
+                                 size_t val_size, dhtable_key_cmp key_cmp,
+                                 dhtable_key_hsh64 key_hsh,
+                                 struct dhtable_backend *backend) {
+
+	/* Validate the key size, round the
+	 * shard count up, allocate the table
+	 * and shards, init each shard's table
+	 * and lock, return.
+	 */
+	DASSERT(key_size != 0, ICALLER, "Given invalid key size.",
+		return NULL;
+		);
+
+	if (shards == 0)
+		shards = DEFAULT_SHARDS;
+
+	unsigned bits = 0;
+
+	while (((size_t) 1 << bits) < shards)
+		bits++;
+
+	dhtable_shard table = (dhtable_shard)
+		malloc(sizeof(struct daelib_hashtable_shard));
+
+	DASSERT(table != NULL, IALLOC, "Failed to allocate table.",
+		return NULL;
+		);
+
+	table->key_size = key_size;
+	table->val_size = val_size;
+	table->key_hsh = key_hsh == NULL ? dhash_key : key_hsh;
+
+	table->shard_bits = bits;
+	table->shard_count = (size_t) 1 << bits;
+
+	atomic_init(&table->count, 0);
+
+	/* Aligned, so each shard
+	 * owns its cache line.
+	 */
+	void *mem = NULL;
+	int t = posix_memalign(&mem, CACHE_LINE,
+		sizeof(struct _dhtable_shard) * table->shard_count);
+
+	DASSERT(t == 0, IALLOC, "Failed to allocate shards.",
+		free(table);
+		return NULL;
+		);
+
+	table->shards = (struct _dhtable_shard*) mem;
+
+	size_t i;
+	for (i = 0; i < table->shard_count; i++) {
+
+		struct _dhtable_shard *shard = table->shards + i;
+
+		shard->table = dhtable_init64(0, key_size, val_size,
+		                              key_cmp, table->key_hsh, backend);
+
+		DASSERT(shard->table != NULL, IHASHTABLE, "Failed to init a shard.",
+			_dhtable_shard_kill_shards(table, i);
+			free(table->shards);
+			free(table);
+			return NULL;
+			);
+
+		t = pthread_rwlock_init(&shard->lock, NULL);
+
+		DASSERT(t == 0, ILOCK, "Failed to init a shard lock.",
+			dhtable_kill(shard->table);
+			_dhtable_shard_kill_shards(table, i);
+			free(table->shards);
+			free(table);
+			return NULL;
+			);
+	}
+
+	return table;
+}
+
+/* Free a sharded table.
+ * No other thread may use it.
+ */
+int dhtable_shard_kill(dhtable_shard table) {
+
+	/* Validate the table, kill each
+	 * shard and lock, free, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_shard_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	_dhtable_shard_kill_shards(table, table->shard_count);
+
+	free(table->shards);
+	free(table);
+
+	return 0;
+}
+
+/* Find the shard, get
+ * under a read lock, return.
+ */
+void *dhtable_shard_get(dhtable_shard table, void *key) {
+
+	/* Validate the table and key,
+	 * find the shard, read lock it,
+	 * get, unlock, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return NULL;
+		);
+
+	DASSERT(_dhtable_shard_valid(table), IINTRA, "Given invalid table.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, ICALLER, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_shard *shard = _dhtable_shard_locate(table, key);
+
+	pthread_rwlock_rdlock(&shard->lock);
+
+	void *value = dhtable_peek(shard->table, key);
+
+	pthread_rwlock_unlock(&shard->lock);
+
+	return value;
+}
+
+/* Find the shard, copy the
+ * value out under a read lock,
+ * return whether it was found.
+ */
+int dhtable_shard_getcpy(dhtable_shard table, void *key, void *value) {
+
+	/* Validate the table, key and
+	 * value, find the shard, read lock
+	 * it, get, copy, unlock, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_shard_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, ICALLER, "Given invalid key.",
+		return 1;
+		);
+
+	DASSERT(value != NULL || table->val_size == 0, ICALLER,
+		"Given invalid value.",
+		return 1;
+		);
+
+	struct _dhtable_shard *shard = _dhtable_shard_locate(table, key);
+
+	pthread_rwlock_rdlock(&shard->lock);
+
+	void *found = dhtable_peek(shard->table, key);
+
+	if (found != NULL && table->val_size != 0)
+		memcpy(value, found, table->val_size);
+
+	pthread_rwlock_unlock(&shard->lock);
+
+	return found == NULL;
+}
+
+/* Find the shard, put
+ * under a write lock,
+ * count, return the status.
+ */
+int dhtable_shard_put(dhtable_shard table, void *key, void *value) {
+
+	/* Validate the table and key,
+	 * find the shard, write lock it,
+	 * check for the key, put, unlock,
+	 * count any new element, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_shard_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, ICALLER, "Given invalid key.",
+		return 1;
+		);
+
+	struct _dhtable_shard *shard = _dhtable_shard_locate(table, key);
+
+	pthread_rwlock_wrlock(&shard->lock);
+
+	int fresh = dhtable_get(shard->table, key) == NULL;
+	int t = dhtable_put(shard->table, key, value);
+
+	pthread_rwlock_unlock(&shard->lock);
+
+	DASSERT(t == 0, IHASHTABLE, "Failed to put into a shard.",
+		return t;
+		);
+
+	if (fresh)
+		atomic_fetch_add(&table->count, 1);
+
+	return 0;
+}
+
+/* Find the shard, rm
+ * under a write lock,
+ * uncount, return the status.
+ */
+int dhtable_shard_rm(dhtable_shard table, void *key) {
+
+	/* Validate the table and key,
+	 * find the shard, write lock it,
+	 * check for the key, rm, unlock,
+	 * uncount any removed element, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_shard_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, ICALLER, "Given invalid key.",
+		return 1;
+		);
+
+	struct _dhtable_shard *shard = _dhtable_shard_locate(table, key);
+
+	pthread_rwlock_wrlock(&shard->lock);
+
+	int found = dhtable_get(shard->table, key) != NULL;
+	int t = found ? dhtable_rm(shard->table, key) : 0;
+
+	pthread_rwlock_unlock(&shard->lock);
+
+	DASSERT(t == 0, IHASHTABLE, "Failed to remove from a shard.",
+		return t;
+		);
+
+	if (found)
+		atomic_fetch_sub(&table->count, 1);
+
+	return 0;
+}
+
+/* Returns the element count. */
+size_t dhtable_shard_size(dhtable_shard table) {
+
+	/* Validate the table,
+	 * load the count, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	DASSERT(_dhtable_shard_valid(table), IINTRA, "Given invalid table.",
+		return 0;
+		);
+
+	return atomic_load(&table->count);
+}
+
+/* Returns the key size. */
+size_t dhtable_shard_key_size(dhtable_shard table) {
+
+	/* Validate the table,
+	 * return the key size.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	DASSERT(_dhtable_shard_valid(table), IINTRA, "Given invalid table.",
+		return 0;
+		);
+
+	return table->key_size;
+}
+
+/* Returns the value size. */
+size_t dhtable_shard_val_size(dhtable_shard table) {
+
+	/* Validate the table,
+	 * return the value size.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	DASSERT(_dhtable_shard_valid(table), IINTRA, "Given invalid table.",
+		return 0;
+		);
+
+	return table->val_size;
+}
+
+/* Join src into dst, shard by shard.
+ * Shards are locked in address order,
+ * so opposite joins cannot deadlock.
+ */
+int dhtable_shard_join(dhtable_shard dst, dhtable_shard src) {
+
+	/* Validate both tables, for each
+	 * shard pair, lock both, join the
+	 * shard tables, recount, unlock, return.
+	 */
+	DASSERT(dst != NULL, ICALLER, "Given NULL destination table.",
+		return 1;
+		);
+
+	DASSERT(src != NULL, ICALLER, "Given NULL source table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_shard_valid(dst) && _dhtable_shard_valid(src), IINTRA,
+		"Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(dst != src, ICALLER, "Given the same table twice.",
+		return 1;
+		);
+
+	DASSERT(dst->shard_count == src->shard_count &&
+	        dst->key_hsh == src->key_hsh, ICALLER,
+		"Given unjoinable tables.",
+		return 1;
+		);
+
+	size_t i;
+	for (i = 0; i < dst->shard_count; i++) {
+
+		struct _dhtable_shard *dshard = dst->shards + i;
+		struct _dhtable_shard *sshard = src->shards + i;
+
+		/* The source is written too,
+		 * joining finishes its migration.
+		 */
+		if (dshard < sshard) {
+			pthread_rwlock_wrlock(&dshard->lock);
+			pthread_rwlock_wrlock(&sshard->lock);
+		} else {
+			pthread_rwlock_wrlock(&sshard->lock);
+			pthread_rwlock_wrlock(&dshard->lock);
+		}
+
+		size_t before = dhtable_size(dshard->table);
+
+		int t = dhtable_join(dshard->table, sshard->table);
+
+		size_t after = dhtable_size(dshard->table);
+
+		pthread_rwlock_unlock(&sshard->lock);
+		pthread_rwlock_unlock(&dshard->lock);
+
+		atomic_fetch_add(&dst->count, after - before);
+
+		DASSERT(t == 0, IHASHTABLE, "Failed to join a shard.",
+			return 1;
+			);
+	}
+
+	return 0;
+}
@@ -0,0 +1,888 @@
+/** daelib/hashtable_swiss.c: Control byte backend for hashtable.
+ */
+
+
+/* Each bucket is an open addressing table
+ * in the style of SwissTable. A control byte
+ * per slot holds 7 bits of the hash, or marks
+ * the slot as empty or deleted. Lookups probe
+ * 16 control bytes at a time, and only compare
+ * keys whose control byte matches.
+ *
+ * With SSE2, a group is matched with one compare
+ * and movemask. Elsewhere, a scalar loop builds
+ * the same mask.
+ *
+ * Like the flat backend, buckets grow on
+ * their own, so use very few of them.
+ */
+
+
+/* Prototypes. */
+#include "hashtable_backend.h"
+
+/* Assertions. */
+#include "assert.h"
+
+/* dalloc_*(). */
+#include "alloc.h"
+
+/* memcpy(), memset(). */
+#include <string.h>
+
+/* uint64_t. */
+#include <stdint.h>
+
+#ifdef __SSE2__
+/* _mm_cmpeq_epi8(), _mm_movemask_epi8(). */
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+
+
+/* Backend functions. */
+void *dhtable_swiss_init(dhtable_ctx *ctx);
+int   dhtable_swiss_kill(dhtable_ctx *ctx, void *bucket);
+void *dhtable_swiss_copy(dhtable_ctx *ctx, void *bucket);
+
+size_t dhtable_swiss_size(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_swiss_get(dhtable_ctx *ctx, void *bucket,
+                        uint64_t hash, void *key);
+int   dhtable_swiss_put(dhtable_ctx *ctx, void *bucket,
+                        uint64_t hash, void *key, void *value);
+int   dhtable_swiss_rm (dhtable_ctx *ctx, void *bucket,
+                        uint64_t hash, void *key);
+
+int dhtable_swiss_join(dhtable_ctx *ctx, void *dst, void *src);
+
+void *dhtable_swiss_begin(dhtable_ctx *ctx, void *bucket);
+void *dhtable_swiss_end  (dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_swiss_prev(dhtable_ctx *ctx, void *bucket, void *it);
+void *dhtable_swiss_next(dhtable_ctx *ctx, void *bucket, void *it);
+
+void *dhtable_swiss_iget(dhtable_ctx *ctx, void *bucket, void *it);
+
+void dhtable_swiss_prefetch(dhtable_ctx *ctx, void *bucket, uint64_t hash);
+
+size_t dhtable_swiss_bytes(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_swiss_emplace(dhtable_ctx *ctx, void *bucket,
+                            uint64_t hash, void *key, int *inserted);
+
+
+/* Hashtable backend struct. */
+struct dhtable_backend dhtable_swiss = {
+	.init = dhtable_swiss_init,
+	.kill = dhtable_swiss_kill,
+	.copy = dhtable_swiss_copy,
+
+	.size = dhtable_swiss_size,
+
+	.get = dhtable_swiss_get,
+	.put = dhtable_swiss_put,
+	.rm = dhtable_swiss_rm,
+
+	.join = dhtable_swiss_join,
+
+	.begin = dhtable_swiss_begin,
+	.end = dhtable_swiss_end,
+
+	.prev = dhtable_swiss_prev,
+	.next = dhtable_swiss_next,
+
+	.iget = dhtable_swiss_iget,
+
+	.prefetch = dhtable_swiss_prefetch,
+
+	.bytes = dhtable_swiss_bytes,
+
+	.emplace = dhtable_swiss_emplace
+};
+
+
+/* Default error behaviour. */
+#ifndef IHASHTABLE /* When fed bad data. */
+#define IHASHTABLE DLOG
+#endif /* IHASHTABLE */
+
+#ifndef IALLOC /* When malloc() fails. */
+#define IALLOC DLOG
+#endif /* IALLOC */
+
+
+/* Slots per probed group. */
+#define SWISS_GROUP 16
+
+/* Slot count of a fresh bucket. */
+#define SWISS_MIN_SLOTS 16
+
+/* Maximum load, as used / slots, in eighths. */
+#define SWISS_MAX_LOAD 7
+
+/* Control bytes. Full slots hold
+ * 7 bits of hash, so have the
+ * high bit clear.
+ */
+#define SWISS_EMPTY   ((signed char) -128)
+#define SWISS_DELETED ((signed char) -2)
+
+
+/* A bucket. The control bytes are
+ * followed by a copy of the first
+ * group, so any slot can start a group.
+ * The slots follow in the same block.
+ */
+struct _dhtable_swiss {
+
+	size_t count;
+	size_t deleted;
+	size_t mask;
+
+	size_t slot_size;
+	signed char *ctrl;
+	char *slots;
+};
+
+
+/* Validate a context. */
+static int _dhtable_ctx_valid(dhtable_ctx *ctx) {
+
+	/* Validate pointer,
+	 * all fields but val_size
+	 * (you can have empty
+	 * value), return.
+	 */
+	if (ctx == NULL)
+		return 0;
+	if (ctx->key_size == 0)
+		return 0;
+	if (ctx->key_cmp == NULL)
+		return 0;
+	if (ctx->key_hsh == NULL && ctx->key_hsh64 == NULL)
+		return 0;
+
+	return 1;
+}
+
+/* Match a byte against a group of
+ * control bytes. Returns a mask with
+ * bit i set where ctrl[i] == byte.
+ */
+static inline unsigned _dhtable_swiss_match(signed char *ctrl,
+                                            signed char byte) {
+
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((__m128i*) ctrl);
+
+	return (unsigned) _mm_movemask_epi8(
+		_mm_cmpeq_epi8(group, _mm_set1_epi8(byte)));
+#else
+	unsigned mask = 0;
+
+	int i;
+	for (i = 0; i < SWISS_GROUP; i++)
+		mask |= (unsigned) (ctrl[i] == byte) << i;
+
+	return mask;
+#endif /* __SSE2__ */
+}
+
+/* Match the empty or deleted bytes
+ * of a group, which have the high
+ * bit set.
+ */
+static inline unsigned _dhtable_swiss_match_free(signed char *ctrl) {
+
+#ifdef __SSE2__
+	__m128i group = _mm_loadu_si128((__m128i*) ctrl);
+
+	return (unsigned) _mm_movemask_epi8(group);
+#else
+	unsigned mask = 0;
+
+	int i;
+	for (i = 0; i < SWISS_GROUP; i++)
+		mask |= (unsigned) (ctrl[i] < 0) << i;
+
+	return mask;
+#endif /* __SSE2__ */
+}
+
+/* Get the index of the lowest set bit.
+ * ASSUMES MASK IS NONZERO.
+ */
+static inline unsigned _dhtable_swiss_ctz(unsigned mask) {
+
+#ifdef __GNUC__
+	return (unsigned) __builtin_ctz(mask);
+#else
+	unsigned i = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		i++;
+	}
+	return i;
+#endif /* __GNUC__ */
+}
+
+/* Get the count of leading clear
+ * bits in a group mask.
+ * ASSUMES MASK IS NONZERO.
+ */
+static inline unsigned _dhtable_swiss_clz(unsigned mask) {
+
+#ifdef __GNUC__
+	return (unsigned) __builtin_clz(mask << 16);
+#else
+	unsigned i = 0;
+	while (!(mask & (1u << (SWISS_GROUP - 1)))) {
+		mask <<= 1;
+		i++;
+	}
+	return i;
+#endif /* __GNUC__ */
+}
+
+/* Mix a hash. The top 7 bits become
+ * the control byte, the rest pick
+ * the first group.
+ */
+static inline uint64_t _dhtable_swiss_mix(uint64_t hash) {
+
+	return hash * 0x9E3779B97F4A7C15ull;
+}
+
+/* Get the control byte of a hash. */
+static inline signed char _dhtable_swiss_h2(uint64_t hash) {
+
+	return (signed char) (hash >> 57);
+}
+
+/* Get a slot by index. */
+static inline char *_dhtable_swiss_at(struct _dhtable_swiss *swiss,
+                                      size_t index) {
+
+	return swiss->slots + index * swiss->slot_size;
+}
+
+/* Set a control byte, and its copy
+ * if it is in the first group.
+ */
+static inline void _dhtable_swiss_set(struct _dhtable_swiss *swiss,
+                                      size_t index, signed char byte) {
+
+	swiss->ctrl[index] = byte;
+
+	if (index < SWISS_GROUP)
+		swiss->ctrl[swiss->mask + 1 + index] = byte;
+}
+
+/* Find the slot index holding a key.
+ * Returns -1 if not found.
+ */
+static long _dhtable_swiss_search(dhtable_ctx *ctx,
+                                  struct _dhtable_swiss *swiss,
+                                  uint64_t hash, void *key) {
+
+	/* Probe groups, compare the keys of
+	 * matching control bytes, stop at a
+	 * group with an empty slot.
+	 */
+	if (swiss->ctrl == NULL)
+		return -1;
+
+	signed char h2 = _dhtable_swiss_h2(hash);
+
+	size_t pos = (size_t) (hash >> 7) & swiss->mask;
+	size_t step = 0;
+
+	for (;;) {
+
+		signed char *group = swiss->ctrl + pos;
+
+		unsigned match = _dhtable_swiss_match(group, h2);
+
+		while (match != 0) {
+
+			size_t i = (pos + _dhtable_swiss_ctz(match)) & swiss->mask;
+
+			if (ctx->key_cmp(ctx->key_size, key,
+			                 _dhtable_swiss_at(swiss, i)) == 0)
+				return (long) i;
+
+			match &= match - 1;
+		}
+
+		if (_dhtable_swiss_match(group, SWISS_EMPTY) != 0)
+			return -1;
+
+		step += SWISS_GROUP;
+		pos = (pos + step) & swiss->mask;
+	}
+}
+
+/* Find a free slot for a hash.
+ * ASSUMES THERE IS A FREE SLOT.
+ */
+static size_t _dhtable_swiss_free(struct _dhtable_swiss *swiss,
+                                  uint64_t hash) {
+
+	/* Probe groups until one
+	 * has an empty or deleted slot.
+	 */
+	size_t pos = (size_t) (hash >> 7) & swiss->mask;
+	size_t step = 0;
+
+	for (;;) {
+
+		unsigned match = _dhtable_swiss_match_free(swiss->ctrl + pos);
+
+		if (match != 0)
+			return (pos + _dhtable_swiss_ctz(match)) & swiss->mask;
+
+		step += SWISS_GROUP;
+		pos = (pos + step) & swiss->mask;
+	}
+}
+
+/* Bytes of a block of slots
+ * and their control bytes.
+ */
+static size_t _dhtable_swiss_block(size_t slots, size_t slot_size) {
+
+	return slots + SWISS_GROUP + slots * slot_size;
+}
+
+/* Reallocate the slots.
+ * Returns nonzero on error.
+ */
+static int _dhtable_swiss_rehash(dhtable_ctx *ctx,
+                                 struct _dhtable_swiss *swiss, size_t slots) {
+
+	/* Allocate a new block, mark every
+	 * control byte empty, swap it in,
+	 * rehash and place each full
+	 * old slot, free the old block.
+	 */
+	size_t ctrl_size = slots + SWISS_GROUP;
+	size_t bytes = _dhtable_swiss_block(slots, swiss->slot_size);
+
+	char *block = (char*) dalloc_alloc(ctx->alloc, bytes);
+	DASSERT(block != NULL, IALLOC, "Failed to allocate slots.",
+		return 1;
+		);
+
+	memset(block, SWISS_EMPTY, ctrl_size);
+
+	signed char *old_ctrl = swiss->ctrl;
+	char *old_slots = swiss->slots;
+	size_t old_count = (old_ctrl == NULL) ? 0 : swiss->mask + 1;
+
+	swiss->ctrl = (signed char*) block;
+	swiss->slots = block + ctrl_size;
+	swiss->mask = slots - 1;
+	swiss->deleted = 0;
+
+	size_t i;
+	for (i = 0; i < old_count; i++) {
+
+		if (old_ctrl[i] < 0)
+			continue;
+
+		char *slot = old_slots + i * swiss->slot_size;
+
+		uint64_t hash = _dhtable_swiss_mix(dhtable_ctx_hash(ctx, slot));
+		size_t index = _dhtable_swiss_free(swiss, hash);
+
+		_dhtable_swiss_set(swiss, index, _dhtable_swiss_h2(hash));
+		memcpy(_dhtable_swiss_at(swiss, index), slot, swiss->slot_size);
+	}
+
+	if (old_ctrl != NULL)
+		dalloc_free(ctx->alloc, old_ctrl,
+		            _dhtable_swiss_block(old_count, swiss->slot_size));
+
+	return 0;
+}
+
+/* Insert a new key, value pair
+ * with a mixed hash. A NULL value
+ * is zeroed. Returns the entry,
+ * NULL on error.
+ */
+static char *_dhtable_swiss_insert(dhtable_ctx *ctx,
+                                   struct _dhtable_swiss *swiss,
+                                   uint64_t hash, void *key, void *value) {
+
+	/* If there is no room, rehash, doubling
+	 * if the live slots need it, find a
+	 * free slot, set it, copy in.
+	 */
+	size_t slots = (swiss->ctrl == NULL) ? 0 : swiss->mask + 1;
+
+	if ((swiss->count + swiss->deleted + 1) * 8 > slots * SWISS_MAX_LOAD) {
+
+		size_t new_slots = slots;
+
+		if (new_slots == 0)
+			new_slots = SWISS_MIN_SLOTS;
+		else if ((swiss->count + 1) * 16 > slots * SWISS_MAX_LOAD)
+			new_slots *= 2;
+
+		if (_dhtable_swiss_rehash(ctx, swiss, new_slots) != 0)
+			return NULL;
+	}
+
+	size_t index = _dhtable_swiss_free(swiss, hash);
+
+	if (swiss->ctrl[index] == SWISS_DELETED)
+		swiss->deleted--;
+
+	_dhtable_swiss_set(swiss, index, _dhtable_swiss_h2(hash));
+
+	char *slot = _dhtable_swiss_at(swiss, index);
+
+	memcpy(slot, key, ctx->key_size);
+
+	if (value != NULL)
+		memcpy(slot + ctx->key_size, value, ctx->val_size);
+	else
+		memset(slot + ctx->key_size, 0, ctx->val_size);
+
+	swiss->count++;
+
+	return slot;
+}
+
+/* Initialize a bucket. */
+void *dhtable_swiss_init(dhtable_ctx *ctx) {
+
+	/* Validate ctx, allocate
+	 * the bucket, leave the slots
+	 * for the first put.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_swiss));
+
+	DASSERT(swiss != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	swiss->count = 0;
+	swiss->deleted = 0;
+	swiss->mask = 0;
+	swiss->slot_size = ctx->key_size + ctx->val_size;
+	swiss->ctrl = NULL;
+	swiss->slots = NULL;
+
+	return (void*) swiss;
+}
+
+/* Free a bucket. */
+int dhtable_swiss_kill(dhtable_ctx *ctx, void *bucket) {
+
+	/* Free the block,
+	 * free the bucket.
+	 */
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	DASSERT(swiss != NULL, IHASHTABLE, "Given NULL bucket.",
+		return 1;
+		);
+
+	if (swiss->ctrl != NULL)
+		dalloc_free(ctx->alloc, swiss->ctrl,
+		            _dhtable_swiss_block(swiss->mask + 1, swiss->slot_size));
+
+	swiss->ctrl = NULL;
+	swiss->slots = NULL;
+
+	dalloc_free(ctx->alloc, swiss, sizeof(struct _dhtable_swiss));
+
+	return 0;
+}
+
+/* Copy a bucket. */
+void *dhtable_swiss_copy(dhtable_ctx *ctx, void *bucket) {
+
+	/* Allocate the bucket,
+	 * copy the metadata, copy
+	 * the block, return.
+	 */
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	DASSERT(swiss != NULL, IHASHTABLE, "Given NULL bucket.",
+		return NULL;
+		);
+
+	struct _dhtable_swiss *new_swiss = (struct _dhtable_swiss*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_swiss));
+
+	DASSERT(new_swiss != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	memcpy(new_swiss, swiss, sizeof(struct _dhtable_swiss));
+
+	if (swiss->ctrl == NULL)
+		return (void*) new_swiss;
+
+	size_t ctrl_size = swiss->mask + 1 + SWISS_GROUP;
+	size_t bytes = ctrl_size + (swiss->mask + 1) * swiss->slot_size;
+
+	char *block = (char*) dalloc_alloc(ctx->alloc, bytes);
+
+	DASSERT(block != NULL, IALLOC, "Failed to allocate slots.",
+		dalloc_free(ctx->alloc, new_swiss, sizeof(struct _dhtable_swiss));
+		return NULL;
+		);
+
+	memcpy(block, swiss->ctrl, bytes);
+
+	new_swiss->ctrl = (signed char*) block;
+	new_swiss->slots = block + ctrl_size;
+
+	return (void*) new_swiss;
+}
+
+/* Get the element count of a bucket. */
+size_t dhtable_swiss_size(dhtable_ctx *ctx, void *bucket) {
+
+	/* Return the count of
+	 * full slots.
+	 */
+	return ((struct _dhtable_swiss*) bucket)->count;
+}
+
+/* Get an element in a bucket. */
+void *dhtable_swiss_get(dhtable_ctx *ctx, void *bucket,
+                        uint64_t hash, void *key) {
+
+	/* Verify the context, verify the key,
+	 * mix the hash, search, return the value.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	hash = _dhtable_swiss_mix(hash);
+
+	long index = _dhtable_swiss_search(ctx, swiss, hash, key);
+
+	if (index < 0)
+		return NULL;
+
+	return (void*) (_dhtable_swiss_at(swiss, index) + ctx->key_size);
+}
+
+/* Put an element into a bucket. */
+int dhtable_swiss_put(dhtable_ctx *ctx, void *bucket,
+                      uint64_t hash, void *key, void *value) {
+
+	/* Verify context, key,
+	 * if exists, overwrite
+	 * value or insert new key, value.
+	 * return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return 1;
+		);
+
+	DASSERT((ctx->val_size == 0) || value != NULL, IHASHTABLE,
+		"Given invalid value.",
+		return 1;
+		);
+
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	hash = _dhtable_swiss_mix(hash);
+
+	long index = _dhtable_swiss_search(ctx, swiss, hash, key);
+
+	if (index < 0)
+		return _dhtable_swiss_insert(ctx, swiss, hash, key, value) == NULL;
+
+	if (ctx->val_size != 0)
+		memcpy(_dhtable_swiss_at(swiss, index) + ctx->key_size,
+		       value, ctx->val_size);
+
+	return 0;
+}
+
+/* Remove an element from
+ * a bucket.
+ */
+int dhtable_swiss_rm(dhtable_ctx *ctx, void *bucket,
+                     uint64_t hash, void *key) {
+
+	/* Verify ctx, key, search, if no
+	 * group around the slot was ever
+	 * full, mark it empty, else mark
+	 * it deleted so probes continue.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return 1;
+		);
+
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	hash = _dhtable_swiss_mix(hash);
+
+	long index = _dhtable_swiss_search(ctx, swiss, hash, key);
+
+	if (index < 0)
+		return 0;
+
+	size_t before = ((size_t) index - SWISS_GROUP) & swiss->mask;
+
+	unsigned empty_before =
+		_dhtable_swiss_match(swiss->ctrl + before, SWISS_EMPTY);
+	unsigned empty_after =
+		_dhtable_swiss_match(swiss->ctrl + index, SWISS_EMPTY);
+
+	/* Full run through the slot, counting
+	 * back from it and forward from it.
+	 */
+	unsigned run = 0;
+
+	if (empty_before != 0 && empty_after != 0)
+		run = _dhtable_swiss_ctz(empty_after) +
+		      _dhtable_swiss_clz(empty_before);
+
+	if (empty_before != 0 && empty_after != 0 && run < SWISS_GROUP) {
+		_dhtable_swiss_set(swiss, index, SWISS_EMPTY);
+	} else {
+		_dhtable_swiss_set(swiss, index, SWISS_DELETED);
+		swiss->deleted++;
+	}
+
+	swiss->count--;
+
+	return 0;
+}
+
+/* Join two buckets. */
+int dhtable_swiss_join(dhtable_ctx *ctx, void *dst, void *src) {
+
+	/* Validate ctx, for each
+	 * full slot in src, search dst,
+	 * if there, replace, else, insert.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return 1;
+		);
+
+	struct _dhtable_swiss *dstswiss = (struct _dhtable_swiss*) dst;
+	struct _dhtable_swiss *srcswiss = (struct _dhtable_swiss*) src;
+
+	if (srcswiss->ctrl == NULL)
+		return 0;
+
+	size_t count = srcswiss->mask + 1;
+
+	size_t i;
+	for (i = 0; i < count; i++) {
+
+		if (srcswiss->ctrl[i] < 0)
+			continue;
+
+		char *key = _dhtable_swiss_at(srcswiss, i);
+		char *value = key + ctx->key_size;
+
+		uint64_t hash = _dhtable_swiss_mix(dhtable_ctx_hash(ctx, key));
+
+		long index = _dhtable_swiss_search(ctx, dstswiss, hash, key);
+
+		if (index < 0) {
+			if (_dhtable_swiss_insert(ctx, dstswiss, hash,
+			                          key, value) == NULL)
+				return 1;
+			continue;
+		}
+
+		if (ctx->val_size != 0)
+			memcpy(_dhtable_swiss_at(dstswiss, index) + ctx->key_size,
+			       value, ctx->val_size);
+	}
+
+	return 0;
+}
+
+
+/* Iterators are a slot index plus one,
+ * so that NULL is past either end.
+ */
+
+/* Get the first element of a bucket. */
+void *dhtable_swiss_begin(dhtable_ctx *ctx, void *bucket) {
+
+	/* Step forward from
+	 * before the first slot.
+	 */
+	return dhtable_swiss_next(ctx, bucket, NULL);
+}
+
+/* Get the last element of a bucket. */
+void *dhtable_swiss_end(dhtable_ctx *ctx, void *bucket) {
+
+	/* Step back from
+	 * after the last slot.
+	 */
+	return dhtable_swiss_prev(ctx, bucket, NULL);
+}
+
+/* Get the previous element of a bucket.
+ * If at NULL, return the last element.
+ */
+void *dhtable_swiss_prev(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Find the slot before it, walk
+	 * back to a full slot, or
+	 * return NULL at the start.
+	 */
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	if (swiss->ctrl == NULL)
+		return NULL;
+
+	size_t i = (it == NULL) ? swiss->mask + 1 : (size_t) it - 1;
+
+	while (i-- > 0)
+		if (swiss->ctrl[i] >= 0)
+			return (void*) (i + 1);
+
+	return NULL;
+}
+
+/* Get the next element of a bucket.
+ * If at NULL, return the first element.
+ */
+void *dhtable_swiss_next(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Find the slot after it, skip
+	 * free slots a group at a time,
+	 * or return NULL at the end.
+	 */
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	if (swiss->ctrl == NULL)
+		return NULL;
+
+	size_t i = (size_t) it;
+
+	while (i <= swiss->mask) {
+
+		unsigned full = ~_dhtable_swiss_match_free(swiss->ctrl + i) & 0xFFFF;
+
+		if (full != 0) {
+			i += _dhtable_swiss_ctz(full);
+			return (i <= swiss->mask) ? (void*) (i + 1) : NULL;
+		}
+
+		i += SWISS_GROUP;
+	}
+
+	return NULL;
+}
+
+/* Get the entry at an iterator. */
+void *dhtable_swiss_iget(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Validate the iterator,
+	 * return the key, the
+	 * value follows it.
+	 */
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	size_t i = (size_t) it - 1;
+
+	DASSERT(swiss->ctrl != NULL && i <= swiss->mask, IHASHTABLE,
+		"Given invalid iterator.",
+		return NULL;
+		);
+
+	return (void*) _dhtable_swiss_at(swiss, i);
+}
+
+/* Prefetch the first group of a hash. */
+void dhtable_swiss_prefetch(dhtable_ctx *ctx, void *bucket, uint64_t hash) {
+
+	/* Find the first group, fetch
+	 * its control bytes and its
+	 * first slot.
+	 */
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	if (swiss->ctrl == NULL)
+		return;
+
+	size_t pos = (size_t) (_dhtable_swiss_mix(hash) >> 7) & swiss->mask;
+
+	DHTABLE_PREFETCH(swiss->ctrl + pos);
+	DHTABLE_PREFETCH(_dhtable_swiss_at(swiss, pos));
+}
+
+/* Get the bytes a bucket holds. */
+size_t dhtable_swiss_bytes(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	if (swiss->ctrl == NULL)
+		return sizeof(struct _dhtable_swiss);
+
+	size_t slots = swiss->mask + 1;
+
+	return sizeof(struct _dhtable_swiss) + slots + SWISS_GROUP +
+		slots * swiss->slot_size;
+}
+
+/* Find a key, or insert it with
+ * a zeroed value. Returns the value,
+ * NULL on error.
+ */
+void *dhtable_swiss_emplace(dhtable_ctx *ctx, void *bucket,
+                            uint64_t hash, void *key, int *inserted) {
+
+	/* Verify context, key, search,
+	 * if missing, insert, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_swiss *swiss = (struct _dhtable_swiss*) bucket;
+
+	hash = _dhtable_swiss_mix(hash);
+
+	long index = _dhtable_swiss_search(ctx, swiss, hash, key);
+
+	*inserted = index < 0;
+
+	char *entry = (index >= 0) ? _dhtable_swiss_at(swiss, index) :
+		_dhtable_swiss_insert(ctx, swiss, hash, key, NULL);
+
+	return (entry == NULL) ? NULL : entry + ctx->key_size;
+}
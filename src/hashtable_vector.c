@@ -1,12 +1,16 @@
 /** daelib/hashtable_vector.c: Vector backend for hashtable.
- * TODO: Decide on iterators for vectors, or
- * allow range treatment. Get is *really* inefficient
- * until then.
  */
 
 
-/* We don't need to store any extra data for
- * vectors, so the bucket is just a dvec.
+/* Each bucket is a pair of parallel vectors.
+ * One holds key|value entries, the other
+ * holds the full hash of each entry. Both
+ * are small vectors, keeping the first few
+ * entries inline, as most buckets hold only
+ * that many. Searches
+ * scan the dense hash array, and only compare
+ * keys whose hash matches. Joins reuse the
+ * stored hashes rather than hashing again.
  * Since we're given a dhtable_ctx, we have
  * the correct sizes.
  */
@@ -15,16 +19,16 @@
 /* Prototypes. */
 #include "hashtable_backend.h"
 
-/* Vectors. */
-#include "vector.h"
+/* Vectors, unchecked accessors. */
+#include "vector_inline.h"
 
 /* Assertions. */
 #include "assert.h"
 
-/* malloc(), realloc(), free(). */
-#include <stdlib.h>
+/* dalloc_*(). */
+#include "alloc.h"
 
-/* memcpy(). */
+/* memcpy(), memset(). */
 #include <string.h>
 
 
@@ -36,14 +40,31 @@ void *dhtable_vector_copy(dhtable_ctx *ctx, void *bucket);
 size_t dhtable_vector_size(dhtable_ctx *ctx, void *bucket);
 
 void *dhtable_vector_get(dhtable_ctx *ctx, void *bucket,
-                         void *key);
+                         uint64_t hash, void *key);
 int   dhtable_vector_put(dhtable_ctx *ctx, void *bucket,
-                         void *key, void *value);
+                         uint64_t hash, void *key, void *value);
 int   dhtable_vector_rm (dhtable_ctx *ctx, void *bucket,
-                         void *key);
+                         uint64_t hash, void *key);
 
 int dhtable_vector_join(dhtable_ctx *ctx, void *dst, void *src);
 
+void *dhtable_vector_begin(dhtable_ctx *ctx, void *bucket);
+void *dhtable_vector_end  (dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_vector_prev(dhtable_ctx *ctx, void *bucket, void *it);
+void *dhtable_vector_next(dhtable_ctx *ctx, void *bucket, void *it);
+
+void *dhtable_vector_iget(dhtable_ctx *ctx, void *bucket, void *it);
+
+uint64_t dhtable_vector_ihsh(dhtable_ctx *ctx, void *bucket, void *it);
+
+void dhtable_vector_prefetch(dhtable_ctx *ctx, void *bucket, uint64_t hash);
+
+size_t dhtable_vector_bytes(dhtable_ctx *ctx, void *bucket);
+
+void *dhtable_vector_emplace(dhtable_ctx *ctx, void *bucket,
+                             uint64_t hash, void *key, int *inserted);
+
 
 /* Hashtable backend struct. */
 struct dhtable_backend dhtable_vector = {
@@ -57,7 +78,23 @@ struct dhtable_backend dhtable_vector = {
 	.put = dhtable_vector_put,
 	.rm = dhtable_vector_rm,
 
-	.join = dhtable_vector_join
+	.join = dhtable_vector_join,
+
+	.begin = dhtable_vector_begin,
+	.end = dhtable_vector_end,
+
+	.prev = dhtable_vector_prev,
+	.next = dhtable_vector_next,
+
+	.iget = dhtable_vector_iget,
+
+	.ihsh = dhtable_vector_ihsh,
+
+	.prefetch = dhtable_vector_prefetch,
+
+	.bytes = dhtable_vector_bytes,
+
+	.emplace = dhtable_vector_emplace
 };
 
 
@@ -70,6 +107,28 @@ struct dhtable_backend dhtable_vector = {
 #define IVECTOR DLOG
 #endif /* IVECTOR */
 
+#ifndef IALLOC /* When malloc() fails. */
+#define IALLOC DLOG
+#endif /* IALLOC */
+
+
+/* Entries each bucket holds inline,
+ * as most hold a few. Entries over
+ * SMALL_BYTES together get fewer.
+ */
+#define SMALL_COUNT 4
+#define SMALL_BYTES 256
+
+
+/* A bucket. The vectors are
+ * always the same length.
+ */
+struct _dhtable_vector {
+
+	dvec entries;
+	dvec hashes;
+};
+
 
 /* A note on assertions:
  * Hashtable and vector each have
@@ -97,7 +156,7 @@ static int _dhtable_ctx_valid(dhtable_ctx *ctx) {
 		return 0;
 	if (ctx->key_cmp == NULL)
 		return 0;
-	if (ctx->key_hsh == NULL)
+	if (ctx->key_hsh == NULL && ctx->key_hsh64 == NULL)
 		return 0;
 
 	return 1;
@@ -105,61 +164,38 @@ static int _dhtable_ctx_valid(dhtable_ctx *ctx) {
 
 /* Search for a key.
  * If not found, return -1.
- * TODO: Decide on continuity or iterators
- * for vectors.
+ * Vectors are continuous, so scan
+ * the hashes directly, and only
+ * compare keys on a match.
  */
-static int _dhtable_vector_search(dhtable_ctx *ctx, dvec vec, void *key) {
-
-	/* TODO: See if I ensure continuity in vectors.
-	 * Until then, use the direct interface.
-	 * This code fragment uses continuity, replace
-	 * the next segment when I decide on iterators or
-	 * continuity.
+static long _dhtable_vector_search(dhtable_ctx *ctx,
+                                   struct _dhtable_vector *vec,
+                                   uint64_t hash, void *key) {
+
+	/* Get the element count,
+	 * get both bases, scan
+	 * for the hash, compare
+	 * keys, return.
 	 */
-	size_t count = dvec_size(vec);
-
-	/* Start version two.
+	size_t count = dvec_size_fast(vec->hashes);
 
 	if (count == 0)
 		return -1;
 
-	size_t elem_size = dvec_elem_size(vec);
-
-	DASSERT(elem_size != 0, "Received invalid elem_size.",
-		return -1;
-		);
-
-	char *base = (char*) dvec_get(vec, 0);
-
-	DASSERT(t != NULL, "Failed to get first element.",
-		return NULL;
-		);
-
-	size_t i;
-	for (i = 0; i < count; i++)
-
-		char *t = base + i * elem_size;
+	uint64_t *hashes = (uint64_t*) dvec_data(vec->hashes);
+	char *entries = (char*) dvec_data(vec->entries);
 
-		if (ctx->key_cmp(ctx->key_size, key, (void*) t) == 0)
-			return i;
-	}
-	* End version two.
-	* Start version one.
-	*/
+	size_t elem_size = ctx->key_size + ctx->val_size;
 
 	size_t i;
 	for (i = 0; i < count; i++) {
 
-		char *t = dvec_get(vec, i);
+		if (hashes[i] != hash)
+			continue;
 
-		DASSERT(t != NULL, IVECTOR, "Failed to get element.",
-			return -1;
-			);
-
-		if (ctx->key_cmp(ctx->key_size, key, (void*) t) == 0)
-			return (int) i;
+		if (ctx->key_cmp(ctx->key_size, key, entries + i * elem_size) == 0)
+			return (long) i;
 	}
-	/* End version one. */
 
 	return -1;
 }
@@ -167,14 +203,11 @@ static int _dhtable_vector_search(dhtable_ctx *ctx, dvec vec, void *key) {
 /* Replace the value of
  * a map element.
  */
-static int _dhtable_vector_replace(dhtable_ctx *ctx, dvec vec,
-                                   int index, void *value) {
+static int _dhtable_vector_replace(dhtable_ctx *ctx,
+                                   struct _dhtable_vector *vec,
+                                   long index, void *value) {
 
-	char *elem = (char*) dvec_get(vec, index);
-
-	DASSERT(elem != NULL, IVECTOR, "Failed to get element.",
-		return 1;
-		);
+	char *elem = (char*) dvec_get_fast(vec->entries, index);
 
 	char *val = elem + ctx->key_size;
 
@@ -183,78 +216,146 @@ static int _dhtable_vector_replace(dhtable_ctx *ctx, dvec vec,
 	return 0;
 }
 
-/* Insert a key, value pair
- * at end.
+/* Insert a key, value pair and its
+ * hash at end, in place. A NULL value
+ * is zeroed. Returns the entry, NULL
+ * on error.
  */
-static int _dhtable_vector_push(dhtable_ctx *ctx, dvec vec,
-                                void *key, void *value) {
+static char *_dhtable_vector_push(dhtable_ctx *ctx,
+                                  struct _dhtable_vector *vec,
+                                  uint64_t hash, void *key, void *value) {
 
-	/* Create buffer, memcpy key,
-	 * if value, memcpy, push,
+	/* Emplace entry, emplace hash,
+	 * undo on failure, fill both,
 	 * return.
 	 */
-	size_t size = dvec_elem_size(vec);
+	char *entry = (char*) dvec_emplace(vec->entries);
 
-	DASSERT(size != 0, IVECTOR, "Received invalid elem_size.",
-		return 1;
-		);
+	if (entry == NULL)
+		return NULL;
+
+	uint64_t *slot = (uint64_t*) dvec_emplace(vec->hashes);
+
+	if (slot == NULL) {
+		dvec_pop(vec->entries);
+		return NULL;
+	}
 
-	char buff[size];
+	*slot = hash;
 
-	memcpy(buff, key, ctx->key_size);
+	memcpy(entry, key, ctx->key_size);
 
-	if (ctx->val_size != 0)
-		memcpy(buff + ctx->key_size, value, ctx->val_size);
+	if (value != NULL)
+		memcpy(entry + ctx->key_size, value, ctx->val_size);
+	else
+		memset(entry + ctx->key_size, 0, ctx->val_size);
 
-	return dvec_push(vec, (void*) buff);
+	return entry;
 }
 
 /* Initialize a bucket. */
 void *dhtable_vector_init(dhtable_ctx *ctx) {
 
-	/* Validate ctx, init vector,
+	/* Validate ctx, allocate
+	 * bucket, init small vectors,
 	 * return.
 	 */
 	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
 		return NULL;
 		);
 
-	return (void*) dvec_init(ctx->key_size + ctx->val_size);
+	struct _dhtable_vector *vec = (struct _dhtable_vector*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_vector));
+
+	DASSERT(vec != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	size_t elem_size = ctx->key_size + ctx->val_size;
+	size_t small = SMALL_BYTES / elem_size;
+
+	if (small > SMALL_COUNT)
+		small = SMALL_COUNT;
+
+	vec->entries = dvec_init_ex(elem_size, small, ctx->alloc);
+	vec->hashes = dvec_init_ex(sizeof(uint64_t), small, ctx->alloc);
+
+	DASSERT(vec->entries != NULL && vec->hashes != NULL, IVECTOR,
+		"Failed to init vectors.",
+		if (vec->entries != NULL)
+			dvec_kill(vec->entries);
+		if (vec->hashes != NULL)
+			dvec_kill(vec->hashes);
+		dalloc_free(ctx->alloc, vec, sizeof(struct _dhtable_vector));
+		return NULL;
+		);
+
+	return (void*) vec;
 }
 
 /* Free a bucket. */
 int dhtable_vector_kill(dhtable_ctx *ctx, void *bucket) {
 
-	/* Call dvec_kill,
-	 * return error.
+	/* Call dvec_kill on both,
+	 * free bucket, return error.
 	 */
-	return dvec_kill((dvec) bucket);
+	struct _dhtable_vector *vec = (struct _dhtable_vector*) bucket;
+
+	int t = dvec_kill(vec->entries) | dvec_kill(vec->hashes);
+
+	dalloc_free(ctx->alloc, vec, sizeof(struct _dhtable_vector));
+
+	return t;
 }
 
 /* Copy a bucket. */
 void *dhtable_vector_copy(dhtable_ctx *ctx, void *bucket) {
 
-	/* Call dvec_copy,
+	/* Allocate bucket,
+	 * call dvec_copy on both,
 	 * return bucket.
 	 */
-	return (void*) dvec_copy((dvec) bucket);
+	struct _dhtable_vector *vec = (struct _dhtable_vector*) bucket;
+
+	struct _dhtable_vector *new_vec = (struct _dhtable_vector*)
+		dalloc_alloc(ctx->alloc, sizeof(struct _dhtable_vector));
+
+	DASSERT(new_vec != NULL, IALLOC, "Failed to allocate bucket.",
+		return NULL;
+		);
+
+	new_vec->entries = dvec_copy(vec->entries);
+	new_vec->hashes = dvec_copy(vec->hashes);
+
+	DASSERT(new_vec->entries != NULL && new_vec->hashes != NULL, IVECTOR,
+		"Failed to copy vectors.",
+		if (new_vec->entries != NULL)
+			dvec_kill(new_vec->entries);
+		if (new_vec->hashes != NULL)
+			dvec_kill(new_vec->hashes);
+		dalloc_free(ctx->alloc, new_vec, sizeof(struct _dhtable_vector));
+		return NULL;
+		);
+
+	return (void*) new_vec;
 }
 
 /* Get the element count of a bucket. */
 size_t dhtable_vector_size(dhtable_ctx *ctx, void *bucket) {
 
-	/* Call dvec_size,
+	/* Call dvec_size_fast,
 	 * return.
 	 */
-	return dvec_size((dvec) bucket);
+	return dvec_size_fast(((struct _dhtable_vector*) bucket)->entries);
 }
 
 /* Get an element in a bucket. */
-void *dhtable_vector_get(dhtable_ctx *ctx, void *bucket, void *key) {
+void *dhtable_vector_get(dhtable_ctx *ctx, void *bucket,
+                         uint64_t hash, void *key) {
 
 	/* Verify the context, verify the key,
 	 * search for element, get element,
-	 * verify, get val, return.
+	 * get val, return.
 	 */
 	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
 		return NULL;
@@ -264,18 +365,14 @@ void *dhtable_vector_get(dhtable_ctx *ctx, void *bucket, void *key) {
 		return NULL;
 		);
 
-	dvec vec = (dvec) bucket;
+	struct _dhtable_vector *vec = (struct _dhtable_vector*) bucket;
 
-	int index = _dhtable_vector_search(ctx, vec, key);
+	long index = _dhtable_vector_search(ctx, vec, hash, key);
 
 	if (index < 0)
 		return NULL;
 
-	char *r = (char*) dvec_get(vec, index);
-
-	DASSERT(r != NULL, IVECTOR, "Failed to get element.",
-		return NULL;
-		);
+	char *r = (char*) dvec_get_fast(vec->entries, index);
 
 	void *value = r + ctx->key_size;
 
@@ -285,7 +382,7 @@ void *dhtable_vector_get(dhtable_ctx *ctx, void *bucket, void *key) {
 /* Push an element onto a bucket.
  */
 int dhtable_vector_put(dhtable_ctx *ctx, void *bucket,
-                       void *key, void *value) {
+                       uint64_t hash, void *key, void *value) {
 
 	/* Verify context, key,
 	 * if exists, overwrite
@@ -305,15 +402,15 @@ int dhtable_vector_put(dhtable_ctx *ctx, void *bucket,
 		return 1;
 		);
 
-	dvec vec = (dvec) bucket;
+	struct _dhtable_vector *vec = (struct _dhtable_vector*) bucket;
 
-	int index = _dhtable_vector_search(ctx, vec, key);
+	long index = _dhtable_vector_search(ctx, vec, hash, key);
 
 	int t;
 	if (index >= 0) {
 		t = _dhtable_vector_replace(ctx, vec, index, value);
 	} else {
-		t = _dhtable_vector_push(ctx, vec, key, value);
+		t = _dhtable_vector_push(ctx, vec, hash, key, value) == NULL;
 	}
 
 	return t;
@@ -322,11 +419,12 @@ int dhtable_vector_put(dhtable_ctx *ctx, void *bucket,
 /* Remove an element from
  * a vector.
  */
-int dhtable_vector_rm(dhtable_ctx *ctx, void *bucket, void *key) {
+int dhtable_vector_rm(dhtable_ctx *ctx, void *bucket,
+                      uint64_t hash, void *key) {
 
 	/* Verify ctx, key,
-	 * get size, search,
-	 * call remove, return.
+	 * search, call remove on
+	 * both vectors, return.
 	 */
 	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
 		return 1;
@@ -336,14 +434,14 @@ int dhtable_vector_rm(dhtable_ctx *ctx, void *bucket, void *key) {
 		return 1;
 		);
 
-	dvec vec = (dvec) bucket;
+	struct _dhtable_vector *vec = (struct _dhtable_vector*) bucket;
 
-	int t = _dhtable_vector_search(ctx, vec, key);
+	long t = _dhtable_vector_search(ctx, vec, hash, key);
 
 	if (t < 0)
 		return 0;
 
-	return dvec_rm(vec, t);
+	return dvec_rm(vec->entries, t) | dvec_rm(vec->hashes, t);
 }
 
 /* Join two vectors. */
@@ -351,35 +449,39 @@ int dhtable_vector_join(dhtable_ctx *ctx, void *dst, void *src) {
 
 	/* Validate ctx,
 	 * Get number of elements,
-	 * for each element, search dst,
+	 * for each element, search dst
+	 * with the stored hash,
 	 * if there, replace, else, put.
 	 */
 	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
 		return 1;
 		);
 
-	dvec dstvec = (dvec) dst;
-	dvec srcvec = (dvec) src;
+	struct _dhtable_vector *dstvec = (struct _dhtable_vector*) dst;
+	struct _dhtable_vector *srcvec = (struct _dhtable_vector*) src;
 
-	size_t count = dvec_size(src);
+	size_t count = dvec_size(srcvec->entries);
 
 	size_t i;
 	for (i = 0; i < count; i++) {
 
-		char *elem = dvec_get(srcvec, i);
+		char *elem = dvec_get(srcvec->entries, i);
+		uint64_t *hash = dvec_get(srcvec->hashes, i);
 
-		DASSERT(elem != NULL, IVECTOR, "Failed to get element.",
+		DASSERT(elem != NULL && hash != NULL, IVECTOR,
+			"Failed to get element.",
 			return 1;
 			);
 
 		void *key = (void*) elem;
 		void *value = (void*) (elem + ctx->key_size);
 
-		int index = _dhtable_vector_search(ctx, dstvec, key);
+		long index = _dhtable_vector_search(ctx, dstvec, *hash, key);
 
 		int t;
 		if (index < 0) {
-			t = _dhtable_vector_push(ctx, dstvec, key, value);
+			t = _dhtable_vector_push(ctx, dstvec, *hash, key,
+			                         value) == NULL;
 		} else {
 			t = _dhtable_vector_replace(ctx, dstvec, index, value);
 		}
@@ -390,3 +492,123 @@ int dhtable_vector_join(dhtable_ctx *ctx, void *dst, void *src) {
 
 	return 0;
 }
+
+/* Get the first element of a bucket. */
+void *dhtable_vector_begin(dhtable_ctx *ctx, void *bucket) {
+
+	/* Call dvec_begin,
+	 * return.
+	 */
+	return (void*) dvec_begin(((struct _dhtable_vector*) bucket)->entries);
+}
+
+/* Get the last element of a bucket. */
+void *dhtable_vector_end(dhtable_ctx *ctx, void *bucket) {
+
+	/* Call dvec_end,
+	 * return.
+	 */
+	return (void*) dvec_end(((struct _dhtable_vector*) bucket)->entries);
+}
+
+/* Get the previous element of a bucket. */
+void *dhtable_vector_prev(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Call dvec_prev,
+	 * return.
+	 */
+	return (void*) dvec_prev(((struct _dhtable_vector*) bucket)->entries,
+	                         (dvec_it) it);
+}
+
+/* Get the next element of a bucket. */
+void *dhtable_vector_next(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Call dvec_next,
+	 * return.
+	 */
+	return (void*) dvec_next(((struct _dhtable_vector*) bucket)->entries,
+	                         (dvec_it) it);
+}
+
+/* Get the entry at an iterator. */
+void *dhtable_vector_iget(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Call dvec_iget, the element
+	 * is already key then value,
+	 * return.
+	 */
+	return dvec_iget(((struct _dhtable_vector*) bucket)->entries,
+	                 (dvec_it) it);
+}
+
+/* Get the stored hash at an iterator. */
+uint64_t dhtable_vector_ihsh(dhtable_ctx *ctx, void *bucket, void *it) {
+
+	/* Call dvec_iget on the
+	 * hashes, return.
+	 */
+	uint64_t *hash = (uint64_t*)
+		dvec_iget(((struct _dhtable_vector*) bucket)->hashes, (dvec_it) it);
+
+	DASSERT(hash != NULL, IVECTOR, "Failed to get hash.",
+		return 0;
+		);
+
+	return *hash;
+}
+
+/* Prefetch a bucket's vectors. */
+void dhtable_vector_prefetch(dhtable_ctx *ctx, void *bucket, uint64_t hash) {
+
+	/* The vectors are opaque, so
+	 * fetch their headers.
+	 */
+	struct _dhtable_vector *vec = (struct _dhtable_vector*) bucket;
+
+	DHTABLE_PREFETCH(vec->hashes);
+	DHTABLE_PREFETCH(vec->entries);
+}
+
+/* Get the bytes a bucket holds.
+ * Vectors count their allocated
+ * capacity, spare room included.
+ */
+size_t dhtable_vector_bytes(dhtable_ctx *ctx, void *bucket) {
+
+	struct _dhtable_vector *vec = (struct _dhtable_vector*) bucket;
+
+	return sizeof(struct _dhtable_vector) +
+		dvec_capacity(vec->entries) * dvec_elem_size(vec->entries) +
+		dvec_capacity(vec->hashes) * dvec_elem_size(vec->hashes);
+}
+
+/* Find a key, or push it with
+ * a zeroed value. Returns the value,
+ * NULL on error.
+ */
+void *dhtable_vector_emplace(dhtable_ctx *ctx, void *bucket,
+                             uint64_t hash, void *key, int *inserted) {
+
+	/* Verify context, key, search,
+	 * if missing, push, return.
+	 */
+	DASSERT(_dhtable_ctx_valid(ctx), IHASHTABLE, "Given invalid context.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL, IHASHTABLE, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_vector *vec = (struct _dhtable_vector*) bucket;
+
+	long index = _dhtable_vector_search(ctx, vec, hash, key);
+
+	*inserted = index < 0;
+
+	char *entry = (index >= 0) ? (char*) dvec_get(vec->entries, index) :
+		_dhtable_vector_push(ctx, vec, hash, key, NULL);
+
+	return (entry == NULL) ? NULL : entry + ctx->key_size;
+}
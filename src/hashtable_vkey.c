@@ -0,0 +1,481 @@
+/** daelib/hashtable_vkey.c: Hashtable with variable length keys.
+ */
+
+
+/* The table is a plain dhtable whose fixed
+ * size key is a small entry: the key's hash,
+ * its length and where its bytes are. Compares
+ * check the hash and length before any bytes,
+ * so most misses never touch the key. The bytes
+ * are copied into an arena of chunks that are
+ * bumped and never moved, so entries hold a
+ * pointer into them, which the compare functor
+ * can follow without the table. Lookups build
+ * the same entry around the caller's bytes.
+ * Removed keys leave their bytes in the arena,
+ * all of which is freed with the table.
+ */
+
+
+/* Prototypes. */
+#include "hashtable_vkey.h"
+
+/* Assertions. */
+#include "assert.h"
+
+/* dhash_bytes(). */
+#include "hash.h"
+
+/* malloc(), free(). */
+#include <stdlib.h>
+
+/* memcpy(), memcmp(). */
+#include <string.h>
+
+
+/* Default error behaviour. */
+#ifndef ICALLER /* When fed bad data. */
+#define ICALLER DLOG
+#endif /* ICALLER */
+
+#ifndef IINTRA /* When table is invalid. */
+#define IINTRA DSTRIP
+#endif /* IINTRA */
+
+#ifndef IALLOC /* When malloc() fails. */
+#define IALLOC DLOG
+#endif /* IALLOC */
+
+#ifndef IHASHTABLE /* When the inner table fails. */
+#define IHASHTABLE DLOG
+#endif /* IHASHTABLE */
+
+
+/* Smallest arena chunk, larger
+ * keys get a chunk of their own.
+ */
+#define ARENA_CHUNK (1 << 16)
+
+
+/* The table's key. */
+struct _dhtable_vkey_key {
+
+	uint64_t hash;
+	const char *bytes;
+	size_t len;
+};
+
+/* An arena chunk, bumped from data. */
+struct _dhtable_vkey_chunk {
+
+	struct _dhtable_vkey_chunk *next;
+	size_t size;
+	size_t used;
+	char data[];
+};
+
+/* Base definition of a variable key hashtable. */
+struct daelib_hashtable_vkey {
+
+	dhtable table;
+
+	/* Newest chunk first. */
+	struct _dhtable_vkey_chunk *chunks;
+	size_t arena;
+};
+
+
+/* Determine if a table is valid.
+ * If valid return nonzero. Else return zero.
+ */
+static int _dhtable_vkey_valid(dhtable_vkey table) {
+
+	/* Check for an inner table
+	 * keyed by entries.
+	 */
+	if (table->table == NULL)
+		return 0;
+
+	if (dhtable_key_size(table->table) != sizeof(struct _dhtable_vkey_key))
+		return 0;
+
+	return 1;
+}
+
+/* Hash functor, returns the cached hash.
+ * Entries may sit unaligned in buckets.
+ */
+static uint64_t _dhtable_vkey_hsh(size_t key_size, void *key) {
+
+	uint64_t hash;
+	memcpy(&hash, key, sizeof(hash));
+
+	return hash;
+}
+
+/* Compare functor, orders by hash, then
+ * length, then bytes, so ordered backends
+ * work too. Zero if equal.
+ */
+static int _dhtable_vkey_cmp(size_t key_size, void *keyl, void *keyr) {
+
+	struct _dhtable_vkey_key l, r;
+	memcpy(&l, keyl, sizeof(l));
+	memcpy(&r, keyr, sizeof(r));
+
+	if (l.hash != r.hash)
+		return l.hash < r.hash ? -1 : 1;
+
+	if (l.len != r.len)
+		return l.len < r.len ? -1 : 1;
+
+	if (l.len == 0 || l.bytes == r.bytes)
+		return 0;
+
+	return memcmp(l.bytes, r.bytes, l.len);
+}
+
+/* Copy a key into the arena.
+ * Returns the copy, NULL on error.
+ */
+static const char *_dhtable_vkey_store(dhtable_vkey table,
+                                       const void *key, size_t len) {
+
+	/* Take a new chunk if the newest
+	 * is full, bump, copy, return.
+	 */
+	struct _dhtable_vkey_chunk *chunk = table->chunks;
+
+	if (chunk == NULL || chunk->size - chunk->used < len) {
+		size_t size = (len > ARENA_CHUNK) ? len : ARENA_CHUNK;
+
+		chunk = (struct _dhtable_vkey_chunk*)
+			malloc(sizeof(struct _dhtable_vkey_chunk) + size);
+
+		DASSERT(chunk != NULL, IALLOC, "Failed to allocate arena chunk.",
+			return NULL;
+			);
+
+		chunk->size = size;
+		chunk->used = 0;
+
+		/* A full chunk stays behind
+		 * the head for large keys.
+		 */
+		if (len >= ARENA_CHUNK && table->chunks != NULL) {
+			chunk->next = table->chunks->next;
+			table->chunks->next = chunk;
+		} else {
+			chunk->next = table->chunks;
+			table->chunks = chunk;
+		}
+
+		table->arena += sizeof(struct _dhtable_vkey_chunk) + size;
+	}
+
+	char *copy = chunk->data + chunk->used;
+
+	memcpy(copy, key, len);
+	chunk->used += len;
+
+	return copy;
+}
+
+/* Initialize a table. */
+dhtable_vkey dhtable_vkey_init(size_t buckets, size_t val_size,
+                               struct dhtable_backend *backend) {
+
+	/* Allocate the table, init the
+	 * inner table, clear the arena,
+	 * return.
+	 */
+	dhtable_vkey table = (dhtable_vkey)
+		malloc(sizeof(struct daelib_hashtable_vkey));
+
+	DASSERT(table != NULL, IALLOC, "Failed to allocate table.",
+		return NULL;
+		);
+
+	table->table = dhtable_init64(buckets, sizeof(struct _dhtable_vkey_key),
+	                              val_size, _dhtable_vkey_cmp,
+	                              _dhtable_vkey_hsh, backend);
+
+	DASSERT(table->table != NULL, IHASHTABLE, "Failed to init table.",
+		free(table);
+		return NULL;
+		);
+
+	table->chunks = NULL;
+	table->arena = 0;
+
+	return table;
+}
+
+/* Free a table and its arena. */
+int dhtable_vkey_kill(dhtable_vkey table) {
+
+	/* Validate the table, kill the
+	 * inner table, free the chunks,
+	 * free, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_vkey_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	dhtable_kill(table->table);
+
+	while (table->chunks != NULL) {
+		struct _dhtable_vkey_chunk *next = table->chunks->next;
+
+		free(table->chunks);
+		table->chunks = next;
+	}
+
+	free(table);
+
+	return 0;
+}
+
+/* Hash the key with dhash_bytes,
+ * get, return the value.
+ */
+void *dhtable_vkey_get(dhtable_vkey table, const void *key, size_t len) {
+
+	return dhtable_vkey_get_hashed(table, key, len,
+	                               dhash_bytes(key, len, 0));
+}
+
+/* Hash the key with dhash_bytes,
+ * put, return the status.
+ */
+int dhtable_vkey_put(dhtable_vkey table, const void *key, size_t len,
+                     void *value) {
+
+	return dhtable_vkey_put_hashed(table, key, len,
+	                               dhash_bytes(key, len, 0), value);
+}
+
+/* Hash the key with dhash_bytes,
+ * remove, return the status.
+ */
+int dhtable_vkey_rm(dhtable_vkey table, const void *key, size_t len) {
+
+	return dhtable_vkey_rm_hashed(table, key, len,
+	                              dhash_bytes(key, len, 0));
+}
+
+/* Wrap the caller's key in an
+ * entry, get, return the value.
+ */
+void *dhtable_vkey_get_hashed(dhtable_vkey table, const void *key,
+                              size_t len, uint64_t hash) {
+
+	/* Validate the table, key,
+	 * build the entry, get, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return NULL;
+		);
+
+	DASSERT(_dhtable_vkey_valid(table), IINTRA, "Given invalid table.",
+		return NULL;
+		);
+
+	DASSERT(key != NULL || len == 0, ICALLER, "Given invalid key.",
+		return NULL;
+		);
+
+	struct _dhtable_vkey_key probe = { hash, (const char*) key, len };
+
+	return dhtable_get(table->table, &probe);
+}
+
+/* Emplace the caller's key, move
+ * new keys into the arena, set
+ * the value, return the status.
+ */
+int dhtable_vkey_put_hashed(dhtable_vkey table, const void *key,
+                            size_t len, uint64_t hash, void *value) {
+
+	/* Validate the table, key, build
+	 * the entry, emplace, if new, copy
+	 * the bytes and repoint the stored
+	 * entry, set the value, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_vkey_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(key != NULL || len == 0, ICALLER, "Given invalid key.",
+		return 1;
+		);
+
+	struct _dhtable_vkey_key probe = { hash, (const char*) key, len };
+
+	int inserted;
+	char *slot = (char*) dhtable_emplace(table->table, &probe, &inserted);
+
+	DASSERT(slot != NULL, IHASHTABLE, "Failed to put key.",
+		return 1;
+		);
+
+	if (inserted && len != 0) {
+		const char *bytes = _dhtable_vkey_store(table, key, len);
+
+		DASSERT(bytes != NULL, IALLOC, "Failed to store key.",
+			dhtable_rm(table->table, &probe);
+			return 1;
+			);
+
+		struct _dhtable_vkey_key stored = { hash, bytes, len };
+
+		/* Every backend keeps the key directly
+		 * before the value, and the copy orders
+		 * the same, so repoint it in place.
+		 */
+		memcpy(slot - sizeof(stored), &stored, sizeof(stored));
+	}
+
+	size_t val_size = dhtable_val_size(table->table);
+
+	if (value != NULL && val_size != 0)
+		memcpy(slot, value, val_size);
+
+	return 0;
+}
+
+/* Wrap the caller's key in an entry,
+ * remove, return the status.
+ */
+int dhtable_vkey_rm_hashed(dhtable_vkey table, const void *key,
+                           size_t len, uint64_t hash) {
+
+	/* Validate the table, key,
+	 * build the entry, rm, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_vkey_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	DASSERT(key != NULL || len == 0, ICALLER, "Given invalid key.",
+		return 1;
+		);
+
+	struct _dhtable_vkey_key probe = { hash, (const char*) key, len };
+
+	return dhtable_rm(table->table, &probe);
+}
+
+/* Return the number of keys. */
+size_t dhtable_vkey_size(dhtable_vkey table) {
+
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	return dhtable_size(table->table);
+}
+
+/* Return the bytes held by the arena. */
+size_t dhtable_vkey_arena(dhtable_vkey table) {
+
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	return table->arena;
+}
+
+/* Return the value size. */
+size_t dhtable_vkey_val_size(dhtable_vkey table) {
+
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	return dhtable_val_size(table->table);
+}
+
+/* Stats of the inner table,
+ * with the arena in its bytes.
+ */
+int dhtable_vkey_stats(dhtable_vkey table, struct dhtable_stats *stats) {
+
+	/* Validate the table, get
+	 * the stats, add the arena,
+	 * return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 1;
+		);
+
+	DASSERT(_dhtable_vkey_valid(table), IINTRA, "Given invalid table.",
+		return 1;
+		);
+
+	int t = dhtable_stats(table->table, stats);
+
+	if (t != 0)
+		return t;
+
+	stats->bytes += sizeof(struct daelib_hashtable_vkey) + table->arena;
+
+	if (stats->buckets != 0)
+		stats->bytes_per_bucket = (double) stats->bytes / stats->buckets;
+
+	return 0;
+}
+
+/* A foreach in progress. */
+struct _dhtable_vkey_walk {
+
+	dhtable_vkey_visit visit;
+	void *arg;
+};
+
+/* Unwrap an entry for the visitor. */
+static int _dhtable_vkey_visit(void *key, void *value, void *arg) {
+
+	struct _dhtable_vkey_walk *walk = (struct _dhtable_vkey_walk*) arg;
+
+	struct _dhtable_vkey_key entry;
+	memcpy(&entry, key, sizeof(entry));
+
+	return walk->visit(entry.bytes, entry.len, value, walk->arg);
+}
+
+/* Visit every pair. */
+int dhtable_vkey_foreach(dhtable_vkey table, dhtable_vkey_visit visit,
+                         void *arg) {
+
+	/* Validate the table, visitor,
+	 * walk the inner table, return.
+	 */
+	DASSERT(table != NULL, ICALLER, "Given NULL table.",
+		return 0;
+		);
+
+	DASSERT(_dhtable_vkey_valid(table), IINTRA, "Given invalid table.",
+		return 0;
+		);
+
+	DASSERT(visit != NULL, ICALLER, "Given NULL visitor.",
+		return 0;
+		);
+
+	struct _dhtable_vkey_walk walk = { visit, arg };
+
+	return dhtable_foreach(table->table, _dhtable_vkey_visit, &walk);
+}
@@ -0,0 +1,81 @@
+/** daelib/alloc.h: Pluggable allocators.
+ */
+
+#ifndef __DAELIB_ALLOC_H
+#define __DAELIB_ALLOC_H
+
+/* Containers take their memory from an
+ * allocator, given at init and kept for
+ * their life, or libc's when given NULL.
+ * Frees and reallocs are told the size,
+ * so arenas and pools need no headers. A
+ * table or vector built on an arena can be
+ * dropped with the arena, never killed.
+ * You can find exacting detail in alloc.c.
+ */
+
+
+/* size_t */
+#include <stdlib.h>
+
+
+/* An allocator. Alloc, aligned and
+ * realloc return NULL on failure,
+ * realloc keeping ptr. Aligned takes
+ * a power of two, and its blocks are
+ * freed with free. Realloc is never
+ * given NULL, nor free NULL.
+ */
+struct dalloc {
+
+	void *(*alloc)  (void *ctx, size_t size);
+	void *(*aligned)(void *ctx, size_t align, size_t size);
+	void *(*realloc)(void *ctx, void *ptr, size_t old_size, size_t new_size);
+	void  (*free)   (void *ctx, void *ptr, size_t size);
+
+	void *ctx;
+};
+
+
+/* malloc(), posix_memalign(), realloc(), free(). */
+extern struct dalloc dalloc_libc;
+
+
+/* Allocate size bytes. */
+static inline void *dalloc_alloc(struct dalloc *alloc, size_t size) {
+
+	return alloc->alloc(alloc->ctx, size);
+}
+
+/* Allocate size bytes aligned
+ * to align, a power of two.
+ */
+static inline void *dalloc_aligned(struct dalloc *alloc, size_t align,
+                                   size_t size) {
+
+	return alloc->aligned(alloc->ctx, align, size);
+}
+
+/* Resize a block, allocating
+ * if it is NULL.
+ */
+static inline void *dalloc_realloc(struct dalloc *alloc, void *ptr,
+                                   size_t old_size, size_t new_size) {
+
+	if (ptr == NULL)
+		return alloc->alloc(alloc->ctx, new_size);
+
+	return alloc->realloc(alloc->ctx, ptr, old_size, new_size);
+}
+
+/* Free a block of size bytes,
+ * ignoring NULL.
+ */
+static inline void dalloc_free(struct dalloc *alloc, void *ptr, size_t size) {
+
+	if (ptr != NULL)
+		alloc->free(alloc->ctx, ptr, size);
+}
+
+
+#endif // __DAELIB_ALLOC_H
@@ -0,0 +1,81 @@
+/** daelib/hash.h: Fast 64 bit hash functions.
+ */
+
+#ifndef __DAELIB_HASH_H
+#define __DAELIB_HASH_H
+
+/* Non-cryptographic hashes for containers.
+ * The byte hash is in the style of wyhash,
+ * and covers the whole of its input. The
+ * integer mixers are cheaper, and suit
+ * fixed size keys.
+ * You can find exacting detail in hash.c.
+ */
+
+
+/* size_t. */
+#include <stdlib.h>
+
+/* uint64_t, uint32_t. */
+#include <stdint.h>
+
+
+/* Hash a block of memory. */
+uint64_t dhash_bytes(const void *data, size_t size, uint64_t seed);
+
+/* Streamed byte hash, for keys built
+ * from pieces. Init with a seed, update
+ * with each piece, final gives what
+ * dhash_bytes would of the whole.
+ */
+#define DHASH_BLOCK 48
+#define DHASH_TAIL  16
+
+struct dhash_state {
+
+	uint64_t seed, see1, see2;
+	size_t size;
+	size_t fill;
+
+	/* The last 16 bytes consumed,
+	 * then those not yet consumed.
+	 */
+	unsigned char buff[DHASH_TAIL + DHASH_BLOCK * 2];
+};
+
+void     dhash_init  (struct dhash_state *state, uint64_t seed);
+void     dhash_update(struct dhash_state *state, const void *data, size_t size);
+uint64_t dhash_final (struct dhash_state *state);
+
+/* Mix integers. */
+uint64_t dhash_u32(uint32_t num);
+uint64_t dhash_u64(uint64_t num);
+
+/* Mix a hash into a bucket or slot index,
+ * by the first half of the murmur finalizer.
+ * Backends tag entries with the top bits of
+ * hash * golden ratio, so an index taken from
+ * that product would give each bucket's
+ * entries one tag. Index by this instead.
+ */
+static inline uint64_t dhash_index_mix(uint64_t hash) {
+
+	hash ^= hash >> 33;
+	hash *= 0xff51afd7ed558ccdull;
+	hash ^= hash >> 33;
+
+	return hash;
+}
+
+
+/* Key functors, matching dhtable_key_hsh64.
+ * dhash_key picks a specialised
+ * hash from the key size.
+ */
+uint64_t dhash_key  (size_t key_size, void *key);
+uint64_t dhash_key4 (size_t key_size, void *key);
+uint64_t dhash_key8 (size_t key_size, void *key);
+uint64_t dhash_key16(size_t key_size, void *key);
+
+
+#endif // __DAELIB_HASH_H
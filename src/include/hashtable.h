@@ -1,7 +1,4 @@
 /* daelib/hashtable.h: Hashtable implementation.
- * TODO: Iterators.
- * TODO: Optional resizing.
- * TODO: Backends.
  */
 
 #ifndef __DAELIB_HASHTABLE_H
@@ -16,6 +13,12 @@
 /* size_t. */
 #include <stdlib.h>
 
+/* uint64_t. */
+#include <stdint.h>
+
+/* struct dalloc. */
+#include "alloc.h"
+
 
 /* Opaque hashtable structure. */
 struct daelib_hashtable;
@@ -24,24 +27,80 @@ struct daelib_hashtable;
 typedef struct daelib_hashtable *dhtable;
 
 
-/* Iterator structure. */
+/* Iterator structure. Passed by value,
+ * it is NULL past either end. Iterators
+ * die when the table is put or rm'd.
+ */
 struct dhtable_iterator {
 
-	int bucket;
+	size_t bucket;
 	void *it;
 };
 
 /* For sanity. */
-typedef struct _dhtable_it dhtable_it;
+typedef struct dhtable_iterator dhtable_it;
 
 
 /* Functors to compare and hash
- * keys. NULL for treating *key as
- * an integral value, and casting
- * to an int. Cmp tests all memory.
+ * keys. NULL for hashing all of
+ * the key with dhash_key, see hash.h.
+ * Cmp tests all memory.
+ */
+typedef int      (*dhtable_key_hsh)  (size_t key_size, void *key);
+typedef uint64_t (*dhtable_key_hsh64)(size_t key_size, void *key);
+typedef int      (*dhtable_key_cmp)  (size_t key_size, void *keyl, void *keyr);
+
+/* Functor for dhtable_foreach.
+ * Return nonzero to stop.
+ */
+typedef int (*dhtable_visit)(void *key, void *value, void *arg);
+
+/* Functor for dhtable_update. Value
+ * is zeroed if the key was inserted.
+ */
+typedef void (*dhtable_updater)(void *key, void *value,
+                                int inserted, void *arg);
+
+/* Bucket indexing. Modulo is the
+ * default. Mask rounds the bucket
+ * count up to a power of two, and
+ * fastrange multiplies and shifts.
+ * Both avoid division.
+ */
+enum dhtable_index {
+
+	DHTABLE_MODULO,
+	DHTABLE_MASK,
+	DHTABLE_FASTRANGE
+};
+
+/* Statistics, from dhtable_stats. Chains
+ * counts the buckets holding each number
+ * of entries, the last counting all longer
+ * ones. Probes are key compares per lookup,
+ * averaged over up to DHTABLE_STATS_SAMPLES
+ * hits and as many misses. Bytes includes
+ * the table and every bucket.
  */
-typedef int (*dhtable_key_hsh)(size_t key_size, void *key);
-typedef int (*dhtable_key_cmp)(size_t key_size, void *keyl, void *keyr);
+#define DHTABLE_STATS_CHAINS 16
+#define DHTABLE_STATS_SAMPLES 1024
+
+struct dhtable_stats {
+
+	size_t count;
+	size_t buckets;
+	size_t occupied;
+	double load;
+
+	size_t chains[DHTABLE_STATS_CHAINS];
+	size_t max_chain;
+
+	double hit_probes;
+	double miss_probes;
+
+	size_t bytes;
+	double bytes_per_bucket;
+};
 
 /* Backend structure. Used in init.
  * You can find example backends in
@@ -53,10 +112,23 @@ struct dhtable_backend;
 
 /* Hashtable functions. */
 
-/* Init/kill/copy. */
+/* Init/kill/copy.
+ * Init with 0 buckets for a
+ * table that resizes itself.
+ * Init_ex takes an allocator for
+ * the table and its buckets, NULL
+ * for libc, which copies share.
+ */
 dhtable dhtable_init(size_t buckets, size_t key_size, size_t val_size,
                      dhtable_key_cmp key_cmp, dhtable_key_hsh key_hsh,
                      struct dhtable_backend *backend);
+dhtable dhtable_init64(size_t buckets, size_t key_size, size_t val_size,
+                       dhtable_key_cmp key_cmp, dhtable_key_hsh64 key_hsh,
+                       struct dhtable_backend *backend);
+dhtable dhtable_init_ex(size_t buckets, size_t key_size, size_t val_size,
+                        dhtable_key_cmp key_cmp, dhtable_key_hsh64 key_hsh,
+                        struct dhtable_backend *backend,
+                        struct dalloc *alloc);
 int     dhtable_kill(dhtable table);
 dhtable dhtable_copy(dhtable table);
 
@@ -65,15 +137,78 @@ void *dhtable_get(dhtable table, void *key);
 int   dhtable_put(dhtable table, void *key, void *value);
 int   dhtable_rm (dhtable table, void *key);
 
-/* Size/metadata. */
+/* Get or insert in one probe. New
+ * values are zeroed, and follow the
+ * stored key directly. The pointer lives
+ * until the next write to the table.
+ */
+void *dhtable_emplace(dhtable table, void *key, int *inserted);
+int   dhtable_update (dhtable table, void *key, dhtable_updater fn, void *arg);
+
+/* Get without stepping a resize.
+ * Safe from concurrent readers.
+ */
+void *dhtable_peek(dhtable table, void *key);
+
+/* Batched Get/Set/Rm. Keys and values
+ * are packed back to back. Misses on
+ * a batch overlap, so large tables
+ * run faster than key by key.
+ */
+int dhtable_get_batch(dhtable table, size_t n, void *keys, void **vals);
+int dhtable_put_batch(dhtable table, size_t n, void *keys, void *vals);
+int dhtable_rm_batch (dhtable table, size_t n, void *keys);
+
+/* Size/metadata. Size is O(1). Stats
+ * walks every bucket, finishing any resize.
+ */
 size_t dhtable_size(dhtable table);
+int    dhtable_stats(dhtable table, struct dhtable_stats *stats);
 size_t dhtable_key_size(dhtable table);
 size_t dhtable_val_size(dhtable table);
 
-/* Range operations. */
+/* Resizing. Buckets are migrated
+ * a few at a time by later calls.
+ */
+int dhtable_set_load(dhtable table, double min_load, double max_load);
+
+/* Indexing. Call on an empty table. */
+int dhtable_set_index(dhtable table, enum dhtable_index index);
+
+/* Threads for copy and join, which split
+ * buckets between them. Join uses those of
+ * dst. Backends with per-table state, like
+ * dhtable_list, stay on one thread.
+ */
+int dhtable_set_threads(dhtable table, size_t threads);
+
+/* Range operations. Joining tables with
+ * different bucket counts rehashes.
+ */
 int dhtable_join(dhtable dst, dhtable src);
 
-/* Iterations. */
+/* Snapshots. Save writes the table as an
+ * image that open maps read only, serving
+ * get straight from the file. Open needs the
+ * sizes and functors the table was saved
+ * with, and fails on another version, size
+ * or hash width. The image is trusted past
+ * its header and bucket offsets. Writes to
+ * a mapped table fail.
+ */
+int     dhtable_save(dhtable table, const char *path);
+dhtable dhtable_open_mmap  (const char *path, size_t key_size,
+                            size_t val_size, dhtable_key_cmp key_cmp,
+                            dhtable_key_hsh key_hsh);
+dhtable dhtable_open_mmap64(const char *path, size_t key_size,
+                            size_t val_size, dhtable_key_cmp key_cmp,
+                            dhtable_key_hsh64 key_hsh);
+
+/* Iterations. Begin and end finish any
+ * resize, and give the first and last
+ * entries. Iget gives the key, with the
+ * value directly after it.
+ */
 dhtable_it dhtable_begin(dhtable table);
 dhtable_it dhtable_end  (dhtable table);
 
@@ -82,13 +217,42 @@ dhtable_it dhtable_next(dhtable table, dhtable_it it);
 
 void      *dhtable_iget(dhtable table, dhtable_it it);
 
+/* Visit every entry, the fastest scan. */
+int dhtable_foreach(dhtable table, dhtable_visit visit, void *arg);
+
 
 /* Builtin backends. */
-/* TODO: These. */
+
+/* The default. Each bucket is a small vector, scanned by hash. */
 extern struct dhtable_backend dhtable_vector;
-extern struct dhtable_backend dhtable_btree_vector;
+
+/* Each bucket is a linked list of nodes
+ * from a per-table pool. Pointers from get
+ * stay valid, across resizes, until that
+ * key is removed.
+ */
 extern struct dhtable_backend dhtable_list;
+
+/* Each bucket is a vector sorted by key,
+ * binary searched. Needs a key_cmp that
+ * orders. Suits read-mostly tables.
+ */
+extern struct dhtable_backend dhtable_btree_vector;
+
+/* Each bucket is a B+ tree, so long buckets
+ * stay O(log n). Needs a key_cmp that orders.
+ */
 extern struct dhtable_backend dhtable_btree;
 
+/* Open addressing, each bucket is a whole
+ * growing table. Use very few buckets.
+ */
+extern struct dhtable_backend dhtable_flat;
+
+/* Open addressing, probed 16 control
+ * bytes at a time. Use very few buckets.
+ */
+extern struct dhtable_backend dhtable_swiss;
+
 
 #endif // __DAELIB_HASHTABLE_H
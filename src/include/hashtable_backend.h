@@ -24,12 +24,45 @@ struct dhtable_backend_context {
 
 	dhtable_key_hsh key_hsh;
 	dhtable_key_cmp key_cmp;
+
+	/* Used over key_hsh when set. */
+	dhtable_key_hsh64 key_hsh64;
+
+	/* Shared by every bucket of a
+	 * table, owned by the backend.
+	 */
+	void *state;
+
+	/* Where buckets take their
+	 * memory. Never NULL.
+	 */
+	struct dalloc *alloc;
 };
 
 /* For sanity. */
 typedef struct dhtable_backend_context dhtable_ctx;
 
 
+/* Hint that memory will be read soon. */
+#ifdef __GNUC__
+#define DHTABLE_PREFETCH(addr) __builtin_prefetch((addr), 0, 3)
+#else
+#define DHTABLE_PREFETCH(addr) ((void) (addr))
+#endif /* __GNUC__ */
+
+
+/* Hash a key with whichever
+ * functor the context has.
+ */
+static inline uint64_t dhtable_ctx_hash(dhtable_ctx *ctx, void *key) {
+
+	if (ctx->key_hsh64 != NULL)
+		return ctx->key_hsh64(ctx->key_size, key);
+
+	return (unsigned) ctx->key_hsh(ctx->key_size, key);
+}
+
+
 /* Hashtable backend interface. */
 typedef void  *(*dhtable_backend_init)(dhtable_ctx *ctx);
 typedef int    (*dhtable_backend_kill)(dhtable_ctx *ctx, void *bucket);
@@ -37,15 +70,26 @@ typedef void  *(*dhtable_backend_copy)(dhtable_ctx *ctx, void *bucket);
 
 typedef size_t (*dhtable_backend_size)(dhtable_ctx *ctx, void *bucket);
 
+/* Get, put and rm are given the key's
+ * hash, from dhtable_ctx_hash, so
+ * backends need not hash again.
+ */
 typedef void  *(*dhtable_backend_get)  (dhtable_ctx *ctx, void *bucket,
-                                        void *key);
+                                        uint64_t hash, void *key);
 typedef int    (*dhtable_backend_put)  (dhtable_ctx *ctx, void *bucket,
-                                        void *key, void *value);
+                                        uint64_t hash, void *key, void *value);
 typedef int    (*dhtable_backend_rm)   (dhtable_ctx *ctx, void *bucket,
-                                        void *key);
+                                        uint64_t hash, void *key);
 
 typedef int (*dhtable_backend_join)(dhtable_ctx *ctx, void *dst, void *src);
 
+/* Bucket iterators are opaque, and NULL
+ * past either end. Next and prev given
+ * NULL return the first and last entries.
+ * Iget returns the entry, which is the
+ * key directly followed by the value.
+ */
+
 typedef void *(*dhtable_backend_begin)(dhtable_ctx *ctx, void *bucket);
 typedef void *(*dhtable_backend_end)  (dhtable_ctx *ctx, void *bucket);
 
@@ -54,6 +98,51 @@ typedef void *(*dhtable_backend_next)(dhtable_ctx *ctx, void *bucket, void *it);
 
 typedef void *(*dhtable_backend_iget)(dhtable_ctx *ctx, void *bucket, void *it);
 
+/* Optional, for backends storing hashes.
+ * Returns the hash of the entry at it.
+ */
+typedef uint64_t (*dhtable_backend_ihsh)(dhtable_ctx *ctx, void *bucket,
+                                         void *it);
+
+/* Optional, used by batches. Prefetches
+ * what a lookup of hash will read,
+ * without waiting on memory.
+ */
+typedef void (*dhtable_backend_prefetch)(dhtable_ctx *ctx, void *bucket,
+                                         uint64_t hash);
+
+/* Optional. Set up and tear down
+ * ctx->state, once per table. Setup
+ * returns nonzero on error.
+ */
+typedef int  (*dhtable_backend_setup)   (dhtable_ctx *ctx);
+typedef void (*dhtable_backend_teardown)(dhtable_ctx *ctx);
+
+/* Optional, used by resizing. Moves the
+ * entry at it from src to dst, which does
+ * not hold its key, without copying it.
+ * Lets entries keep their address.
+ */
+typedef int (*dhtable_backend_move)(dhtable_ctx *ctx, void *dst, void *src,
+                                    void *it, uint64_t hash);
+
+/* Optional, for dhtable_stats. The bytes
+ * a bucket has allocated. When unset, its
+ * entries are counted instead.
+ */
+typedef size_t (*dhtable_backend_bytes)(dhtable_ctx *ctx, void *bucket);
+
+/* Optional. Find a key, or add it with a
+ * zeroed value, in one probe. Returns the
+ * value, setting *inserted if it was added,
+ * NULL on error. Unset, the table gets,
+ * then puts. Either way the stored key
+ * sits directly before the value.
+ */
+typedef void *(*dhtable_backend_emplace)(dhtable_ctx *ctx, void *bucket,
+                                         uint64_t hash, void *key,
+                                         int *inserted);
+
 /* Holding structure. */
 struct dhtable_backend {
 
@@ -76,6 +165,19 @@ struct dhtable_backend {
 	dhtable_backend_next next;
 
 	dhtable_backend_iget iget;
+
+	dhtable_backend_ihsh ihsh;
+
+	dhtable_backend_prefetch prefetch;
+
+	dhtable_backend_setup setup;
+	dhtable_backend_teardown teardown;
+
+	dhtable_backend_move move;
+
+	dhtable_backend_bytes bytes;
+
+	dhtable_backend_emplace emplace;
 };
 
 
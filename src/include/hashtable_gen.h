@@ -0,0 +1,288 @@
+/* daelib/hashtable_gen.h: Type specialised hashtables.
+ */
+
+#ifndef __DAELIB_HASHTABLE_GEN_H
+#define __DAELIB_HASHTABLE_GEN_H
+
+/* DHTABLE_DEFINE(name, K, V, hash_fn, eq_fn)
+ * emits a hashtable from K to V as static
+ * inline functions, so the sizes, hash and
+ * compare are all known to the compiler.
+ * hash_fn(key) gives a uint64_t, eq_fn(l, r)
+ * is nonzero on equal keys. Either may be
+ * a macro.
+ *
+ * The table is open addressed and linearly
+ * probed, with a byte per slot marking use.
+ * Removal shifts later entries back rather
+ * than leaving tombstones. It doubles past
+ * a load of 3/4.
+ *
+ * Emitted, for a name of imap:
+ *   struct imap *imap_init(size_t slots);
+ *   int          imap_kill(struct imap *table);
+ *   V           *imap_get (struct imap *table, K key);
+ *   int          imap_put (struct imap *table, K key, V value);
+ *   int          imap_rm  (struct imap *table, K key);
+ *   size_t       imap_size(struct imap *table);
+ * Pointers from get die on the next put or rm.
+ */
+
+
+/* size_t, malloc(), free(). */
+#include <stdlib.h>
+
+/* uint64_t. */
+#include <stdint.h>
+
+/* memset(). */
+#include <string.h>
+
+/* Assertions. */
+#include "assert.h"
+
+
+/* Default error behaviour. Namespaced, as
+ * this header is included by users, and
+ * kept defined, as DHTABLE_DEFINE expands
+ * in their files.
+ */
+#ifndef DHTABLE_GEN_ICALLER /* When fed bad data. */
+#define DHTABLE_GEN_ICALLER DLOG
+#endif /* DHTABLE_GEN_ICALLER */
+
+#ifndef DHTABLE_GEN_IALLOC /* When malloc() fails. */
+#define DHTABLE_GEN_IALLOC DLOG
+#endif /* DHTABLE_GEN_IALLOC */
+
+
+/* Inline hash and compare for
+ * integer and pointer keys.
+ */
+static inline uint64_t dhtable_gen_hash(uint64_t key) {
+
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdull;
+	key ^= key >> 33;
+	key *= 0xc4ceb9fe1a85ec53ull;
+	key ^= key >> 33;
+
+	return key;
+}
+
+#define DHTABLE_GEN_EQ(l, r) ((l) == (r))
+
+
+/* Define a table. */
+#define DHTABLE_DEFINE(name, K, V, hash_fn, eq_fn)                            \
+                                                                              \
+struct name##_slot {                                                          \
+                                                                              \
+	K key;                                                                    \
+	V val;                                                                    \
+};                                                                            \
+                                                                              \
+struct name {                                                                 \
+                                                                              \
+	size_t count;                                                             \
+	size_t mask;                                                              \
+	unsigned shift;                                                           \
+                                                                              \
+	unsigned char *used;                                                      \
+	struct name##_slot *slots;                                                \
+};                                                                            \
+                                                                              \
+/* Find the home slot of a key. */                                            \
+static inline size_t name##_home(struct name *table, K key) {                 \
+                                                                              \
+	return (size_t) (((uint64_t) (hash_fn(key)) * 0x9E3779B97F4A7C15ull) >>   \
+	                 table->shift);                                           \
+}                                                                             \
+                                                                              \
+/* Allocate a clean slot array. */                                            \
+static inline int name##_alloc(struct name *table, size_t slots) {            \
+                                                                              \
+	unsigned bits = 3;                                                        \
+                                                                              \
+	while (((size_t) 1 << bits) < slots)                                      \
+		bits++;                                                               \
+                                                                              \
+	slots = (size_t) 1 << bits;                                               \
+                                                                              \
+	table->used = (unsigned char*) malloc(slots);                             \
+	table->slots = (struct name##_slot*)                                      \
+		malloc(sizeof(struct name##_slot) * slots);                           \
+                                                                              \
+	DASSERT(table->used != NULL && table->slots != NULL,                      \
+	        DHTABLE_GEN_IALLOC, "Failed to allocate slots.",                  \
+		free(table->used);                                                    \
+		free(table->slots);                                                   \
+		return 1;                                                             \
+		);                                                                    \
+                                                                              \
+	memset(table->used, 0, slots);                                            \
+                                                                              \
+	table->mask = slots - 1;                                                  \
+	table->shift = 64 - bits;                                                 \
+                                                                              \
+	return 0;                                                                 \
+}                                                                             \
+                                                                              \
+/* Initialize a table. */                                                     \
+static inline struct name *name##_init(size_t slots) {                        \
+                                                                              \
+	struct name *table = (struct name*) malloc(sizeof(struct name));          \
+                                                                              \
+	DASSERT(table != NULL, DHTABLE_GEN_IALLOC, "Failed to allocate table.",   \
+		return NULL;                                                          \
+		);                                                                    \
+                                                                              \
+	table->count = 0;                                                         \
+                                                                              \
+	if (name##_alloc(table, slots) != 0) {                                    \
+		free(table);                                                          \
+		return NULL;                                                          \
+	}                                                                         \
+                                                                              \
+	return table;                                                             \
+}                                                                             \
+                                                                              \
+/* Free a table. */                                                           \
+static inline int name##_kill(struct name *table) {                           \
+                                                                              \
+	DASSERT(table != NULL, DHTABLE_GEN_ICALLER, "Given NULL table.",          \
+		return 1;                                                             \
+		);                                                                    \
+                                                                              \
+	free(table->used);                                                        \
+	free(table->slots);                                                       \
+	free(table);                                                              \
+                                                                              \
+	return 0;                                                                 \
+}                                                                             \
+                                                                              \
+/* Find the slot of a key,                                                    \
+ * or the empty slot ending                                                   \
+ * its probe.                                                                 \
+ */                                                                           \
+static inline size_t name##_find(struct name *table, K key) {                 \
+                                                                              \
+	size_t i = name##_home(table, key);                                       \
+                                                                              \
+	while (table->used[i] && !(eq_fn(table->slots[i].key, key)))              \
+		i = (i + 1) & table->mask;                                            \
+                                                                              \
+	return i;                                                                 \
+}                                                                             \
+                                                                              \
+/* Double the slots, reinserting. */                                          \
+static inline int name##_grow(struct name *table) {                           \
+                                                                              \
+	struct name old = *table;                                                 \
+                                                                              \
+	if (name##_alloc(table, (old.mask + 1) * 2) != 0) {                       \
+		table->used = old.used;                                               \
+		table->slots = old.slots;                                             \
+		return 1;                                                             \
+	}                                                                         \
+                                                                              \
+	size_t i;                                                                 \
+	for (i = 0; i <= old.mask; i++) {                                         \
+                                                                              \
+		if (!old.used[i])                                                     \
+			continue;                                                         \
+                                                                              \
+		size_t j = name##_home(table, old.slots[i].key);                      \
+                                                                              \
+		while (table->used[j])                                                \
+			j = (j + 1) & table->mask;                                        \
+                                                                              \
+		table->used[j] = 1;                                                   \
+		table->slots[j] = old.slots[i];                                       \
+	}                                                                         \
+                                                                              \
+	free(old.used);                                                           \
+	free(old.slots);                                                          \
+                                                                              \
+	return 0;                                                                 \
+}                                                                             \
+                                                                              \
+/* Get a value, NULL if missing. */                                           \
+static inline V *name##_get(struct name *table, K key) {                      \
+                                                                              \
+	size_t i = name##_find(table, key);                                       \
+                                                                              \
+	return table->used[i] ? &table->slots[i].val : NULL;                      \
+}                                                                             \
+                                                                              \
+/* Put a pair, replacing any value. */                                        \
+static inline int name##_put(struct name *table, K key, V value) {            \
+                                                                              \
+	size_t i = name##_find(table, key);                                       \
+                                                                              \
+	if (table->used[i]) {                                                     \
+		table->slots[i].val = value;                                          \
+		return 0;                                                             \
+	}                                                                         \
+                                                                              \
+	if ((table->count + 1) * 4 > (table->mask + 1) * 3) {                     \
+                                                                              \
+		if (name##_grow(table) != 0)                                          \
+			return 1;                                                         \
+                                                                              \
+		i = name##_find(table, key);                                          \
+	}                                                                         \
+                                                                              \
+	table->used[i] = 1;                                                       \
+	table->slots[i].key = key;                                                \
+	table->slots[i].val = value;                                              \
+	table->count++;                                                           \
+                                                                              \
+	return 0;                                                                 \
+}                                                                             \
+                                                                              \
+/* Remove a key, shifting back                                                \
+ * any entry that probed past it.                                             \
+ */                                                                           \
+static inline int name##_rm(struct name *table, K key) {                      \
+                                                                              \
+	size_t i = name##_find(table, key);                                       \
+                                                                              \
+	if (!table->used[i])                                                      \
+		return 0;                                                             \
+                                                                              \
+	size_t j = i;                                                             \
+                                                                              \
+	for (;;) {                                                                \
+                                                                              \
+		j = (j + 1) & table->mask;                                            \
+                                                                              \
+		if (!table->used[j])                                                  \
+			break;                                                            \
+                                                                              \
+		/* Leave entries whose home                                           \
+		 * lies in (i, j].                                                    \
+		 */                                                                   \
+		size_t home = name##_home(table, table->slots[j].key);                \
+                                                                              \
+		if (((j - home) & table->mask) < ((j - i) & table->mask))             \
+			continue;                                                         \
+                                                                              \
+		table->slots[i] = table->slots[j];                                    \
+		i = j;                                                                \
+	}                                                                         \
+                                                                              \
+	table->used[i] = 0;                                                       \
+	table->count--;                                                           \
+                                                                              \
+	return 0;                                                                 \
+}                                                                             \
+                                                                              \
+/* Returns the element count. */                                              \
+static inline size_t name##_size(struct name *table) {                        \
+                                                                              \
+	return table->count;                                                      \
+}
+
+
+#endif // __DAELIB_HASHTABLE_GEN_H
@@ -0,0 +1,74 @@
+/* daelib/hashtable_rcu.h: Read-mostly hashtable.
+ */
+
+#ifndef __DAELIB_HASHTABLE_RCU_H
+#define __DAELIB_HASHTABLE_RCU_H
+
+/* A thread safe hashtable for data read far
+ * more often than it is written. Readers take
+ * no lock and never wait: they read a published
+ * bucket array. Writers copy the one bucket they
+ * change, publish the copy with an atomic swap
+ * and free the old one once no reader can hold it.
+ * You can find exacting detail in hashtable_rcu.c.
+ */
+
+
+/* dhtable functors, backends. */
+#include "hashtable.h"
+
+
+/* Opaque read-mostly hashtable structure. */
+struct daelib_hashtable_rcu;
+
+/* For sanity. */
+typedef struct daelib_hashtable_rcu *dhtable_rcu;
+
+/* A registered reader, one per thread. */
+typedef struct dhtable_rcu_reader *dhtable_rcu_reader;
+
+
+/* Read-mostly hashtable functions. */
+
+/* Init/kill.
+ * Init with 0 buckets for a table that
+ * grows itself, counts round up to a power
+ * of two. Kill only once no thread uses it.
+ */
+dhtable_rcu dhtable_rcu_init(size_t buckets, size_t key_size, size_t val_size,
+                             dhtable_key_cmp key_cmp,
+                             dhtable_key_hsh64 key_hsh,
+                             struct dhtable_backend *backend);
+int         dhtable_rcu_kill(dhtable_rcu table);
+
+/* Readers. A thread registers once, then
+ * brackets its gets with enter and leave,
+ * which never wait. Pointers from get
+ * are valid until leave.
+ */
+dhtable_rcu_reader dhtable_rcu_register  (dhtable_rcu table);
+int                dhtable_rcu_unregister(dhtable_rcu table,
+                                          dhtable_rcu_reader reader);
+
+void  dhtable_rcu_enter(dhtable_rcu_reader reader);
+void  dhtable_rcu_leave(dhtable_rcu_reader reader);
+void *dhtable_rcu_get  (dhtable_rcu table, void *key);
+
+/* Writers. Put and rm are serialized, and
+ * seen by every get entered after they
+ * return. Old buckets are freed once no
+ * reader holds them. Synchronize waits
+ * for every reader inside to leave, then
+ * frees them all.
+ */
+int dhtable_rcu_put(dhtable_rcu table, void *key, void *value);
+int dhtable_rcu_rm (dhtable_rcu table, void *key);
+int dhtable_rcu_synchronize(dhtable_rcu table);
+
+/* Size/metadata. Size is one atomic read. */
+size_t dhtable_rcu_size(dhtable_rcu table);
+size_t dhtable_rcu_key_size(dhtable_rcu table);
+size_t dhtable_rcu_val_size(dhtable_rcu table);
+
+
+#endif // __DAELIB_HASHTABLE_RCU_H
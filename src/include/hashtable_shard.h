@@ -0,0 +1,61 @@
+/* daelib/hashtable_shard.h: Concurrent sharded hashtable.
+ */
+
+#ifndef __DAELIB_HASHTABLE_SHARD_H
+#define __DAELIB_HASHTABLE_SHARD_H
+
+/* A thread safe hashtable. Keys are spread
+ * over independently locked shards, each a
+ * plain dhtable, so threads touching different
+ * shards never wait on each other.
+ * You can find exacting detail in hashtable_shard.c.
+ */
+
+
+/* dhtable, functors, backends. */
+#include "hashtable.h"
+
+
+/* Opaque sharded hashtable structure. */
+struct daelib_hashtable_shard;
+
+/* For sanity. */
+typedef struct daelib_hashtable_shard *dhtable_shard;
+
+
+/* Sharded hashtable functions. */
+
+/* Init/kill.
+ * Init with 0 shards for a default,
+ * shard counts round up to a power of two.
+ * Each shard resizes itself.
+ */
+dhtable_shard dhtable_shard_init(size_t shards, size_t key_size,
+                                 size_t val_size, dhtable_key_cmp key_cmp,
+                                 dhtable_key_hsh64 key_hsh,
+                                 struct dhtable_backend *backend);
+int           dhtable_shard_kill(dhtable_shard table);
+
+/* Get/Set/Rm.
+ * The pointer from get is only safe while
+ * no other thread writes that key. Getcpy
+ * copies the value out under the lock,
+ * returning 0 if found, 1 otherwise.
+ */
+void *dhtable_shard_get   (dhtable_shard table, void *key);
+int   dhtable_shard_getcpy(dhtable_shard table, void *key, void *value);
+int   dhtable_shard_put   (dhtable_shard table, void *key, void *value);
+int   dhtable_shard_rm    (dhtable_shard table, void *key);
+
+/* Size/metadata. Size is one atomic read. */
+size_t dhtable_shard_size(dhtable_shard table);
+size_t dhtable_shard_key_size(dhtable_shard table);
+size_t dhtable_shard_val_size(dhtable_shard table);
+
+/* Range operations. Tables need the
+ * same shard count and hash.
+ */
+int dhtable_shard_join(dhtable_shard dst, dhtable_shard src);
+
+
+#endif // __DAELIB_HASHTABLE_SHARD_H
@@ -0,0 +1,82 @@
+/* daelib/hashtable_vkey.h: Hashtable with variable length keys.
+ */
+
+#ifndef __DAELIB_HASHTABLE_VKEY_H
+#define __DAELIB_HASHTABLE_VKEY_H
+
+/* A hashtable keyed by strings or byte blobs
+ * of any length. Key bytes are copied once
+ * into a per-table arena, and the table
+ * itself holds a small fixed entry per key,
+ * so keys need not be padded to a maximum.
+ * You can find exacting detail in hashtable_vkey.c.
+ */
+
+
+/* dhtable, backends, dhtable_stats. */
+#include "hashtable.h"
+
+/* struct dhash_state. */
+#include "hash.h"
+
+
+/* Opaque variable key hashtable structure. */
+struct daelib_hashtable_vkey;
+
+/* For sanity. */
+typedef struct daelib_hashtable_vkey *dhtable_vkey;
+
+/* Functor for dhtable_vkey_foreach.
+ * Return nonzero to stop.
+ */
+typedef int (*dhtable_vkey_visit)(const void *key, size_t len,
+                                  void *value, void *arg);
+
+
+/* Variable key hashtable functions. */
+
+/* Init/kill.
+ * Init with 0 buckets for a
+ * table that resizes itself.
+ */
+dhtable_vkey dhtable_vkey_init(size_t buckets, size_t val_size,
+                               struct dhtable_backend *backend);
+int          dhtable_vkey_kill(dhtable_vkey table);
+
+/* Get/Set/Rm. Keys are hashed
+ * with dhash_bytes and seed 0.
+ */
+void *dhtable_vkey_get(dhtable_vkey table, const void *key, size_t len);
+int   dhtable_vkey_put(dhtable_vkey table, const void *key, size_t len,
+                       void *value);
+int   dhtable_vkey_rm (dhtable_vkey table, const void *key, size_t len);
+
+/* Get/Set/Rm with a hash the caller
+ * made, as from dhash_final with
+ * seed 0 over the key's pieces.
+ */
+void *dhtable_vkey_get_hashed(dhtable_vkey table, const void *key,
+                              size_t len, uint64_t hash);
+int   dhtable_vkey_put_hashed(dhtable_vkey table, const void *key,
+                              size_t len, uint64_t hash, void *value);
+int   dhtable_vkey_rm_hashed (dhtable_vkey table, const void *key,
+                              size_t len, uint64_t hash);
+
+/* Size/metadata. Arena counts the
+ * key bytes held, which removed keys
+ * keep until the table is killed.
+ */
+size_t dhtable_vkey_size (dhtable_vkey table);
+size_t dhtable_vkey_arena(dhtable_vkey table);
+size_t dhtable_vkey_val_size(dhtable_vkey table);
+int    dhtable_vkey_stats(dhtable_vkey table, struct dhtable_stats *stats);
+
+/* Visit every pair. Returns
+ * the nonzero visit result that
+ * stopped it, else 0.
+ */
+int dhtable_vkey_foreach(dhtable_vkey table, dhtable_vkey_visit visit,
+                         void *arg);
+
+
+#endif // __DAELIB_HASHTABLE_VKEY_H
@@ -14,6 +14,9 @@
 /* size_t */
 #include <stdlib.h>
 
+/* struct dalloc. */
+#include "alloc.h"
+
 
 /* Opaque structure. */
 struct daelib_vector;
@@ -25,22 +28,62 @@ typedef struct daelib_vector *dvec;
 /* Iterators, opaque. */
 typedef void *dvec_it;
 
+/* Growth policies. Double rounds to a
+ * power of two, half grows by 1.5x, and
+ * chunk rounds up to whole chunks.
+ */
+enum dvec_growth {
 
-/* Vector functions. */
+	DVEC_DOUBLE,
+	DVEC_HALF,
+	DVEC_CHUNK
+};
 
-/* Init/kill/copy. */
-dvec dvec_init(size_t elem_size);
-int  dvec_kill(dvec vec);
-dvec dvec_copy(dvec vec);
 
-/* Push/pop/peek. */
+/* Vector functions. */
+
+/* Init/kill/copy. Small vectors hold
+ * their first count elements inline,
+ * in one allocation with the vector.
+ * Init_ex takes an allocator, NULL
+ * for libc, which copies share.
+ */
+dvec dvec_init      (size_t elem_size);
+dvec dvec_init_small(size_t elem_size, size_t count);
+dvec dvec_init_ex   (size_t elem_size, size_t count, struct dalloc *alloc);
+int  dvec_kill      (dvec vec);
+dvec dvec_copy      (dvec vec);
+
+/* Push/pop/peek. Emplace pushes
+ * an unset element, returning it.
+ */
 int   dvec_push(dvec vec, void *elem);
+void *dvec_emplace(dvec vec);
 void *dvec_peek(dvec vec);
 int   dvec_pop (dvec vec);
 
 /* Size/metadata. */
 size_t dvec_size     (dvec vec);
 size_t dvec_elem_size(dvec vec);
+size_t dvec_capacity (dvec vec);
+
+/* Capacity. Reserve keeps its room
+ * until shrink_to_fit. Vectors shrink
+ * under a quarter full, to twice their
+ * size, unless set otherwise.
+ */
+int dvec_reserve      (dvec vec, size_t count);
+int dvec_shrink_to_fit(dvec vec);
+int dvec_set_growth   (dvec vec, enum dvec_growth growth, size_t chunk);
+int dvec_set_shrink   (dvec vec, double load);
+
+/* Blocks of 16 MiB and up are mapped,
+ * whole huge pages, and grow in place.
+ * Set the size, or 0 to always use the
+ * allocator. Vectors with their own
+ * allocator start at 0.
+ */
+int dvec_set_mapping  (dvec vec, size_t bytes);
 
 /* Random access. */
 void *dvec_get(dvec vec, size_t index);
@@ -0,0 +1,141 @@
+/** daelib/vector_inline.h: Unchecked inline vector accessors.
+ */
+
+#ifndef __DAELIB_VECTOR_INLINE_H
+#define __DAELIB_VECTOR_INLINE_H
+
+/* The vector layout, with unchecked
+ * accessors inlined over it for hot
+ * loops. They skip every check dvec_*
+ * makes, so give them only valid
+ * vectors and indexes. Include vector.h
+ * alone for the checked, opaque ABI.
+ */
+
+
+/* dvec, enum dvec_growth, dvec_push(). */
+#include "vector.h"
+
+/* struct dalloc. */
+#include "alloc.h"
+
+/* memcpy(). */
+#include <string.h>
+
+/* max_align_t. */
+#include <stddef.h>
+
+
+/* Base definition for a vector. */
+struct daelib_vector {
+	size_t elem_size;
+	size_t elem_count;
+
+	size_t allocated;
+	void *data;
+
+	/* Capacity policy. Reserved bytes
+	 * are never given back by shrinking.
+	 */
+	enum dvec_growth growth;
+	size_t chunk;
+	double shrink;
+	size_t reserved;
+
+	/* Blocks of map_at bytes or more
+	 * are mapped, not malloc'd.
+	 */
+	size_t map_at;
+	int mapped;
+
+	/* Where blocks come from. */
+	struct dalloc *alloc;
+
+	/* Small vectors keep their first
+	 * inline_size bytes here, and
+	 * data points here until they
+	 * outgrow it.
+	 */
+	size_t inline_size;
+	_Alignas(max_align_t) char inline_data[];
+};
+
+/* A run of contiguous elements. */
+struct dvec_span {
+	void *data;
+	size_t count;
+	size_t elem_size;
+};
+
+
+/* Get the element count. */
+static inline size_t dvec_size_fast(dvec vec) {
+
+	return vec->elem_count;
+}
+
+/* Get the first element, or
+ * NULL if none were allocated.
+ * Small vectors always have one,
+ * inline.
+ */
+static inline void *dvec_data(dvec vec) {
+
+	return vec->data;
+}
+
+/* Get an element. The index
+ * must be in bounds.
+ */
+static inline void *dvec_get_fast(dvec vec, size_t index) {
+
+	return (char*) vec->data + index * vec->elem_size;
+}
+
+/* Get the last element. The
+ * vector must not be empty.
+ */
+static inline void *dvec_peek_fast(dvec vec) {
+
+	return (char*) vec->data + (vec->elem_count - 1) * vec->elem_size;
+}
+
+/* Push an element. Copies in place when
+ * there is room, else calls dvec_push.
+ * Returns nonzero on error.
+ */
+static inline int dvec_push_fast(dvec vec, void *elem) {
+
+	/* Copy into spare capacity and
+	 * count it, or fall back to
+	 * the checked, growing push.
+	 */
+	size_t used = vec->elem_count * vec->elem_size;
+
+	if (vec->allocated - used < vec->elem_size)
+		return dvec_push(vec, elem);
+
+	memcpy((char*) vec->data + used, elem, vec->elem_size);
+	vec->elem_count++;
+
+	return 0;
+}
+
+/* Get elements [start, end) as one span,
+ * valid until the vector next resizes.
+ * Needs start <= end <= size.
+ */
+static inline struct dvec_span dvec_span_fast(dvec vec, size_t start,
+                                              size_t end) {
+
+	struct dvec_span span;
+
+	span.data = (char*) vec->data + start * vec->elem_size;
+	span.count = end - start;
+	span.elem_size = vec->elem_size;
+
+	return span;
+}
+
+
+#endif // __DAELIB_VECTOR_INLINE_H
@@ -0,0 +1,522 @@
+/** daelib/bench.c: Hashtable workload benchmarks.
+ */
+
+
+/* Each case fills a table, then times a
+ * fixed stream of operations, drawn before
+ * timing, in batches. Batch times over every
+ * run give the median and p99 ns per op.
+ * Cases vary one thing at a time from a base:
+ * size, buckets, key and value size, key
+ * distribution, hit ratio, read/write mix
+ * and delete churn. Results go to a CSV file,
+ * and a CSV from an earlier run can be given
+ * to flag cases that got slower, failing
+ * the run if any did.
+ *
+ * Usage: bench [out.csv] [runs] [base.csv]
+ */
+
+
+/* printf(), fopen(), fprintf(). */
+#include <stdio.h>
+
+/* exit(), malloc(), qsort(), atoi(). */
+#include <stdlib.h>
+
+/* memset(), memcpy(), strcmp(). */
+#include <string.h>
+
+/* pow(). */
+#include <math.h>
+
+/* clock_gettime(). */
+#include <time.h>
+
+/* Hashtable. */
+#include "hashtable.h"
+
+/* logging. */
+#include "log.h"
+#include "loggers.h"
+
+
+#define CLOCK CLOCK_MONOTONIC
+
+/* Operations per run, and per timed batch. */
+#define BENCH_OPS   (1 << 18)
+#define BENCH_BATCH 1024
+
+/* Runs per case, unless given. */
+#define BENCH_RUNS 5
+
+/* Slowdown over the base flagged
+ * as a regression.
+ */
+#define BENCH_SLOWER 1.10
+
+/* Zipf exponent. */
+#define BENCH_ZIPF 0.99
+
+
+/* Key distributions. */
+enum bench_dist {
+
+	BENCH_UNIFORM,
+	BENCH_SEQUENTIAL,
+	BENCH_ZIPFIAN
+};
+
+static const char *bench_dist_names[] = { "uniform", "sequential", "zipf" };
+
+/* Operations. */
+enum bench_op {
+
+	BENCH_GET,
+	BENCH_PUT,
+	BENCH_CHURN
+};
+
+/* A benchmark case. Of the operations,
+ * read percent are gets, hit percent of
+ * which find their key. Of the writes,
+ * churn percent remove a key and put it
+ * back, the rest overwrite one.
+ */
+struct bench_case {
+
+	const char *backend_name;
+	struct dhtable_backend *backend;
+
+	size_t entries;
+	size_t buckets;
+	size_t key_size;
+	size_t val_size;
+
+	enum bench_dist dist;
+	int read_pct;
+	int hit_pct;
+	int churn_pct;
+};
+
+/* A case's results. */
+struct bench_result {
+
+	double median;
+	double p99;
+	double mean;
+};
+
+
+void bench_init(void);
+void bench_kill(int status);
+
+void bench_cases(const char *backend_name, struct dhtable_backend *backend);
+void bench_run(struct bench_case *c);
+
+static FILE *bench_out = NULL;
+static FILE *bench_base = NULL;
+static int bench_runs = BENCH_RUNS;
+static int bench_slower = 0;
+
+int main(int argc, char **argv) {
+
+	bench_init();
+
+	const char *out = (argc > 1) ? argv[1] : "bench.csv";
+
+	if (argc > 2 && atoi(argv[2]) > 0)
+		bench_runs = atoi(argv[2]);
+
+	bench_out = fopen(out, "w");
+	if (bench_out == NULL) {
+		dlog(EERR, "bench/init", "Failed to open %s.", out);
+		bench_kill(EXIT_FAILURE);
+	}
+
+	if (argc > 3) {
+		bench_base = fopen(argv[3], "r");
+		if (bench_base == NULL)
+			dlog(EERR, "bench/init", "Failed to open %s.", argv[3]);
+	}
+
+	fprintf(bench_out, "case,backend,entries,buckets,key_size,val_size,"
+	        "dist,read_pct,hit_pct,churn_pct,ops,runs,"
+	        "median_ns,p99_ns,mean_ns\n");
+
+	bench_cases("vector", NULL);
+	bench_cases("flat", &dhtable_flat);
+	bench_cases("swiss", &dhtable_swiss);
+	bench_cases("list", &dhtable_list);
+	bench_cases("btree", &dhtable_btree);
+	bench_cases("btree_vector", &dhtable_btree_vector);
+
+	fclose(bench_out);
+
+	if (bench_base != NULL)
+		fclose(bench_base);
+
+	dlog(EINFO, "bench/term", "Wrote %s. %d cases slower than the base.",
+	     out, bench_slower);
+
+	bench_kill(bench_slower > 0 ? EXIT_FAILURE : EXIT_SUCCESS);
+
+	return 0;
+}
+
+
+void bench_init(void) {
+
+	dlog_init();
+	dlog_add(&stdout_logger, EDEBUG, NULL);
+
+	dlog(EINFO, "bench/init", "Init completed.");
+}
+
+void bench_kill(int status) {
+
+	dlog(EINFO, "bench/term", "Benchmarks completed. Exiting.");
+
+	dlog_kill();
+
+	exit(status);
+}
+
+
+/* Nanoseconds between two
+ * readings of CLOCK.
+ */
+static long long bench_ns(struct timespec *start, struct timespec *end) {
+
+	return (end->tv_sec - start->tv_sec) * 1000000000LL +
+	       (end->tv_nsec - start->tv_nsec);
+}
+
+/* xorshift64*, seeded per case
+ * so streams repeat.
+ */
+static uint64_t bench_rand(uint64_t *state) {
+
+	*state ^= *state >> 12;
+	*state ^= *state << 25;
+	*state ^= *state >> 27;
+
+	return *state * 0x2545F4914F6CDD1Dull;
+}
+
+/* Fill key i, hits below entries,
+ * misses above. Wide keys share
+ * a prefix, as real ones do.
+ */
+static void bench_key(char *key, size_t key_size, size_t i) {
+
+	memset(key, 'k', key_size);
+
+	uint32_t low = (uint32_t) i;
+	uint64_t wide = (uint64_t) i;
+
+	if (key_size < sizeof(wide))
+		memcpy(key, &low, sizeof(low));
+	else
+		memcpy(key + key_size - sizeof(wide), &wide, sizeof(wide));
+}
+
+/* Draw key indices, below n. */
+static void bench_draw(size_t *out, size_t count, size_t n,
+                       enum bench_dist dist, uint64_t *state) {
+
+	size_t i;
+
+	switch (dist) {
+
+	case BENCH_UNIFORM:
+		for (i = 0; i < count; i++)
+			out[i] = bench_rand(state) % n;
+		break;
+
+	case BENCH_SEQUENTIAL:
+		for (i = 0; i < count; i++)
+			out[i] = i % n;
+		break;
+
+	case BENCH_ZIPFIAN: {
+
+		/* Invert the CDF by binary search.
+		 * Ranks are scattered over the keys,
+		 * so hot keys are not neighbours.
+		 */
+		double *cdf = malloc(sizeof(double) * n);
+		double sum = 0;
+
+		for (i = 0; i < n; i++) {
+			sum += 1.0 / pow((double) (i + 1), BENCH_ZIPF);
+			cdf[i] = sum;
+		}
+
+		for (i = 0; i < count; i++) {
+			double u = (double) (bench_rand(state) >> 11) / (1ull << 53) * sum;
+			size_t lo = 0, hi = n - 1;
+
+			while (lo < hi) {
+				size_t mid = (lo + hi) / 2;
+				if (cdf[mid] < u)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+
+			out[i] = (lo * 2654435761u) % n;
+		}
+
+		free(cdf);
+		break;
+	}
+	}
+}
+
+/* Orders doubles for qsort. */
+static int bench_cmp(const void *l, const void *r) {
+
+	double a = *(const double*) l, b = *(const double*) r;
+
+	return (a > b) - (a < b);
+}
+
+/* Find a case's median in the
+ * base CSV. Returns 0 if absent.
+ */
+static double bench_base_median(const char *name) {
+
+	char line[512];
+
+	rewind(bench_base);
+
+	while (fgets(line, sizeof(line), bench_base) != NULL) {
+		char *comma = strchr(line, ',');
+		if (comma == NULL)
+			continue;
+
+		*comma = '\0';
+		if (strcmp(line, name) != 0)
+			continue;
+
+		/* Median is the 13th column. */
+		char *field = comma + 1;
+		int column;
+
+		for (column = 1; column < 12 && field != NULL; column++) {
+			field = strchr(field, ',');
+			if (field != NULL)
+				field++;
+		}
+
+		return (field != NULL) ? atof(field) : 0;
+	}
+
+	return 0;
+}
+
+/* Run one case, log and write the result. */
+void bench_run(struct bench_case *c) {
+
+	/* Name the case, fill the table,
+	 * draw the stream, time it in
+	 * batches over every run, sort,
+	 * write, compare, return.
+	 */
+	char name[128];
+	snprintf(name, sizeof(name), "%s/%zu/b%zu/k%zuv%zu/%s/r%dh%dc%d",
+	         c->backend_name, c->entries, c->buckets, c->key_size,
+	         c->val_size, bench_dist_names[c->dist], c->read_pct,
+	         c->hit_pct, c->churn_pct);
+
+	dhtable table = dhtable_init(c->buckets, c->key_size, c->val_size,
+	                             NULL, NULL, c->backend);
+	if (table == NULL) {
+		dlog(EERR, name, "Failed to init table.");
+		return;
+	}
+
+	char *keys = malloc(c->key_size * c->entries * 2);
+	char *value = calloc(1, c->val_size + 1);
+
+	size_t i;
+	for (i = 0; i < c->entries * 2; i++)
+		bench_key(keys + i * c->key_size, c->key_size, i);
+
+	for (i = 0; i < c->entries; i++)
+		if (dhtable_put(table, keys + i * c->key_size, value) != 0)
+			dlog(EERR, name, "Failed to put element.");
+
+	/* Draw the stream. Misses
+	 * use the upper keys.
+	 */
+	uint64_t state = 0x9E3779B97F4A7C15ull ^ c->entries;
+	size_t *index = malloc(sizeof(size_t) * BENCH_OPS);
+	unsigned char *ops = malloc(BENCH_OPS);
+
+	bench_draw(index, BENCH_OPS, c->entries, c->dist, &state);
+
+	for (i = 0; i < BENCH_OPS; i++) {
+		int roll = bench_rand(&state) % 100;
+
+		if (roll < c->read_pct) {
+			ops[i] = BENCH_GET;
+			if ((int) (bench_rand(&state) % 100) >= c->hit_pct)
+				index[i] += c->entries;
+		} else {
+			ops[i] = ((int) (bench_rand(&state) % 100) < c->churn_pct) ?
+				BENCH_CHURN : BENCH_PUT;
+		}
+	}
+
+	size_t batches = BENCH_OPS / BENCH_BATCH;
+	double *samples = malloc(sizeof(double) * batches * bench_runs);
+	size_t found = 0, n = 0;
+	double total = 0;
+
+	int run;
+	for (run = 0; run < bench_runs; run++) {
+
+		size_t batch;
+		for (batch = 0; batch < batches; batch++) {
+			struct timespec start, end;
+
+			clock_gettime(CLOCK, &start);
+
+			for (i = batch * BENCH_BATCH; i < (batch + 1) * BENCH_BATCH; i++) {
+				char *key = keys + index[i] * c->key_size;
+
+				switch (ops[i]) {
+				case BENCH_GET:
+					found += dhtable_get(table, key) != NULL;
+					break;
+				case BENCH_PUT:
+					dhtable_put(table, key, value);
+					break;
+				case BENCH_CHURN:
+					dhtable_rm(table, key);
+					dhtable_put(table, key, value);
+					break;
+				}
+			}
+
+			clock_gettime(CLOCK, &end);
+
+			double ns = (double) bench_ns(&start, &end) / BENCH_BATCH;
+
+			samples[n++] = ns;
+			total += ns;
+		}
+	}
+
+	qsort(samples, n, sizeof(double), bench_cmp);
+
+	struct bench_result r = {
+		samples[n / 2], samples[n * 99 / 100], total / n
+	};
+
+	if (dhtable_size(table) != c->entries)
+		dlog(EERR, name, "Table holds %zu entries.", dhtable_size(table));
+
+	dlog(EINFO, name, "Median: %.1f ns/op. p99: %.1f ns/op. Hits: %zu.",
+	     r.median, r.p99, found);
+
+	fprintf(bench_out, "%s,%s,%zu,%zu,%zu,%zu,%s,%d,%d,%d,%d,%d,"
+	        "%.2f,%.2f,%.2f\n", name, c->backend_name, c->entries,
+	        c->buckets, c->key_size, c->val_size, bench_dist_names[c->dist],
+	        c->read_pct, c->hit_pct, c->churn_pct, BENCH_OPS, bench_runs,
+	        r.median, r.p99, r.mean);
+
+	if (bench_base != NULL) {
+		double base = bench_base_median(name);
+
+		if (base > 0 && r.median > base * BENCH_SLOWER) {
+			dlog(EWARNING, name, "Slower than the base: %.1f ns/op, was %.1f.",
+			     r.median, base);
+			bench_slower++;
+		}
+	}
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, name, "Failed to kill table.");
+
+	free(samples);
+	free(ops);
+	free(index);
+	free(value);
+	free(keys);
+}
+
+/* Run every case for a backend. */
+void bench_cases(const char *backend_name, struct dhtable_backend *backend) {
+
+	/* A base, then one thing
+	 * changed at a time.
+	 */
+	struct bench_case base = {
+		backend_name, backend, 1 << 16, 0, 4, 4, BENCH_UNIFORM, 100, 100, 0
+	};
+
+	struct bench_case c;
+
+	/* Size, in and out of cache. */
+	size_t entries[] = { 1 << 10, 1 << 16, 1 << 20 };
+
+	size_t i;
+	for (i = 0; i < sizeof(entries) / sizeof(entries[0]); i++) {
+		c = base;
+		c.entries = entries[i];
+		bench_run(&c);
+	}
+
+	/* Fixed buckets, no resizing. */
+	c = base;
+	c.buckets = c.entries / 8;
+	bench_run(&c);
+
+	/* Wider keys and values. */
+	c = base;
+	c.key_size = 16;
+	c.val_size = 8;
+	bench_run(&c);
+
+	c = base;
+	c.key_size = 64;
+	c.val_size = 64;
+	bench_run(&c);
+
+	/* Distributions. */
+	c = base;
+	c.dist = BENCH_SEQUENTIAL;
+	bench_run(&c);
+
+	c = base;
+	c.dist = BENCH_ZIPFIAN;
+	bench_run(&c);
+
+	/* Hit ratios. */
+	c = base;
+	c.hit_pct = 50;
+	bench_run(&c);
+
+	c = base;
+	c.hit_pct = 0;
+	bench_run(&c);
+
+	/* Read/write mixes. */
+	c = base;
+	c.read_pct = 90;
+	bench_run(&c);
+
+	c = base;
+	c.read_pct = 50;
+	c.dist = BENCH_ZIPFIAN;
+	bench_run(&c);
+
+	/* Delete churn. */
+	c = base;
+	c.read_pct = 50;
+	c.churn_pct = 100;
+	bench_run(&c);
+}
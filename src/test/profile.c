@@ -10,12 +10,33 @@
 /* clock_gettime(). */
 #include <time.h>
 
+/* memset(). */
+#include <string.h>
+
 /* vectors. */
 #include "vector.h"
 
+/* Unchecked vector accessors. */
+#include "vector_inline.h"
+
 /* Hashtable. */
 #include "hashtable.h"
 
+/* Sharded hashtable. */
+#include "hashtable_shard.h"
+
+/* Variable key hashtable. */
+#include "hashtable_vkey.h"
+
+/* Read-mostly hashtable. */
+#include "hashtable_rcu.h"
+
+/* Generated hashtables. */
+#include "hashtable_gen.h"
+
+/* pthread_create(), pthread_mutex_*(). */
+#include <pthread.h>
+
 /* logging. */
 #include "log.h"
 #include "loggers.h"
@@ -23,11 +44,36 @@
 
 #define CLOCK CLOCK_MONOTONIC
 
+/* Nanoseconds between two
+ * readings of CLOCK, across
+ * any second boundary.
+ */
+static long long profile_ns(struct timespec *start, struct timespec *end) {
+
+	return (end->tv_sec - start->tv_sec) * 1000000000LL +
+	       (end->tv_nsec - start->tv_nsec);
+}
+
 void profile_init(void);
 void profile_kill(void);
 
 void profile_vector(void);
 void profile_hashtable(void);
+void profile_hashtable_index(const char *path, enum dhtable_index index);
+void profile_hashtable_batch(const char *path,
+                             struct dhtable_backend *backend);
+void profile_hashtable_shard(int threads);
+void profile_hashtable_iter(void);
+void profile_hashtable_gen(void);
+void profile_hashtable_chain(const char *path,
+                             struct dhtable_backend *backend);
+void profile_hashtable_mmap(void);
+void profile_hashtable_merge(size_t threads);
+void profile_hashtable_upsert(const char *path,
+                              struct dhtable_backend *backend);
+void profile_hashtable_vkey(void);
+void profile_hashtable_rcu(int threads);
+void profile_hashtable_short(void);
 
 int main() {
 
@@ -36,6 +82,46 @@ int main() {
 	profile_vector();
 	profile_hashtable();
 
+	profile_hashtable_index("profile/hashtable/index/modulo", DHTABLE_MODULO);
+	profile_hashtable_index("profile/hashtable/index/mask", DHTABLE_MASK);
+	profile_hashtable_index("profile/hashtable/index/fastrange",
+	                        DHTABLE_FASTRANGE);
+
+	profile_hashtable_batch("profile/hashtable/batch/vector", NULL);
+	profile_hashtable_batch("profile/hashtable/batch/flat", &dhtable_flat);
+	profile_hashtable_batch("profile/hashtable/batch/swiss", &dhtable_swiss);
+
+	profile_hashtable_shard(1);
+	profile_hashtable_shard(2);
+	profile_hashtable_shard(4);
+	profile_hashtable_shard(8);
+
+	profile_hashtable_iter();
+
+	profile_hashtable_gen();
+
+	profile_hashtable_chain("profile/hashtable/chain/vector", NULL);
+	profile_hashtable_chain("profile/hashtable/chain/btree", &dhtable_btree);
+	profile_hashtable_chain("profile/hashtable/chain/list", &dhtable_list);
+	profile_hashtable_chain("profile/hashtable/chain/btree_vector",
+	                        &dhtable_btree_vector);
+
+	profile_hashtable_mmap();
+
+	profile_hashtable_merge(1);
+	profile_hashtable_merge(4);
+
+	profile_hashtable_upsert("profile/hashtable/upsert/vector", NULL);
+	profile_hashtable_upsert("profile/hashtable/upsert/flat", &dhtable_flat);
+	profile_hashtable_upsert("profile/hashtable/upsert/swiss", &dhtable_swiss);
+
+	profile_hashtable_vkey();
+
+	profile_hashtable_rcu(1);
+	profile_hashtable_rcu(4);
+
+	profile_hashtable_short();
+
 	profile_kill();
 
 	return 0;
@@ -49,7 +135,7 @@ void profile_init(void) {
 
 	struct timespec t;
 	clock_getres(CLOCK, &t);
-	dlog(EINFO, "profile/init", "Clock resolution: %d ns.", t.tv_nsec);
+	dlog(EINFO, "profile/init", "Clock resolution: %ld ns.", t.tv_nsec);
 
 	dlog(EINFO, "profile/init", "Init completed.");
 }
@@ -86,8 +172,8 @@ void profile_vector(void) {
 	clock_gettime(CLOCK, &end);
 
 
-	dlog(EINFO, "profile/vector/stack/t1", "Done. Time: %d ns.",
-	     end.tv_nsec - start.tv_nsec);
+	dlog(EINFO, "profile/vector/stack/t1", "Done. Time: %lld ns.",
+	     profile_ns(&start, &end));
 
 	
 	dlog(EINFO, "profile/vector/stack/t2", "push() peek() pop() x 1mil.");
@@ -106,8 +192,8 @@ void profile_vector(void) {
 
 	clock_gettime(CLOCK, &end);
 
-	dlog(EINFO, "profile/vector/stack/t2", "Done. Time: %d ns.",
-	     end.tv_nsec - start.tv_nsec);
+	dlog(EINFO, "profile/vector/stack/t2", "Done. Time: %lld ns.",
+	     profile_ns(&start, &end));
 
 
 	dlog(EINFO, "profile/vector/stack/t3", "push() x 1mil, get() x 1mil.");
@@ -126,8 +212,31 @@ void profile_vector(void) {
 
 	clock_gettime(CLOCK, &end);
 
-	dlog(EINFO, "profile/vector/stack/t3", "Done. Time: %d ns.",
-	     end.tv_nsec - start.tv_nsec);
+	dlog(EINFO, "profile/vector/stack/t3", "Done. Time: %lld ns.",
+	     profile_ns(&start, &end));
+
+
+	dlog(EINFO, "profile/vector/stack/t3",
+	     "push_fast() x 1mil, get_fast() x 1mil.");
+
+	clock_gettime(CLOCK, &start);
+
+	dvec v3f = dvec_init(sizeof(char));
+
+	for (i = 0; i < (1 << 20); i++)
+		dvec_push_fast(v3f, "a");
+
+	/* Sum, so the inlined gets stay. */
+	volatile char sink = 0;
+	for (i = 0; i < (1 << 20); i++)
+		sink += *(char*) dvec_get_fast(v3f, i);
+
+	clock_gettime(CLOCK, &end);
+
+	dlog(EINFO, "profile/vector/stack/t3", "Done. Time: %lld ns.",
+	     profile_ns(&start, &end));
+
+	dvec_kill(v3f);
 
 	
 	dlog(EINFO, "profile/vector/stack/t4", "for 10000:pushx1000,popx1000.");
@@ -146,8 +255,101 @@ void profile_vector(void) {
 
 	clock_gettime(CLOCK, &end);
 
-	dlog(EINFO, "profile/vector/stack/t4", "Done. Time: %d ns.",
-	     end.tv_nsec - start.tv_nsec);
+	dlog(EINFO, "profile/vector/stack/t4", "Done. Time: %lld ns.",
+	     profile_ns(&start, &end));
+
+	dvec_kill(v4);
+
+
+	/* Draining a vector of big elements
+	 * reallocs every pass, unless its room
+	 * is reserved.
+	 */
+	char big[64] = {0};
+	int reserve;
+
+	for (reserve = 0; reserve < 2; reserve++) {
+		dlog(EINFO, "profile/vector/stack/t5",
+		     "for 10000:pushx1000,popx1000, 64b%s.",
+		     reserve ? ", reserved" : "");
+
+		clock_gettime(CLOCK, &start);
+
+		dvec v6 = dvec_init(sizeof(big));
+		if (reserve)
+			dvec_reserve(v6, 1000);
+
+		size_t cap = dvec_capacity(v6), reallocs = 0;
+
+		for (i = 0; i < 10000; i++) {
+			int i2;
+			for (i2 = 0; i2 < 1000; i2++) {
+				dvec_push(v6, big);
+				reallocs += (dvec_capacity(v6) != cap);
+				cap = dvec_capacity(v6);
+			}
+			for (i2 = 0; i2 < 1000; i2++) {
+				dvec_pop(v6);
+				reallocs += (dvec_capacity(v6) != cap);
+				cap = dvec_capacity(v6);
+			}
+		}
+
+		dvec_kill(v6);
+
+		clock_gettime(CLOCK, &end);
+
+		dlog(EINFO, "profile/vector/stack/t5",
+		     "Done. Time: %lld ns. Reallocs: %zu.",
+		     profile_ns(&start, &end), reallocs);
+	}
+
+
+	/* Growing a big vector by realloc()
+	 * copies it, mapped it grows in place.
+	 */
+	int map;
+
+	for (map = 0; map < 2; map++) {
+		dlog(EINFO, "profile/vector/stack/t6",
+		     "push() x 32mil, 8b, %s.", map ? "mapped" : "malloc'd");
+
+		clock_gettime(CLOCK, &start);
+
+		dvec v7 = dvec_init(sizeof(uint64_t));
+		if (!map)
+			dvec_set_mapping(v7, 0);
+
+		uint64_t n;
+		for (n = 0; n < (1 << 25); n++)
+			dvec_push(v7, &n);
+
+		clock_gettime(CLOCK, &end);
+
+		dlog(EINFO, "profile/vector/stack/t6", "Done. Time: %lld ns.",
+		     profile_ns(&start, &end));
+
+		/* Random reads, where huge pages
+		 * save TLB misses.
+		 */
+		dlog(EINFO, "profile/vector/stack/t6", "get() x 8mil, random.");
+
+		clock_gettime(CLOCK, &start);
+
+		uint64_t sum = 0, at = 1;
+		for (n = 0; n < (1 << 23); n++) {
+			at = at * 6364136223846793005ULL + 1442695040888963407ULL;
+			sum += *(uint64_t*) dvec_get(v7, at >> 39);
+		}
+
+		clock_gettime(CLOCK, &end);
+
+		dlog(EINFO, "profile/vector/stack/t6",
+		     "Done. Time: %lld ns. Sum: %llu.",
+		     profile_ns(&start, &end), (unsigned long long) sum);
+
+		dvec_kill(v7);
+	}
 
 
 	dlog(EINFO, "profile/vector/range/t1", "Joining two 1m vecs.");
@@ -163,8 +365,8 @@ void profile_vector(void) {
 
 	clock_gettime(CLOCK, &end);
 
-	dlog(EINFO, "profile/vector/range/t1", "Done. Time: %d ns.",
-	     end.tv_nsec - start.tv_nsec);
+	dlog(EINFO, "profile/vector/range/t1", "Done. Time: %lld ns.",
+	     profile_ns(&start, &end));
 
 	return;
 }
@@ -195,7 +397,839 @@ void profile_hashtable(void) {
 
 	clock_gettime(CLOCK, &end);
 
-	dlog(EINFO, "profile/hashtable/t1", "Done. Time: %d ns.",
-	     end.tv_nsec - start.tv_nsec);
+	dlog(EINFO, "profile/hashtable/t1", "Done. Time: %lld ns.",
+	     profile_ns(&start, &end));
+
+
+	table = dhtable_init(1, sizeof(int), 0, NULL, NULL, &dhtable_flat);
+
+	dlog(EINFO, "profile/hashtable/t2", "flat: put() x 16k, get() x 16k.");
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < (1 << 14); i++)
+		if (dhtable_put(table, &i, NULL) != 0)
+			dlog(EERR, "profile/hashtable/t2", "Failed to put element.");
+
+	for (i = 0; i < (1 << 14); i++)
+		if (dhtable_get(table, &i) == NULL)
+			dlog(EERR, "profile/hashtable/t2", "Failed to get element.");
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, "profile/hashtable/t2", "Failed to kill table.");
+
+	clock_gettime(CLOCK, &end);
+
+	dlog(EINFO, "profile/hashtable/t2", "Done. Time: %lld ns.",
+	     profile_ns(&start, &end));
+
+
+	table = dhtable_init(1, sizeof(int), 0, NULL, NULL, &dhtable_swiss);
+
+	dlog(EINFO, "profile/hashtable/t3", "swiss: put() x 16k, get() x 16k.");
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < (1 << 14); i++)
+		if (dhtable_put(table, &i, NULL) != 0)
+			dlog(EERR, "profile/hashtable/t3", "Failed to put element.");
+
+	for (i = 0; i < (1 << 14); i++)
+		if (dhtable_get(table, &i) == NULL)
+			dlog(EERR, "profile/hashtable/t3", "Failed to get element.");
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, "profile/hashtable/t3", "Failed to kill table.");
+
+	clock_gettime(CLOCK, &end);
+
+	dlog(EINFO, "profile/hashtable/t3", "Done. Time: %lld ns.",
+	     profile_ns(&start, &end));
+
+
+	struct { int a, b, c, d, e, f, g, h; } key = { 0 };
+
+	table = dhtable_init((1 << 6), sizeof(key), 0, NULL, NULL, NULL);
+
+	dlog(EINFO, "profile/hashtable/t4", "32b keys: put() x 16k, get() x 16k.");
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < (1 << 14); i++) {
+		key.h = i;
+		if (dhtable_put(table, &key, NULL) != 0)
+			dlog(EERR, "profile/hashtable/t4", "Failed to put element.");
+	}
+
+	for (i = 0; i < (1 << 14); i++) {
+		key.h = i;
+		if (dhtable_get(table, &key) == NULL)
+			dlog(EERR, "profile/hashtable/t4", "Failed to get element.");
+	}
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, "profile/hashtable/t4", "Failed to kill table.");
+
+	clock_gettime(CLOCK, &end);
+
+	dlog(EINFO, "profile/hashtable/t4", "Done. Time: %lld ns.",
+	     profile_ns(&start, &end));
+}
+
+void profile_hashtable_index(const char *path, enum dhtable_index index) {
+
+	struct timespec start, end;
+
+	dhtable table = dhtable_init((1 << 12), sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+
+	if (dhtable_set_index(table, index) != 0)
+		dlog(EERR, path, "Failed to set index.");
+
+	dlog(EINFO, path, "put() x 16k, get() x 1mil into 4k buckets.");
+
+	int i;
+	for (i = 0; i < (1 << 14); i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < (1 << 20); i++) {
+		int key = i & ((1 << 14) - 1);
+		if (dhtable_get(table, &key) == NULL)
+			dlog(EERR, path, "Failed to get element.");
+	}
+
+	clock_gettime(CLOCK, &end);
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	long long ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Done. Time: %lld ns.", ns);
+}
+
+void profile_hashtable_batch(const char *path,
+                             struct dhtable_backend *backend) {
+
+	struct timespec start, end;
+
+	int count = 1 << 20;
+
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, backend);
+
+	int *keys = malloc(sizeof(int) * count);
+	void **vals = malloc(sizeof(void*) * count);
+
+	/* Scatter keys, so lookups miss cache. */
+	int i;
+	for (i = 0; i < count; i++)
+		keys[i] = (int) ((unsigned) i * 2654435761u);
+
+	if (dhtable_put_batch(table, count, keys, keys) != 0)
+		dlog(EERR, path, "Failed to put batch.");
+
+	/* Finish any migration before timing. */
+	for (i = 0; i < count; i += 256)
+		dhtable_get_batch(table, 256, keys + i, vals + i);
+
+	dlog(EINFO, path, "get() x 1mil, then get_batch() x 1mil in 256s.");
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < count; i++)
+		if (dhtable_get(table, keys + i) == NULL)
+			dlog(EERR, path, "Failed to get element.");
+
+	clock_gettime(CLOCK, &end);
+
+	long long ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Single done. Time: %lld ns.", ns);
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < count; i += 256)
+		if (dhtable_get_batch(table, 256, keys + i, vals + i) != 0)
+			dlog(EERR, path, "Failed to get batch.");
+
+	clock_gettime(CLOCK, &end);
+
+	for (i = 0; i < count; i++)
+		if (vals[i] == NULL)
+			dlog(EERR, path, "Failed to get element.");
+
+	ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Batch done. Time: %lld ns.", ns);
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	free(keys);
+	free(vals);
+}
+
+/* Keys and operations per shard thread. */
+#define SHARD_KEYS (1 << 16)
+#define SHARD_OPS  (1 << 20)
+
+/* A thread's view of the benchmark.
+ * With shard NULL, table is
+ * guarded by the one mutex.
+ */
+struct profile_shard_arg {
+
+	dhtable_shard shard;
+	dhtable table;
+	pthread_mutex_t *mutex;
+	unsigned seed;
+};
+
+/* 1 in 8 operations writes. */
+static void *profile_shard_worker(void *varg) {
+
+	struct profile_shard_arg *arg = (struct profile_shard_arg*) varg;
+
+	unsigned x = arg->seed;
+	int value;
+
+	int i;
+	for (i = 0; i < SHARD_OPS; i++) {
+
+		x = x * 1664525u + 1013904223u;
+		int key = (int) ((x >> 8) % SHARD_KEYS);
+
+		if (arg->shard != NULL) {
+			if ((x & 7) == 0)
+				dhtable_shard_put(arg->shard, &key, &key);
+			else
+				dhtable_shard_getcpy(arg->shard, &key, &value);
+
+			continue;
+		}
+
+		pthread_mutex_lock(arg->mutex);
+		if ((x & 7) == 0)
+			dhtable_put(arg->table, &key, &key);
+		else
+			dhtable_get(arg->table, &key);
+		pthread_mutex_unlock(arg->mutex);
+	}
+
+	return NULL;
+}
+
+/* Time threads over a table. */
+static long long profile_shard_run(int threads, dhtable_shard shard,
+                                   dhtable table, pthread_mutex_t *mutex) {
+
+	struct timespec start, end;
+
+	pthread_t ids[threads];
+	struct profile_shard_arg args[threads];
+
+	clock_gettime(CLOCK, &start);
+
+	int i;
+	for (i = 0; i < threads; i++) {
+		args[i].shard = shard;
+		args[i].table = table;
+		args[i].mutex = mutex;
+		args[i].seed = i + 1;
+		pthread_create(ids + i, NULL, profile_shard_worker, args + i);
+	}
+
+	for (i = 0; i < threads; i++)
+		pthread_join(ids[i], NULL);
+
+	clock_gettime(CLOCK, &end);
+
+	return profile_ns(&start, &end);
+}
+
+void profile_hashtable_shard(int threads) {
+
+	const char *path = "profile/hashtable/shard";
+
+	dlog(EINFO, path, "%d threads x 1mil ops, 1 in 8 put, 64k keys.",
+	     threads);
+
+	pthread_mutex_t mutex;
+	pthread_mutex_init(&mutex, NULL);
+
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+	dhtable_shard shard = dhtable_shard_init(0, sizeof(int), sizeof(int),
+	                                         NULL, NULL, NULL);
+
+	long long ns = profile_shard_run(threads, NULL, table, &mutex);
+
+	dlog(EINFO, path, "Global mutex done. Time: %lld ns.", ns);
+
+	ns = profile_shard_run(threads, shard, NULL, NULL);
+
+	dlog(EINFO, path, "Sharded done. Time: %lld ns.", ns);
+
+	if (dhtable_kill(table) != 0 || dhtable_shard_kill(shard) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	pthread_mutex_destroy(&mutex);
+}
+
+/* Sums values. */
+static int profile_iter_visit(void *key, void *value, void *arg) {
+
+	*(long*) arg += *(int*) value;
+
+	return 0;
+}
+
+void profile_hashtable_iter(void) {
+
+	const char *path = "profile/hashtable/iter";
+
+	struct timespec start, end;
+
+	dhtable table = dhtable_init((1 << 20), sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+
+	dlog(EINFO, path, "Walk 16k entries in 1mil buckets, x 16.");
+
+	int i;
+	for (i = 0; i < (1 << 14); i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	long sum = 0;
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < 16; i++) {
+		dhtable_it it;
+		for (it = dhtable_begin(table); it.it != NULL;
+		     it = dhtable_next(table, it))
+			sum += ((int*) dhtable_iget(table, it))[1];
+	}
+
+	clock_gettime(CLOCK, &end);
+
+	long long ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Iterators done. Time: %lld ns.", ns);
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < 16; i++)
+		dhtable_foreach(table, profile_iter_visit, &sum);
+
+	clock_gettime(CLOCK, &end);
+
+	ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Foreach done. Time: %lld ns. Sum: %ld.", ns, sum);
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+}
+
+/* Int to int. */
+DHTABLE_DEFINE(profile_imap, int, int, dhtable_gen_hash, DHTABLE_GEN_EQ)
+
+void profile_hashtable_gen(void) {
+
+	const char *path = "profile/hashtable/gen";
+
+	struct timespec start, end;
+
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+	struct profile_imap *imap = profile_imap_init(0);
+
+	dlog(EINFO, path, "put() x 64k, get() x 4mil, generic then generated.");
+
+	clock_gettime(CLOCK, &start);
+
+	int i;
+	for (i = 0; i < (1 << 16); i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	for (i = 0; i < (1 << 22); i++) {
+		int key = i & ((1 << 16) - 1);
+		if (dhtable_get(table, &key) == NULL)
+			dlog(EERR, path, "Failed to get element.");
+	}
+
+	clock_gettime(CLOCK, &end);
+
+	long long ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Generic done. Time: %lld ns.", ns);
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < (1 << 16); i++)
+		if (profile_imap_put(imap, i, i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	for (i = 0; i < (1 << 22); i++)
+		if (profile_imap_get(imap, i & ((1 << 16) - 1)) == NULL)
+			dlog(EERR, path, "Failed to get element.");
+
+	clock_gettime(CLOCK, &end);
+
+	ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Generated done. Time: %lld ns.", ns);
+
+	if (dhtable_kill(table) != 0 || profile_imap_kill(imap) != 0)
+		dlog(EERR, path, "Failed to kill table.");
 }
 
+void profile_hashtable_chain(const char *path,
+                             struct dhtable_backend *backend) {
+
+	struct timespec start, end;
+
+	/* Undersized on purpose. */
+	dhtable table = dhtable_init(16, sizeof(int), sizeof(int),
+	                             NULL, NULL, backend);
+
+	dlog(EINFO, path, "put() x 16k, get() x 64k into 16 buckets.");
+
+	clock_gettime(CLOCK, &start);
+
+	int i;
+	for (i = 0; i < (1 << 14); i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	for (i = 0; i < (1 << 16); i++) {
+		int key = (i * 7919) & ((1 << 14) - 1);
+		if (dhtable_get(table, &key) == NULL)
+			dlog(EERR, path, "Failed to get element.");
+	}
+
+	clock_gettime(CLOCK, &end);
+
+	long long ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Done. Time: %lld ns.", ns);
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+}
+
+void profile_hashtable_mmap(void) {
+
+	const char *path = "profile/hashtable/mmap";
+	const char *file = "/tmp/daelib_profile.dht";
+
+	struct timespec start, end;
+
+	dlog(EINFO, path, "put() x 1mil, then save and open_mmap.");
+
+	clock_gettime(CLOCK, &start);
+
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+
+	int i;
+	for (i = 0; i < (1 << 20); i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	clock_gettime(CLOCK, &end);
+
+	long long ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Build done. Time: %lld ns.", ns);
+
+	if (dhtable_save(table, file) != 0)
+		dlog(EERR, path, "Failed to save table.");
+
+	clock_gettime(CLOCK, &start);
+
+	dhtable mapped = dhtable_open_mmap(file, sizeof(int), sizeof(int),
+	                                   NULL, NULL);
+	if (mapped == NULL)
+		dlog(EERR, path, "Failed to map table.");
+
+	clock_gettime(CLOCK, &end);
+
+	ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Open done. Time: %lld ns.", ns);
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; mapped != NULL && i < (1 << 20); i++)
+		if (dhtable_get(mapped, &i) == NULL)
+			dlog(EERR, path, "Failed to get element.");
+
+	clock_gettime(CLOCK, &end);
+
+	ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Mapped get() x 1mil done. Time: %lld ns.", ns);
+
+	if (dhtable_kill(table) != 0 ||
+	    (mapped != NULL && dhtable_kill(mapped) != 0))
+		dlog(EERR, path, "Failed to kill table.");
+
+	remove(file);
+}
+
+void profile_hashtable_merge(size_t threads) {
+
+	const char *path = "profile/hashtable/merge";
+
+	struct timespec start, end;
+
+	dhtable parts[16];
+
+	int i, j;
+	for (i = 0; i < 16; i++) {
+
+		/* Bucket counts differ, as
+		 * with per-worker tables.
+		 */
+		parts[i] = dhtable_init(1000 + i, sizeof(int), sizeof(int),
+		                        NULL, NULL, NULL);
+
+		for (j = i << 14; j < (i + 1) << 14; j++)
+			if (dhtable_put(parts[i], &j, &j) != 0)
+				dlog(EERR, path, "Failed to put element.");
+	}
+
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+
+	if (dhtable_set_threads(table, threads) != 0)
+		dlog(EERR, path, "Failed to set threads.");
+
+	dlog(EINFO, path, "join() x 16 tables of 16k, %d threads.", (int) threads);
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < 16; i++)
+		if (dhtable_join(table, parts[i]) != 0)
+			dlog(EERR, path, "Failed to join tables.");
+
+	dhtable copy = dhtable_copy(table);
+
+	clock_gettime(CLOCK, &end);
+
+	long long ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Done, with a copy. Time: %lld ns.", ns);
+
+	if (copy == NULL || dhtable_size(copy) != (16 << 14))
+		dlog(EERR, path, "Bad merged table.");
+
+	for (i = 0; i < 16; i++)
+		dhtable_kill(parts[i]);
+
+	if (dhtable_kill(table) != 0 || (copy != NULL && dhtable_kill(copy) != 0))
+		dlog(EERR, path, "Failed to kill table.");
+}
+
+/* Adds one to a counter. */
+static void profile_upsert_count(void *key, void *value,
+                                 int inserted, void *arg) {
+
+	(*(int*) value)++;
+}
+
+void profile_hashtable_upsert(const char *path,
+                              struct dhtable_backend *backend) {
+
+	struct timespec start, end;
+
+	int count = 1 << 19;
+
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, backend);
+	dhtable table2 = dhtable_init(0, sizeof(int), sizeof(int),
+	                              NULL, NULL, backend);
+
+	dlog(EINFO, path, "Counting 512k keys over 256k, get() then put(), "
+	     "then update().");
+
+	/* Word counting, half the calls insert. */
+	int i, one = 1;
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < count; i++) {
+		int key = (int) (((unsigned) i * 2654435761u) & 0x3ffff);
+		int *value = dhtable_get(table, &key);
+
+		if (value != NULL)
+			(*value)++;
+		else if (dhtable_put(table, &key, &one) != 0)
+			dlog(EERR, path, "Failed to put element.");
+	}
+
+	clock_gettime(CLOCK, &end);
+
+	long long ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Get/put done. Time: %lld ns.", ns);
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < count; i++) {
+		int key = (int) (((unsigned) i * 2654435761u) & 0x3ffff);
+
+		if (dhtable_update(table2, &key, profile_upsert_count, NULL) != 0)
+			dlog(EERR, path, "Failed to update element.");
+	}
+
+	clock_gettime(CLOCK, &end);
+
+	ns = profile_ns(&start, &end);
+
+	dlog(EINFO, path, "Update done. Time: %lld ns.", ns);
+
+	if (dhtable_size(table) != dhtable_size(table2))
+		dlog(EERR, path, "Tables disagree on size.");
+
+	if (dhtable_kill(table) != 0 || dhtable_kill(table2) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+}
+
+/* Padding for fixed size keys. */
+#define VKEY_PAD 256
+
+/* Builds a URL like key, 20 to 80 bytes. */
+static int profile_vkey_key(char *key, int i) {
+
+	memset(key, 0, VKEY_PAD);
+
+	return snprintf(key, VKEY_PAD, "https://example.com/%x/%.*s",
+	                (unsigned) i * 2654435761u, i % 48,
+	                "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa");
+}
+
+void profile_hashtable_vkey(void) {
+
+	struct timespec start, end;
+	struct dhtable_stats stats;
+
+	int count = 1 << 18;
+	char key[VKEY_PAD];
+
+	dhtable table = dhtable_init(0, VKEY_PAD, sizeof(int),
+	                             NULL, NULL, &dhtable_flat);
+	dhtable_vkey vtable = dhtable_vkey_init(0, sizeof(int), &dhtable_flat);
+
+	dlog(EINFO, "profile/hashtable/vkey", "put() then get() x 256k URLs, "
+	     "padded to 256 bytes, then variable length.");
+
+	clock_gettime(CLOCK, &start);
+
+	int i;
+	for (i = 0; i < count; i++) {
+		profile_vkey_key(key, i);
+		if (dhtable_put(table, key, &i) != 0)
+			dlog(EERR, "profile/hashtable/vkey", "Failed to put element.");
+	}
+
+	for (i = 0; i < count; i++) {
+		profile_vkey_key(key, i);
+		if (dhtable_get(table, key) == NULL)
+			dlog(EERR, "profile/hashtable/vkey", "Failed to get element.");
+	}
+
+	clock_gettime(CLOCK, &end);
+
+	long long ns = profile_ns(&start, &end);
+
+	dhtable_stats(table, &stats);
+
+	dlog(EINFO, "profile/hashtable/vkey", "Padded done. Time: %lld ns. "
+	     "Bytes: %lu.", ns, (unsigned long) stats.bytes);
+
+	clock_gettime(CLOCK, &start);
+
+	for (i = 0; i < count; i++) {
+		int len = profile_vkey_key(key, i);
+		if (dhtable_vkey_put(vtable, key, len, &i) != 0)
+			dlog(EERR, "profile/hashtable/vkey", "Failed to put element.");
+	}
+
+	for (i = 0; i < count; i++) {
+		int len = profile_vkey_key(key, i);
+		if (dhtable_vkey_get(vtable, key, len) == NULL)
+			dlog(EERR, "profile/hashtable/vkey", "Failed to get element.");
+	}
+
+	clock_gettime(CLOCK, &end);
+
+	ns = profile_ns(&start, &end);
+
+	dhtable_vkey_stats(vtable, &stats);
+
+	dlog(EINFO, "profile/hashtable/vkey", "Variable done. Time: %lld ns. "
+	     "Bytes: %lu.", ns, (unsigned long) stats.bytes);
+
+	if (dhtable_kill(table) != 0 || dhtable_vkey_kill(vtable) != 0)
+		dlog(EERR, "profile/hashtable/vkey", "Failed to kill table.");
+}
+
+/* Keys and reads per rcu reader. */
+#define RCU_KEYS (1 << 16)
+#define RCU_OPS  (1 << 20)
+
+/* A reader's view of the benchmark.
+ * With rcu NULL, reads the shard.
+ */
+struct profile_rcu_arg {
+
+	dhtable_rcu rcu;
+	dhtable_shard shard;
+	unsigned seed;
+};
+
+/* Reads only, entering per read. */
+static void *profile_rcu_reader(void *varg) {
+
+	struct profile_rcu_arg *arg = (struct profile_rcu_arg*) varg;
+
+	dhtable_rcu_reader reader = (arg->rcu != NULL) ?
+		dhtable_rcu_register(arg->rcu) : NULL;
+
+	unsigned x = arg->seed;
+	int value;
+
+	int i;
+	for (i = 0; i < RCU_OPS; i++) {
+
+		x = x * 1664525u + 1013904223u;
+		int key = (int) ((x >> 8) % RCU_KEYS);
+
+		if (arg->rcu == NULL) {
+			dhtable_shard_getcpy(arg->shard, &key, &value);
+			continue;
+		}
+
+		dhtable_rcu_enter(reader);
+		int *found = dhtable_rcu_get(arg->rcu, &key);
+		if (found != NULL)
+			value = *found;
+		dhtable_rcu_leave(reader);
+	}
+
+	if (reader != NULL)
+		dhtable_rcu_unregister(arg->rcu, reader);
+
+	return NULL;
+}
+
+/* Time readers, with one write
+ * per reader every 64k reads.
+ */
+static long long profile_rcu_run(int threads, dhtable_rcu rcu,
+                                 dhtable_shard shard) {
+
+	struct timespec start, end;
+
+	pthread_t ids[threads];
+	struct profile_rcu_arg args[threads];
+
+	clock_gettime(CLOCK, &start);
+
+	int i;
+	for (i = 0; i < threads; i++) {
+		args[i].rcu = rcu;
+		args[i].shard = shard;
+		args[i].seed = i + 1;
+		pthread_create(ids + i, NULL, profile_rcu_reader, args + i);
+	}
+
+	for (i = 0; i < threads * (RCU_OPS / RCU_KEYS); i++) {
+		int key = i % RCU_KEYS;
+
+		if (rcu != NULL)
+			dhtable_rcu_put(rcu, &key, &i);
+		else
+			dhtable_shard_put(shard, &key, &i);
+	}
+
+	for (i = 0; i < threads; i++)
+		pthread_join(ids[i], NULL);
+
+	clock_gettime(CLOCK, &end);
+
+	return profile_ns(&start, &end);
+}
+
+void profile_hashtable_rcu(int threads) {
+
+	const char *path = "profile/hashtable/rcu";
+
+	dlog(EINFO, path, "%d readers x 1mil get(), 64k keys, few writes.",
+	     threads);
+
+	dhtable_rcu rcu = dhtable_rcu_init(0, sizeof(int), sizeof(int),
+	                                   NULL, NULL, &dhtable_flat);
+	dhtable_shard shard = dhtable_shard_init(0, sizeof(int), sizeof(int),
+	                                         NULL, NULL, &dhtable_flat);
+
+	int i;
+	for (i = 0; i < RCU_KEYS; i++) {
+		dhtable_rcu_put(rcu, &i, &i);
+		dhtable_shard_put(shard, &i, &i);
+	}
+
+	long long ns = profile_rcu_run(threads, NULL, shard);
+
+	dlog(EINFO, path, "Sharded done. Time: %lld ns.", ns);
+
+	ns = profile_rcu_run(threads, rcu, NULL);
+
+	dlog(EINFO, path, "Read-mostly done. Time: %lld ns.", ns);
+
+	if (dhtable_rcu_kill(rcu) != 0 || dhtable_shard_kill(shard) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+}
+
+void profile_hashtable_short(void) {
+
+	struct timespec start, end;
+
+	/* One entry per bucket on average, where
+	 * the vector backend's small vectors keep
+	 * each chain in its vector's allocation.
+	 */
+	const char *path = "profile/hashtable/short/vector";
+	dhtable table = dhtable_init((1 << 18), sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+
+	dlog(EINFO, path, "put() x 256k, get() x 1mil into 256k buckets.");
+
+	clock_gettime(CLOCK, &start);
+
+	int i;
+	for (i = 0; i < (1 << 18); i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	for (i = 0; i < (1 << 20); i++) {
+		int key = (int) (((unsigned) i * 7919u) & ((1u << 18) - 1));
+		if (dhtable_get(table, &key) == NULL)
+			dlog(EERR, path, "Failed to get element.");
+	}
+
+	clock_gettime(CLOCK, &end);
+
+	dlog(EINFO, path, "Done. Time: %lld ns.", profile_ns(&start, &end));
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+}
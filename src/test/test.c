@@ -13,9 +13,33 @@
 /* Vectors. */
 #include "vector.h"
 
+/* Unchecked vector accessors. */
+#include "vector_inline.h"
+
 /* Hastable. */
 #include "hashtable.h"
 
+/* Backend slots, to test without emplace. */
+#include "hashtable_backend.h"
+
+/* Hashes. */
+#include "hash.h"
+
+/* Sharded hashtable. */
+#include "hashtable_shard.h"
+
+/* Variable key hashtable. */
+#include "hashtable_vkey.h"
+
+/* Read-mostly hashtable. */
+#include "hashtable_rcu.h"
+
+/* Generated hashtables. */
+#include "hashtable_gen.h"
+
+/* pthread_create(), pthread_join(). */
+#include <pthread.h>
+
 /* Logging. */
 #include "log.h"
 #include "loggers.h"
@@ -30,7 +54,32 @@ void init_loggers(void);
 void kill_loggers(void);
 
 void test_hashtable(void);
+void test_hashtable_backend(const char *path,
+                            struct dhtable_backend *backend);
+void test_hashtable_resize(void);
+void test_hashtable_hash(void);
+void test_hashtable_index(enum dhtable_index index);
+void test_hashtable_batch(const char *path,
+                          struct dhtable_backend *backend);
+void test_hashtable_shard(void);
+void test_hashtable_rcu(const char *path,
+                        struct dhtable_backend *backend);
+void test_hashtable_rcu_tags(void);
+void test_hashtable_iter(const char *path,
+                         struct dhtable_backend *backend);
+void test_hashtable_stable(void);
+void test_hashtable_vkey(const char *path,
+                         struct dhtable_backend *backend);
+void test_hashtable_emplace(const char *path,
+                            struct dhtable_backend *backend);
+void test_hashtable_mmap(const char *path,
+                         struct dhtable_backend *backend);
+void test_hashtable_parallel(void);
+void test_hashtable_stats(void);
+void test_hashtable_gen(void);
 void test_vector(void);
+void test_alloc(const char *path, struct dhtable_backend *backend);
+void test_alloc_arena(void);
 
 void test_assert(void);
 
@@ -42,8 +91,120 @@ int main() {
 
 	test_hashtable();
 
+	test_hashtable_backend("test/hashtable/flat", &dhtable_flat);
+
+	test_hashtable_backend("test/hashtable/swiss", &dhtable_swiss);
+
+	test_hashtable_backend("test/hashtable/btree", &dhtable_btree);
+
+	test_hashtable_backend("test/hashtable/btree_vector",
+	                       &dhtable_btree_vector);
+
+	test_hashtable_backend("test/hashtable/list", &dhtable_list);
+
+	test_hashtable_resize();
+
+	test_hashtable_hash();
+
+	test_hashtable_index(DHTABLE_MASK);
+
+	test_hashtable_index(DHTABLE_FASTRANGE);
+
+	test_hashtable_batch("test/hashtable/batch/vector", NULL);
+
+	test_hashtable_batch("test/hashtable/batch/flat", &dhtable_flat);
+
+	test_hashtable_batch("test/hashtable/batch/swiss", &dhtable_swiss);
+
+	test_hashtable_batch("test/hashtable/batch/btree", &dhtable_btree);
+
+	test_hashtable_batch("test/hashtable/batch/btree_vector",
+	                     &dhtable_btree_vector);
+
+	test_hashtable_batch("test/hashtable/batch/list", &dhtable_list);
+
+	test_hashtable_shard();
+
+	test_hashtable_rcu("test/hashtable/rcu/vector", NULL);
+
+	test_hashtable_rcu("test/hashtable/rcu/flat", &dhtable_flat);
+
+	test_hashtable_rcu("test/hashtable/rcu/list", &dhtable_list);
+
+	test_hashtable_rcu_tags();
+
+	test_hashtable_iter("test/hashtable/iter/vector", NULL);
+
+	test_hashtable_iter("test/hashtable/iter/flat", &dhtable_flat);
+
+	test_hashtable_iter("test/hashtable/iter/swiss", &dhtable_swiss);
+
+	test_hashtable_iter("test/hashtable/iter/btree", &dhtable_btree);
+
+	test_hashtable_iter("test/hashtable/iter/btree_vector",
+	                    &dhtable_btree_vector);
+
+	test_hashtable_iter("test/hashtable/iter/list", &dhtable_list);
+
+	test_hashtable_stable();
+
+	test_hashtable_vkey("test/hashtable/vkey/vector", NULL);
+
+	test_hashtable_vkey("test/hashtable/vkey/flat", &dhtable_flat);
+
+	test_hashtable_vkey("test/hashtable/vkey/swiss", &dhtable_swiss);
+
+	test_hashtable_vkey("test/hashtable/vkey/btree", &dhtable_btree);
+
+	test_hashtable_vkey("test/hashtable/vkey/btree_vector",
+	                    &dhtable_btree_vector);
+
+	test_hashtable_vkey("test/hashtable/vkey/list", &dhtable_list);
+
+	test_hashtable_emplace("test/hashtable/emplace/vector", NULL);
+
+	test_hashtable_emplace("test/hashtable/emplace/flat", &dhtable_flat);
+
+	test_hashtable_emplace("test/hashtable/emplace/swiss", &dhtable_swiss);
+
+	test_hashtable_emplace("test/hashtable/emplace/btree", &dhtable_btree);
+
+	test_hashtable_emplace("test/hashtable/emplace/btree_vector",
+	                       &dhtable_btree_vector);
+
+	test_hashtable_emplace("test/hashtable/emplace/list", &dhtable_list);
+
+	struct dhtable_backend get_put = dhtable_flat;
+	get_put.emplace = NULL;
+
+	test_hashtable_emplace("test/hashtable/emplace/get_put", &get_put);
+
+	test_hashtable_mmap("test/hashtable/mmap/vector", NULL);
+
+	test_hashtable_mmap("test/hashtable/mmap/btree", &dhtable_btree);
+
+	test_hashtable_parallel();
+
+	test_hashtable_stats();
+
+	test_hashtable_gen();
+
 	test_vector();
 
+	test_alloc("test/alloc/vector", NULL);
+
+	test_alloc("test/alloc/flat", &dhtable_flat);
+
+	test_alloc("test/alloc/swiss", &dhtable_swiss);
+
+	test_alloc("test/alloc/btree", &dhtable_btree);
+
+	test_alloc("test/alloc/btree_vector", &dhtable_btree_vector);
+
+	test_alloc("test/alloc/list", &dhtable_list);
+
+	test_alloc_arena();
+
 	test_assert();
 
 	dlog(EINFO, "test/term", "Successfully completed tests. Exiting.");
@@ -167,9 +328,1684 @@ void test_hashtable(void) {
 	dlog(EINFO, "test/hashtable", "Finished tests.");
 }
 
-void test_vector(void) {
+void test_hashtable_backend(const char *path,
+                            struct dhtable_backend *backend) {
+
+	dlog(EINFO, path, "Starting backend tests.");
+	dhtable table = dhtable_init(1, sizeof(int), sizeof(int),
+	                             NULL, NULL, backend);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	int i, j;
+
+	dlog(EINFO, path, "Starting insertion.");
+	for (i = 0; i < (1 << 12); i++) {
+		j = i * 3;
+		if (dhtable_put(table, &i, &j) != 0)
+			dlog(EERR, path, "Failed to put element.");
+	}
+
+	dlog(EINFO, path, "Starting searching.");
+	for (i = 0; i < (1 << 12); i++) {
+		int *t = dhtable_get(table, &i);
+		if (t == NULL || *t != i * 3)
+			dlog(EERR, path, "Failed to get element.");
+	}
+
+	dlog(EINFO, path, "Removing odd elements.");
+	for (i = 1; i < (1 << 12); i += 2)
+		if (dhtable_rm(table, &i) != 0)
+			dlog(EERR, path, "Failed to remove element.");
+
+	for (i = 0; i < (1 << 12); i++)
+		if ((dhtable_get(table, &i) == NULL) != (i & 1))
+			dlog(EERR, path, "Bad element after rm.");
+
+	dlog(EINFO, path, "Starting table clone and join.");
+	dhtable table2 = dhtable_copy(table);
+	if (table2 == NULL)
+		dlog(EERR, path, "Failed to copy table.");
+
+	for (i = 1; i < (1 << 12); i += 2)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	if (dhtable_join(table2, table) != 0)
+		dlog(EERR, path, "Failed to join tables.");
+	dlog(EINFO, path, "Elements: New: %d, old: %d.",
+	     dhtable_size(table2), dhtable_size(table));
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+	if (dhtable_kill(table2) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	dlog(EINFO, path, "Finished tests.");
+}
+
+void test_hashtable_resize(void) {
+
+	dlog(EINFO, "test/hashtable/resize", "Starting resizing tests.");
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int), NULL, NULL, NULL);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	int i, j;
+
+	dlog(EINFO, "test/hashtable/resize", "Inserting while growing.");
+	for (i = 0; i < (1 << 14); i++) {
+		j = -i;
+		if (dhtable_put(table, &i, &j) != 0)
+			dlog(EERR, "test/hashtable/resize", "Failed to put element.");
+
+		j = i / 2;
+		int *t = dhtable_get(table, &j);
+		if (t == NULL || *t != -j)
+			dlog(EERR, "test/hashtable/resize", "Lost element %d.", j);
+	}
+
+	dlog(EINFO, "test/hashtable/resize", "Elements: %d.", dhtable_size(table));
+
+	dlog(EINFO, "test/hashtable/resize", "Removing while shrinking.");
+	for (i = 0; i < (1 << 14) - 16; i++)
+		if (dhtable_rm(table, &i) != 0)
+			dlog(EERR, "test/hashtable/resize", "Failed to remove element.");
+
+	for (i = 0; i < (1 << 14); i++)
+		if ((dhtable_get(table, &i) == NULL) != (i < (1 << 14) - 16))
+			dlog(EERR, "test/hashtable/resize", "Bad element %d.", i);
+
+	dlog(EINFO, "test/hashtable/resize", "Elements: %d.", dhtable_size(table));
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, "test/hashtable/resize", "Failed to kill table.");
+
+	dlog(EINFO, "test/hashtable/resize", "Finished tests.");
+}
+
+void test_hashtable_hash(void) {
+
+	dlog(EINFO, "test/hashtable/hash", "Starting hash tests.");
+
+	/* Keys sharing their first 4 bytes. */
+	struct { int a, b, c; } key = { 7, 0, 0 };
+
+	uint64_t h0 = dhash_key(sizeof(key), &key);
+	key.c = 1;
+	if (dhash_key(sizeof(key), &key) == h0)
+		dlog(EERR, "test/hashtable/hash", "Tail of key is not hashed.");
+
+	/* Streamed in uneven pieces, across
+	 * the short, 16 and 48 byte paths.
+	 */
+	unsigned char bytes[300];
+	size_t n, at, piece;
+
+	for (n = 0; n < sizeof(bytes); n++)
+		bytes[n] = (unsigned char) (n * 131 + 7);
+
+	for (n = 0; n < sizeof(bytes); n++) {
+		struct dhash_state state;
+		dhash_init(&state, n);
+
+		for (at = 0, piece = 1; at < n; at += piece, piece = piece * 3 % 61)
+			dhash_update(&state, bytes + at,
+			             (piece < n - at) ? piece : n - at);
+
+		if (dhash_final(&state) != dhash_bytes(bytes, n, n))
+			dlog(EERR, "test/hashtable/hash", "Bad streamed hash of %lu.",
+			     (unsigned long) n);
+	}
+
+	dhtable table = dhtable_init64(64, sizeof(key), 0, NULL, NULL, NULL);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	int i;
+	for (i = 0; i < (1 << 10); i++) {
+		key.b = i;
+		if (dhtable_put(table, &key, NULL) != 0)
+			dlog(EERR, "test/hashtable/hash", "Failed to put element.");
+	}
+
+	for (i = 0; i < (1 << 10); i++) {
+		key.b = i;
+		if (dhtable_get(table, &key) == NULL)
+			dlog(EERR, "test/hashtable/hash", "Failed to get element.");
+	}
+
+	dlog(EINFO, "test/hashtable/hash", "Elements: %d.", dhtable_size(table));
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, "test/hashtable/hash", "Failed to kill table.");
+
+	dlog(EINFO, "test/hashtable/hash", "Finished tests.");
+}
+
+void test_hashtable_index(enum dhtable_index index) {
+
+	dlog(EINFO, "test/hashtable/index", "Starting index %d tests.", index);
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int), NULL, NULL, NULL);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	if (dhtable_set_index(table, index) != 0)
+		dlog(EERR, "test/hashtable/index", "Failed to set index.");
+
+	int i;
+	for (i = 0; i < (1 << 12); i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, "test/hashtable/index", "Failed to put element.");
+
+	if (dhtable_set_index(table, DHTABLE_MODULO) == 0)
+		dlog(EERR, "test/hashtable/index", "Reindexed a full table.");
+
+	for (i = 0; i < (1 << 12); i++) {
+		int *t = dhtable_get(table, &i);
+		if (t == NULL || *t != i)
+			dlog(EERR, "test/hashtable/index", "Failed to get element.");
+	}
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, "test/hashtable/index", "Failed to kill table.");
+
+	/* Swiss tags stay spread within a bucket,
+	 * so misses rarely compare a key.
+	 */
+	table = dhtable_init(1024, sizeof(int), sizeof(int), NULL, NULL,
+	                     &dhtable_swiss);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	if (dhtable_set_index(table, index) != 0)
+		dlog(EERR, "test/hashtable/index", "Failed to set index.");
+
+	for (i = 0; i < (1 << 17); i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, "test/hashtable/index", "Failed to put element.");
+
+	struct dhtable_stats stats;
+
+	if (dhtable_stats(table, &stats) != 0 || stats.miss_probes > 1 ||
+	    stats.hit_probes > 1.5)
+		dlog(EERR, "test/hashtable/index", "Tags follow the index, "
+		     "probes %.2f/%.2f.", stats.hit_probes, stats.miss_probes);
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, "test/hashtable/index", "Failed to kill table.");
+
+	dlog(EINFO, "test/hashtable/index", "Finished tests.");
+}
+
+void test_hashtable_batch(const char *path,
+                          struct dhtable_backend *backend) {
+
+	dlog(EINFO, path, "Starting batch tests.");
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, backend);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	int keys[1000], vals[1000];
+	void *found[1000];
+
+	int i;
+	for (i = 0; i < 1000; i++) {
+		keys[i] = i * 7;
+		vals[i] = -i;
+	}
+
+	/* Odd sizes, so runs end mid step. */
+	if (dhtable_put_batch(table, 999, keys, vals) != 0)
+		dlog(EERR, path, "Failed to put batch.");
+
+	if (dhtable_size(table) != 999)
+		dlog(EERR, path, "Bad size after put: %d.", dhtable_size(table));
+
+	if (dhtable_get_batch(table, 1000, keys, found) != 0)
+		dlog(EERR, path, "Failed to get batch.");
+
+	for (i = 0; i < 1000; i++)
+		if ((found[i] == NULL) != (i == 999) ||
+		    (found[i] != NULL && *(int*) found[i] != -i))
+			dlog(EERR, path, "Bad element %d after put.", i);
+
+	if (dhtable_rm_batch(table, 501, keys) != 0)
+		dlog(EERR, path, "Failed to remove batch.");
+
+	if (dhtable_get_batch(table, 1000, keys, found) != 0)
+		dlog(EERR, path, "Failed to get batch.");
+
+	for (i = 0; i < 1000; i++)
+		if ((found[i] == NULL) != (i < 501 || i == 999))
+			dlog(EERR, path, "Bad element %d after rm.", i);
+
+	if (dhtable_size(table) != 498)
+		dlog(EERR, path, "Bad size after rm: %d.", dhtable_size(table));
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	dlog(EINFO, path, "Finished tests.");
+}
+
+/* Counts key compares. */
+static long test_cmps;
+
+static int test_count_cmp(size_t key_size, void *keyl, void *keyr) {
+
+	test_cmps++;
+
+	return memcmp(keyl, keyr, key_size);
+}
+
+/* Each thread owns a range of keys. */
+struct test_shard_arg {
+
+	dhtable_shard table;
+	int first;
+};
+
+static void *test_shard_worker(void *varg) {
+
+	struct test_shard_arg *arg = (struct test_shard_arg*) varg;
+
+	int i, j;
+	for (i = arg->first; i < arg->first + (1 << 12); i++) {
+		j = -i;
+		if (dhtable_shard_put(arg->table, &i, &j) != 0)
+			dlog(EERR, "test/hashtable/shard", "Failed to put element.");
+	}
+
+	for (i = arg->first; i < arg->first + (1 << 12); i += 2)
+		if (dhtable_shard_rm(arg->table, &i) != 0)
+			dlog(EERR, "test/hashtable/shard", "Failed to remove element.");
+
+	return NULL;
+}
+
+void test_hashtable_shard(void) {
+
+	dlog(EINFO, "test/hashtable/shard", "Starting shard tests.");
+	dhtable_shard table = dhtable_shard_init(0, sizeof(int), sizeof(int),
+	                                         NULL, NULL, NULL);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	pthread_t threads[4];
+	struct test_shard_arg args[4];
+
+	int i, j;
+	for (i = 0; i < 4; i++) {
+		args[i].table = table;
+		args[i].first = i << 12;
+		if (pthread_create(threads + i, NULL, test_shard_worker, args + i))
+			dlog(EERR, "test/hashtable/shard", "Failed to start thread.");
+	}
+
+	for (i = 0; i < 4; i++)
+		pthread_join(threads[i], NULL);
+
+	if (dhtable_shard_size(table) != (1 << 13))
+		dlog(EERR, "test/hashtable/shard", "Bad size: %d.",
+		     dhtable_shard_size(table));
+
+	for (i = 0; i < (1 << 14); i++) {
+		int found = dhtable_shard_getcpy(table, &i, &j) == 0;
+		if (found != (i & 1) || (found && j != -i))
+			dlog(EERR, "test/hashtable/shard", "Bad element %d.", i);
+	}
+
+	/* Shards of different sizes, so
+	 * the shard joins rehash.
+	 */
+	dhtable_shard table2 = dhtable_shard_init(0, sizeof(int), sizeof(int),
+	                                          NULL, NULL, NULL);
+	DASSERT(table2 != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	for (i = 0; i < (1 << 14); i += 2)
+		if (dhtable_shard_put(table2, &i, &i) != 0)
+			dlog(EERR, "test/hashtable/shard", "Failed to put element.");
+
+	if (dhtable_shard_join(table2, table) != 0)
+		dlog(EERR, "test/hashtable/shard", "Failed to join tables.");
+
+	if (dhtable_shard_size(table2) != (1 << 14))
+		dlog(EERR, "test/hashtable/shard", "Bad size after join: %d.",
+		     dhtable_shard_size(table2));
+
+	for (i = 0; i < (1 << 14); i++)
+		if (dhtable_shard_getcpy(table2, &i, &j) != 0 ||
+		    j != ((i & 1) ? -i : i))
+			dlog(EERR, "test/hashtable/shard", "Bad joined element %d.", i);
+
+	if (dhtable_shard_kill(table) != 0 || dhtable_shard_kill(table2) != 0)
+		dlog(EERR, "test/hashtable/shard", "Failed to kill table.");
+
+	/* Swiss tags stay spread within a
+	 * shard, so misses rarely compare.
+	 */
+	table = dhtable_shard_init(64, sizeof(int), sizeof(int),
+	                           &test_count_cmp, NULL, &dhtable_swiss);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	for (i = 0; i < (1 << 16); i++)
+		if (dhtable_shard_put(table, &i, &i) != 0)
+			dlog(EERR, "test/hashtable/shard", "Failed to put element.");
+
+	test_cmps = 0;
+	for (i = 1 << 16; i < (1 << 17); i++)
+		if (dhtable_shard_getcpy(table, &i, &j) == 0)
+			dlog(EERR, "test/hashtable/shard", "Found missing element %d.", i);
+
+	if (test_cmps > (1 << 15))
+		dlog(EERR, "test/hashtable/shard", "Tags follow the shard, "
+		     "%.2f compares per miss.", (double) test_cmps / (1 << 16));
+
+	if (dhtable_shard_kill(table) != 0)
+		dlog(EERR, "test/hashtable/shard", "Failed to kill table.");
+
+	dlog(EINFO, "test/hashtable/shard", "Finished tests.");
+}
+
+/* Keys readers must always find. */
+#define RCU_STABLE 100000
+#define RCU_STABLE_COUNT 64
+
+/* A reader's view of the rcu test. */
+struct test_rcu_arg {
+
+	dhtable_rcu table;
+	const char *path;
+	volatile int *stop;
+	long reads;
+};
+
+/* Reads until stopped. Values are
+ * always the key or its negation.
+ */
+static void *test_rcu_reader(void *varg) {
+
+	struct test_rcu_arg *arg = (struct test_rcu_arg*) varg;
+
+	dhtable_rcu_reader reader = dhtable_rcu_register(arg->table);
+	if (reader == NULL) {
+		dlog(EERR, arg->path, "Failed to register reader.");
+		return NULL;
+	}
+
+	unsigned seed = (unsigned) arg->reads;
+	arg->reads = 0;
+
+	while (!__atomic_load_n(arg->stop, __ATOMIC_ACQUIRE)) {
+		seed = seed * 1103515245 + 12345;
+		int key = (seed >> 8) % (1 << 12);
+		int stable = RCU_STABLE + (seed >> 20) % RCU_STABLE_COUNT;
+
+		dhtable_rcu_enter(reader);
+
+		int *value = dhtable_rcu_get(arg->table, &key);
+		if (value != NULL && *value != key && *value != -key)
+			dlog(EERR, arg->path, "Read torn value of %d.", key);
+
+		value = dhtable_rcu_get(arg->table, &stable);
+		if (value == NULL || *value != stable)
+			dlog(EERR, arg->path, "Lost stable key %d.", stable);
+
+		dhtable_rcu_leave(reader);
+
+		arg->reads++;
+	}
+
+	if (dhtable_rcu_unregister(arg->table, reader) != 0)
+		dlog(EERR, arg->path, "Failed to unregister reader.");
+
+	return NULL;
+}
+
+void test_hashtable_rcu(const char *path,
+                        struct dhtable_backend *backend) {
+
+	dlog(EINFO, path, "Starting read-mostly tests.");
+	dhtable_rcu table = dhtable_rcu_init(0, sizeof(int), sizeof(int),
+	                                     NULL, NULL, backend);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	int i, j;
+	for (i = RCU_STABLE; i < RCU_STABLE + RCU_STABLE_COUNT; i++)
+		if (dhtable_rcu_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	/* Readers run through every
+	 * write and every growth.
+	 */
+	volatile int stop = 0;
+	pthread_t threads[3];
+	struct test_rcu_arg args[3];
+
+	for (i = 0; i < 3; i++) {
+		args[i].table = table;
+		args[i].path = path;
+		args[i].stop = &stop;
+		args[i].reads = i + 1;
+		if (pthread_create(threads + i, NULL, test_rcu_reader, args + i))
+			dlog(EERR, path, "Failed to start thread.");
+	}
+
+	for (i = 0; i < (1 << 12); i++) {
+		j = -i;
+		if (dhtable_rcu_put(table, &i, &j) != 0)
+			dlog(EERR, path, "Failed to put element.");
+	}
+
+	for (i = 0; i < (1 << 12); i += 2)
+		if (dhtable_rcu_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to overwrite element.");
+
+	for (i = 0; i < (1 << 12); i += 3)
+		if (dhtable_rcu_rm(table, &i) != 0)
+			dlog(EERR, path, "Failed to remove element.");
+
+	if (dhtable_rcu_synchronize(table) != 0)
+		dlog(EERR, path, "Failed to synchronize.");
+
+	__atomic_store_n(&stop, 1, __ATOMIC_RELEASE);
+
+	long reads = 0;
+	for (i = 0; i < 3; i++) {
+		pthread_join(threads[i], NULL);
+		reads += args[i].reads;
+	}
+
+	dhtable_rcu_reader reader = dhtable_rcu_register(table);
+	dhtable_rcu_enter(reader);
+
+	int count = 0;
+	for (i = 0; i < (1 << 12); i++) {
+		int *value = dhtable_rcu_get(table, &i);
+		int expect = (i & 1) ? -i : i;
+
+		if ((value != NULL) != (i % 3 != 0) || (value && *value != expect))
+			dlog(EERR, path, "Bad element %d.", i);
+
+		count += value != NULL;
+	}
+
+	dhtable_rcu_leave(reader);
+	dhtable_rcu_unregister(table, reader);
+
+	if (dhtable_rcu_size(table) != (size_t) count + RCU_STABLE_COUNT)
+		dlog(EERR, path, "Bad size: %lu.",
+		     (unsigned long) dhtable_rcu_size(table));
+
+	dlog(EINFO, path, "Readers made %ld reads.", reads);
+
+	if (dhtable_rcu_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	dlog(EINFO, path, "Finished tests.");
+}
+
+void test_hashtable_rcu_tags(void) {
+
+	const char *path = "test/hashtable/rcu/tags";
+
+	dlog(EINFO, path, "Starting tag spread tests.");
+	dhtable_rcu table = dhtable_rcu_init(1024, sizeof(int), sizeof(int),
+	                                     &test_count_cmp, NULL,
+	                                     &dhtable_swiss);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	int i;
+	for (i = 0; i < (1 << 16); i++)
+		if (dhtable_rcu_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	/* Swiss tags stay spread within a
+	 * slot, so misses rarely compare.
+	 */
+	dhtable_rcu_reader reader = dhtable_rcu_register(table);
+	dhtable_rcu_enter(reader);
+
+	test_cmps = 0;
+	for (i = 1 << 16; i < (1 << 17); i++)
+		if (dhtable_rcu_get(table, &i) != NULL)
+			dlog(EERR, path, "Found missing element %d.", i);
+
+	dhtable_rcu_leave(reader);
+	dhtable_rcu_unregister(table, reader);
+
+	if (test_cmps > (1 << 16))
+		dlog(EERR, path, "Tags follow the slot, %.2f compares per miss.",
+		     (double) test_cmps / (1 << 16));
+
+	if (dhtable_rcu_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	dlog(EINFO, path, "Finished tests.");
+}
+
+/* Sums values, stops on a negative one. */
+static int test_iter_visit(void *key, void *value, void *arg) {
+
+	if (*(int*) value < 0)
+		return 1;
+
+	*(long*) arg += *(int*) value;
+
+	return 0;
+}
+
+void test_hashtable_iter(const char *path,
+                         struct dhtable_backend *backend) {
+
+	dlog(EINFO, path, "Starting iterator tests.");
+
+	/* Sparse, so most bitmap words are empty. */
+	dhtable table = dhtable_init(1 << 16, sizeof(int), sizeof(int),
+	                             NULL, NULL, backend);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	dhtable_it it = dhtable_begin(table);
+	if (it.it != NULL)
+		dlog(EERR, path, "Empty table has an entry.");
+
+	int i, j;
+	for (i = 0; i < 1000; i++) {
+		j = i * 2;
+		if (dhtable_put(table, &i, &j) != 0)
+			dlog(EERR, path, "Failed to put element.");
+	}
+
+	for (i = 0; i < 1000; i += 3)
+		if (dhtable_rm(table, &i) != 0)
+			dlog(EERR, path, "Failed to remove element.");
+
+	long sum = 0, expect = 0;
+	int n = 0;
+
+	for (i = 0; i < 1000; i++)
+		if (i % 3 != 0)
+			expect += i * 2;
+
+	for (it = dhtable_begin(table); it.it != NULL;
+	     it = dhtable_next(table, it)) {
+		int *key = dhtable_iget(table, it);
+		if (key == NULL || key[1] != key[0] * 2 || key[0] % 3 == 0)
+			dlog(EERR, path, "Bad entry while iterating.");
+		else
+			sum += key[1];
+		n++;
+	}
+
+	if (n != 666 || sum != expect)
+		dlog(EERR, path, "Forward walk saw %d entries.", n);
+
+	n = 0;
+	for (it = dhtable_end(table); it.it != NULL;
+	     it = dhtable_prev(table, it))
+		n++;
+
+	if (n != 666)
+		dlog(EERR, path, "Backward walk saw %d entries.", n);
+
+	sum = 0;
+	if (dhtable_foreach(table, test_iter_visit, &sum) != 0 || sum != expect)
+		dlog(EERR, path, "Bad foreach sum.");
+
+	i = 500;
+	j = -1;
+	dhtable_put(table, &i, &j);
+
+	if (dhtable_foreach(table, test_iter_visit, &sum) != 1)
+		dlog(EERR, path, "Foreach did not stop.");
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	dlog(EINFO, path, "Finished tests.");
+}
+
+/* Counts visits and their bytes. */
+static int test_vkey_visit(const void *key, size_t len,
+                           void *value, void *arg) {
+
+	size_t *seen = (size_t*) arg;
+
+	seen[0]++;
+	seen[1] += len;
+
+	return 0;
+}
+
+/* Builds key i, padded by i % 150. */
+static int test_vkey_key(char *key, int i) {
+
+	memset(key, 'k', 256);
+
+	int len = snprintf(key, 256, "http://host/%d/", i);
+	key[len] = 'k';
+
+	return len + i % 150;
+}
+
+void test_hashtable_vkey(const char *path,
+                         struct dhtable_backend *backend) {
+
+	dlog(EINFO, path, "Starting variable key tests.");
+	dhtable_vkey table = dhtable_vkey_init(0, sizeof(int), backend);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	/* Keys of every length up to 200,
+	 * sharing prefixes, so compares
+	 * must reach the bytes.
+	 */
+	char key[256];
+	int i, len;
+	size_t bytes = 0;
+
+	for (i = 0; i < 2000; i++) {
+		len = test_vkey_key(key, i);
+
+		if (dhtable_vkey_put(table, key, len, &i) != 0)
+			dlog(EERR, path, "Failed to put key %d.", i);
+
+		bytes += len;
+	}
+
+	if (dhtable_vkey_put(table, "", 0, &i) != 0)
+		dlog(EERR, path, "Failed to put empty key.");
+
+	if (dhtable_vkey_size(table) != 2001)
+		dlog(EERR, path, "Bad size %lu.",
+		     (unsigned long) dhtable_vkey_size(table));
+
+	for (i = 0; i < 2000; i++) {
+		len = test_vkey_key(key, i);
+
+		/* Built from pieces. */
+		struct dhash_state state;
+		dhash_init(&state, 0);
+		dhash_update(&state, key, 5);
+		dhash_update(&state, key + 5, len - 5);
+
+		int *value = dhtable_vkey_get_hashed(table, key, len,
+		                                     dhash_final(&state));
+		if (value == NULL || *value != i)
+			dlog(EERR, path, "Failed to get key %d.", i);
+
+		if (dhtable_vkey_get(table, key, len - 1) != NULL)
+			dlog(EERR, path, "Got a prefix of key %d.", i);
+	}
+
+	for (i = 0; i < 2000; i += 2) {
+		len = test_vkey_key(key, i);
+
+		if (dhtable_vkey_rm(table, key, len) != 0)
+			dlog(EERR, path, "Failed to remove key %d.", i);
+	}
+
+	size_t seen[2] = { 0, 0 };
+
+	if (dhtable_vkey_foreach(table, test_vkey_visit, seen) != 0 ||
+	    seen[0] != 1001)
+		dlog(EERR, path, "Foreach saw %lu keys.", (unsigned long) seen[0]);
+
+	if (dhtable_vkey_arena(table) < bytes)
+		dlog(EERR, path, "Arena lost key bytes.");
+
+	int *value = dhtable_vkey_get(table, "", 0);
+	if (value == NULL || *value != 2000)
+		dlog(EERR, path, "Failed to get empty key.");
+
+	if (dhtable_vkey_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	dlog(EINFO, path, "Finished tests.");
+}
+
+/* Int to int. */
+DHTABLE_DEFINE(test_imap, int, int, dhtable_gen_hash, DHTABLE_GEN_EQ)
+
+void test_hashtable_stable(void) {
+
+	dlog(EINFO, "test/hashtable/stable", "Starting pointer stability tests.");
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, &dhtable_list);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	int i, j;
+	int *ptrs[64];
+
+	for (i = 0; i < 64; i++) {
+		j = i * 7;
+		if (dhtable_put(table, &i, &j) != 0)
+			dlog(EERR, "test/hashtable/stable", "Failed to put element.");
+		ptrs[i] = dhtable_get(table, &i);
+	}
+
+	dlog(EINFO, "test/hashtable/stable", "Growing, then shrinking.");
+	for (i = 64; i < (1 << 14); i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, "test/hashtable/stable", "Failed to put element.");
+
+	for (i = 1; i < 64; i += 2)
+		if (dhtable_rm(table, &i) != 0)
+			dlog(EERR, "test/hashtable/stable", "Failed to remove element.");
+
+	for (i = 64; i < (1 << 14); i++)
+		if (dhtable_rm(table, &i) != 0)
+			dlog(EERR, "test/hashtable/stable", "Failed to remove element.");
+
+	for (i = 0; i < 64; i += 2)
+		if (dhtable_get(table, &i) != ptrs[i] || *ptrs[i] != i * 7)
+			dlog(EERR, "test/hashtable/stable", "Moved element %d.", i);
+
+	dhtable copy = dhtable_copy(table);
+	if (copy == NULL || dhtable_size(copy) != 32)
+		dlog(EERR, "test/hashtable/stable", "Failed to copy table.");
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, "test/hashtable/stable", "Failed to kill table.");
+
+	for (i = 0; copy != NULL && i < 64; i++) {
+		int *t = dhtable_get(copy, &i);
+		if ((t == NULL) != (i & 1) || (t != NULL && *t != i * 7))
+			dlog(EERR, "test/hashtable/stable", "Bad copy element %d.", i);
+	}
+
+	if (copy != NULL && dhtable_kill(copy) != 0)
+		dlog(EERR, "test/hashtable/stable", "Failed to kill table.");
+
+	dlog(EINFO, "test/hashtable/stable", "Finished tests.");
+}
+
+/* Adds arg to a counter, new ones start at 0. */
+static void test_emplace_count(void *key, void *value,
+                               int inserted, void *arg) {
+
+	*(int*) value += *(int*) arg;
+}
+
+void test_hashtable_emplace(const char *path,
+                            struct dhtable_backend *backend) {
+
+	dlog(EINFO, path, "Starting emplace tests.");
+
+	/* Resizing, so inserts cross migrations. */
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, backend);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	int i, inserted, one = 1;
+	for (i = 0; i < 3000; i++) {
+		int key = i % 1000;
+		int *value = dhtable_emplace(table, &key, &inserted);
+
+		if (value == NULL || inserted != (i < 1000) ||
+		    (inserted && *value != 0))
+			dlog(EERR, path, "Bad emplace of %d.", key);
+		else
+			(*value)++;
+	}
+
+	if (dhtable_size(table) != 1000)
+		dlog(EERR, path, "Emplace counted %lu entries.",
+		     (unsigned long) dhtable_size(table));
+
+	for (i = 0; i < 2000; i++) {
+		int key = i % 1500;
+		if (dhtable_update(table, &key, test_emplace_count, &one) != 0)
+			dlog(EERR, path, "Failed to update %d.", key);
+	}
+
+	for (i = 0; i < 1500; i++) {
+		int *value = dhtable_get(table, &i);
+		int expect = (i < 1000 ? 3 : 0) + (i < 500 ? 2 : 1);
+
+		if (value == NULL || *value != expect)
+			dlog(EERR, path, "Bad count for %d.", i);
+	}
+
+	if (dhtable_size(table) != 1500)
+		dlog(EERR, path, "Update counted %lu entries.",
+		     (unsigned long) dhtable_size(table));
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	dlog(EINFO, path, "Finished tests.");
+}
+
+void test_hashtable_mmap(const char *path,
+                         struct dhtable_backend *backend) {
+
+	const char *file = "/tmp/daelib_test.dht";
+
+	dlog(EINFO, path, "Starting snapshot tests.");
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, backend);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	int i, j;
+
+	for (i = 0; i < (1 << 12); i++) {
+		j = i * 5;
+		if (dhtable_put(table, &i, &j) != 0)
+			dlog(EERR, path, "Failed to put element.");
+	}
+
+	for (i = 1; i < (1 << 12); i += 2)
+		if (dhtable_rm(table, &i) != 0)
+			dlog(EERR, path, "Failed to remove element.");
+
+	if (dhtable_save(table, file) != 0)
+		dlog(EERR, path, "Failed to save table.");
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	dlog(EINFO, path, "Mapping the image.");
+	dhtable mapped = dhtable_open_mmap(file, sizeof(int), sizeof(int),
+	                                   NULL, NULL);
+	if (mapped == NULL) {
+		dlog(EERR, path, "Failed to map table.");
+		return;
+	}
+
+	if (dhtable_size(mapped) != (1 << 11))
+		dlog(EERR, path, "Bad mapped size.");
+
+	for (i = 0; i < (1 << 12); i++) {
+		int *t = dhtable_get(mapped, &i);
+		if ((t == NULL) != (i & 1) || (t != NULL && *t != i * 5))
+			dlog(EERR, path, "Bad mapped element %d.", i);
+	}
+
+	size_t n = 0;
+	dhtable_it it;
+	for (it = dhtable_begin(mapped); it.it != NULL;
+	     it = dhtable_next(mapped, it))
+		n++;
+
+	if (n != (1 << 11))
+		dlog(EERR, path, "Bad mapped iteration.");
+
+	dlog(EINFO, path, "Testing rejected writes and images.");
+	i = 0;
+	if (dhtable_put(mapped, &i, &i) == 0)
+		dlog(EERR, path, "Wrote to a mapped table.");
+
+	dhtable bad = dhtable_open_mmap(file, sizeof(int), sizeof(long),
+	                                NULL, NULL);
+	if (bad != NULL)
+		dlog(EERR, path, "Mapped an image of other sizes.");
+
+	dlog(EINFO, path, "Saving over the mapped image.");
+	table = dhtable_init(0, sizeof(int), sizeof(int), NULL, NULL, backend);
+
+	for (i = 0; i < (1 << 12); i += 2) {
+		j = i * 7;
+		if (dhtable_put(table, &i, &j) != 0)
+			dlog(EERR, path, "Failed to put element.");
+	}
+
+	if (dhtable_save(table, file) != 0)
+		dlog(EERR, path, "Failed to save over the image.");
+
+	dhtable_kill(table);
+
+	for (i = 0; i < (1 << 12); i += 2) {
+		int *t = dhtable_get(mapped, &i);
+		if (t == NULL || *t != i * 5)
+			dlog(EERR, path, "Saving changed mapped element %d.", i);
+	}
+
+	dhtable remapped = dhtable_open_mmap(file, sizeof(int), sizeof(int),
+	                                     NULL, NULL);
+	if (remapped == NULL) {
+		dlog(EERR, path, "Failed to map the new image.");
+	} else {
+		for (i = 0; i < (1 << 12); i += 2) {
+			int *t = dhtable_get(remapped, &i);
+			if (t == NULL || *t != i * 7)
+				dlog(EERR, path, "Bad remapped element %d.", i);
+		}
+
+		dhtable_kill(remapped);
+	}
+
+	if (dhtable_kill(mapped) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	remove(file);
+
+	dlog(EINFO, path, "Finished tests.");
+}
+
+void test_hashtable_parallel(void) {
+
+	const char *path = "test/hashtable/parallel";
+
+	dlog(EINFO, path, "Starting parallel copy and join tests.");
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+	dhtable fixed = dhtable_init(1000, sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+	DASSERT(table != NULL && fixed != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	if (dhtable_set_threads(table, 4) != 0)
+		dlog(EERR, path, "Failed to set threads.");
+
+	int i, j;
+
+	for (i = 0; i < (1 << 15); i++) {
+		j = i * 2;
+		if (dhtable_put(table, &i, &j) != 0)
+			dlog(EERR, path, "Failed to put element.");
+	}
+
+	for (i = 1 << 15; i < (1 << 16); i++)
+		if (dhtable_put(fixed, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	dlog(EINFO, path, "Copying.");
+	dhtable copy = dhtable_copy(table);
+	if (copy == NULL) {
+		dlog(EERR, path, "Failed to copy table.");
+		return;
+	}
+
+	for (i = 0; i < (1 << 15); i++) {
+		int *t = dhtable_get(copy, &i);
+		if (t == NULL || *t != i * 2)
+			dlog(EERR, path, "Bad copied element %d.", i);
+	}
+
+	dlog(EINFO, path, "Joining the same layout.");
+	for (i = 0; i < (1 << 15); i += 2) {
+		j = -i;
+		if (dhtable_put(table, &i, &j) != 0)
+			dlog(EERR, path, "Failed to put element.");
+	}
+
+	if (dhtable_set_threads(copy, 4) != 0 || dhtable_join(copy, table) != 0)
+		dlog(EERR, path, "Failed to join tables.");
+
+	for (i = 0; i < (1 << 15); i++) {
+		int *t = dhtable_get(copy, &i);
+		if (t == NULL || *t != ((i & 1) ? i * 2 : -i))
+			dlog(EERR, path, "Bad joined element %d.", i);
+	}
+
+	dlog(EINFO, path, "Joining other bucket counts.");
+	if (dhtable_join(copy, fixed) != 0)
+		dlog(EERR, path, "Failed to join tables.");
+
+	if (dhtable_size(copy) != (1 << 16))
+		dlog(EERR, path, "Bad joined size %d.", (int) dhtable_size(copy));
+
+	for (i = 1 << 15; i < (1 << 16); i++) {
+		int *t = dhtable_get(copy, &i);
+		if (t == NULL || *t != i)
+			dlog(EERR, path, "Bad rehashed element %d.", i);
+	}
+
+	dlog(EINFO, path, "Joining into a growing table serially.");
+	dhtable grown = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+	struct dhtable_stats stats;
+
+	if (grown == NULL || dhtable_join(grown, copy) != 0 ||
+	    dhtable_stats(grown, &stats) != 0)
+		dlog(EERR, path, "Failed to join into a growing table.");
+
+	else if (stats.count != (1 << 16) || stats.load > 2.0)
+		dlog(EERR, path, "Serial join left load %f over %zu buckets.",
+		     stats.load, stats.buckets);
+
+	if (grown != NULL && dhtable_kill(grown) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	if (dhtable_kill(table) != 0 || dhtable_kill(fixed) != 0 ||
+	    dhtable_kill(copy) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	dlog(EINFO, path, "Finished tests.");
+}
+
+static uint64_t test_stats_hsh(size_t key_size, void *key) {
+
+	return 42;
+}
+
+void test_hashtable_stats(void) {
+
+	const char *path = "test/hashtable/stats";
+
+	dlog(EINFO, path, "Starting statistics tests.");
+	dhtable table = dhtable_init(0, sizeof(int), sizeof(int),
+	                             NULL, NULL, NULL);
+	dhtable bad = dhtable_init64(64, sizeof(int), sizeof(int),
+	                             NULL, &test_stats_hsh, NULL);
+	DASSERT(table != NULL && bad != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	int i;
+	for (i = 0; i < (1 << 12); i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	for (i = 0; i < (1 << 12); i += 3)
+		if (dhtable_rm(table, &i) != 0)
+			dlog(EERR, path, "Failed to remove element.");
+
+	for (i = 0; i < 256; i++)
+		if (dhtable_put(bad, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put element.");
+
+	size_t n = 0;
+	dhtable_it it;
+	for (it = dhtable_begin(table); it.it != NULL;
+	     it = dhtable_next(table, it))
+		n++;
+
+	if (dhtable_size(table) != n)
+		dlog(EERR, path, "Size drifted from the entries.");
+
+	struct dhtable_stats stats;
+	if (dhtable_stats(table, &stats) != 0)
+		dlog(EERR, path, "Failed to gather stats.");
+
+	size_t buckets = 0, entries = 0;
+	for (i = 0; i < DHTABLE_STATS_CHAINS; i++) {
+		buckets += stats.chains[i];
+		entries += i * stats.chains[i];
+	}
+
+	if (stats.count != n || buckets != stats.buckets ||
+	    stats.occupied != stats.buckets - stats.chains[0] ||
+	    (stats.max_chain < DHTABLE_STATS_CHAINS && entries != n))
+		dlog(EERR, path, "Bad chain stats.");
+
+	if (stats.hit_probes < 1 || stats.bytes == 0)
+		dlog(EERR, path, "Bad probe or byte stats.");
+
+	dlog(EINFO, path, "Load %.2f, max chain %d, probes %.2f/%.2f, "
+	     "%.1f bytes per bucket.", stats.load, (int) stats.max_chain,
+	     stats.hit_probes, stats.miss_probes, stats.bytes_per_bucket);
+
+	if (dhtable_stats(bad, &stats) != 0)
+		dlog(EERR, path, "Failed to gather stats.");
+
+	if (stats.occupied != 1 || stats.max_chain != 256 ||
+	    stats.chains[DHTABLE_STATS_CHAINS - 1] != 1 || stats.hit_probes < 2)
+		dlog(EERR, path, "Missed a degraded hash.");
+
+	if (dhtable_kill(table) != 0 || dhtable_kill(bad) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	dlog(EINFO, path, "Finished tests.");
+}
+
+void test_hashtable_gen(void) {
+
+	dlog(EINFO, "test/hashtable/gen", "Starting generated table tests.");
+	struct test_imap *table = test_imap_init(0);
+	DASSERT(table != NULL, DLOG, "Failed to init table.",
+		return;
+		);
+
+	/* Checked against a plain array. */
+	static int ref[1 << 12];
+	static char has[1 << 12];
+
+	unsigned x = 1;
+
+	int i;
+	for (i = 0; i < (1 << 18); i++) {
+
+		x = x * 1664525u + 1013904223u;
+		int key = (int) ((x >> 8) & ((1 << 12) - 1));
+
+		if ((x >> 28) < 6) {
+			if (test_imap_put(table, key, i) != 0)
+				dlog(EERR, "test/hashtable/gen", "Failed to put element.");
+			ref[key] = i;
+			has[key] = 1;
+
+		} else if ((x >> 28) < 12) {
+			if (test_imap_rm(table, key) != 0)
+				dlog(EERR, "test/hashtable/gen", "Failed to remove element.");
+			has[key] = 0;
+
+		} else {
+			int *t = test_imap_get(table, key);
+			if ((t != NULL) != has[key] || (t != NULL && *t != ref[key]))
+				dlog(EERR, "test/hashtable/gen", "Bad element %d.", key);
+		}
+	}
+
+	size_t count = 0;
+	for (i = 0; i < (1 << 12); i++)
+		count += has[i];
+
+	if (test_imap_size(table) != count)
+		dlog(EERR, "test/hashtable/gen", "Bad size: %d.",
+		     test_imap_size(table));
+
+	if (test_imap_kill(table) != 0)
+		dlog(EERR, "test/hashtable/gen", "Failed to kill table.");
+
+	dlog(EINFO, "test/hashtable/gen", "Finished tests.");
+}
+
+void test_vector(void) {
+
+	dlog(EINFO, "test/vector", "Starting capacity tests.");
+
+	dvec vec = dvec_init(sizeof(uint64_t));
+	uint64_t i;
+
+	if (dvec_capacity(vec) != 0)
+		dlog(EERR, "test/vector", "New vector has capacity.");
+
+	/* Reserve is exact, and survives draining. */
+	if (dvec_reserve(vec, 1000) != 0 || dvec_capacity(vec) != 1000)
+		dlog(EERR, "test/vector", "Reserve gave %zu.", dvec_capacity(vec));
+
+	for (i = 0; i < 1000; i++)
+		dvec_push(vec, &i);
+
+	if (dvec_capacity(vec) != 1000)
+		dlog(EERR, "test/vector", "Reserved push reallocated.");
+
+	for (i = 0; i < 1000; i++)
+		dvec_pop(vec);
+
+	if (dvec_capacity(vec) != 1000)
+		dlog(EERR, "test/vector", "Reserved pop shrank.");
+
+	/* Shrink to fit drops the reservation. */
+	for (i = 0; i < 10; i++)
+		dvec_push(vec, &i);
+
+	if (dvec_shrink_to_fit(vec) != 0 || dvec_capacity(vec) != 10)
+		dlog(EERR, "test/vector", "Shrink to fit gave %zu.",
+		     dvec_capacity(vec));
+
+	for (i = 0; i < 10; i++)
+		if (*(uint64_t*) dvec_get(vec, i) != i)
+			dlog(EERR, "test/vector", "Shrink to fit lost %llu.",
+			     (unsigned long long) i);
+
+	/* Default growth doubles to powers of two. */
+	for (i = 10; i < 4096; i++)
+		dvec_push(vec, &i);
+
+	if (dvec_capacity(vec) != 4096)
+		dlog(EERR, "test/vector", "Double gave %zu.", dvec_capacity(vec));
+
+	/* Default shrink waits for a quarter, and halves. */
+	for (i = 0; i < 3072; i++)
+		dvec_pop(vec);
+
+	if (dvec_capacity(vec) != 4096)
+		dlog(EERR, "test/vector", "Shrank above a quarter.");
+
+	dvec_pop(vec);
+
+	if (dvec_capacity(vec) != 2046)
+		dlog(EERR, "test/vector", "Shrink gave %zu.", dvec_capacity(vec));
+
+	/* No shrinking at all. */
+	dvec_set_shrink(vec, 0);
+	while (dvec_size(vec) > 0)
+		dvec_pop(vec);
+
+	if (dvec_capacity(vec) != 2046)
+		dlog(EERR, "test/vector", "Shrank while disabled.");
+
+	dvec_shrink_to_fit(vec);
+
+	/* Chunk and half growth. */
+	dvec_set_growth(vec, DVEC_CHUNK, 100);
+	for (i = 0; i < 250; i++)
+		dvec_push(vec, &i);
+
+	if (dvec_capacity(vec) != 300)
+		dlog(EERR, "test/vector", "Chunk gave %zu.", dvec_capacity(vec));
+
+	dvec_shrink_to_fit(vec);
+	dvec_set_growth(vec, DVEC_HALF, 0);
+	dvec_push(vec, &i);
+
+	if (dvec_capacity(vec) != 375)
+		dlog(EERR, "test/vector", "Half gave %zu.", dvec_capacity(vec));
+
+	/* Copies keep the policy. */
+	dvec copy = dvec_copy(vec);
+	dvec_shrink_to_fit(copy);
+	dvec_push(copy, &i);
+
+	if (dvec_capacity(copy) != 376)
+		dlog(EERR, "test/vector", "Copy gave %zu.", dvec_capacity(copy));
+
+	dvec_kill(copy);
+	dvec_kill(vec);
+
+	/* Mapped blocks round to huge pages,
+	 * and keep elements moving in and out.
+	 */
+	vec = dvec_init(sizeof(uint64_t));
+	dvec_set_mapping(vec, 1 << 20);
+
+	for (i = 0; i < (1 << 18); i++)
+		dvec_push(vec, &i);
+
+	if (dvec_capacity(vec) % ((2 << 20) / sizeof(uint64_t)) != 0)
+		dlog(EERR, "test/vector", "Mapped capacity %zu not aligned.",
+		     dvec_capacity(vec));
+
+	copy = dvec_copy(vec);
+
+	for (i = 0; i < (1 << 18) - 100; i++)
+		dvec_pop(vec);
+
+	if (dvec_capacity(vec) >= (1 << 17))
+		dlog(EERR, "test/vector", "Mapped vector did not shrink.");
+
+	for (i = 0; i < 100; i++)
+		if (*(uint64_t*) dvec_get(vec, i) != i)
+			dlog(EERR, "test/vector", "Unmapping lost %llu.",
+			     (unsigned long long) i);
+
+	for (i = 0; i < (1 << 18); i++)
+		if (*(uint64_t*) dvec_get(copy, i) != i) {
+			dlog(EERR, "test/vector", "Mapped copy lost %llu.",
+			     (unsigned long long) i);
+			break;
+		}
+
+	/* Bulk deletes unmap without copying
+	 * past the block they move to.
+	 */
+	dvec bulk = dvec_init(sizeof(uint64_t));
+	dvec_set_mapping(bulk, 1 << 20);
+
+	for (i = 0; i < (1 << 18); i++)
+		dvec_push(bulk, &i);
+
+	if (dvec_delete(bulk, 0, (1 << 18) - 10) != 0 || dvec_size(bulk) != 10)
+		dlog(EERR, "test/vector", "Bulk delete left %zu.", dvec_size(bulk));
+
+	for (i = 0; i < 10; i++)
+		if (*(uint64_t*) dvec_get(bulk, i) != (1 << 18) - 10 + i)
+			dlog(EERR, "test/vector", "Bulk delete lost %llu.",
+			     (unsigned long long) i);
+
+	dvec_kill(bulk);
+
+	/* Unchecked accessors match the checked ones. */
+	for (i = 100; i < 5000; i++)
+		if (dvec_push_fast(vec, &i) != 0)
+			dlog(EERR, "test/vector", "Fast push failed.");
+
+	if (dvec_size_fast(vec) != dvec_size(vec) || dvec_size(vec) != 5000)
+		dlog(EERR, "test/vector", "Fast size gave %zu.", dvec_size_fast(vec));
+
+	if (dvec_peek_fast(vec) != dvec_peek(vec) || dvec_data(vec) != dvec_get(vec, 0))
+		dlog(EERR, "test/vector", "Fast peek or data differs.");
+
+	struct dvec_span span = dvec_span_fast(vec, 10, 5000);
+
+	if (span.count != 4990 || span.elem_size != sizeof(uint64_t))
+		dlog(EERR, "test/vector", "Span has %zu elements.", span.count);
+
+	for (i = 0; i < span.count; i++)
+		if (((uint64_t*) span.data)[i] != i + 10 ||
+		    *(uint64_t*) dvec_get_fast(vec, i + 10) != i + 10) {
+			dlog(EERR, "test/vector", "Fast get lost %llu.",
+			     (unsigned long long) i + 10);
+			break;
+		}
+
+	/* Small vectors stay inline until they
+	 * spill, and move back when they fit.
+	 */
+	dvec small = dvec_init_small(sizeof(uint64_t), 4);
+	void *inline_data = dvec_data(small);
+
+	if (dvec_capacity(small) != 4 || inline_data == NULL)
+		dlog(EERR, "test/vector", "Small capacity %zu.", dvec_capacity(small));
+
+	for (i = 0; i < 4; i++)
+		dvec_push(small, &i);
+
+	if (dvec_data(small) != inline_data)
+		dlog(EERR, "test/vector", "Small vector spilled early.");
+
+	for (i = 4; i < 100; i++)
+		dvec_push(small, &i);
+
+	dvec small_copy = dvec_copy(small);
+
+	while (dvec_size(small) > 3)
+		dvec_pop(small);
+
+	dvec_shrink_to_fit(small);
+
+	if (dvec_data(small) != inline_data || dvec_capacity(small) != 4)
+		dlog(EERR, "test/vector", "Small vector did not move back inline.");
+
+	for (i = 0; i < 3; i++)
+		if (*(uint64_t*) dvec_get(small, i) != i)
+			dlog(EERR, "test/vector", "Small vector lost %llu.",
+			     (unsigned long long) i);
+
+	for (i = 0; i < 100; i++)
+		if (*(uint64_t*) dvec_get(small_copy, i) != i) {
+			dlog(EERR, "test/vector", "Small copy lost %llu.",
+			     (unsigned long long) i);
+			break;
+		}
+
+	/* Bulk deletes move back inline
+	 * without overrunning it.
+	 */
+	dvec small_bulk = dvec_init_small(1, 8192);
+	char bytes[40000];
+
+	for (i = 0; i < sizeof(bytes); i++)
+		bytes[i] = (char) i;
+
+	if (dvec_insert(small_bulk, sizeof(bytes), bytes, 0) != 0 ||
+	    dvec_delete(small_bulk, 0, sizeof(bytes) - 10) != 0)
+		dlog(EERR, "test/vector", "Small bulk insert or delete failed.");
+
+	if (dvec_size(small_bulk) != 10 || dvec_capacity(small_bulk) != 8192)
+		dlog(EERR, "test/vector", "Small bulk delete left %zu of %zu.",
+		     dvec_size(small_bulk), dvec_capacity(small_bulk));
+
+	for (i = 0; i < 10; i++)
+		if (*(char*) dvec_get(small_bulk, i) != bytes[sizeof(bytes) - 10 + i])
+			dlog(EERR, "test/vector", "Small bulk delete lost %llu.",
+			     (unsigned long long) i);
+
+	dvec_kill(small_bulk);
+	dvec_kill(small_copy);
+	dvec_kill(small);
+
+	/* Sizes past SIZE_MAX fail cleanly. */
+	if (dvec_reserve(vec, SIZE_MAX / 4) == 0)
+		dlog(EERR, "test/vector", "Overflowing reserve succeeded.");
+
+	dvec_kill(copy);
+	dvec_kill(vec);
+
+	dlog(EINFO, "test/vector", "Finished capacity tests.");
+}
+
+/* Counts what is live, by the
+ * sizes the containers give.
+ */
+struct test_count {
+	size_t blocks;
+	size_t bytes;
+	size_t calls;
+};
+
+static void *test_count_alloc(void *ctx, size_t size) {
+
+	struct test_count *count = ctx;
+
+	count->blocks++;
+	count->bytes += size;
+	count->calls++;
+
+	return malloc(size);
+}
+
+static void *test_count_aligned(void *ctx, size_t align, size_t size) {
+
+	struct test_count *count = ctx;
+	void *mem = NULL;
+
+	if (posix_memalign(&mem, align < sizeof(void*) ? sizeof(void*) : align,
+	                   size) != 0)
+		return NULL;
+
+	count->blocks++;
+	count->bytes += size;
+	count->calls++;
+
+	return mem;
+}
+
+static void *test_count_realloc(void *ctx, void *ptr,
+                                size_t old_size, size_t new_size) {
+
+	struct test_count *count = ctx;
+
+	count->bytes += new_size - old_size;
+	count->calls++;
+
+	return realloc(ptr, new_size);
+}
+
+static void test_count_free(void *ctx, void *ptr, size_t size) {
+
+	struct test_count *count = ctx;
+
+	count->blocks--;
+	count->bytes -= size;
+	count->calls++;
+
+	free(ptr);
+}
+
+void test_alloc(const char *path, struct dhtable_backend *backend) {
+
+	dlog(EINFO, path, "Starting allocator tests.");
+
+	struct test_count count = {0, 0, 0};
+	struct dalloc alloc = {
+		.alloc = &test_count_alloc,
+		.aligned = &test_count_aligned,
+		.realloc = &test_count_realloc,
+		.free = &test_count_free,
+		.ctx = &count
+	};
+
+	dhtable table = dhtable_init_ex(0, sizeof(int), sizeof(int),
+	                                NULL, NULL, backend, &alloc);
+
+	if (table == NULL) {
+		dlog(EERR, path, "Failed to init table.");
+		return;
+	}
+
+	int i;
+	for (i = 0; i < 5000; i++)
+		if (dhtable_put(table, &i, &i) != 0)
+			dlog(EERR, path, "Failed to put %d.", i);
+
+	for (i = 0; i < 5000; i += 2)
+		if (dhtable_rm(table, &i) != 0)
+			dlog(EERR, path, "Failed to rm %d.", i);
+
+	dhtable copy = dhtable_copy(table);
+
+	if (copy == NULL || dhtable_size(copy) != 2500)
+		dlog(EERR, path, "Failed to copy table.");
+
+	for (i = 1; i < 5000; i += 2) {
+		int *value = dhtable_get(copy, &i);
+		if (value == NULL || *value != i)
+			dlog(EERR, path, "Copy lost %d.", i);
+	}
+
+	dhtable_kill(copy);
+
+	if (count.calls == 0)
+		dlog(EERR, path, "Allocator was never called.");
+
+	if (dhtable_kill(table) != 0)
+		dlog(EERR, path, "Failed to kill table.");
+
+	if (count.blocks != 0 || count.bytes != 0)
+		dlog(EERR, path, "Leaked %zu blocks, %zu bytes.",
+		     count.blocks, count.bytes);
+
+	/* Vectors, growing past their inline
+	 * room and shrinking back.
+	 */
+	dvec vec = dvec_init_ex(sizeof(int), 4, &alloc);
+
+	for (i = 0; i < 10000; i++)
+		dvec_push(vec, &i);
+
+	dvec vec_copy = dvec_copy(vec);
+
+	while (dvec_size(vec) > 2)
+		dvec_pop(vec);
+
+	dvec_shrink_to_fit(vec);
+	dvec_kill(vec);
+	dvec_kill(vec_copy);
+
+	if (count.blocks != 0 || count.bytes != 0)
+		dlog(EERR, path, "Vectors leaked %zu blocks, %zu bytes.",
+		     count.blocks, count.bytes);
+
+	dlog(EINFO, path, "Finished allocator tests.");
+}
+
+/* A bump arena, freed whole. */
+struct test_arena {
+	char *chunks[256];
+	size_t count;
+	size_t used;
+};
+
+#define TEST_ARENA_CHUNK (1 << 20)
+
+static void *test_arena_aligned(void *ctx, size_t align, size_t size) {
+
+	struct test_arena *arena = ctx;
+
+	if (align < 16)
+		align = 16;
+
+	uintptr_t base = (arena->count == 0) ? 0 :
+		(uintptr_t) arena->chunks[arena->count - 1];
+	size_t at = arena->used + (-(base + arena->used) & (align - 1));
+
+	if (arena->count == 0 || at + size > TEST_ARENA_CHUNK) {
+		if (size + align > TEST_ARENA_CHUNK || arena->count == 256)
+			return NULL;
+
+		arena->chunks[arena->count++] = malloc(TEST_ARENA_CHUNK);
+		at = -(uintptr_t) arena->chunks[arena->count - 1] & (align - 1);
+	}
+
+	arena->used = at + size;
+
+	return arena->chunks[arena->count - 1] + at;
+}
+
+static void *test_arena_alloc(void *ctx, size_t size) {
+
+	return test_arena_aligned(ctx, 16, size);
+}
+
+static void *test_arena_realloc(void *ctx, void *ptr,
+                                size_t old_size, size_t new_size) {
+
+	void *mem = test_arena_aligned(ctx, 16, new_size);
+
+	if (mem != NULL)
+		memcpy(mem, ptr, old_size < new_size ? old_size : new_size);
+
+	return mem;
+}
+
+static void test_arena_free(void *ctx, void *ptr, size_t size) {
+
+}
+
+void test_alloc_arena(void) {
+
+	dlog(EINFO, "test/alloc/arena", "Starting arena tests.");
+
+	struct test_arena arena = {{NULL}, 0, 0};
+	struct dalloc alloc = {
+		.alloc = &test_arena_alloc,
+		.aligned = &test_arena_aligned,
+		.realloc = &test_arena_realloc,
+		.free = &test_arena_free,
+		.ctx = &arena
+	};
+
+	/* Request scoped tables, dropped
+	 * with the arena, never killed.
+	 */
+	struct dhtable_backend *backends[] = {
+		NULL, &dhtable_flat, &dhtable_swiss, &dhtable_btree, &dhtable_list
+	};
+
+	size_t b;
+	for (b = 0; b < sizeof(backends) / sizeof(*backends); b++) {
+
+		dhtable table = dhtable_init_ex(0, sizeof(int), sizeof(int),
+		                                NULL, NULL, backends[b], &alloc);
+
+		int i;
+		for (i = 0; i < 2000; i++)
+			if (dhtable_put(table, &i, &i) != 0)
+				dlog(EERR, "test/alloc/arena", "Failed to put %d.", i);
+
+		for (i = 0; i < 2000; i++) {
+			int *value = dhtable_get(table, &i);
+			if (value == NULL || *value != i)
+				dlog(EERR, "test/alloc/arena", "Lost %d.", i);
+		}
+	}
 
+	size_t c;
+	for (c = 0; c < arena.count; c++)
+		free(arena.chunks[c]);
 
+	dlog(EINFO, "test/alloc/arena", "Finished arena tests.");
 }
 
 void test_assert(void) {
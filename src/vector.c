@@ -1,33 +1,30 @@
 /** daelib/vector.c: Simple vector implementation.
  * TODO:
- * - growth ratio
  * - further profiling
- * - SizeMax + asserts
  */
 
 #define _VECTOR_DEBUG
 
-/* Prototypes. */
-#include "vector.h"
+/* mremap(), MREMAP_MAYMOVE. */
+#define _GNU_SOURCE
+
+/* Prototypes, struct layout. */
+#include "vector_inline.h"
 
 /* Assertions. */
 #include "assert.h"
 
-/* malloc(), realloc(), free(). */
-#include <stdlib.h>
+/* dalloc_libc, dalloc_*(). */
+#include "alloc.h"
 
 /* memcpy(), memmove(). */
 #include <string.h>
 
+/* SIZE_MAX. */
+#include <stdint.h>
 
-/* Base definition for a vector. */
-struct daelib_vector {
-	size_t elem_size;
-	size_t elem_count;
-
-	size_t allocated;
-	void *data;
-};
+/* mmap(), mremap(), madvise(). */
+#include <sys/mman.h>
 
 
 #if 0 /* For debugging. */
@@ -50,69 +47,277 @@ void _dvec_print_int_map(dvec vec);
 #endif /* IALLOC */
 
 
+/* Shrink when under this load,
+ * to twice the elements held.
+ */
+#define DEFAULT_SHRINK 0.25
+
+/* Shrinking never goes under this
+ * many bytes, as small blocks are
+ * cheaper kept than reallocated.
+ */
+#define SHRINK_FLOOR 4096
+
+/* Blocks this big are mapped, grown in
+ * place by mremap() and backed by huge
+ * pages where the kernel allows.
+ */
+#define DEFAULT_MAP_AT (16 << 20)
+
+/* Mapped blocks round up to whole huge
+ * pages, as a part page can't be one.
+ */
+#define MAP_ALIGN (2 << 20)
+
+
 /* Smears bits to the right.
  * Round up to the next 2^n-1.
- * Returns -1 on negative.
  */
-static int _dvec_smear(int num) {
+static size_t _dvec_smear(size_t num) {
 
 	/* Return 2^n - 1, where n is the
 	 * largest bitplace with an on bit.
 	 * (AKA round up to the next 2^n-1.)
 	 */
-	int tmp = num;
+	size_t tmp = num;
 	tmp |= tmp >>  1;
 	tmp |= tmp >>  2;
 	tmp |= tmp >>  4;
 	tmp |= tmp >>  8;
 	tmp |= tmp >> 16;
+#if SIZE_MAX > 0xFFFFFFFFu
+	tmp |= tmp >> 32;
+#endif
 	return tmp;
 }
 
-/* Round up a vector's size. */
-static int _dvec_round(size_t size) {
+/* Round up a vector's size.
+ * Returns size when 2^n
+ * would overflow.
+ */
+static size_t _dvec_round(size_t size) {
 
 	/* Adjust smear (2^n-1), add one (2^n),
 	 * and make it make sure it won't round up
-	 * powers of two.
+	 * powers of two. Wrapping to 0 means the
+	 * next power of two can't be held.
 	 */
-	return _dvec_smear(size - 1) + 1;
+	size_t rounded = _dvec_smear(size - 1) + 1;
+
+	return (rounded < size) ? size : rounded;
 }
 
-/* Resize a vector.
- * Returns nonzero on error.
+/* Map a block, asking for huge pages.
+ * Returns NULL on error.
+ */
+static void *_dvec_map(size_t bytes) {
+
+	/* Map anonymous memory, advise,
+	 * return.
+	 */
+	void *data = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+	                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+	if (data == MAP_FAILED)
+		return NULL;
+
+#ifdef MADV_HUGEPAGE
+	madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+
+	return data;
+}
+
+/* Free a vector's block.
  * ASSUMES VEC IS VALID.
- * TODO: 1.5 growth factor?
  */
-static int _dvec_resize(dvec vec, size_t newsize) {
+static void _dvec_free(dvec vec) {
+
+	/* Unmap or free by how the
+	 * block was made, leave an
+	 * inline one, clear it.
+	 */
+	if (vec->mapped)
+		munmap(vec->data, vec->allocated);
+	else if (vec->data != vec->inline_data)
+		dalloc_free(vec->alloc, vec->data, vec->allocated);
+
+	vec->data = NULL;
+	vec->allocated = 0;
+	vec->mapped = 0;
+}
+
+/* Get the bytes of elements that fit a block
+ * of bytes. Deletes shrink before they count
+ * down, so only the head is kept then.
+ * ASSUMES VEC IS VALID.
+ */
+static size_t _dvec_kept(dvec vec, size_t bytes) {
 
-	/* Heuristically eliminate most queries.
-	 * Verify we won't go over our type limits.
-	 * Find the desired rounded size.
-	 * Realloc (or malloc) a new (appropriately
-	 * sized) data block. Check for errors
-	 * and return.
+	/* Clamp the used bytes, return. */
+	size_t used = vec->elem_count * vec->elem_size;
+
+	return used < bytes ? used : bytes;
+}
+
+/* Move a vector's block to bytes, keeping
+ * its elements. Big blocks are mapped, and
+ * grow in place. Returns nonzero on error.
+ * ASSUMES VEC IS VALID, BYTES HOLDS ITS ELEMENTS.
+ */
+static int _dvec_realloc(dvec vec, size_t bytes) {
+
+	/* Move back inline if it fits. Free an
+	 * empty block. Round mapped sizes to whole
+	 * huge pages. Remap a mapped block, realloc
+	 * an allocated one, or else move the elements
+	 * across, free the old block and return.
 	 */
-	if ((newsize * vec->elem_size <= vec->allocated) &&
-	    newsize * vec->elem_size > ((vec->allocated >> 2)))
+	if (vec->inline_size != 0 && bytes <= vec->inline_size) {
+		if (vec->data != vec->inline_data) {
+			memcpy(vec->inline_data, vec->data,
+			       _dvec_kept(vec, bytes));
+			_dvec_free(vec);
+		}
+
+		vec->data = vec->inline_data;
+		vec->allocated = vec->inline_size;
+
+		return 0;
+	}
+
+	if (bytes == 0) {
+		_dvec_free(vec);
+		return 0;
+	}
+
+	int map = (vec->map_at != 0 && bytes >= vec->map_at);
+	void *new_data;
+
+	if (map && bytes <= SIZE_MAX - MAP_ALIGN)
+		bytes = (bytes + MAP_ALIGN - 1) / MAP_ALIGN * MAP_ALIGN;
+
+	if (map && vec->mapped) {
+#ifdef MREMAP_MAYMOVE
+		new_data = mremap(vec->data, vec->allocated, bytes,
+		                  MREMAP_MAYMOVE);
+
+		DASSERT(new_data != MAP_FAILED, IALLOC,
+		        "Failed to remap vector.",
+			return 1;
+			);
+
+#ifdef MADV_HUGEPAGE
+		madvise(new_data, bytes, MADV_HUGEPAGE);
+#endif
+
+		vec->data = new_data;
+		vec->allocated = bytes;
+
 		return 0;
+#endif
+	}
+
+	if (!map && !vec->mapped && vec->data != vec->inline_data) {
+		new_data = dalloc_realloc(vec->alloc, vec->data,
+		                          vec->allocated, bytes);
 
-	size_t new_allocated = _dvec_round(newsize * vec->elem_size);
+		DASSERT(new_data != NULL, IALLOC, "Failed to realloc vector.",
+			return 1;
+			);
 
-	void *new_data = NULL;
-	new_data = (void*) realloc(vec->data, new_allocated);
+		vec->data = new_data;
+		vec->allocated = bytes;
 
-	DASSERT(new_data != NULL || new_allocated == 0, IALLOC,
-	        "Failed to realloc vector.",
+		return 0;
+	}
+
+	new_data = map ? _dvec_map(bytes) : dalloc_alloc(vec->alloc, bytes);
+
+	DASSERT(new_data != NULL, IALLOC, "Failed to reallocate vector.",
 		return 1;
 		);
 
+	if (vec->data != NULL)
+		memcpy(new_data, vec->data, _dvec_kept(vec, bytes));
+
+	_dvec_free(vec);
+
 	vec->data = new_data;
-	vec->allocated = new_allocated;
+	vec->allocated = bytes;
+	vec->mapped = map;
 
 	return 0;
 }
 
+/* Find the bytes to grow to, to
+ * hold need, by the growth policy.
+ * ASSUMES VEC IS VALID.
+ */
+static size_t _dvec_grow(dvec vec, size_t need) {
+
+	/* Double to a power of two,
+	 * or add half, or round up
+	 * to whole chunks.
+	 */
+	size_t grown;
+
+	switch (vec->growth) {
+	case DVEC_HALF:
+		grown = vec->allocated + (vec->allocated >> 1);
+		return (grown > need && grown > vec->allocated) ? grown : need;
+
+	case DVEC_CHUNK:
+		grown = vec->chunk * vec->elem_size;
+		if (grown == 0 || need > SIZE_MAX - grown)
+			return need;
+		return (need + grown - 1) / grown * grown;
+
+	default:
+		return _dvec_round(need);
+	}
+}
+
+/* Resize a vector, growing by its
+ * policy, shrinking only under its
+ * shrink load. Returns nonzero on error.
+ * ASSUMES VEC IS VALID.
+ */
+static int _dvec_resize(dvec vec, size_t newsize) {
+
+	/* Check the bytes fit a size_t. Keep
+	 * the block if it fits and is loaded
+	 * enough, or is too small to shrink.
+	 * Else grow, or shrink to twice the
+	 * need. Move the block, return.
+	 */
+	DASSERT(vec->elem_size == 0 || newsize <= SIZE_MAX / vec->elem_size,
+	        ICALLER, "Vector size overflows.",
+		return 1;
+		);
+
+	size_t need = newsize * vec->elem_size;
+	size_t new_allocated;
+
+	if (need <= vec->allocated) {
+		size_t floor = (vec->reserved > SHRINK_FLOOR) ?
+			vec->reserved : SHRINK_FLOOR;
+
+		if (vec->allocated <= floor ||
+		    (double) need >= vec->shrink * vec->allocated)
+			return 0;
+
+		new_allocated = (need * 2 > floor) ? need * 2 : floor;
+
+		if (new_allocated >= vec->allocated)
+			return 0;
+	}
+	else
+		new_allocated = _dvec_grow(vec, need);
+
+	return _dvec_realloc(vec, new_allocated);
+}
+
 /* Determine if a vector is valid.
  * Assumes vec is not NULL.
  * If valid return nonzero. Else return 0.
@@ -190,11 +395,45 @@ static void _dvec_delete(dvec vec, size_t start, size_t end) {
  */
 dvec dvec_init(size_t elem_size) {
 
-	/* Allocate a vector structure,
-	 * check for failures, apply
-	 * defaults.
+	/* A vector with no inline
+	 * elements, on libc.
+	 */
+	return dvec_init_ex(elem_size, 0, NULL);
+}
+
+/* Create a vector holding its first
+ * count elements inline, in the one
+ * allocation. Returns NULL on error.
+ */
+dvec dvec_init_small(size_t elem_size, size_t count) {
+
+	/* A vector on libc. */
+	return dvec_init_ex(elem_size, count, NULL);
+}
+
+/* Create a small vector on an allocator,
+ * or libc if NULL. Only libc vectors map
+ * their huge blocks. Returns NULL on error.
+ */
+dvec dvec_init_ex(size_t elem_size, size_t count, struct dalloc *alloc) {
+
+	/* Check the inline size, allocate
+	 * a vector structure with it, check
+	 * for failures, apply defaults.
 	 */
-	dvec new_vec = (dvec) malloc(sizeof(struct daelib_vector));
+	DASSERT(elem_size == 0 || count <= (SIZE_MAX - sizeof(struct daelib_vector))
+	        / elem_size, ICALLER, "Inline size overflows.",
+		return NULL;
+		);
+
+	size_t inline_size = elem_size * count;
+	size_t map_at = (alloc == NULL) ? DEFAULT_MAP_AT : 0;
+
+	if (alloc == NULL)
+		alloc = &dalloc_libc;
+
+	dvec new_vec = (dvec) dalloc_alloc(alloc, sizeof(struct daelib_vector) +
+	                                   inline_size);
 
 	DASSERT(new_vec != NULL, IALLOC, "Failed to allocate new vector.",
 		return NULL;
@@ -202,8 +441,18 @@ dvec dvec_init(size_t elem_size) {
 
 	new_vec->elem_size = elem_size;
 	new_vec->elem_count = 0;
-	new_vec->allocated = 0;
-	new_vec->data = NULL;
+	new_vec->inline_size = inline_size;
+	new_vec->allocated = inline_size;
+	new_vec->data = (inline_size != 0) ? new_vec->inline_data : NULL;
+
+	new_vec->growth = DVEC_DOUBLE;
+	new_vec->chunk = 0;
+	new_vec->shrink = DEFAULT_SHRINK;
+	new_vec->reserved = 0;
+
+	new_vec->map_at = map_at;
+	new_vec->mapped = 0;
+	new_vec->alloc = alloc;
 
 	return new_vec;
 }
@@ -217,7 +466,8 @@ int dvec_kill(dvec vec) {
 
 	/* Check if vector is valid,
 	 * free non-NULL data, invalidate
-	 * fields, free the struct.
+	 * fields, free the struct to
+	 * its allocator.
 	 */
 	DASSERT(vec != NULL, ICALLER, "Given NULL vector.",
 		return 1;
@@ -227,13 +477,13 @@ int dvec_kill(dvec vec) {
 		return 1;
 		);
 
-	if (vec->data != NULL)
-		free(vec->data);
+	_dvec_free(vec);
 
 	vec->allocated = 1;
 	vec->data = NULL;
 
-	free(vec);
+	dalloc_free(vec->alloc, vec,
+	            sizeof(struct daelib_vector) + vec->inline_size);
 
 	return 0;
 }
@@ -255,28 +505,36 @@ dvec dvec_copy(dvec vec) {
 		return NULL;
 		);
 
-	dvec t= (dvec) malloc(sizeof(struct daelib_vector));
+	dvec t= (dvec) dalloc_alloc(vec->alloc, sizeof(struct daelib_vector) +
+	                            vec->inline_size);
 
 	DASSERT(t != NULL, IALLOC, "Failed to allocate new vector.",
 		return NULL;
 		);
 
-	t->data = NULL;
-	t->allocated = vec->allocated;
-	t->elem_count = vec->elem_count;
+	t->inline_size = vec->inline_size;
+	t->data = (t->inline_size != 0) ? t->inline_data : NULL;
+	t->allocated = t->inline_size;
+	t->elem_count = 0;
 	t->elem_size = vec->elem_size;
 
-	if (t->allocated == 0)
-		return t;
+	t->growth = vec->growth;
+	t->chunk = vec->chunk;
+	t->shrink = vec->shrink;
+	t->reserved = vec->reserved;
 
-	t->data = malloc(vec->allocated);
+	t->map_at = vec->map_at;
+	t->mapped = 0;
+	t->alloc = vec->alloc;
 
-	DASSERT(t->data != NULL, IALLOC, "Failed to allocate new vector data.",
-		free(t);
+	if (_dvec_realloc(t, vec->allocated) != 0) {
+		dalloc_free(t->alloc, t,
+		            sizeof(struct daelib_vector) + t->inline_size);
 		return NULL;
-		);
+	}
 
-	memcpy(t->data, vec->data, t->elem_count * t->elem_size);
+	memcpy(t->data, vec->data, vec->elem_count * vec->elem_size);
+	t->elem_count = vec->elem_count;
 
 	return t;
 }
@@ -302,6 +560,30 @@ int dvec_push(dvec vec, void *elem) {
 	return _dvec_insert(vec, 1, elem, vec->elem_count);
 }
 
+/* Push an element, leaving it
+ * for the caller to fill. Returns
+ * the element, NULL on error.
+ */
+void *dvec_emplace(dvec vec) {
+
+	/* Check the validity of the
+	 * vector, resize, count it,
+	 * return the last element.
+	 */
+	DASSERT(vec != NULL, ICALLER, "Given NULL vector.",
+		return NULL;
+		);
+
+	DASSERT(_dvec_valid(vec), IINTRA, "Given invalid vector.",
+		return NULL;
+		);
+
+	if (_dvec_resize(vec, vec->elem_count + 1) != 0)
+		return NULL;
+
+	return (char*) (vec->data) + (vec->elem_count++) * (vec->elem_size);
+}
+
 /* Peek the last element of
  * a vector. Returs NULL on
  * error.
@@ -393,6 +675,168 @@ size_t dvec_elem_size(dvec vec) {
 	return vec->elem_size;
 }
 
+/* Return the elements a vector
+ * holds without reallocating.
+ * Returns 0 on error.
+ */
+size_t dvec_capacity(dvec vec) {
+
+	/* Check if the vector is valid,
+	 * return the allocated elements.
+	 */
+	DASSERT(vec != NULL, ICALLER, "Given NULL vector.",
+		return 0;
+		);
+
+	DASSERT(_dvec_valid(vec), IINTRA, "Given invalid vector.",
+		return 0;
+		);
+
+	if (vec->elem_size == 0)
+		return 0;
+
+	return vec->allocated / vec->elem_size;
+}
+
+/* Make room for count elements, which
+ * shrinking will then keep. Returns
+ * nonzero on error.
+ */
+int dvec_reserve(dvec vec, size_t count) {
+
+	/* Check if the vector is valid,
+	 * realloc exactly if short,
+	 * set the floor, return.
+	 */
+	DASSERT(vec != NULL, ICALLER, "Given NULL vector.",
+		return 1;
+		);
+
+	DASSERT(_dvec_valid(vec), IINTRA, "Given invalid vector.",
+		return 1;
+		);
+
+	DASSERT(vec->elem_size == 0 || count <= SIZE_MAX / vec->elem_size,
+	        ICALLER, "Vector size overflows.",
+		return 1;
+		);
+
+	size_t need = count * vec->elem_size;
+
+	if (need > vec->allocated && _dvec_realloc(vec, need) != 0)
+		return 1;
+
+	vec->reserved = need;
+
+	return 0;
+}
+
+/* Free unused capacity, and any
+ * reservation. Returns nonzero
+ * on error.
+ */
+int dvec_shrink_to_fit(dvec vec) {
+
+	/* Check if the vector is valid,
+	 * drop the floor, free an empty
+	 * block or realloc it exactly,
+	 * return.
+	 */
+	DASSERT(vec != NULL, ICALLER, "Given NULL vector.",
+		return 1;
+		);
+
+	DASSERT(_dvec_valid(vec), IINTRA, "Given invalid vector.",
+		return 1;
+		);
+
+	size_t need = vec->elem_count * vec->elem_size;
+
+	vec->reserved = 0;
+
+	if (need == vec->allocated)
+		return 0;
+
+	return _dvec_realloc(vec, need);
+}
+
+/* Set how a vector grows. Chunk is
+ * in elements, for DVEC_CHUNK only.
+ * Returns nonzero on error.
+ */
+int dvec_set_growth(dvec vec, enum dvec_growth growth, size_t chunk) {
+
+	/* Check if the vector is valid,
+	 * check the chunk, set, return.
+	 */
+	DASSERT(vec != NULL, ICALLER, "Given NULL vector.",
+		return 1;
+		);
+
+	DASSERT(_dvec_valid(vec), IINTRA, "Given invalid vector.",
+		return 1;
+		);
+
+	DASSERT(growth != DVEC_CHUNK || chunk != 0, ICALLER,
+	        "Given empty chunk.",
+		return 1;
+		);
+
+	vec->growth = growth;
+	vec->chunk = chunk;
+
+	return 0;
+}
+
+/* Set the load under which a vector
+ * shrinks, 0 to never shrink. Returns
+ * nonzero on error.
+ */
+int dvec_set_shrink(dvec vec, double load) {
+
+	/* Check if the vector is valid,
+	 * check the load, set, return.
+	 */
+	DASSERT(vec != NULL, ICALLER, "Given NULL vector.",
+		return 1;
+		);
+
+	DASSERT(_dvec_valid(vec), IINTRA, "Given invalid vector.",
+		return 1;
+		);
+
+	DASSERT(load >= 0 && load < 0.5, ICALLER, "Given bad shrink load.",
+		return 1;
+		);
+
+	vec->shrink = load;
+
+	return 0;
+}
+
+/* Set the block size from which a
+ * vector is mapped, 0 to never map.
+ * Returns nonzero on error.
+ */
+int dvec_set_mapping(dvec vec, size_t bytes) {
+
+	/* Check if the vector is valid,
+	 * set, return. The block moves
+	 * on its next resize.
+	 */
+	DASSERT(vec != NULL, ICALLER, "Given NULL vector.",
+		return 1;
+		);
+
+	DASSERT(_dvec_valid(vec), IINTRA, "Given invalid vector.",
+		return 1;
+		);
+
+	vec->map_at = bytes;
+
+	return 0;
+}
+
 /* Get a random element of a vector.
  * Returns NULL on error.
  */